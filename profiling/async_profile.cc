@@ -0,0 +1,102 @@
+/*
+ * FileName: async_profile.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/async_profile.h"
+
+#include <thread>
+#include <utility>
+
+namespace pprofcpp {
+
+namespace {
+
+// addrs per SearchSymbolIds call of SymbolizeAsync, cancellation is also checked between batches so that locators
+// not checking control themselves are stopped in time
+constexpr size_t kAsyncSymbolizeBatch = 4 * kControlCheckInterval;
+
+// @brief future of a callback style task
+template <typename Ret, typename Start>
+std::future<Ret> ToFuture(const Start& start) {
+  auto promise = std::make_shared<std::promise<Ret>>();
+  auto future = promise->get_future();
+  start([promise](Ret ret) { promise->set_value(ret); });
+  return future;
+}
+
+}  // namespace
+
+Executor ThreadExecutor() {
+  return [](std::function<void()> task) { std::thread(std::move(task)).detach(); };
+}
+
+void ParseAsync(std::shared_ptr<CPUProfile> profile, const Executor& executor,
+                std::shared_ptr<ProcessingControl> control, ParseCallback done) {
+  executor([profile = std::move(profile), control = std::move(control), done = std::move(done)]() {
+    ReaderRetCode ret;
+    {
+      ScopedControl scoped(control.get());
+      ret = profile->Parse();
+    }
+    done(ret);
+  });
+}
+
+std::future<ReaderRetCode> ParseAsync(std::shared_ptr<CPUProfile> profile, const Executor& executor,
+                                      std::shared_ptr<ProcessingControl> control) {
+  return ToFuture<ReaderRetCode>([&](ParseCallback done) {
+    ParseAsync(std::move(profile), executor, std::move(control), std::move(done));
+  });
+}
+
+void SymbolizeAsync(std::shared_ptr<CPUProfile> profile, std::shared_ptr<SymbolLocator> locator,
+                    const Executor& executor, std::shared_ptr<ProcessingControl> control, ProfileCallback done) {
+  executor([profile = std::move(profile), locator = std::move(locator), control = std::move(control),
+            done = std::move(done)]() {
+    CPUProfileRetCode ret;
+    {
+      ScopedControl scoped(control.get());
+      ProgressiveSymbolOptions options;
+      options.batch_size = kAsyncSymbolizeBatch;
+      ret = profile->SymbolizeProgressively(locator.get(), options, nullptr);
+    }
+    done(ret);
+  });
+}
+
+std::future<CPUProfileRetCode> SymbolizeAsync(std::shared_ptr<CPUProfile> profile,
+                                              std::shared_ptr<SymbolLocator> locator, const Executor& executor,
+                                              std::shared_ptr<ProcessingControl> control) {
+  return ToFuture<CPUProfileRetCode>([&](ProfileCallback done) {
+    SymbolizeAsync(std::move(profile), std::move(locator), executor, std::move(control), std::move(done));
+  });
+}
+
+void GenerateRawProfileAsync(std::shared_ptr<CPUProfile> profile, const RawProfileMeta& meta,
+                             std::shared_ptr<SymbolLocator> locator, ChunkCallback chunk_callback,
+                             const Executor& executor, std::shared_ptr<ProcessingControl> control,
+                             ProfileCallback done) {
+  executor([profile = std::move(profile), meta, locator = std::move(locator),
+            chunk_callback = std::move(chunk_callback), control = std::move(control), done = std::move(done)]() {
+    CPUProfileRetCode ret;
+    {
+      ScopedControl scoped(control.get());
+      ret = profile->GenerateRawProfile(meta, locator.get(), chunk_callback);
+    }
+    done(ret);
+  });
+}
+
+std::future<CPUProfileRetCode> GenerateRawProfileAsync(std::shared_ptr<CPUProfile> profile,
+                                                       const RawProfileMeta& meta,
+                                                       std::shared_ptr<SymbolLocator> locator,
+                                                       ChunkCallback chunk_callback, const Executor& executor,
+                                                       std::shared_ptr<ProcessingControl> control) {
+  return ToFuture<CPUProfileRetCode>([&](ProfileCallback done) {
+    GenerateRawProfileAsync(std::move(profile), meta, std::move(locator), std::move(chunk_callback), executor,
+                            std::move(control), std::move(done));
+  });
+}
+
+}  // namespace pprofcpp
@@ -0,0 +1,58 @@
+/*
+ * FileName: async_profile.h
+ * Author: jattle
+ * Descrption: asynchronous parse, symbolization & emission of CPU profile with cancellation and deadline
+ */
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+
+#include "profiling/cpu_profile.h"
+#include "profiling/io/profile_io.h"
+#include "profiling/symbol/profile_symbol.h"
+#include "profiling/util/control.h"
+
+namespace pprofcpp {
+
+/// @brief runs a task, e.g. posts it to a thread pool. tasks must not be dropped, or futures never become ready
+using Executor = std::function<void(std::function<void()>)>;
+
+/// @brief executor running every task on a new detached thread
+Executor ThreadExecutor();
+
+/// @brief every task below runs on executor with control(nullable) installed as control of its thread, so that
+// Cancel/SetDeadline of control stops it at the next check of record or search loop. a stopped task returns
+// kCancelled/kDeadlineExceeded and keeps partial results: records parsed so far, addrs symbolized by finished
+// batches. progress is published to control while running. profile & locator are shared with the task, the caller
+// must not touch profile until the task is done, locator may be shared by concurrent tasks if it is thread-safe
+
+using ParseCallback = std::function<void(ReaderRetCode)>;
+using ProfileCallback = std::function<void(CPUProfileRetCode)>;
+
+// @brief CPUProfile::Parse
+void ParseAsync(std::shared_ptr<CPUProfile> profile, const Executor& executor,
+                std::shared_ptr<ProcessingControl> control, ParseCallback done);
+std::future<ReaderRetCode> ParseAsync(std::shared_ptr<CPUProfile> profile, const Executor& executor,
+                                      std::shared_ptr<ProcessingControl> control = nullptr);
+
+// @brief resolve all symbol addrs in weight order, batch by batch, hottest addrs are kept if stopped
+void SymbolizeAsync(std::shared_ptr<CPUProfile> profile, std::shared_ptr<SymbolLocator> locator,
+                    const Executor& executor, std::shared_ptr<ProcessingControl> control, ProfileCallback done);
+std::future<CPUProfileRetCode> SymbolizeAsync(std::shared_ptr<CPUProfile> profile,
+                                              std::shared_ptr<SymbolLocator> locator, const Executor& executor,
+                                              std::shared_ptr<ProcessingControl> control = nullptr);
+
+// @brief CPUProfile::GenerateRawProfile into chunk callback(called on executor thread)
+void GenerateRawProfileAsync(std::shared_ptr<CPUProfile> profile, const RawProfileMeta& meta,
+                             std::shared_ptr<SymbolLocator> locator, ChunkCallback chunk_callback,
+                             const Executor& executor, std::shared_ptr<ProcessingControl> control,
+                             ProfileCallback done);
+std::future<CPUProfileRetCode> GenerateRawProfileAsync(std::shared_ptr<CPUProfile> profile,
+                                                       const RawProfileMeta& meta,
+                                                       std::shared_ptr<SymbolLocator> locator,
+                                                       ChunkCallback chunk_callback, const Executor& executor,
+                                                       std::shared_ptr<ProcessingControl> control = nullptr);
+
+}  // namespace pprofcpp
@@ -0,0 +1,169 @@
+/*
+ * FileName: async_profile_test.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/async_profile.h"
+
+#include <deque>
+#include <sstream>
+
+#include "fmt/format.h"
+#include "gtest/gtest.h"
+#include "profiling/io/synthetic_profile.h"
+
+using namespace pprofcpp;
+
+constexpr char kCPUProfileSample[] = "./profiling/io/cpu_profile_sample";
+
+// @brief executor holding tasks until RunAll, so that tests control when they start
+class ManualExecutor {
+ public:
+  Executor Get() {
+    return [this](std::function<void()> task) { tasks_.push_back(std::move(task)); };
+  }
+  void RunAll() {
+    while (!tasks_.empty()) {
+      auto task = std::move(tasks_.front());
+      tasks_.pop_front();
+      task();
+    }
+  }
+
+ private:
+  std::deque<std::function<void()>> tasks_;
+};
+
+// @brief names every addr, optionally cancels control on the first search
+class CancellingLocator : public SymbolLocator {
+ public:
+  LocatorStatus SearchSymbols(const std::vector<void*>& addrs,
+                              std::unordered_map<void*, SymbolInfo>* sym_mapping) override {
+    for (const auto& addr : addrs) {
+      sym_mapping->emplace(addr, SymbolInfo{addr, fmt::format("func_{}", addr)});
+    }
+    search_num++;
+    if (control != nullptr) {
+      control->Cancel();
+    }
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  }
+  ProcessingControl* control{nullptr};
+  size_t search_num{0};
+};
+
+std::shared_ptr<CPUProfile> MakeSyntheticProfile(size_t record_num) {
+  SyntheticProfileOptions options;
+  options.record_num = record_num;
+  options.duplicate_ratio = 0;
+  auto os = std::make_shared<std::stringstream>();
+  EXPECT_EQ(WriteSyntheticProfile(options, os), WriterRetCode::kOK);
+  return std::make_shared<CPUProfile>(std::make_unique<std::stringstream>(os->str()));
+}
+
+TEST(AsyncProfile, MatchesSync) {
+  auto profile = std::make_shared<CPUProfile>(kCPUProfileSample);
+  auto locator = std::make_shared<CancellingLocator>();
+  auto control = std::make_shared<ProcessingControl>();
+  ASSERT_EQ(ParseAsync(profile, ThreadExecutor(), control).get(), ReaderRetCode::kOK);
+  ASSERT_EQ(control->GetProgress().records_parsed, profile->GetRecordNum());
+  ASSERT_EQ(SymbolizeAsync(profile, locator, ThreadExecutor(), control).get(), CPUProfileRetCode::kOK);
+  auto progress = control->GetProgress();
+  ASSERT_GT(progress.addrs_total, 0);
+  ASSERT_EQ(progress.addrs_symbolized, progress.addrs_total);
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  std::string output;
+  auto append = [&output](const char* data, size_t len) -> bool {
+    output.append(data, len);
+    return true;
+  };
+  ASSERT_EQ(GenerateRawProfileAsync(profile, meta, locator, append, ThreadExecutor(), control).get(),
+            CPUProfileRetCode::kOK);
+  ASSERT_EQ(control->GetProgress().records_emitted, profile->GetCallStacks().size());
+  CPUProfile sync{kCPUProfileSample};
+  ASSERT_EQ(sync.Parse(), ReaderRetCode::kOK);
+  std::string expected;
+  ASSERT_EQ(sync.GenerateRawProfile(meta, locator.get(), &expected), CPUProfileRetCode::kOK);
+  ASSERT_EQ(output, expected);
+}
+
+TEST(AsyncProfile, Callback) {
+  ManualExecutor executor;
+  auto profile = std::make_shared<CPUProfile>(kCPUProfileSample);
+  ReaderRetCode ret{ReaderRetCode::kNotInited};
+  ParseAsync(profile, executor.Get(), nullptr, [&ret](ReaderRetCode r) { ret = r; });
+  ASSERT_EQ(ret, ReaderRetCode::kNotInited);
+  executor.RunAll();
+  ASSERT_EQ(ret, ReaderRetCode::kOK);
+  ASSERT_GT(profile->GetRecordNum(), 0);
+}
+
+TEST(AsyncProfile, CancelBeforeStart) {
+  ManualExecutor executor;
+  auto profile = std::make_shared<CPUProfile>(kCPUProfileSample);
+  auto control = std::make_shared<ProcessingControl>();
+  auto future = ParseAsync(profile, executor.Get(), control);
+  control->Cancel();
+  executor.RunAll();
+  ASSERT_EQ(future.get(), ReaderRetCode::kCancelled);
+  ASSERT_EQ(profile->GetRecordNum(), 0);
+  // cancellation wins over deadline
+  control->SetTimeout(std::chrono::nanoseconds{-1});
+  ASSERT_EQ(control->Check(), ControlStatus::kCancelled);
+}
+
+TEST(AsyncProfile, DeadlineExceeded) {
+  auto profile = MakeSyntheticProfile(10000);
+  auto control = std::make_shared<ProcessingControl>();
+  control->SetDeadline(std::chrono::steady_clock::now());
+  ASSERT_EQ(ParseAsync(profile, ThreadExecutor(), control).get(), ReaderRetCode::kDeadlineExceeded);
+  ASSERT_EQ(control->GetProgress().records_parsed, 0);
+  // not stopped before deadline
+  profile = MakeSyntheticProfile(10000);
+  control->SetTimeout(std::chrono::hours(1));
+  ASSERT_EQ(ParseAsync(profile, ThreadExecutor(), control).get(), ReaderRetCode::kOK);
+  ASSERT_EQ(control->GetProgress().records_parsed, 10000);
+}
+
+TEST(AsyncProfile, CancelDuringSymbolize) {
+  auto profile = MakeSyntheticProfile(10000);
+  ASSERT_EQ(profile->Parse(), ReaderRetCode::kOK);
+  auto locator = std::make_shared<CancellingLocator>();
+  auto control = std::make_shared<ProcessingControl>();
+  locator->control = control.get();
+  ASSERT_EQ(SymbolizeAsync(profile, locator, ThreadExecutor(), control).get(), CPUProfileRetCode::kCancelled);
+  // addrs of the first batch are kept
+  ASSERT_EQ(locator->search_num, 1);
+  auto progress = control->GetProgress();
+  ASSERT_GT(progress.addrs_symbolized, 0);
+  ASSERT_LT(progress.addrs_symbolized, progress.addrs_total);
+  // resume with a fresh control
+  locator->control = nullptr;
+  auto resumed = std::make_shared<ProcessingControl>();
+  ASSERT_EQ(SymbolizeAsync(profile, locator, ThreadExecutor(), resumed).get(), CPUProfileRetCode::kOK);
+  ASSERT_EQ(resumed->GetProgress().addrs_symbolized, progress.addrs_total);
+}
+
+TEST(AsyncProfile, CancelDuringEmit) {
+  auto profile = MakeSyntheticProfile(10000);
+  ASSERT_EQ(profile->Parse(), ReaderRetCode::kOK);
+  auto locator = std::make_shared<CancellingLocator>();
+  auto control = std::make_shared<ProcessingControl>();
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  // cancel once records are being written
+  auto output = std::make_shared<std::string>();
+  auto cancel = [control, output](const char* data, size_t len) -> bool {
+    output->append(data, len);
+    if (output->find("--- profile\n") != std::string::npos) {
+      control->Cancel();
+    }
+    return true;
+  };
+  ASSERT_EQ(GenerateRawProfileAsync(profile, meta, locator, cancel, ThreadExecutor(), control).get(),
+            CPUProfileRetCode::kCancelled);
+  auto emitted = control->GetProgress().records_emitted;
+  ASSERT_GT(emitted, 0);
+  ASSERT_LT(emitted, profile->GetCallStacks().size());
+}
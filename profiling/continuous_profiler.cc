@@ -0,0 +1,161 @@
+/*
+ * FileName: continuous_profiler.cc
+ * Author: jattle
+ * Descrption:
+ */
+
+#include "profiling/continuous_profiler.h"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <ctime>
+
+#include "fmt/format.h"
+
+namespace pprofcpp {
+
+namespace {
+
+std::chrono::nanoseconds ThreadCPUTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+}  // namespace
+
+ContinuousProfiler::ContinuousProfiler(ContinuousProfilerOptions options, ProfilerHooks hooks,
+                                       ProfileWindowSink sink, std::shared_ptr<SymbolLocator> locator)
+    : options_(std::move(options)), hooks_(std::move(hooks)), sink_(std::move(sink)), locator_(std::move(locator)) {}
+
+bool ContinuousProfiler::Start() {
+  std::lock_guard<std::mutex> locker(mutex_);
+  if (running_ || !hooks_.start || !hooks_.stop || !sink_) {
+    return false;
+  }
+  running_ = true;
+  stopping_ = false;
+  schedule_done_ = false;
+  schedule_thread_ = std::thread(&ContinuousProfiler::ScheduleLoop, this);
+  process_thread_ = std::thread(&ContinuousProfiler::ProcessLoop, this);
+  return true;
+}
+
+void ContinuousProfiler::Stop() {
+  {
+    std::lock_guard<std::mutex> locker(mutex_);
+    if (!running_) {
+      return;
+    }
+    stopping_ = true;
+  }
+  schedule_cv_.notify_all();
+  process_cv_.notify_all();
+  schedule_thread_.join();
+  process_thread_.join();
+  std::lock_guard<std::mutex> locker(mutex_);
+  running_ = false;
+}
+
+uint64_t ContinuousProfiler::GetProcessedNum() const {
+  std::lock_guard<std::mutex> locker(mutex_);
+  return processed_num_;
+}
+
+uint64_t ContinuousProfiler::GetDroppedNum() const {
+  std::lock_guard<std::mutex> locker(mutex_);
+  return dropped_num_;
+}
+
+std::string ContinuousProfiler::WindowFile(uint64_t seq) const {
+  return fmt::format("{}/{}.{}.{}.prof", options_.output_dir, options_.file_prefix, getpid(), seq);
+}
+
+void ContinuousProfiler::ScheduleLoop() {
+  // only schedule thread touches next_seq_, Start creates it after the previous one is joined
+  while (true) {
+    ProfileWindow window;
+    window.seq = next_seq_++;
+    window.profile_file = WindowFile(window.seq);
+    window.start_time = std::chrono::system_clock::now();
+    bool started = hooks_.start(window.profile_file);
+    {
+      std::unique_lock<std::mutex> locker(mutex_);
+      schedule_cv_.wait_for(locker, options_.window, [this] { return stopping_; });
+    }
+    if (started) {
+      hooks_.stop();
+      window.end_time = std::chrono::system_clock::now();
+      std::lock_guard<std::mutex> locker(mutex_);
+      pending_.emplace_back(std::move(window));
+      if (pending_.size() > options_.max_pending) {
+        // processing falls behind budget, drop the oldest window rather than grow without bound
+        if (!options_.keep_files) {
+          remove(pending_.front().profile_file.c_str());
+        }
+        pending_.pop_front();
+        dropped_num_++;
+      }
+    }
+    process_cv_.notify_all();
+    std::lock_guard<std::mutex> locker(mutex_);
+    if (stopping_) {
+      schedule_done_ = true;
+      process_cv_.notify_all();
+      return;
+    }
+  }
+}
+
+void ContinuousProfiler::ProcessLoop() {
+  // only lower priority of this thread, nice value of linux thread is per thread
+  setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), options_.nice);
+  if (locator_ == nullptr) {
+    // keep one warm locator for all windows
+    locator_ = std::make_shared<BfdSymbolLocator>();
+  }
+  while (true) {
+    ProfileWindow window;
+    {
+      std::unique_lock<std::mutex> locker(mutex_);
+      process_cv_.wait(locker, [this] { return !pending_.empty() || schedule_done_; });
+      if (pending_.empty()) {
+        return;
+      }
+      window = std::move(pending_.front());
+      pending_.pop_front();
+    }
+    auto cpu_start = ThreadCPUTime();
+    ProcessWindow(window);
+    auto cpu_used = ThreadCPUTime() - cpu_start;
+    if (options_.cpu_budget > 0 && options_.cpu_budget < 1) {
+      // pace: used / (used + idle) <= budget
+      auto idle = std::chrono::duration_cast<std::chrono::nanoseconds>(cpu_used * (1 / options_.cpu_budget - 1));
+      std::unique_lock<std::mutex> locker(mutex_);
+      process_cv_.wait_for(locker, idle, [this] { return stopping_; });
+    }
+  }
+}
+
+void ContinuousProfiler::ProcessWindow(const ProfileWindow& window) {
+  ProfileWindowResult result;
+  CPUProfile profile{window.profile_file};
+  result.parse_ret = profile.Parse();
+  if (result.parse_ret == ReaderRetCode::kOK) {
+    RawProfileMeta meta;
+    meta.program_path = options_.program_path;
+    meta.profile_type = options_.profile_type;
+    result.generate_ret = profile.GenerateRawProfile(meta, locator_.get(), &result.raw_profile);
+  }
+  if (!options_.keep_files) {
+    remove(window.profile_file.c_str());
+  }
+  sink_(window, std::move(result));
+  std::lock_guard<std::mutex> locker(mutex_);
+  processed_num_++;
+}
+
+}  // namespace pprofcpp
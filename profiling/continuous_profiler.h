@@ -0,0 +1,104 @@
+/*
+ * FileName: continuous_profiler.h
+ * Author: jattle
+ * Descrption: always-on CPU profiling, rotate profile windows on schedule and symbolize them in background
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "profiling/cpu_profile.h"
+#include "profiling/symbol/profile_symbol.h"
+
+namespace pprofcpp {
+
+/// @brief start & stop of the underlying CPU profiler, usually bound to gperftools:
+// start = [](const std::string& file) { return ProfilerStart(file.c_str()) != 0; }, stop = ProfilerStop
+struct ProfilerHooks {
+  std::function<bool(const std::string& file)> start;
+  std::function<void()> stop;
+};
+
+/// @brief a finished profile window
+struct ProfileWindow {
+  uint64_t seq{0};
+  std::chrono::system_clock::time_point start_time;
+  std::chrono::system_clock::time_point end_time;
+  std::string profile_file;
+};
+
+/// @brief processing result of a window, raw_profile is valid only if both codes are kOK
+struct ProfileWindowResult {
+  ReaderRetCode parse_ret{ReaderRetCode::kOK};
+  CPUProfileRetCode generate_ret{CPUProfileRetCode::kOK};
+  std::string raw_profile;
+};
+
+/// @brief consumer of processed windows, called on the background processing thread
+using ProfileWindowSink = std::function<void(const ProfileWindow& window, ProfileWindowResult&& result)>;
+
+struct ContinuousProfilerOptions {
+  std::chrono::milliseconds window{std::chrono::seconds(60)};  // length of every profile window
+  std::string output_dir{"/tmp"};     // window files are named <output_dir>/<file_prefix>.<pid>.<seq>.prof
+  std::string file_prefix{"cpu"};
+  std::string program_path{"/proc/self/exe"};  // binary path written into raw profile
+  RawProfileType profile_type{RawProfileType::kPProfCompatible};
+  double cpu_budget{0.01};  // fraction of one core processing thread may use on average
+  int nice{19};             // nice value of processing thread
+  size_t max_pending{4};    // max windows waiting for processing, the oldest is dropped beyond it
+  bool keep_files{false};   // keep window files after processing
+};
+
+/// @brief continuous profiling controller
+// a schedule thread rotates windows through hooks, a low priority processing thread parses every finished window
+// with CPUProfile, symbolizes it through a shared warm locator, and hands the raw profile to sink.
+// processing thread sleeps after each window so that its CPU time stays within cpu_budget.
+class ContinuousProfiler {
+ public:
+  // @brief locator is shared across windows, a BfdSymbolLocator for current process is created on demand if null
+  ContinuousProfiler(ContinuousProfilerOptions options, ProfilerHooks hooks, ProfileWindowSink sink,
+                     std::shared_ptr<SymbolLocator> locator = nullptr);
+  ~ContinuousProfiler() { Stop(); }
+  ContinuousProfiler(const ContinuousProfiler&) = delete;
+  ContinuousProfiler& operator=(const ContinuousProfiler&) = delete;
+  // @brief start profiling, return false if already started or hooks are missing
+  bool Start();
+  // @brief stop current window and wait until all pending windows are processed
+  void Stop();
+  uint64_t GetProcessedNum() const;
+  uint64_t GetDroppedNum() const;
+
+ private:
+  void ScheduleLoop();
+  void ProcessLoop();
+  void ProcessWindow(const ProfileWindow& window);
+  std::string WindowFile(uint64_t seq) const;
+
+  ContinuousProfilerOptions options_;
+  ProfilerHooks hooks_;
+  ProfileWindowSink sink_;
+  std::shared_ptr<SymbolLocator> locator_;
+  mutable std::mutex mutex_;
+  std::condition_variable schedule_cv_;
+  std::condition_variable process_cv_;
+  std::deque<ProfileWindow> pending_;
+  bool running_{false};
+  bool stopping_{false};
+  bool schedule_done_{false};
+  uint64_t processed_num_{0};
+  uint64_t dropped_num_{0};
+  uint64_t next_seq_{0};  // seq of next window, kept across Start/Stop so that kept window files are not overwritten
+  std::thread schedule_thread_;
+  std::thread process_thread_;
+};
+
+}  // namespace pprofcpp
@@ -0,0 +1,119 @@
+/*
+ * FileName: continuous_profiler_test.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/continuous_profiler.h"
+
+#include <atomic>
+#include <cstdio>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "profiling/symbol/fake_locator.h"
+#include "profiling/util/utils.h"
+
+using namespace pprofcpp;
+
+constexpr char kCPUProfileSample[] = "./profiling/io/cpu_profile_sample";
+
+static std::string WindowName(uintptr_t) { return "func"; }
+
+// fake profiler writes sample profile to window file on stop, like ProfilerStop flushes profile
+static ProfilerHooks MakeFakeHooks(std::string* current_file) {
+  ProfilerHooks hooks;
+  hooks.start = [current_file](const std::string& file) -> bool {
+    *current_file = file;
+    return true;
+  };
+  hooks.stop = [current_file]() {
+    std::string content;
+    ASSERT_EQ(LoadFileContent(kCPUProfileSample, &content), 0);
+    FILE* fp = fopen(current_file->c_str(), "wb");
+    ASSERT_NE(fp, nullptr);
+    fwrite(content.data(), 1, content.size(), fp);
+    fclose(fp);
+  };
+  return hooks;
+}
+
+TEST(ContinuousProfiler, RotateWindows) {
+  std::string current_file;
+  std::mutex mutex;
+  std::vector<ProfileWindow> windows;
+  std::vector<ProfileWindowResult> results;
+  ContinuousProfilerOptions options;
+  options.window = std::chrono::milliseconds(20);
+  options.file_prefix = "continuous_profiler_test";
+  options.cpu_budget = 0.5;
+  options.max_pending = 100;
+  ContinuousProfiler profiler{options, MakeFakeHooks(&current_file),
+                              [&](const ProfileWindow& window, ProfileWindowResult&& result) {
+                                std::lock_guard<std::mutex> locker(mutex);
+                                windows.push_back(window);
+                                results.push_back(std::move(result));
+                              },
+                              std::make_shared<FakeLocator>(WindowName)};
+  EXPECT_TRUE(profiler.Start());
+  EXPECT_FALSE(profiler.Start());
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  profiler.Stop();
+  std::lock_guard<std::mutex> locker(mutex);
+  ASSERT_GE(windows.size(), 2u);
+  EXPECT_EQ(profiler.GetProcessedNum(), windows.size());
+  EXPECT_EQ(profiler.GetDroppedNum(), 0u);
+  for (size_t i = 0; i < windows.size(); i++) {
+    EXPECT_EQ(results[i].parse_ret, ReaderRetCode::kOK);
+    EXPECT_EQ(results[i].generate_ret, CPUProfileRetCode::kOK);
+    EXPECT_EQ(results[i].raw_profile.find("--- symbol\nbinary=/proc/self/exe\n"), 0u);
+    EXPECT_LE(windows[i].start_time, windows[i].end_time);
+    // window file is removed after processing
+    EXPECT_EQ(fopen(windows[i].profile_file.c_str(), "rb"), nullptr);
+    if (i > 0) {
+      EXPECT_GT(windows[i].seq, windows[i - 1].seq);
+    }
+  }
+}
+
+TEST(ContinuousProfiler, RestartKeepsFiles) {
+  std::string current_file;
+  std::mutex mutex;
+  std::vector<ProfileWindow> windows;
+  ContinuousProfilerOptions options;
+  options.window = std::chrono::milliseconds(20);
+  options.file_prefix = "continuous_profiler_restart_test";
+  options.cpu_budget = 0.5;
+  options.max_pending = 100;
+  options.keep_files = true;
+  ContinuousProfiler profiler{options, MakeFakeHooks(&current_file),
+                              [&](const ProfileWindow& window, ProfileWindowResult&&) {
+                                std::lock_guard<std::mutex> locker(mutex);
+                                windows.push_back(window);
+                              },
+                              std::make_shared<FakeLocator>(WindowName)};
+  for (int round = 0; round < 2; round++) {
+    ASSERT_TRUE(profiler.Start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    profiler.Stop();
+  }
+  std::lock_guard<std::mutex> locker(mutex);
+  ASSERT_GE(windows.size(), 2u);
+  // seq goes on after restart, so windows of the second round do not overwrite kept files of the first
+  for (size_t i = 0; i < windows.size(); i++) {
+    EXPECT_EQ(windows[i].seq, i);
+    FILE* fp = fopen(windows[i].profile_file.c_str(), "rb");
+    EXPECT_NE(fp, nullptr);
+    if (fp != nullptr) {
+      fclose(fp);
+    }
+    remove(windows[i].profile_file.c_str());
+  }
+}
+
+TEST(ContinuousProfiler, MissingHooks) {
+  ContinuousProfiler profiler{ContinuousProfilerOptions{}, ProfilerHooks{},
+                              [](const ProfileWindow&, ProfileWindowResult&&) {}};
+  EXPECT_FALSE(profiler.Start());
+  profiler.Stop();
+}
@@ -6,17 +6,109 @@
 
 #include "profiling/cpu_profile.h"
 
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <random>
+#include <regex>
 #include <sstream>
-#include <unordered_set>
 
 #include "fmt/format.h"
 
+#include "profiling/stack_table.h"
 #include "profiling/symbol/profile_symbol.h"
+#include "profiling/util/control.h"
+#include "profiling/util/utils.h"
 
 namespace pprofcpp {
 
+CPUProfile::CPUProfile(const CPUProfileBinaryHeader& header, std::vector<CallStack> stacks, std::string maps_text)
+    : binary_header_(header), stacks_(std::move(stacks)) {
+  for (const auto& s : this->stacks_) {
+    this->total_sample_cnt_ += s.sample_count;
+    this->ptr_num_ += s.ptrs.size();
+  }
+  this->record_num_ = this->stacks_.size();
+  if (!maps_text.empty() && ParseMapsText(maps_text) == 0) {
+    this->maps_text_ = std::move(maps_text);
+  }
+}
+
+namespace {
+
+// max stack depth of gperftools is 254, reservation is capped in case num_pcs of a record is corrupted
+constexpr size_t kMaxReservedPcs = 1024;
+
+// @brief ret code of processing stopped by control of current thread, or ret if not stopped
+CPUProfileRetCode StoppedOr(CPUProfileRetCode ret) {
+  switch (CheckCurrentControl()) {
+    case ControlStatus::kCancelled:
+      return CPUProfileRetCode::kCancelled;
+    case ControlStatus::kDeadlineExceeded:
+      return CPUProfileRetCode::kDeadlineExceeded;
+    default:
+      return ret;
+  }
+}
+
+}  // namespace
+
+ReaderRetCode CPUProfile::EstimateMemory(const std::string& file, const MemoryEstimateOptions& options,
+                                         MemoryEstimate* estimate) {
+  struct stat st;
+  if (stat(file.c_str(), &st) != 0) {
+    return ReaderRetCode::kInvalidStream;
+  }
+  // header decides slot size
+  CPUProfileReader reader(file);
+  size_t hdr_words{0};
+  if (auto ret = reader.GetSlot(1, &hdr_words); ret != ReaderRetCode::kOK) {
+    return ret;
+  }
+  size_t slot_size = reader.GetAddressLen() == ProfileAddressLen::k32Bit ? k32BitSize : k64BitSize;
+  *estimate = EstimateMemory(static_cast<size_t>(st.st_size), slot_size, options);
+  return ReaderRetCode::kOK;
+}
+
+MemoryEstimate CPUProfile::EstimateMemory(size_t file_size, size_t slot_size, const MemoryEstimateOptions& options) {
+  constexpr size_t kMallocOverhead = 16;
+  constexpr size_t kHashNodeOverhead = 2 * sizeof(void*) + kMallocOverhead;
+  // maps text is counted as slots too, it only makes the estimate larger
+  size_t slots = file_size / std::max<size_t>(slot_size, 1);
+  size_t depth = std::max<size_t>(options.mean_depth, 1);
+  size_t records = slots / (depth + 2);
+  size_t pcs = records * depth;
+  double addr_ratio = std::min(std::max(options.distinct_addr_ratio, 0.0), 1.0);
+  auto addrs = static_cast<size_t>(static_cast<double>(pcs) * addr_ratio);
+  MemoryEstimate estimate;
+  // reader keeps every slot, vector growth holds old & new buffers at once
+  size_t slot_buffer = 3 * slots * sizeof(size_t);
+  size_t stack_bytes = records * kMallocOverhead + pcs * sizeof(void*);
+  estimate.parse_bytes = slot_buffer + stack_bytes + 3 * records * sizeof(CallStack);
+  estimate.profile_bytes = stack_bytes + 2 * records * sizeof(CallStack);
+  // collected addrs keep capacity of all pcs, every distinct addr may get a distinct name
+  size_t name_bytes = sizeof(std::string) + options.mean_name_len + 1 + sizeof(std::pair<std::string_view, uint32_t>) +
+                      kHashNodeOverhead;
+  size_t locator_cache_bytes = sizeof(std::pair<const char*, uint32_t>) + kHashNodeOverhead;
+  estimate.symbolize_bytes =
+      pcs * sizeof(void*) + addrs * (sizeof(uint32_t) + sizeof(void*) + name_bytes + locator_cache_bytes);
+  if (options.buffered_output) {
+    // symbol lines plus 64-bit binary profile: header, records, trailer
+    size_t raw_bytes = addrs * (kHexAddrLen + options.mean_name_len + 2) + (5 + 2 * records + pcs + 3) * k64BitSize;
+    // string grows by doubling and starts with 2M reserved
+    estimate.output_bytes = std::max<size_t>(3 * raw_bytes, 2 * 1024 * 1024);
+  } else {
+    // chunk buffer of output stream & slot buffer of writer
+    estimate.output_bytes = 2 * kDefaultChunkSize;
+  }
+  estimate.peak_bytes = std::max(estimate.parse_bytes,
+                                 estimate.profile_bytes + estimate.symbolize_bytes + estimate.output_bytes);
+  return estimate;
+}
+
 ReaderRetCode CPUProfile::Parse() {
-  CPUProfileReader reader(std::move(this->is_));
+  CPUProfileReader reader(std::move(this->is_), this->stats_);
+  ScopedPhase phase(this->stats_, StatsPhase::kBuildStacks);
 #define RETURN_IF_NOT_EXPECTED(expr, expected) \
   do {                                         \
     auto ret = (expr);                         \
@@ -33,7 +125,15 @@ ReaderRetCode CPUProfile::Parse() {
   }
   // read record
   bool end_of_slots{false};
+  ProcessingControl* control = CurrentControl();
   while (true) {
+    if (control != nullptr && (this->record_num_ & (kControlCheckInterval - 1)) == 0) {
+      // records parsed so far are kept
+      control->SetRecordsParsed(this->record_num_);
+      if (auto st = control->Check(); st != ControlStatus::kOK) {
+        return st == ControlStatus::kCancelled ? ReaderRetCode::kCancelled : ReaderRetCode::kDeadlineExceeded;
+      }
+    }
     size_t sample_count, num_pcs, pc{0};
     RETURN_IF_NOT_EXPECTED(reader.GetSlot(index++, &sample_count), ReaderRetCode::kOK);
     RETURN_IF_NOT_EXPECTED(reader.GetSlot(index++, &num_pcs), ReaderRetCode::kOK);
@@ -42,10 +142,14 @@ ReaderRetCode CPUProfile::Parse() {
       // Binary Trailer found: gperftools/docs/cpuprofile-fileformat.html
       // end of slots
       end_of_slots = true;
+      if (control != nullptr) {
+        control->SetRecordsParsed(this->record_num_);
+      }
       break;
     }
     CallStack stack;
     stack.sample_count = sample_count;
+    stack.ptrs.reserve(std::min(num_pcs, kMaxReservedPcs));
     stack.ptrs.emplace_back(reinterpret_cast<void*>(pc));
     for (size_t i = 1; i < num_pcs; i++) {
       size_t val;
@@ -57,6 +161,7 @@ ReaderRetCode CPUProfile::Parse() {
     this->total_sample_cnt_ += sample_count;
     this->record_num_++;
     this->ptr_num_ += stack.ptrs.size();
+    CountStack(stack);
     this->stacks_.emplace_back(std::move(stack));
   }
   // Parse Text List of Mapped Objects
@@ -75,6 +180,56 @@ ReaderRetCode CPUProfile::Parse() {
   return ReaderRetCode::kOK;
 }
 
+ReaderRetCode CPUProfile::Follow(size_t* new_record_num) {
+  if (this->follower_ == nullptr) {
+    if (this->is_ == nullptr) {
+      return ReaderRetCode::kInvalidStream;
+    }
+    this->follower_ = std::make_unique<CPUProfileFollowReader>(std::move(this->is_), this->stats_);
+  }
+  ScopedPhase phase(this->stats_, StatsPhase::kBuildStacks);
+  size_t stack_num = this->stacks_.size();
+  auto ret = this->follower_->Poll(
+      [this](size_t sample_count, const size_t* pcs, size_t num_pcs) {
+        CallStack stack;
+        stack.sample_count = sample_count;
+        stack.ptrs.reserve(num_pcs);
+        for (size_t i = 0; i < num_pcs; i++) {
+          stack.ptrs.emplace_back(reinterpret_cast<void*>(pcs[i]));
+        }
+        this->total_sample_cnt_ += sample_count;
+        this->record_num_++;
+        this->ptr_num_ += num_pcs;
+        CountStack(stack);
+        this->stacks_.emplace_back(std::move(stack));
+      },
+      new_record_num);
+  if (this->follower_->HeaderReady()) {
+    this->binary_header_ = this->follower_->GetHeader();
+  }
+  if (this->stacks_.size() != stack_num) {
+    // new addrs may show up, symbols are rebuilt on next query
+    ResetSymbols();
+  }
+  const auto& maps_text = this->follower_->GetMapsText();
+  if (this->follower_->Finished() && maps_text.size() != this->maps_text_.size()) {
+    // maps text may arrive in pieces after trailer
+    this->proc_maps_items_.clear();
+    if (ParseMapsText(maps_text) == 0) {
+      this->maps_text_ = maps_text;
+    }
+  }
+  return ret;
+}
+
+void CPUProfile::CountStack(const CallStack& stack) {
+  if (this->stats_ != nullptr) {
+    this->stats_->records++;
+    this->stats_->alloc_num++;
+    this->stats_->alloc_bytes += stack.ptrs.capacity() * sizeof(void*);
+  }
+}
+
 void CPUProfile::ReplaceBuildSpecifier(const std::string& pat, const std::string& target, std::string& line) {
   auto is_word_char = [](char c) -> bool { return isalnum(c) || c == '_'; };
   for (auto pos = line.find(pat); pos != std::string::npos;) {
@@ -93,6 +248,7 @@ int CPUProfile::ParseMapsText(const std::string& maps_text) {
   if (maps_text.empty()) {
     return -1;
   }
+  ScopedPhase phase(this->stats_, StatsPhase::kParseMaps);
   std::istringstream iss{maps_text};
   std::string binary;
   const std::string kBuildSpecifier{"build="};
@@ -119,133 +275,678 @@ int CPUProfile::ParseMapsText(const std::string& maps_text) {
   return this->proc_maps_items_.empty() ? -1 : 0;
 }
 
+namespace {
+
+/// @brief open addressing map from symbol addr to filter bits. matched functions occupy few pages, a page bitmap
+// small enough for L1 rejects most frames before probing
+class AddrBitsMap {
+ public:
+  explicit AddrBitsMap(size_t n) : pages_(kPageBits / 64, 0) {
+    size_t slot_num = 16;
+    while (slot_num < 2 * n) {
+      slot_num *= 2;
+    }
+    shift_ = 64 - __builtin_ctzll(slot_num);
+    keys_.assign(slot_num, 0);
+    bits_.assign(slot_num, 0);
+  }
+  // @brief addr must not be 0, which marks empty slots
+  void Insert(const void* addr, uint8_t bits) {
+    size_t slot = Slot(addr);
+    while (keys_[slot] != 0 && keys_[slot] != reinterpret_cast<uintptr_t>(addr)) {
+      slot = (slot + 1) & (keys_.size() - 1);
+    }
+    keys_[slot] = reinterpret_cast<uintptr_t>(addr);
+    bits_[slot] |= bits;
+    size_t page = Page(addr);
+    pages_[page / 64] |= uint64_t{1} << (page % 64);
+  }
+  uint8_t Find(const void* addr) const {
+    if (size_t page = Page(addr); (pages_[page / 64] & (uint64_t{1} << (page % 64))) == 0) {
+      return 0;
+    }
+    for (size_t slot = Slot(addr); keys_[slot] != 0; slot = (slot + 1) & (keys_.size() - 1)) {
+      if (keys_[slot] == reinterpret_cast<uintptr_t>(addr)) {
+        return bits_[slot];
+      }
+    }
+    return 0;
+  }
+
+ private:
+  static constexpr size_t kPageBits = 1 << 16;
+  size_t Slot(const void* addr) const {
+    return static_cast<size_t>((reinterpret_cast<uintptr_t>(addr) * 0x9e3779b97f4a7c15ULL) >> shift_);
+  }
+  static size_t Page(const void* addr) {
+    // 4K pages hashed into kPageBits bits
+    return static_cast<size_t>(((reinterpret_cast<uintptr_t>(addr) >> 12) * 0x9e3779b97f4a7c15ULL) >> 48);
+  }
+
+  std::vector<uint64_t> pages_;
+  std::vector<uintptr_t> keys_;
+  std::vector<uint8_t> bits_;
+  int shift_{0};
+};
+
+}  // namespace
+
+std::vector<void*> CPUProfile::CollectSymbolAddrs() const {
+  // sort & unique a flat vector rather than hashing every ptr into a node based set
+  std::vector<void*> addrs;
+  addrs.reserve(this->ptr_num_);
+  for (const auto& s : this->stacks_) {
+    for (size_t i = 0; i < s.ptrs.size(); i++) {
+      addrs.push_back(ToSymbolAddr(s.ptrs.data(), i));
+    }
+  }
+  std::sort(addrs.begin(), addrs.end());
+  addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+  return addrs;
+}
+
+void CPUProfile::ResetSymbols() {
+  this->interned_symbols_ = InternedSymbols{};
+  this->symbol_mapping_.clear();
+  this->symbolize_order_.clear();
+  this->addr_weights_.clear();
+  this->symbolize_next_ = 0;
+  this->total_addr_weight_ = 0;
+  this->resolved_addr_weight_ = 0;
+}
+
 CPUProfileRetCode CPUProfile::GenerateSymbolMapping(SymbolLocator* locator) {
   if (this->stacks_.empty()) {
     return CPUProfileRetCode::kEmptyStack;
   }
-  std::unordered_set<void*> addrs_set;
+  ScopedPhase phase(this->stats_, StatsPhase::kLookup);
+  InternedSymbols interned;
+  interned.addrs = CollectSymbolAddrs();
+  if (auto* control = CurrentControl(); control != nullptr) {
+    control->SetAddrsSymbolized(0, interned.addrs.size());
+  }
+  if (auto ret = locator->SearchSymbolIds(&interned); ret.ret != LocatorRetCode::kOK) {
+    return StoppedOr(CPUProfileRetCode::kSearchSymbolFailed);
+  }
+  if (auto* control = CurrentControl(); control != nullptr) {
+    control->SetAddrsSymbolized(interned.addrs.size(), interned.addrs.size());
+  }
+  ResetSymbols();
+  this->interned_symbols_ = std::move(interned);
+  NameOtherStack();
+  return CPUProfileRetCode::kOK;
+}
+
+void CPUProfile::NameOtherStack() {
+  auto& interned = this->interned_symbols_;
+  auto other = reinterpret_cast<void*>(kOtherStackAddr);
+  auto iter = std::lower_bound(interned.addrs.cbegin(), interned.addrs.cend(), other);
+  if (iter != interned.addrs.cend() && *iter == other) {
+    interned.sym_ids[iter - interned.addrs.cbegin()] = interned.table->Intern(kOtherStackName);
+  }
+}
+
+CPUProfileRetCode CPUProfile::Reduce(const ReduceOptions& options, ReduceStats* stats) {
+  if (this->stacks_.empty()) {
+    return CPUProfileRetCode::kEmptyStack;
+  }
+  ReduceStats result;
+  result.stack_num_before = this->stacks_.size();
+  // truncate & merge
+  StackTable table;
+  std::vector<size_t> counts;
   for (const auto& s : this->stacks_) {
-    if (s.ptrs.empty()) {
+    size_t depth = s.ptrs.size();
+    if (options.max_depth > 0 && depth > options.max_depth) {
+      depth = options.max_depth;
+      result.truncated_stack_num++;
+    }
+    uint32_t id = table.Intern(s.ptrs.data(), depth);
+    if (id >= counts.size()) {
+      counts.resize(id + 1);
+    }
+    counts[id] += s.sample_count;
+  }
+  // unbiased sampling: keep light stack with probability c / threshold and scale it up to threshold
+  if (options.sample_threshold > 0) {
+    std::mt19937_64 rng{options.seed};
+    std::uniform_int_distribution<size_t> dist{0, options.sample_threshold - 1};
+    for (auto& count : counts) {
+      if (count > 0 && count < options.sample_threshold) {
+        if (dist(rng) < count) {
+          count = options.sample_threshold;
+        } else {
+          count = 0;
+          result.sampled_out_stack_num++;
+        }
+      }
+    }
+  }
+  size_t total{0};
+  for (auto count : counts) {
+    total += count;
+  }
+  // prune into [other] bucket
+  auto min_count = std::max(options.min_sample_count,
+                            static_cast<size_t>(options.min_weight_fraction * static_cast<double>(total)));
+  std::vector<CallStack> stacks;
+  stacks.reserve(table.Size());
+  size_t other{0};
+  for (uint32_t id = 0; id < table.Size(); id++) {
+    if (counts[id] == 0) {
       continue;
     }
-    addrs_set.insert(s.ptrs.at(0));
-    for (size_t i = 1; i < s.ptrs.size(); i++) {
-      // subtract by 1 to get call ptr
-      addrs_set.insert(reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(s.ptrs[i]) - 1));
+    if (counts[id] < min_count) {
+      other += counts[id];
+      result.pruned_stack_num++;
+      continue;
+    }
+    CallStack stack;
+    stack.sample_count = counts[id];
+    const void* const* ptrs = table.GetPtrs(id);
+    for (size_t i = 0; i < table.GetDepth(id); i++) {
+      stack.ptrs.push_back(const_cast<void*>(ptrs[i]));
     }
+    stacks.emplace_back(std::move(stack));
   }
-  std::unordered_map<void*, SymbolInfo> sym_mapping;
-  std::vector<void*> addrs{addrs_set.cbegin(), addrs_set.cend()};
-  if (auto ret = locator->SearchSymbols(addrs, &sym_mapping); ret.ret != LocatorRetCode::kOK) {
-    return CPUProfileRetCode::kSearchSymbolFailed;
+  if (other > 0) {
+    stacks.emplace_back(CallStack{other, {reinterpret_cast<void*>(kOtherStackAddr)}});
   }
-  for (const auto& item : sym_mapping) {
-    this->symbol_mapping_[item.first] = item.second.symbol_name;
+  result.other_sample_count = other;
+  result.stack_num_after = stacks.size();
+  this->stacks_ = std::move(stacks);
+  this->record_num_ = this->stacks_.size();
+  this->ptr_num_ = 0;
+  this->total_sample_cnt_ = 0;
+  for (const auto& s : this->stacks_) {
+    this->ptr_num_ += s.ptrs.size();
+    this->total_sample_cnt_ += s.sample_count;
+  }
+  ResetSymbols();
+  if (stats != nullptr) {
+    *stats = result;
   }
   return CPUProfileRetCode::kOK;
 }
 
-/// @brief generate raw profile(similar to file genreated by pprof --raw)
-CPUProfileRetCode CPUProfile::GenerateRawProfile(const RawProfileMeta& meta, SymbolLocator* locator,
-                                                 std::string* profile) {
+CPUProfileRetCode CPUProfile::Filter(SymbolLocator* locator, const FilterOptions& options, FilterStats* stats) {
+  if (this->stacks_.empty()) {
+    return CPUProfileRetCode::kEmptyStack;
+  }
+  // filter bits of symbol
+  constexpr uint8_t kFocus = 1, kIgnore = 2, kPrune = 4;
+  std::vector<std::pair<std::regex, uint8_t>> filters;
+  try {
+    for (const auto& [pattern, bit] : {std::make_pair(&options.focus, kFocus), std::make_pair(&options.ignore, kIgnore),
+                                       std::make_pair(&options.prune_from, kPrune)}) {
+      if (!pattern->empty()) {
+        filters.emplace_back(std::regex{*pattern, std::regex::ECMAScript | std::regex::optimize}, bit);
+      }
+    }
+  } catch (const std::regex_error&) {
+    return CPUProfileRetCode::kInvalidFilter;
+  }
+  if (this->interned_symbols_.table == nullptr) {
+    if (auto ret = GenerateSymbolMapping(locator); ret != CPUProfileRetCode::kOK) {
+      return ret;
+    }
+  } else if (this->symbolize_next_ < this->symbolize_order_.size()) {
+    // finish progressive symbolization, so that every frame can be matched
+    if (auto ret = SymbolizeProgressively(locator, ProgressiveSymbolOptions{}, nullptr);
+        ret != CPUProfileRetCode::kOK) {
+      return ret;
+    }
+  }
+  const auto& interned = this->interned_symbols_;
+  FilterStats result;
+  result.stack_num_before = this->stacks_.size();
+  // regexes run once per distinct symbol, id 0(unresolved) never matches
+  const auto& table = *interned.table;
+  std::vector<uint8_t> sym_bits(table.Size(), 0);
+  for (uint32_t id = 1; id < table.Size(); id++) {
+    for (const auto& [re, bit] : filters) {
+      if (std::regex_search(table.GetName(id), re)) {
+        sym_bits[id] |= bit;
+      }
+    }
+    result.matched_symbol_num += sym_bits[id] != 0 ? 1 : 0;
+  }
+  // only addrs of matched symbols are indexed, usually a small fraction
+  size_t matched_addr_num{0};
+  for (size_t i = 0; i < interned.addrs.size(); i++) {
+    matched_addr_num += sym_bits[interned.sym_ids[i]] != 0 ? 1 : 0;
+  }
+  AddrBitsMap addr_bits{matched_addr_num};
+  for (size_t i = 0; i < interned.addrs.size(); i++) {
+    if (uint8_t bits = sym_bits[interned.sym_ids[i]]; bits != 0 && interned.addrs[i] != nullptr) {
+      addr_bits.Insert(interned.addrs[i], bits);
+    }
+  }
+  bool focus = !options.focus.empty();
+  size_t kept{0};
+  for (size_t id = 0; id < this->stacks_.size(); id++) {
+    auto& s = this->stacks_[id];
+    uint8_t bits{0};
+    size_t prune_at{0};
+    bool pruned{false};
+    if (matched_addr_num > 0) {
+      for (size_t i = 0; i < s.ptrs.size(); i++) {
+        uint8_t frame_bits = addr_bits.Find(ToSymbolAddr(s.ptrs.data(), i));
+        // cut at the leaf-most match like pprof, outer recursive frames are kept
+        if ((frame_bits & kPrune) != 0 && !pruned) {
+          pruned = true;
+          prune_at = i;
+        }
+        bits |= frame_bits;
+      }
+    }
+    if ((bits & kIgnore) != 0) {
+      result.ignored_stack_num++;
+      continue;
+    }
+    if (focus && (bits & kFocus) == 0) {
+      result.unfocused_stack_num++;
+      continue;
+    }
+    if (prune_at > 0) {
+      // new leaf keeps symbol addr of the caller frame(return address - 1), so symbols stay valid
+      s.ptrs.erase(s.ptrs.begin(), s.ptrs.begin() + prune_at);
+      s.ptrs[0] = reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(s.ptrs[0]) - 1);
+      result.pruned_stack_num++;
+    }
+    result.sample_count_after += s.sample_count;
+    if (kept != id) {
+      this->stacks_[kept] = std::move(s);
+    }
+    kept++;
+  }
+  this->stacks_.resize(kept);
+  this->total_sample_cnt_ = result.sample_count_after;
+  this->record_num_ = this->stacks_.size();
+  this->ptr_num_ = 0;
+  for (const auto& s : this->stacks_) {
+    this->ptr_num_ += s.ptrs.size();
+  }
+  result.stack_num_after = this->stacks_.size();
+  if (stats != nullptr) {
+    *stats = result;
+  }
+  return CPUProfileRetCode::kOK;
+}
+
+void CPUProfile::PrepareProgressiveSymbols() {
+  ResetSymbols();
+  auto& interned = this->interned_symbols_;
+  interned.addrs = CollectSymbolAddrs();
+  interned.sym_ids.assign(interned.addrs.size(), SymbolTable::kUnknownSymbolId);
+  interned.func_addrs.assign(interned.addrs.size(), nullptr);
+  interned.table = std::make_shared<SymbolTable>();
+  NameOtherStack();
+  this->addr_weights_.assign(interned.addrs.size(), 0);
+  // recursive frames are counted once per stack
+  std::vector<size_t> last_stack(interned.addrs.size(), SIZE_MAX);
+  for (size_t id = 0; id < this->stacks_.size(); id++) {
+    const auto& s = this->stacks_[id];
+    for (size_t i = 0; i < s.ptrs.size(); i++) {
+      auto addr = ToSymbolAddr(s.ptrs.data(), i);
+      auto iter = std::lower_bound(interned.addrs.cbegin(), interned.addrs.cend(), addr);
+      size_t index = iter - interned.addrs.cbegin();
+      if (last_stack[index] != id) {
+        last_stack[index] = id;
+        this->addr_weights_[index] += s.sample_count;
+        this->total_addr_weight_ += s.sample_count;
+      }
+    }
+  }
+  this->symbolize_order_.resize(interned.addrs.size());
+  for (uint32_t i = 0; i < this->symbolize_order_.size(); i++) {
+    this->symbolize_order_[i] = i;
+  }
+  // ties keep address order
+  std::stable_sort(this->symbolize_order_.begin(), this->symbolize_order_.end(),
+                   [this](uint32_t l, uint32_t r) { return this->addr_weights_[l] > this->addr_weights_[r]; });
+}
+
+CPUProfileRetCode CPUProfile::CollapseToFunctions(SymbolLocator* locator, CollapseStats* stats) {
+  if (this->stacks_.empty()) {
+    return CPUProfileRetCode::kEmptyStack;
+  }
+  if (this->interned_symbols_.table == nullptr) {
+    if (auto ret = GenerateSymbolMapping(locator); ret != CPUProfileRetCode::kOK) {
+      return ret;
+    }
+  }
+  const auto& interned = this->interned_symbols_;
+  CollapseStats result;
+  result.stack_num_before = this->stacks_.size();
+  result.addr_num_before = interned.addrs.size();
+  // addr -> function start, unresolved addr stays as is
+  auto to_func = [&interned](void* addr) -> void* {
+    auto iter = std::lower_bound(interned.addrs.cbegin(), interned.addrs.cend(), addr);
+    size_t index = iter - interned.addrs.cbegin();
+    if (iter == interned.addrs.cend() || *iter != addr || index >= interned.func_addrs.size() ||
+        interned.func_addrs[index] == nullptr) {
+      return addr;
+    }
+    return interned.func_addrs[index];
+  };
+  StackTable table;
+  std::vector<size_t> counts;
+  std::vector<const void*> ptrs;
+  for (const auto& s : this->stacks_) {
+    ptrs.clear();
+    for (size_t i = 0; i < s.ptrs.size(); i++) {
+      auto func = reinterpret_cast<uintptr_t>(to_func(ToSymbolAddr(s.ptrs.data(), i)));
+      // callers are stored as return address, add 1 back so that symbol addr(ptr - 1) is function start
+      ptrs.push_back(reinterpret_cast<const void*>(i == 0 ? func : func + 1));
+    }
+    uint32_t id = table.Intern(ptrs.data(), ptrs.size());
+    if (id >= counts.size()) {
+      counts.resize(id + 1);
+    }
+    counts[id] += s.sample_count;
+  }
+  // symbols of function starts are known already, no second lookup
+  InternedSymbols collapsed;
+  collapsed.table = interned.table;
+  std::vector<std::pair<void*, uint32_t>> funcs;
+  funcs.reserve(interned.addrs.size());
+  for (size_t i = 0; i < interned.addrs.size(); i++) {
+    void* func = to_func(interned.addrs[i]);
+    funcs.emplace_back(func, interned.sym_ids[i]);
+  }
+  std::sort(funcs.begin(), funcs.end());
+  funcs.erase(std::unique(funcs.begin(), funcs.end(),
+                          [](const auto& l, const auto& r) { return l.first == r.first; }),
+              funcs.end());
+  for (const auto& [func, sym_id] : funcs) {
+    collapsed.addrs.push_back(func);
+    collapsed.sym_ids.push_back(sym_id);
+    collapsed.func_addrs.push_back(func);
+  }
+  std::vector<CallStack> stacks;
+  stacks.reserve(table.Size());
+  this->ptr_num_ = 0;
+  for (uint32_t id = 0; id < table.Size(); id++) {
+    CallStack stack;
+    stack.sample_count = counts[id];
+    const void* const* collapsed_ptrs = table.GetPtrs(id);
+    for (size_t i = 0; i < table.GetDepth(id); i++) {
+      stack.ptrs.push_back(const_cast<void*>(collapsed_ptrs[i]));
+    }
+    this->ptr_num_ += stack.ptrs.size();
+    stacks.emplace_back(std::move(stack));
+  }
+  this->stacks_ = std::move(stacks);
+  this->record_num_ = this->stacks_.size();
+  ResetSymbols();
+  this->interned_symbols_ = std::move(collapsed);
+  result.stack_num_after = this->stacks_.size();
+  result.addr_num_after = this->interned_symbols_.addrs.size();
+  if (stats != nullptr) {
+    *stats = result;
+  }
+  return CPUProfileRetCode::kOK;
+}
+
+CPUProfileRetCode CPUProfile::SymbolizeProgressively(SymbolLocator* locator, const ProgressiveSymbolOptions& options,
+                                                     SymbolizeProgress* progress) {
+  if (this->stacks_.empty()) {
+    return CPUProfileRetCode::kEmptyStack;
+  }
+  ScopedPhase phase(this->stats_, StatsPhase::kLookup);
+  auto start = std::chrono::steady_clock::now();
+  if (this->interned_symbols_.table == nullptr) {
+    PrepareProgressiveSymbols();
+  }
+  auto& interned = this->interned_symbols_;
+  auto coverage = [this]() -> double {
+    return this->total_addr_weight_ == 0
+               ? 1.0
+               : static_cast<double>(this->resolved_addr_weight_) / static_cast<double>(this->total_addr_weight_);
+  };
+  size_t batch_size = std::max<size_t>(options.batch_size, 1);
+  InternedSymbols batch;
+  batch.table = interned.table;
+  ProcessingControl* control = CurrentControl();
+  CPUProfileRetCode ret{CPUProfileRetCode::kOK};
+  while (this->symbolize_next_ < this->symbolize_order_.size() && coverage() < options.coverage) {
+    if (options.time_budget.count() > 0 && std::chrono::steady_clock::now() - start >= options.time_budget) {
+      break;
+    }
+    if (control != nullptr) {
+      control->SetAddrsSymbolized(this->symbolize_next_, this->symbolize_order_.size());
+      // addrs resolved by finished batches are kept
+      if (ret = StoppedOr(CPUProfileRetCode::kOK); ret != CPUProfileRetCode::kOK) {
+        break;
+      }
+    }
+    size_t end = std::min(this->symbolize_next_ + batch_size, this->symbolize_order_.size());
+    // lookup in address order, locators walk mappings sequentially
+    std::vector<uint32_t> indexes(this->symbolize_order_.begin() + this->symbolize_next_,
+                                  this->symbolize_order_.begin() + end);
+    std::sort(indexes.begin(), indexes.end());
+    batch.addrs.clear();
+    for (auto index : indexes) {
+      batch.addrs.push_back(interned.addrs[index]);
+    }
+    if (auto st = locator->SearchSymbolIds(&batch); st.ret != LocatorRetCode::kOK) {
+      if (ret = StoppedOr(CPUProfileRetCode::kSearchSymbolFailed); ret == CPUProfileRetCode::kSearchSymbolFailed) {
+        return ret;
+      }
+      break;
+    }
+    for (size_t i = 0; i < indexes.size(); i++) {
+      interned.sym_ids[indexes[i]] = batch.sym_ids[i];
+      interned.func_addrs[indexes[i]] = batch.func_addrs[i];
+      this->resolved_addr_weight_ += this->addr_weights_[indexes[i]];
+    }
+    this->symbolize_next_ = end;
+    this->symbol_mapping_.clear();
+  }
+  NameOtherStack();
+  if (progress != nullptr) {
+    bool finished = this->symbolize_next_ >= this->symbolize_order_.size();
+    progress->total_addr_num = interned.addrs.size();
+    // symbolize_order_ is empty once all addrs are resolved by GenerateSymbolMapping
+    progress->resolved_addr_num = finished ? interned.addrs.size() : this->symbolize_next_;
+    progress->coverage = finished ? 1.0 : coverage();
+    progress->finished = finished;
+  }
+  if (control != nullptr && ret == CPUProfileRetCode::kOK) {
+    control->SetAddrsSymbolized(this->symbolize_next_, this->symbolize_order_.size());
+  }
+  return ret;
+}
+
+CPUProfileRetCode WriteRawProfile(const RawProfileMeta& meta, const CPUProfileBinaryHeader& header,
+                                  const void* const* addrs, size_t n,
+                                  const std::function<std::string_view(size_t)>& name_of,
+                                  const std::function<CPUProfileRetCode(const RawRecordSink&)>& for_each_record,
+                                  std::ostream& os) {
   if (meta.program_path.empty()) {
     return CPUProfileRetCode::kNoProgramPath;
   }
-  // assume 2M
-  profile->reserve(2 * 1024 * 1024);
   if (meta.profile_type == RawProfileType::kFixedRaw) {
-    profile->append("--- symbol_fixed\n");
+    os << "--- symbol_fixed\n";
   } else if (meta.profile_type == RawProfileType::kPProfCompatible) {
-    profile->append("--- symbol\n");
+    os << "--- symbol\n";
+  }
+  os << "binary=" << meta.program_path << "\n";
+  WriteRawSymbols(addrs, n, name_of, os);
+  os << "---\n";
+  os << "--- profile\n";
+  // writer does not own os
+  std::shared_ptr<std::ostream> os_ref{&os, [](std::ostream*) {}};
+  CPUProfileWriter writer{os_ref, header};
+  // call ptr is subtracted by 1 for pprof compatible profile
+  uintptr_t pc_adjust = meta.profile_type == RawProfileType::kPProfCompatible ? 1 : 0;
+  bool write_failed{false};
+  auto ret = for_each_record([&](size_t sample_count, const void* const* pcs, size_t depth) {
+    write_failed = writer.AppendRecord(sample_count, pcs, depth, pc_adjust) != WriterRetCode::kOK;
+    return !write_failed;
+  });
+  if (write_failed) {
+    return CPUProfileRetCode::kGenProfileFailed;
   }
-  profile->append(fmt::format("binary={}\n", meta.program_path));
-  std::string symbols;
-  if (auto ret = GenerateRawSymbols(locator, &symbols); ret != CPUProfileRetCode::kOK) {
+  if (ret != CPUProfileRetCode::kOK) {
     return ret;
   }
-  profile->append(symbols);
-  profile->append("---\n");
-  profile->append("--- profile\n");
-  std::string content;
-  if (auto st = GenerateBinaryProfile(meta, &content); st != CPUProfileRetCode::kOK) {
-    return st;
+  // binary trailer, maps text is not needed here
+  if (writer.AppendSlot(0) != WriterRetCode::kOK || writer.AppendSlot(1) != WriterRetCode::kOK ||
+      writer.AppendSlot(0) != WriterRetCode::kOK || writer.Flush() != WriterRetCode::kOK) {
+    return CPUProfileRetCode::kGenProfileFailed;
   }
-  profile->append(content);
-  return CPUProfileRetCode::kOK;
+  os.flush();
+  return os.good() ? CPUProfileRetCode::kOK : CPUProfileRetCode::kWriteOutputFailed;
 }
 
-CPUProfileRetCode CPUProfile::GenerateBinaryProfile(const RawProfileMeta& meta, std::string* content) {
-  std::shared_ptr<std::ostream> os = std::make_shared<std::ostringstream>();
-  CPUProfileWriter writer{os, this->binary_header_};
-#define RETURN_IF_NOT_EXPECTED(expr, expected)                          \
-  do {                                                                  \
-    auto ret = (expr);                                                  \
-    if (ret != (expected)) return CPUProfileRetCode::kGenProfileFailed; \
-  } while (0);
-  // dump stack
-  for (const auto& s : this->stacks_) {
-    // sample count, num_pc, pc
-    RETURN_IF_NOT_EXPECTED(writer.AppendSlot(s.sample_count), WriterRetCode::kOK);
-    RETURN_IF_NOT_EXPECTED(writer.AppendSlot(s.ptrs.size()), WriterRetCode::kOK);
-    RETURN_IF_NOT_EXPECTED(writer.AppendSlot(reinterpret_cast<uintptr_t>(s.ptrs.at(0))), WriterRetCode::kOK);
-    for (size_t i = 1; i < s.ptrs.size(); i++) {
-      if (meta.profile_type == RawProfileType::kPProfCompatible) {
-        // call ptr is subtracted by 1
-        RETURN_IF_NOT_EXPECTED(writer.AppendSlot(reinterpret_cast<uintptr_t>(s.ptrs.at(i)) - 1), WriterRetCode::kOK);
-      } else if (meta.profile_type == RawProfileType::kFixedRaw) {
-        RETURN_IF_NOT_EXPECTED(writer.AppendSlot(reinterpret_cast<uintptr_t>(s.ptrs.at(i))), WriterRetCode::kOK);
-      }
+/// @brief generate raw profile(similar to file genreated by pprof --raw)
+CPUProfileRetCode CPUProfile::GenerateRawProfile(const RawProfileMeta& meta, SymbolLocator* locator,
+                                                 std::string* profile) {
+  // assume 2M
+  profile->reserve(profile->size() + 2 * 1024 * 1024);
+  return GenerateRawProfile(meta, locator, [profile](const char* data, size_t len) -> bool {
+    profile->append(data, len);
+    return true;
+  });
+}
+
+CPUProfileRetCode CPUProfile::GenerateRawProfile(const RawProfileMeta& meta, SymbolLocator* locator, int fd) {
+  return GenerateRawProfile(meta, locator, FdChunkCallback(fd));
+}
+
+CPUProfileRetCode CPUProfile::GenerateRawProfile(const RawProfileMeta& meta, SymbolLocator* locator,
+                                                 const ChunkCallback& callback, size_t chunk_size) {
+  ChunkStreamBuf buf{callback, chunk_size};
+  std::ostream os{&buf};
+  return GenerateRawProfile(meta, locator, os);
+}
+
+CPUProfileRetCode CPUProfile::GenerateRawProfile(const RawProfileMeta& meta, SymbolLocator* locator,
+                                                 std::ostream& os) {
+  if (meta.program_path.empty()) {
+    return CPUProfileRetCode::kNoProgramPath;
+  }
+  ScopedPhase phase(this->stats_, StatsPhase::kEmit);
+  // symbolize before writing anything, so that nothing is emitted on search failure
+  if (!stacks_.empty() && interned_symbols_.table == nullptr) {
+    if (auto ret = GenerateSymbolMapping(locator); ret != CPUProfileRetCode::kOK) {
+      return ret;
     }
   }
-  // dump trailer
-  RETURN_IF_NOT_EXPECTED(writer.AppendSlot(0), WriterRetCode::kOK);
-  RETURN_IF_NOT_EXPECTED(writer.AppendSlot(1), WriterRetCode::kOK);
-  RETURN_IF_NOT_EXPECTED(writer.AppendSlot(0), WriterRetCode::kOK);
-  // we dont need maps text here
-  *content = static_cast<std::ostringstream*>(os.get())->str();
-#undef RETURN_IF_NOT_EXPECTED
-  return CPUProfileRetCode::kOK;
+  const auto& interned = this->interned_symbols_;
+  ProcessingControl* control = CurrentControl();
+  return WriteRawProfile(
+      meta, this->binary_header_, interned.addrs.data(), interned.table != nullptr ? interned.addrs.size() : 0,
+      [&interned](size_t i) -> std::string_view { return interned.table->GetName(interned.sym_ids[i]); },
+      [this, control](const RawRecordSink& sink) {
+        for (size_t i = 0; i < this->stacks_.size(); i++) {
+          if (control != nullptr && (i & (kControlCheckInterval - 1)) == 0) {
+            control->SetRecordsEmitted(i);
+            if (auto ret = StoppedOr(CPUProfileRetCode::kOK); ret != CPUProfileRetCode::kOK) {
+              return ret;
+            }
+          }
+          const auto& s = this->stacks_[i];
+          if (!sink(s.sample_count, s.ptrs.data(), s.ptrs.size())) {
+            return CPUProfileRetCode::kGenProfileFailed;
+          }
+        }
+        if (control != nullptr) {
+          control->SetRecordsEmitted(this->stacks_.size());
+        }
+        return CPUProfileRetCode::kOK;
+      },
+      os);
 }
 
-CPUProfileRetCode CPUProfile::GenerateRawSymbols(SymbolLocator* locator, std::string* symbols) {
-  if (!stacks_.empty() && symbol_mapping_.empty()) {
+CPUProfileRetCode CPUProfile::GenerateCompactProfile(SymbolLocator* locator, std::ostream& os,
+                                                     CompactCompression compression) {
+  ScopedPhase phase(this->stats_, StatsPhase::kEmit);
+  if (!stacks_.empty() && interned_symbols_.table == nullptr) {
     if (auto ret = GenerateSymbolMapping(locator); ret != CPUProfileRetCode::kOK) {
       return ret;
     }
   }
-  char buf[20] = {0};
-  for (const auto& [addr, sym] : symbol_mapping_) {
-    size_t n = snprintf(buf, sizeof(buf), "%#018lx", reinterpret_cast<uintptr_t>(addr));
-    symbols->append(buf, buf + n);
-    symbols->append(" ");
-    symbols->append(sym.empty() ? std::string(buf, buf + n) : sym);
-    symbols->append("\n");
+  CompactProfileWriter writer{os, compression};
+  writer.WriteHeader(this->binary_header_);
+  const auto& interned = this->interned_symbols_;
+  std::vector<std::string_view> names;
+  if (interned.table != nullptr) {
+    names.reserve(interned.table->Size());
+    for (uint32_t id = 0; id < interned.table->Size(); id++) {
+      names.emplace_back(interned.table->GetName(id));
+    }
   }
-  return CPUProfileRetCode::kOK;
+  writer.WriteStringTable(names);
+  writer.WriteSymbols(interned.addrs.data(), interned.sym_ids.data(), interned.addrs.size());
+  writer.BeginStacks(this->stacks_.size());
+  for (const auto& s : this->stacks_) {
+    writer.AppendStack(s.sample_count, s.ptrs.data(), s.ptrs.size());
+  }
+  writer.WriteMapsText(this->maps_text_);
+  // writer keeps the first error, later calls are no-op
+  return writer.Finish() == CompactRetCode::kOK ? CPUProfileRetCode::kOK : CPUProfileRetCode::kWriteOutputFailed;
+}
+
+ProfileMemoryUsage CPUProfile::MemoryUsage() const {
+  ProfileMemoryUsage usage;
+  usage.stacks = this->stacks_.capacity() * sizeof(CallStack);
+  for (const auto& s : this->stacks_) {
+    usage.stacks += s.ptrs.capacity() * sizeof(void*);
+  }
+  const auto& interned = this->interned_symbols_;
+  usage.symbols = interned.addrs.capacity() * sizeof(void*) + interned.sym_ids.capacity() * sizeof(uint32_t) +
+                  interned.func_addrs.capacity() * sizeof(void*) +
+                  (interned.table != nullptr ? interned.table->MemoryUsage() : 0) +
+                  HashNodeBytes(this->symbol_mapping_) + this->symbolize_order_.capacity() * sizeof(uint32_t) +
+                  this->addr_weights_.capacity() * sizeof(size_t);
+  for (const auto& [addr, name] : this->symbol_mapping_) {
+    usage.symbols += StringHeapBytes(name);
+  }
+  usage.maps_text = StringHeapBytes(this->maps_text_);
+  usage.maps_items = this->proc_maps_items_.capacity() * sizeof(std::string);
+  for (const auto& item : this->proc_maps_items_) {
+    usage.maps_items += StringHeapBytes(item);
+  }
+  return usage;
 }
 
 std::string CPUProfile::ToString() {
-  std::string report;
-  report.append(fmt::format("---------------Header:\n"));
-  report.append(fmt::format("hdr_count: {}\n", this->binary_header_.hdr_count));
-  report.append(fmt::format("hdr_words: {}\n", this->binary_header_.hdr_words));
-  report.append(fmt::format("version: {}\n", this->binary_header_.version));
-  report.append(fmt::format("sampling_period: {}\n", this->binary_header_.sampling_period));
-  report.append(fmt::format("padding: {}\n", this->binary_header_.padding));
-  report.append(fmt::format("profile num: {}, total sample num: {}, call stack num: {}, ptr nums: {}\n",
+  std::string header;
+  header.append(fmt::format("---------------Header:\n"));
+  header.append(fmt::format("hdr_count: {}\n", this->binary_header_.hdr_count));
+  header.append(fmt::format("hdr_words: {}\n", this->binary_header_.hdr_words));
+  header.append(fmt::format("version: {}\n", this->binary_header_.version));
+  header.append(fmt::format("sampling_period: {}\n", this->binary_header_.sampling_period));
+  header.append(fmt::format("padding: {}\n", this->binary_header_.padding));
+  header.append(fmt::format("profile num: {}, total sample num: {}, call stack num: {}, ptr nums: {}\n",
                             this->record_num_, this->total_sample_cnt_, this->stacks_.size(), this->ptr_num_));
-  report.append(fmt::format("---------------Stacks:\n"));
-  std::unordered_set<void*> dedupped_ptrs;
-  char buf[20] = {0};
+  header.append(fmt::format("---------------Stacks:\n"));
+  // exact size pass: every ptr takes kHexAddrLen + 1 bytes, plus one line break per stack
+  size_t stacks_len{0};
+  std::vector<void*> dedupped_ptrs;
+  dedupped_ptrs.reserve(this->ptr_num_);
+  for (const auto& s : this->stacks_) {
+    stacks_len += s.ptrs.size() * (kHexAddrLen + 1) + 1;
+    dedupped_ptrs.insert(dedupped_ptrs.end(), s.ptrs.cbegin(), s.ptrs.cend());
+  }
+  std::sort(dedupped_ptrs.begin(), dedupped_ptrs.end());
+  size_t distinct_num = std::unique(dedupped_ptrs.begin(), dedupped_ptrs.end()) - dedupped_ptrs.begin();
+  std::string footer = fmt::format("distinct ptr num: {}\n", distinct_num);
+  // render pass, single allocation
+  std::string report;
+  report.resize(header.size() + stacks_len + footer.size());
+  char* p = std::copy(header.cbegin(), header.cend(), report.data());
   for (const auto& s : this->stacks_) {
     for (const auto& ptr : s.ptrs) {
-      size_t n = snprintf(buf, sizeof(buf), "%#018lx ", reinterpret_cast<uintptr_t>(ptr));
-      report.append(buf, buf + n);
-      dedupped_ptrs.insert(ptr);
+      p = FormatHexAddr(reinterpret_cast<uintptr_t>(ptr), p);
+      *p++ = ' ';
     }
-    report.append("\n");
+    *p++ = '\n';
   }
-  report.append(fmt::format("distinct ptr num: {}\n", dedupped_ptrs.size()));
+  std::copy(footer.cbegin(), footer.cend(), p);
   return report;
 }
 
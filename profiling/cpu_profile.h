@@ -6,13 +6,19 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "profiling/io/compact_profile.h"
 #include "profiling/io/profile_io.h"
+#include "profiling/symbol/profile_symbol.h"
+#include "profiling/util/stats.h"
 
 /// @brief Function call stack, generally consists of stack frame pointers
 struct CallStack {
@@ -33,6 +39,10 @@ enum class CPUProfileRetCode {
   kGenProfileFailed = 2,
   kEmptyStack = 3,
   kSearchSymbolFailed = 4,
+  kWriteOutputFailed = 5,
+  kCancelled = 6,
+  kDeadlineExceeded = 7,
+  kInvalidFilter = 8,
 };
 
 enum class RawProfileType {
@@ -45,6 +55,110 @@ struct RawProfileMeta {
   RawProfileType profile_type{RawProfileType::kPProfCompatible};
 };
 
+/// @brief leaf pc of the [other] bucket stack created by CPUProfile::Reduce, named kOtherStackName when symbolized
+constexpr uintptr_t kOtherStackAddr = 1;
+constexpr char kOtherStackName[] = "[other]";
+
+/// @brief reduction applied by CPUProfile::Reduce, in order: truncation, sampling, pruning. zero disables a step
+struct ReduceOptions {
+  size_t max_depth{0};              // keep at most max_depth leaf-side frames of every stack
+  size_t sample_threshold{0};       // stack with count c < threshold is kept with probability c / threshold and
+                                    // count set to threshold, expected per-function totals are preserved
+  uint64_t seed{0};                 // random seed of sampling
+  size_t min_sample_count{0};       // stacks with fewer samples are merged into [other] bucket
+  double min_weight_fraction{0};    // stacks carrying less fraction of total samples are merged into [other] bucket
+};
+
+/// @brief result of CPUProfile::Reduce
+struct ReduceStats {
+  size_t stack_num_before{0};
+  size_t stack_num_after{0};
+  size_t truncated_stack_num{0};  // stacks deeper than max_depth
+  size_t sampled_out_stack_num{0};
+  size_t pruned_stack_num{0};
+  size_t other_sample_count{0};   // samples moved into [other] bucket
+};
+
+/// @brief result of CPUProfile::CollapseToFunctions
+struct CollapseStats {
+  size_t stack_num_before{0};
+  size_t stack_num_after{0};
+  size_t addr_num_before{0};  // distinct symbol addrs
+  size_t addr_num_after{0};
+};
+
+/// @brief pprof style filters applied by CPUProfile::Filter in a single pass, every regex(ECMAScript, matching any
+// part of name) is tested once per distinct symbol. empty disables a filter, unresolved frames never match
+struct FilterOptions {
+  std::string focus;       // keep only stacks with a frame matching focus
+  std::string ignore;      // drop stacks with a frame matching ignore
+  std::string prune_from;  // drop callees of the leaf-most frame matching prune_from(as pprof), which becomes leaf
+};
+
+/// @brief result of CPUProfile::Filter
+struct FilterStats {
+  size_t stack_num_before{0};
+  size_t stack_num_after{0};
+  size_t unfocused_stack_num{0};  // dropped for not matching focus
+  size_t ignored_stack_num{0};
+  size_t pruned_stack_num{0};     // stacks trimmed by prune_from
+  size_t sample_count_after{0};
+  size_t matched_symbol_num{0};   // distinct symbols matching any filter
+};
+
+/// @brief budget of one SymbolizeProgressively call, symbolization stops at whichever budget is hit first
+struct ProgressiveSymbolOptions {
+  std::chrono::microseconds time_budget{0};  // 0 means no time limit
+  double coverage{1.0};                      // stop once resolved addrs carry this fraction of total addr weight
+  size_t batch_size{256};                    // addrs handed to locator at a time, budgets are checked between batches
+};
+
+/// @brief progress of progressive symbolization
+struct SymbolizeProgress {
+  size_t resolved_addr_num{0};  // addrs looked up so far, in weight order
+  size_t total_addr_num{0};
+  double coverage{0};           // weight of looked up addrs / total addr weight
+  bool finished{false};         // all addrs are looked up
+};
+
+/// @brief approximate heap bytes held by CPUProfile
+struct ProfileMemoryUsage {
+  size_t stacks{0};      // call stacks & their pcs
+  size_t symbols{0};     // interned symbols(table included even if shared), symbol mapping & progressive state
+  size_t maps_text{0};
+  size_t maps_items{0};  // parsed proc maps items
+  size_t Total() const { return stacks + symbols + maps_text + maps_items; }
+};
+
+/// @brief profile shape assumed by CPUProfile::EstimateMemory, defaults are the worst case except name length
+struct MemoryEstimateOptions {
+  size_t mean_depth{1};             // mean pcs per record, shallow records cost the most per file byte
+  double distinct_addr_ratio{1.0};  // distinct symbol addrs / total pcs
+  size_t mean_name_len{64};         // mean length of demangled symbol names
+  bool buffered_output{true};       // raw profile generated into std::string, false for stream/fd/callback output
+};
+
+/// @brief estimated memory in bytes of Parse + GenerateRawProfile, locator memory is not included
+struct MemoryEstimate {
+  size_t parse_bytes{0};      // peak of Parse: slot buffer of reader plus call stacks
+  size_t profile_bytes{0};    // held by parsed profile
+  size_t symbolize_bytes{0};  // symbol addrs, ids & names added by symbolization
+  size_t output_bytes{0};     // raw profile output buffers
+  size_t peak_bytes{0};       // max(parse_bytes, profile_bytes + symbolize_bytes + output_bytes)
+};
+
+/// @brief receives one record(leaf first pcs) of raw profile, false if it can not be written
+using RawRecordSink = std::function<bool(size_t sample_count, const void* const* pcs, size_t depth)>;
+
+/// @brief write raw profile into os: symbol section of n sorted addrs named by name_of(i), then binary profile whose
+// records are passed to sink by for_each_record. for_each_record returns kOK, kGenProfileFailed once sink fails, or
+// its own stop code(e.g. kCancelled) which is returned as is
+CPUProfileRetCode WriteRawProfile(const RawProfileMeta& meta, const CPUProfileBinaryHeader& header,
+                                  const void* const* addrs, size_t n,
+                                  const std::function<std::string_view(size_t)>& name_of,
+                                  const std::function<CPUProfileRetCode(const RawRecordSink&)>& for_each_record,
+                                  std::ostream& os);
+
 /// @brief  gperftools CPU Profile
 // only parse binary header & profile records now, with text mapping objects ignored
 // because we only focus on runtime analysis and realtime mapping objects can be parsed from /proc/self/maps
@@ -55,42 +169,111 @@ class CPUProfile {
     this->is_ = std::make_unique<std::ifstream>(filename.c_str(), std::ios_base::binary);
   }
   explicit CPUProfile(std::unique_ptr<std::istream> is) : is_(std::move(is)) {}
+  // @brief build profile from stacks collected in memory(e.g. by CPUSampler), no Parse is needed
+  CPUProfile(const CPUProfileBinaryHeader& header, std::vector<CallStack> stacks, std::string maps_text);
   ~CPUProfile() = default;
+  // @brief collect per-phase timings & counters of following calls into stats(not owned, nullptr disables)
+  // set it before Parse/Follow to include reading, pass the same stats to locator to include symbol loading
+  void SetStats(ProcessingStats* stats) { stats_ = stats; }
+  // @brief estimate memory of Parse + GenerateRawProfile from file size & binary header, records are not read
+  // so that oversized profiles can be rejected or routed elsewhere before processing
+  static ReaderRetCode EstimateMemory(const std::string& file, const MemoryEstimateOptions& options,
+                                      MemoryEstimate* estimate);
+  // @brief estimate from profile size in bytes and slot size(8 for 64-bit profiles, 4 for 32-bit)
+  static MemoryEstimate EstimateMemory(size_t file_size, size_t slot_size, const MemoryEstimateOptions& options);
   // @brief parse whole profile file
   ReaderRetCode Parse();
+  // @brief follow mode for a profile file still being written, parse records appended since last call
+  // partial trailing record is left for next call, aggregates are updated incrementally and symbol caches are
+  // refreshed lazily. new_record_num(nullable) is set to records parsed by this call. do not mix with Parse.
+  ReaderRetCode Follow(size_t* new_record_num = nullptr);
+  // @brief whether followed profile is complete(binary trailer found)
+  bool IsFollowFinished() const { return follower_ != nullptr && follower_->Finished(); }
   // @brief convert CPU profile as text
   std::string ToString();
   // @brief return address to symbol(function provided by symbol parser) mapping for this profile
+  // names are copied from interned symbols, prefer GetInternedSymbols for large profiles
   const std::unordered_map<void*, std::string>& GetSymbolMapping(SymbolLocator* parser) {
-    if (!stacks_.empty() && symbol_mapping_.empty()) {
-      GenerateSymbolMapping(parser);
+    const auto& interned = GetInternedSymbols(parser);
+    if (symbol_mapping_.empty() && interned.table != nullptr) {
+      for (size_t i = 0; i < interned.addrs.size(); i++) {
+        symbol_mapping_[interned.addrs[i]] = interned.table->GetName(interned.sym_ids[i]);
+      }
     }
     return symbol_mapping_;
   }
-  // @brief generate raw profile(similar to file genreated by pprof --raw)
+  // @brief return distinct addrs(sorted) and their interned symbol ids of this profile, names are shared, not copied
+  const InternedSymbols& GetInternedSymbols(SymbolLocator* locator) {
+    if (!stacks_.empty() && interned_symbols_.table == nullptr) {
+      GenerateSymbolMapping(locator);
+    }
+    return interned_symbols_;
+  }
+  // @brief shrink profile before symbolization, identical stacks(after truncation) are merged, symbols are reset
+  // stats is nullable
+  CPUProfileRetCode Reduce(const ReduceOptions& options, ReduceStats* stats = nullptr);
+  // @brief function granularity: symbolize(if not yet), replace every pc by start address of its function and merge
+  // identical stacks, so that symbol section & records shrink. addrs without function start are kept.
+  // stats is nullable
+  CPUProfileRetCode CollapseToFunctions(SymbolLocator* locator, CollapseStats* stats = nullptr);
+  // @brief symbolize(if not yet) and filter stacks in place, later output of any format covers filtered stacks only.
+  // symbols are kept, so no second lookup is needed. kInvalidFilter if a regex is malformed. stats is nullable
+  CPUProfileRetCode Filter(SymbolLocator* locator, const FilterOptions& options, FilterStats* stats = nullptr);
+  // @brief symbolize addrs in descending order of cumulative sample weight(samples of stacks containing the addr),
+  // stop when budget of options is used up, call again to continue. before finished, GetInternedSymbols and
+  // GenerateRawProfile use addrs resolved so far, unresolved addrs are emitted as raw addresses
+  CPUProfileRetCode SymbolizeProgressively(SymbolLocator* locator, const ProgressiveSymbolOptions& options,
+                                           SymbolizeProgress* progress);
+  // @brief generate raw profile(similar to file genreated by pprof --raw), appended to profile
   CPUProfileRetCode GenerateRawProfile(const RawProfileMeta& meta, SymbolLocator* locator, std::string* profile);
+  // @brief stream raw profile into os, no intermediate copy of output is kept
+  CPUProfileRetCode GenerateRawProfile(const RawProfileMeta& meta, SymbolLocator* locator, std::ostream& os);
+  // @brief stream raw profile to fd through a fixed-size buffer
+  CPUProfileRetCode GenerateRawProfile(const RawProfileMeta& meta, SymbolLocator* locator, int fd);
+  // @brief stream raw profile in chunks(at most chunk_size bytes buffered) to callback, e.g. upload while generating
+  CPUProfileRetCode GenerateRawProfile(const RawProfileMeta& meta, SymbolLocator* locator,
+                                       const ChunkCallback& callback, size_t chunk_size = kDefaultChunkSize);
+  // @brief symbolize(if not yet) and write compact transport format(see compact_profile.h) into os
+  CPUProfileRetCode GenerateCompactProfile(SymbolLocator* locator, std::ostream& os,
+                                           CompactCompression compression = CompactCompression::kZlib);
+  // @brief parsed call stacks
+  const std::vector<CallStack>& GetCallStacks() const { return stacks_; }
+  const CPUProfileBinaryHeader& GetHeader() const { return binary_header_; }
   // @brief get sample record num
   size_t GetRecordNum() const { return record_num_; }
   // @brief get original proc mapping content
   const std::string& GetMapsText() const { return maps_text_; }
+  // @brief approximate heap bytes currently held
+  ProfileMemoryUsage MemoryUsage() const;
 
  private:
-  CPUProfileRetCode GenerateRawSymbols(SymbolLocator* locator, std::string* symbols);
   CPUProfileRetCode GenerateSymbolMapping(SymbolLocator* locator);
+  std::vector<void*> CollectSymbolAddrs() const;
+  void PrepareProgressiveSymbols();
+  void ResetSymbols();
+  void NameOtherStack();
   int ParseMapsText(const std::string& maps_text);
-  CPUProfileRetCode GenerateBinaryProfile(const RawProfileMeta& meta, std::string* content);
+  void CountStack(const CallStack& stack);
   static void ReplaceBuildSpecifier(const std::string& pat, const std::string& target, std::string& line);
 
   std::string profile_file_;  // profile file path holded
   std::unique_ptr<std::istream> is_;
+  std::unique_ptr<CPUProfileFollowReader> follower_;  // created by first Follow
   // following 5 fields belong to profile binary header
   CPUProfileBinaryHeader binary_header_;
   size_t record_num_{0};  // profile record num
   size_t ptr_num_{0};     // distinct call ptr num
   std::vector<CallStack> stacks_;
   size_t total_sample_cnt_{0};
+  InternedSymbols interned_symbols_;                       // backtrace addrs and their interned symbol names
   std::unordered_map<void*, std::string> symbol_mapping_;  // backtrace addr to demangled symbol name
+  std::vector<uint32_t> symbolize_order_;                  // index of interned addrs, by weight desc
+  std::vector<size_t> addr_weights_;                       // cumulative sample weight of interned addrs
+  size_t symbolize_next_{0};                               // next position in symbolize_order_
+  size_t total_addr_weight_{0};
+  size_t resolved_addr_weight_{0};
   std::string maps_text_;                                  // original proc mapping content
   std::vector<std::string> proc_maps_items_;               // proc maps items
+  ProcessingStats* stats_{nullptr};                         // not owned, nullable
 };
 }  // namespace fustsdk
@@ -0,0 +1,173 @@
+/*
+ * FileName: cpu_profile_benchmark.cc
+ * Author: jattle
+ * Descrption: CPUProfile parse(stack materialization), symbolization, filtering and raw profile emission at 1k/100k/10M records
+ */
+#include <random>
+#include <sstream>
+
+#include "benchmark/benchmark.h"
+#include "fmt/format.h"
+
+#include "profiling/cpu_profile.h"
+
+using namespace pprofcpp;
+
+namespace {
+
+constexpr size_t kDepth = 4;  // keeps 10M records parse within ~1.5GB(input bytes, reader slots & stacks)
+constexpr uintptr_t kTextBase = 0x400000;
+constexpr size_t kFuncNum = 16384;
+constexpr size_t kFuncSize = 256;
+constexpr char kMapsText[] = "00400000-01400000 r-xp 00000000 08:01 1234   /path/to/binary\n";
+
+/// @brief names kFuncNum functions of kFuncSize bytes laid out from kTextBase, no object file involved
+class SyntheticLocator : public SymbolLocator {
+ public:
+  SyntheticLocator() {
+    names_.reserve(kFuncNum);
+    for (size_t i = 0; i < kFuncNum; i++) {
+      names_.push_back(fmt::format("ns{}::Class{}::Method{}(int, std::string const&)", i % 17, i % 389, i));
+    }
+  }
+  LocatorStatus SearchSymbols(const std::vector<void*>& addrs,
+                              std::unordered_map<void*, SymbolInfo>* sym_mapping) override {
+    for (auto addr : addrs) {
+      size_t index = (reinterpret_cast<uintptr_t>(addr) - kTextBase) / kFuncSize;
+      if (index < kFuncNum) {
+        auto start = reinterpret_cast<const void*>(kTextBase + index * kFuncSize);
+        sym_mapping->emplace(addr, SymbolInfo{addr, names_[index], start});
+      }
+    }
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  }
+
+ private:
+  std::vector<std::string> names_;
+};
+
+std::vector<CallStack> MakeStacks(size_t record_num) {
+  std::mt19937_64 rng{record_num};
+  std::vector<CallStack> stacks(record_num);
+  for (auto& stack : stacks) {
+    stack.sample_count = rng() % 10 + 1;
+    stack.ptrs.reserve(kDepth);
+    for (size_t d = 0; d < kDepth; d++) {
+      stack.ptrs.push_back(reinterpret_cast<void*>(kTextBase + rng() % (kFuncNum * kFuncSize)));
+    }
+  }
+  return stacks;
+}
+
+// encoded profile of record_num records, only the latest size is cached to bound memory
+const std::string& GetProfileBytes(size_t record_num) {
+  static size_t cached_num = 0;
+  static std::string bytes;
+  if (cached_num != record_num) {
+    auto os = std::make_shared<std::stringstream>();
+    {
+      CPUProfileWriter writer{os, CPUProfileBinaryHeader{}};
+      for (const auto& stack : MakeStacks(record_num)) {
+        writer.AppendRecord(stack.sample_count, stack.ptrs.data(), stack.ptrs.size());
+      }
+      // binary trailer
+      writer.AppendSlot(0);
+      writer.AppendSlot(1);
+      writer.AppendSlot(0);
+      writer.AppendMapsText(kMapsText);
+    }
+    bytes = os->str();
+    cached_num = record_num;
+  }
+  return bytes;
+}
+
+void RecordArgs(benchmark::internal::Benchmark* b) {
+  b->Arg(1000)->Arg(100000)->Arg(10000000)->ArgName("records")->Unit(benchmark::kMillisecond);
+}
+
+}  // namespace
+
+static void BM_Parse(benchmark::State& state) {
+  auto record_num = static_cast<size_t>(state.range(0));
+  const auto& bytes = GetProfileBytes(record_num);
+  for (auto _ : state) {
+    CPUProfile profile{std::make_unique<std::istringstream>(bytes)};
+    if (profile.Parse() != ReaderRetCode::kOK) {
+      state.SkipWithError("parse failed");
+      return;
+    }
+    benchmark::DoNotOptimize(profile.GetCallStacks().data());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes.size()));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * record_num));
+}
+BENCHMARK(BM_Parse)->Apply(RecordArgs);
+
+static void BM_Symbolize(benchmark::State& state) {
+  auto record_num = static_cast<size_t>(state.range(0));
+  SyntheticLocator locator;
+  auto stacks = MakeStacks(record_num);
+  size_t addr_num = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    CPUProfile profile{CPUProfileBinaryHeader{}, stacks, kMapsText};
+    state.ResumeTiming();
+    addr_num = profile.GetInternedSymbols(&locator).addrs.size();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * record_num));
+  state.counters["addrs"] = static_cast<double>(addr_num);
+}
+BENCHMARK(BM_Symbolize)->Apply(RecordArgs);
+
+static void BM_GenerateRawProfile(benchmark::State& state) {
+  auto record_num = static_cast<size_t>(state.range(0));
+  SyntheticLocator locator;
+  CPUProfile profile{CPUProfileBinaryHeader{}, MakeStacks(record_num), kMapsText};
+  RawProfileMeta meta;
+  meta.program_path = "/path/to/binary";
+  size_t bytes = 0;
+  auto callback = [&bytes](const char*, size_t len) -> bool {
+    bytes += len;
+    return true;
+  };
+  // symbols are searched once & cached, iterations measure emission only
+  if (profile.GenerateRawProfile(meta, &locator, callback) != CPUProfileRetCode::kOK) {
+    state.SkipWithError("generate raw profile failed");
+    return;
+  }
+  for (auto _ : state) {
+    bytes = 0;
+    profile.GenerateRawProfile(meta, &locator, callback);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * record_num));
+}
+BENCHMARK(BM_GenerateRawProfile)->Apply(RecordArgs);
+
+static void BM_Filter(benchmark::State& state) {
+  auto record_num = static_cast<size_t>(state.range(0));
+  SyntheticLocator locator;
+  auto stacks = MakeStacks(record_num);
+  FilterOptions options;
+  options.focus = "Class1[0-9]::";
+  options.ignore = "Method[0-9]*7\\(";
+  size_t stack_num_after = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    CPUProfile profile{CPUProfileBinaryHeader{}, stacks, kMapsText};
+    profile.GetInternedSymbols(&locator);
+    state.ResumeTiming();
+    FilterStats stats;
+    if (profile.Filter(&locator, options, &stats) != CPUProfileRetCode::kOK) {
+      state.SkipWithError("filter failed");
+      return;
+    }
+    stack_num_after = stats.stack_num_after;
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * record_num));
+  state.counters["kept"] = static_cast<double>(stack_num_after);
+}
+BENCHMARK(BM_Filter)->Apply(RecordArgs);
+
+BENCHMARK_MAIN();
@@ -5,7 +5,15 @@
  */
 #include "profiling/cpu_profile.h"
 #include "profiling/symbol/profile_symbol.h"
+#include "profiling/util/utils.h"
 
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "fmt/format.h"
 #include "gtest/gtest.h"
 
 using namespace pprofcpp;
@@ -66,6 +74,41 @@ TEST(CPUProfile, Parse) {
   EXPECT_FALSE(profile.proc_maps_items_.empty());
 }
 
+TEST(CPUProfile, Follow) {
+  CPUProfile full{kCPUProfileSample};
+  ASSERT_EQ(full.Parse(), ReaderRetCode::kOK);
+  std::string content;
+  ASSERT_EQ(LoadFileContent(kCPUProfileSample, &content), 0);
+  const std::string file = "./cpu_profile_follow_test.prof";
+  std::ofstream ofs(file, std::ios_base::binary | std::ios_base::trunc);
+  CPUProfile profile{file};
+  BfdSymbolLocator locator;
+  locator.dyn_mappings_ = PackDynLibMappings();
+  size_t new_record_num{0}, total_record_num{0};
+  const size_t kPiece = content.size() / 3 + 1;
+  for (size_t pos = 0; pos < content.size(); pos += kPiece) {
+    ofs.write(content.data() + pos, std::min(kPiece, content.size() - pos));
+    ofs.flush();
+    ASSERT_EQ(profile.Follow(&new_record_num), ReaderRetCode::kOK);
+    total_record_num += new_record_num;
+    ASSERT_EQ(profile.record_num_, total_record_num);
+    // symbols cover records parsed so far
+    ASSERT_EQ(profile.GetInternedSymbols(&locator).addrs.empty(), profile.stacks_.empty());
+  }
+  ASSERT_TRUE(profile.IsFollowFinished());
+  EXPECT_EQ(profile.binary_header_, full.binary_header_);
+  EXPECT_EQ(profile.record_num_, full.record_num_);
+  EXPECT_EQ(profile.ptr_num_, full.ptr_num_);
+  EXPECT_EQ(profile.total_sample_cnt_, full.total_sample_cnt_);
+  EXPECT_EQ(profile.stacks_, full.stacks_);
+  EXPECT_EQ(profile.proc_maps_items_, full.proc_maps_items_);
+  EXPECT_EQ(profile.GetInternedSymbols(&locator).addrs, full.GetInternedSymbols(&locator).addrs);
+  // nothing new
+  ASSERT_EQ(profile.Follow(&new_record_num), ReaderRetCode::kOK);
+  ASSERT_EQ(new_record_num, 0);
+  remove(file.c_str());
+}
+
 TEST(CPUProfile, GenerateRawProfile) {
   CPUProfile profile{kCPUProfileSample};
   auto st = profile.Parse();
@@ -87,6 +130,529 @@ TEST(CPUProfile, GenerateRawProfile) {
   EXPECT_TRUE(profile_content.find("binary=./fustcpp\n") != std::string::npos);
 }
 
+TEST(CPUProfile, GenerateRawProfileStreaming) {
+  CPUProfile profile{kCPUProfileSample};
+  auto st = profile.Parse();
+  EXPECT_EQ(st, ReaderRetCode::kOK);
+  BfdSymbolLocator locator;
+  locator.dyn_mappings_ = PackDynLibMappings();
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  std::string expected;
+  EXPECT_EQ(profile.GenerateRawProfile(meta, &locator, &expected), CPUProfileRetCode::kOK);
+  {
+    std::ostringstream oss;
+    EXPECT_EQ(profile.GenerateRawProfile(meta, &locator, oss), CPUProfileRetCode::kOK);
+    EXPECT_EQ(oss.str(), expected);
+  }
+  {
+    constexpr size_t kChunkSize = 128;
+    std::string chunked;
+    size_t max_chunk{0};
+    auto ret = profile.GenerateRawProfile(
+        meta, &locator,
+        [&](const char* data, size_t len) -> bool {
+          chunked.append(data, len);
+          max_chunk = std::max(max_chunk, len);
+          return true;
+        },
+        kChunkSize);
+    EXPECT_EQ(ret, CPUProfileRetCode::kOK);
+    EXPECT_EQ(chunked, expected);
+    EXPECT_LE(max_chunk, kChunkSize);
+  }
+  {
+    FILE* fp = tmpfile();
+    ASSERT_NE(fp, nullptr);
+    EXPECT_EQ(profile.GenerateRawProfile(meta, &locator, fileno(fp)), CPUProfileRetCode::kOK);
+    std::string content(expected.size(), '\0');
+    rewind(fp);
+    EXPECT_EQ(fread(content.data(), 1, content.size(), fp), expected.size());
+    EXPECT_EQ(content, expected);
+    fclose(fp);
+  }
+  {
+    auto ret = profile.GenerateRawProfile(meta, &locator, [](const char*, size_t) -> bool { return false; });
+    EXPECT_EQ(ret, CPUProfileRetCode::kWriteOutputFailed);
+  }
+}
+
+TEST(CPUProfile, GetInternedSymbols) {
+  CPUProfile profile{kCPUProfileSample};
+  auto st = profile.Parse();
+  EXPECT_EQ(st, ReaderRetCode::kOK);
+  BfdSymbolLocator locator;
+  locator.dyn_mappings_ = PackDynLibMappings();
+  const auto& interned = profile.GetInternedSymbols(&locator);
+  ASSERT_NE(interned.table, nullptr);
+  EXPECT_FALSE(interned.addrs.empty());
+  EXPECT_EQ(interned.addrs.size(), interned.sym_ids.size());
+  EXPECT_TRUE(std::is_sorted(interned.addrs.cbegin(), interned.addrs.cend()));
+  EXPECT_LE(interned.table->Size(), interned.addrs.size() + 1);
+  const auto& mapping = profile.GetSymbolMapping(&locator);
+  EXPECT_EQ(mapping.size(), interned.addrs.size());
+}
+
+class AddrNameLocator : public SymbolLocator {
+ public:
+  LocatorStatus SearchSymbols(const std::vector<void*>& addrs,
+                              std::unordered_map<void*, SymbolInfo>* sym_mapping) override {
+    searched_num += addrs.size();
+    for (const auto& addr : addrs) {
+      sym_mapping->emplace(addr, SymbolInfo{addr, fmt::format("func_{}", addr)});
+    }
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  }
+  size_t searched_num{0};
+};
+
+TEST(CPUProfile, SymbolizeProgressively) {
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  AddrNameLocator locator;
+  ProgressiveSymbolOptions options;
+  options.coverage = 0.5;
+  options.batch_size = 4;
+  SymbolizeProgress progress;
+  ASSERT_EQ(profile.SymbolizeProgressively(&locator, options, &progress), CPUProfileRetCode::kOK);
+  ASSERT_GE(progress.coverage, 0.5);
+  ASSERT_FALSE(progress.finished);
+  ASSERT_LT(progress.resolved_addr_num, progress.total_addr_num);
+  ASSERT_EQ(locator.searched_num, progress.resolved_addr_num);
+  // resolved addrs are the heaviest ones
+  const auto& interned = profile.interned_symbols_;
+  size_t min_resolved = SIZE_MAX, max_unresolved = 0;
+  for (size_t i = 0; i < interned.addrs.size(); i++) {
+    if (interned.sym_ids[i] == SymbolTable::kUnknownSymbolId) {
+      max_unresolved = std::max(max_unresolved, profile.addr_weights_[i]);
+    } else {
+      min_resolved = std::min(min_resolved, profile.addr_weights_[i]);
+    }
+  }
+  ASSERT_GE(min_resolved, max_unresolved);
+  // unresolved addrs are emitted as raw addresses
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  std::string partial;
+  ASSERT_EQ(profile.GenerateRawProfile(meta, &locator, &partial), CPUProfileRetCode::kOK);
+  ASSERT_NE(partial.find("func_"), std::string::npos);
+  // continue without budget
+  ASSERT_EQ(profile.SymbolizeProgressively(&locator, ProgressiveSymbolOptions{}, &progress), CPUProfileRetCode::kOK);
+  ASSERT_TRUE(progress.finished);
+  ASSERT_EQ(progress.resolved_addr_num, progress.total_addr_num);
+  ASSERT_EQ(locator.searched_num, progress.total_addr_num);
+  std::string progressive;
+  ASSERT_EQ(profile.GenerateRawProfile(meta, &locator, &progressive), CPUProfileRetCode::kOK);
+  // same output as symbolizing all at once
+  CPUProfile full{kCPUProfileSample};
+  ASSERT_EQ(full.Parse(), ReaderRetCode::kOK);
+  std::string expected;
+  ASSERT_EQ(full.GenerateRawProfile(meta, &locator, &expected), CPUProfileRetCode::kOK);
+  ASSERT_EQ(progressive, expected);
+  ASSERT_NE(partial, expected);
+}
+
+TEST(CPUProfile, ProcessingStats) {
+  std::string content;
+  ASSERT_EQ(LoadFileContent(kCPUProfileSample, &content), 0);
+  ProcessingStats stats;
+  CPUProfile profile{kCPUProfileSample};
+  profile.SetStats(&stats);
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  EXPECT_EQ(stats.bytes_read, content.size());
+  EXPECT_EQ(stats.records, profile.GetRecordNum());
+  EXPECT_GE(stats.slots_decoded, profile.ptr_num_ + 2 * profile.record_num_);
+  EXPECT_EQ(stats.alloc_num, profile.GetRecordNum());
+  EXPECT_GE(stats.alloc_bytes, profile.ptr_num_ * sizeof(void*));
+  EXPECT_EQ(stats.GetPhase(StatsPhase::kBuildStacks).calls, 1);
+  EXPECT_GT(stats.GetPhase(StatsPhase::kRead).calls, 0);
+  EXPECT_EQ(stats.GetPhase(StatsPhase::kParseMaps).calls, 1);
+  AddrNameLocator locator;
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  std::string raw;
+  ASSERT_EQ(profile.GenerateRawProfile(meta, &locator, &raw), CPUProfileRetCode::kOK);
+  EXPECT_EQ(stats.GetPhase(StatsPhase::kEmit).calls, 1);
+  EXPECT_EQ(stats.GetPhase(StatsPhase::kLookup).calls, 1);
+  EXPECT_EQ(stats.active_phase, nullptr);
+  // nested phases are excluded from the enclosing one
+  ProcessingStats nested;
+  {
+    ScopedPhase outer(&nested, StatsPhase::kLookup);
+    ScopedPhase inner(&nested, StatsPhase::kLoadLibs);
+    ScopedPhase same(&nested, StatsPhase::kLoadLibs);
+    usleep(2000);
+  }
+  EXPECT_EQ(nested.GetPhase(StatsPhase::kLookup).calls, 1);
+  EXPECT_EQ(nested.GetPhase(StatsPhase::kLoadLibs).calls, 1);
+  EXPECT_GE(nested.GetPhase(StatsPhase::kLoadLibs).wall_ns, 2000000);
+  EXPECT_LT(nested.GetPhase(StatsPhase::kLookup).wall_ns, nested.GetPhase(StatsPhase::kLoadLibs).wall_ns);
+  auto json = stats.ToJson();
+  EXPECT_NE(json.find(fmt::format("\"records\":{}", stats.records)), std::string::npos);
+  EXPECT_NE(json.find("\"build_stacks\":{\"wall_ns\":"), std::string::npos);
+  EXPECT_NE(stats.ToText().find(fmt::format("bytes_read: {}\n", content.size())), std::string::npos);
+  stats.Reset();
+  EXPECT_EQ(stats.records, 0);
+  EXPECT_EQ(stats.GetPhase(StatsPhase::kEmit).calls, 0);
+  // disabled by default
+  CPUProfile plain{kCPUProfileSample};
+  ASSERT_EQ(plain.Parse(), ReaderRetCode::kOK);
+  EXPECT_EQ(plain.stacks_, profile.stacks_);
+}
+
+TEST(CPUProfile, MemoryUsage) {
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  auto parsed = profile.MemoryUsage();
+  EXPECT_GE(parsed.stacks, profile.ptr_num_ * sizeof(void*) + profile.stacks_.size() * sizeof(CallStack));
+  // nothing but empty containers before symbolization
+  EXPECT_LT(parsed.symbols, 64);
+  EXPECT_GE(parsed.maps_text, profile.maps_text_.size());
+  EXPECT_GE(parsed.maps_items, profile.proc_maps_items_.size() * sizeof(std::string));
+  AddrNameLocator locator;
+  profile.GetSymbolMapping(&locator);
+  auto symbolized = profile.MemoryUsage();
+  EXPECT_GT(symbolized.symbols, profile.interned_symbols_.addrs.size() * (sizeof(void*) + sizeof(uint32_t)));
+  EXPECT_EQ(symbolized.stacks, parsed.stacks);
+  EXPECT_EQ(symbolized.Total() - symbolized.symbols, parsed.Total() - parsed.symbols);
+}
+
+TEST(CPUProfile, EstimateMemory) {
+  MemoryEstimate estimate;
+  EXPECT_EQ(CPUProfile::EstimateMemory("file_not_exists", MemoryEstimateOptions{}, &estimate),
+            ReaderRetCode::kInvalidStream);
+  ASSERT_EQ(CPUProfile::EstimateMemory(kCPUProfileSample, MemoryEstimateOptions{}, &estimate), ReaderRetCode::kOK);
+  EXPECT_EQ(estimate.peak_bytes, std::max(estimate.parse_bytes, estimate.profile_bytes + estimate.symbolize_bytes +
+                                                                    estimate.output_bytes));
+  // worst case estimate covers what is actually held
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  AddrNameLocator locator;
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  std::string raw;
+  ASSERT_EQ(profile.GenerateRawProfile(meta, &locator, &raw), CPUProfileRetCode::kOK);
+  auto usage = profile.MemoryUsage();
+  EXPECT_GE(estimate.profile_bytes, usage.stacks);
+  EXPECT_GE(estimate.profile_bytes + estimate.symbolize_bytes, usage.stacks + usage.symbols);
+  EXPECT_GE(estimate.output_bytes, raw.capacity());
+  EXPECT_GE(estimate.peak_bytes, usage.Total() + raw.capacity());
+  // realistic shape and streaming output estimate less
+  MemoryEstimateOptions options;
+  options.mean_depth = 20;
+  options.distinct_addr_ratio = 0.1;
+  options.buffered_output = false;
+  auto streaming = CPUProfile::EstimateMemory(1 << 30, k64BitSize, options);
+  auto worst = CPUProfile::EstimateMemory(1 << 30, k64BitSize, MemoryEstimateOptions{});
+  EXPECT_LT(streaming.peak_bytes, worst.peak_bytes);
+  EXPECT_EQ(streaming.output_bytes, 2 * kDefaultChunkSize);
+  // 32-bit profile holds twice the slots of same size
+  EXPECT_GT(CPUProfile::EstimateMemory(1 << 30, k32BitSize, options).parse_bytes, streaming.parse_bytes);
+}
+
+TEST(CPUProfile, Reduce) {
+  CPUProfile full{kCPUProfileSample};
+  ASSERT_EQ(full.Parse(), ReaderRetCode::kOK);
+  {
+    // truncation only, samples are kept
+    CPUProfile profile{kCPUProfileSample};
+    ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+    ReduceOptions options;
+    options.max_depth = 2;
+    ReduceStats stats;
+    ASSERT_EQ(profile.Reduce(options, &stats), CPUProfileRetCode::kOK);
+    ASSERT_EQ(stats.stack_num_before, full.stacks_.size());
+    ASSERT_GT(stats.truncated_stack_num, 0);
+    ASSERT_LE(stats.stack_num_after, stats.stack_num_before);
+    ASSERT_EQ(profile.total_sample_cnt_, full.total_sample_cnt_);
+    ASSERT_EQ(profile.record_num_, stats.stack_num_after);
+    for (const auto& s : profile.stacks_) {
+      ASSERT_LE(s.ptrs.size(), 2);
+    }
+  }
+  {
+    // pruned samples go to [other]
+    CPUProfile profile{kCPUProfileSample};
+    ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+    ReduceOptions options;
+    options.min_weight_fraction = 0.05;
+    ReduceStats stats;
+    ASSERT_EQ(profile.Reduce(options, &stats), CPUProfileRetCode::kOK);
+    ASSERT_GT(stats.pruned_stack_num, 0);
+    ASSERT_GT(stats.other_sample_count, 0);
+    ASSERT_EQ(profile.total_sample_cnt_, full.total_sample_cnt_);
+    const auto& other = profile.stacks_.back();
+    ASSERT_EQ(other.ptrs, std::vector<void*>{reinterpret_cast<void*>(kOtherStackAddr)});
+    ASSERT_EQ(other.sample_count, stats.other_sample_count);
+    AddrNameLocator locator;
+    RawProfileMeta meta;
+    meta.program_path = "./fustcpp";
+    std::string raw;
+    ASSERT_EQ(profile.GenerateRawProfile(meta, &locator, &raw), CPUProfileRetCode::kOK);
+    ASSERT_NE(raw.find("0x0000000000000001 [other]\n"), std::string::npos);
+  }
+  {
+    // sampled stacks are scaled up to threshold
+    CPUProfile profile{kCPUProfileSample};
+    ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+    ReduceOptions options;
+    options.sample_threshold = 4;
+    options.seed = 7;
+    ReduceStats stats;
+    ASSERT_EQ(profile.Reduce(options, &stats), CPUProfileRetCode::kOK);
+    // duplicated stacks are merged as well
+    ASSERT_LE(stats.stack_num_after + stats.sampled_out_stack_num, stats.stack_num_before);
+    ASSERT_GT(stats.sampled_out_stack_num, 0);
+    for (const auto& s : profile.stacks_) {
+      ASSERT_GE(s.sample_count, 4);
+    }
+  }
+}
+
+TEST(CPUProfile, ReduceUnbiased) {
+  // 1000 stacks of count 1 over 4 leaf functions, sampled totals stay close to original totals
+  CPUProfileBinaryHeader header;
+  std::vector<CallStack> stacks;
+  for (uintptr_t i = 0; i < 1000; i++) {
+    stacks.push_back(CallStack{1, {reinterpret_cast<void*>(0x1000 + i % 4), reinterpret_cast<void*>(0x2000 + i)}});
+  }
+  CPUProfile profile{header, stacks, ""};
+  ReduceOptions options;
+  options.sample_threshold = 10;
+  options.seed = 1;
+  ReduceStats stats;
+  ASSERT_EQ(profile.Reduce(options, &stats), CPUProfileRetCode::kOK);
+  ASSERT_LT(stats.stack_num_after, 200);
+  std::unordered_map<void*, size_t> totals;
+  for (const auto& s : profile.stacks_) {
+    totals[s.ptrs[0]] += s.sample_count;
+  }
+  for (uintptr_t leaf = 0x1000; leaf < 0x1004; leaf++) {
+    EXPECT_NEAR(static_cast<double>(totals[reinterpret_cast<void*>(leaf)]), 250.0, 100.0);
+  }
+}
+
+// every 0x100 bytes is a function
+class AlignedFuncLocator : public SymbolLocator {
+ public:
+  LocatorStatus SearchSymbols(const std::vector<void*>& addrs,
+                              std::unordered_map<void*, SymbolInfo>* sym_mapping) override {
+    for (const auto& addr : addrs) {
+      auto start = reinterpret_cast<const void*>(reinterpret_cast<uintptr_t>(addr) & ~uintptr_t{0xff});
+      sym_mapping->emplace(addr, SymbolInfo{addr, fmt::format("func_{}", start), start});
+    }
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  }
+};
+
+TEST(CPUProfile, CollapseToFunctions) {
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  size_t total = profile.total_sample_cnt_;
+  AlignedFuncLocator locator;
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  std::string before;
+  ASSERT_EQ(profile.GenerateRawProfile(meta, &locator, &before), CPUProfileRetCode::kOK);
+  CollapseStats stats;
+  ASSERT_EQ(profile.CollapseToFunctions(&locator, &stats), CPUProfileRetCode::kOK);
+  ASSERT_LT(stats.addr_num_after, stats.addr_num_before);
+  ASSERT_LE(stats.stack_num_after, stats.stack_num_before);
+  ASSERT_EQ(profile.total_sample_cnt_, total);
+  ASSERT_EQ(profile.record_num_, stats.stack_num_after);
+  for (const auto& s : profile.stacks_) {
+    for (size_t i = 0; i < s.ptrs.size(); i++) {
+      auto addr = reinterpret_cast<uintptr_t>(s.ptrs[i]) - (i == 0 ? 0 : 1);
+      ASSERT_EQ(addr & 0xff, 0);
+    }
+  }
+  const auto& interned = profile.GetInternedSymbols(&locator);
+  ASSERT_EQ(interned.addrs.size(), stats.addr_num_after);
+  for (size_t i = 0; i < interned.addrs.size(); i++) {
+    ASSERT_EQ(interned.table->GetName(interned.sym_ids[i]), fmt::format("func_{}", interned.addrs[i]));
+  }
+  std::string after;
+  ASSERT_EQ(profile.GenerateRawProfile(meta, &locator, &after), CPUProfileRetCode::kOK);
+  ASSERT_LT(after.size(), before.size());
+}
+
+TEST(CPUProfile, Filter) {
+  AlignedFuncLocator locator;
+  auto parsed = [&locator]() {
+    auto profile = std::make_unique<CPUProfile>(kCPUProfileSample);
+    EXPECT_EQ(profile->Parse(), ReaderRetCode::kOK);
+    return profile;
+  };
+  auto base = parsed();
+  size_t total = base->total_sample_cnt_;
+  // function of symbol addr, see AlignedFuncLocator
+  auto func_of = [](const CallStack& s, size_t i) -> uintptr_t {
+    return (reinterpret_cast<uintptr_t>(s.ptrs[i]) - (i == 0 ? 0 : 1)) & ~uintptr_t{0xff};
+  };
+  auto has_func = [&func_of](const CallStack& s, uintptr_t func) {
+    for (size_t i = 0; i < s.ptrs.size(); i++) {
+      if (func_of(s, i) == func) {
+        return true;
+      }
+    }
+    return false;
+  };
+  constexpr uintptr_t kFunc = 0x7f6c3f3f1500;
+  size_t func_samples{0};
+  for (const auto& s : base->stacks_) {
+    func_samples += has_func(s, kFunc) ? s.sample_count : 0;
+  }
+  ASSERT_GT(func_samples, 0);
+  ASSERT_LT(func_samples, total);
+  FilterOptions focus;
+  focus.focus = "func_0x7f6c3f3f1500$";
+  auto focused = parsed();
+  FilterStats stats;
+  ASSERT_EQ(focused->Filter(&locator, focus, &stats), CPUProfileRetCode::kOK);
+  EXPECT_EQ(stats.sample_count_after, func_samples);
+  EXPECT_EQ(focused->total_sample_cnt_, func_samples);
+  EXPECT_EQ(stats.matched_symbol_num, 1);
+  EXPECT_EQ(stats.stack_num_after + stats.unfocused_stack_num, stats.stack_num_before);
+  for (const auto& s : focused->stacks_) {
+    EXPECT_TRUE(has_func(s, kFunc));
+  }
+  FilterOptions ignore;
+  ignore.ignore = focus.focus;
+  auto ignored = parsed();
+  ASSERT_EQ(ignored->Filter(&locator, ignore, &stats), CPUProfileRetCode::kOK);
+  EXPECT_EQ(stats.sample_count_after, total - func_samples);
+  EXPECT_EQ(stats.ignored_stack_num + stats.stack_num_after, stats.stack_num_before);
+  // prune: callees of the matched frame are dropped, samples are kept
+  FilterOptions prune;
+  constexpr uintptr_t kPruneFunc = 0x7f6c3f3f3f00;
+  prune.prune_from = "func_0x7f6c3f3f3f00$";
+  auto pruned = parsed();
+  ASSERT_EQ(pruned->Filter(&locator, prune, &stats), CPUProfileRetCode::kOK);
+  EXPECT_GT(stats.pruned_stack_num, 0);
+  EXPECT_EQ(stats.stack_num_after, stats.stack_num_before);
+  EXPECT_EQ(pruned->total_sample_cnt_, total);
+  for (size_t id = 0; id < pruned->stacks_.size(); id++) {
+    const auto& s = pruned->stacks_[id];
+    const auto& orig = base->stacks_[id];
+    if (has_func(orig, kPruneFunc)) {
+      EXPECT_EQ(func_of(s, 0), kPruneFunc);
+    } else {
+      EXPECT_EQ(s, orig);
+    }
+  }
+  // recursive match: like pprof, leaf-first [A,B,C,B,D] pruned from B is [B,C,B,D]
+  std::vector<CallStack> recursive_stacks{CallStack{
+      3, {reinterpret_cast<void*>(0x500010), reinterpret_cast<void*>(kPruneFunc + 0x11),
+          reinterpret_cast<void*>(0x400101), reinterpret_cast<void*>(kPruneFunc + 0x21),
+          reinterpret_cast<void*>(0x400201)}}};
+  CPUProfile recursive{CPUProfileBinaryHeader{}, std::move(recursive_stacks), ""};
+  ASSERT_EQ(recursive.Filter(&locator, prune, &stats), CPUProfileRetCode::kOK);
+  EXPECT_EQ(stats.pruned_stack_num, 1);
+  ASSERT_EQ(recursive.stacks_.size(), 1);
+  EXPECT_EQ(recursive.stacks_[0].ptrs,
+            (std::vector<void*>{reinterpret_cast<void*>(kPruneFunc + 0x10), reinterpret_cast<void*>(0x400101),
+                                reinterpret_cast<void*>(kPruneFunc + 0x21), reinterpret_cast<void*>(0x400201)}));
+  EXPECT_EQ(recursive.stacks_[0].sample_count, 3);
+  // raw output of pruned profile resolves every leaf without second lookup
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  std::string raw;
+  ASSERT_EQ(pruned->GenerateRawProfile(meta, &locator, &raw), CPUProfileRetCode::kOK);
+  // all filters in one pass equal filters applied one by one
+  FilterOptions all;
+  all.focus = "func_0x40";
+  all.ignore = "func_0x7f6c3f3f2900";
+  all.prune_from = prune.prune_from;
+  auto combined = parsed();
+  ASSERT_EQ(combined->Filter(&locator, all, &stats), CPUProfileRetCode::kOK);
+  auto sequential = parsed();
+  for (auto options : {FilterOptions{all.focus, "", ""}, FilterOptions{"", all.ignore, ""},
+                       FilterOptions{"", "", all.prune_from}}) {
+    ASSERT_EQ(sequential->Filter(&locator, options), CPUProfileRetCode::kOK);
+  }
+  EXPECT_EQ(combined->stacks_, sequential->stacks_);
+  // malformed regex leaves profile untouched
+  FilterOptions invalid;
+  invalid.focus = "func_(";
+  auto untouched = parsed();
+  EXPECT_EQ(untouched->Filter(&locator, invalid), CPUProfileRetCode::kInvalidFilter);
+  EXPECT_EQ(untouched->stacks_, base->stacks_);
+}
+
+TEST(CPUProfile, GenerateCompactProfile) {
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  AddrNameLocator locator;
+  std::ostringstream oss;
+  ASSERT_EQ(profile.GenerateCompactProfile(&locator, oss), CPUProfileRetCode::kOK);
+  std::string compact = oss.str();
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  std::string raw;
+  ASSERT_EQ(profile.GenerateRawProfile(meta, &locator, &raw), CPUProfileRetCode::kOK);
+  // raw profile carries no maps text, compact one does
+  EXPECT_LT(compact.size() * 5, raw.size() + profile.maps_text_.size());
+  std::istringstream iss{compact};
+  CompactProfileData data;
+  ASSERT_EQ(CompactProfileReader{iss}.Read(&data), CompactRetCode::kOK);
+  EXPECT_EQ(data.header, profile.binary_header_);
+  EXPECT_EQ(data.maps_text, profile.maps_text_);
+  std::vector<CallStack> stacks;
+  for (size_t i = 0; i < data.counts.size(); i++) {
+    CallStack stack;
+    stack.sample_count = data.counts[i];
+    for (size_t j = data.offsets[i]; j < data.offsets[i + 1]; j++) {
+      stack.ptrs.push_back(reinterpret_cast<void*>(data.pcs[j]));
+    }
+    stacks.emplace_back(std::move(stack));
+  }
+  EXPECT_EQ(stacks, profile.stacks_);
+  const auto& interned = profile.GetInternedSymbols(&locator);
+  ASSERT_EQ(data.addrs.size(), interned.addrs.size());
+  for (size_t i = 0; i < data.addrs.size(); i++) {
+    EXPECT_EQ(data.addrs[i], reinterpret_cast<uintptr_t>(interned.addrs[i]));
+    EXPECT_EQ(data.names[data.addr_names[i]], interned.table->GetName(interned.sym_ids[i]));
+  }
+  // decoded data rebuilds an equivalent profile
+  CPUProfile decoded{data.header, std::move(stacks), data.maps_text};
+  EXPECT_EQ(decoded.record_num_, profile.record_num_);
+  EXPECT_EQ(decoded.total_sample_cnt_, profile.total_sample_cnt_);
+  EXPECT_EQ(decoded.proc_maps_items_, profile.proc_maps_items_);
+}
+
+TEST(CPUProfile, FormatHexAddr) {
+  for (uintptr_t addr : {uintptr_t{0}, uintptr_t{1}, uintptr_t{0x4005d6}, uintptr_t{0x7fd4246d05b6}, UINTPTR_MAX}) {
+    char expected[20] = {0};
+    snprintf(expected, sizeof(expected), "%#018lx", addr);
+    char buf[kHexAddrLen] = {0};
+    EXPECT_EQ(FormatHexAddr(addr, buf), buf + kHexAddrLen);
+    EXPECT_EQ(std::string(buf, kHexAddrLen), expected);
+  }
+}
+
+TEST(CPUProfile, ToString) {
+  CPUProfile profile{kCPUProfileSample};
+  EXPECT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  std::string report = profile.ToString();
+  const std::string kStacksMarker{"---------------Stacks:\n"};
+  auto pos = report.find(kStacksMarker);
+  ASSERT_NE(pos, std::string::npos);
+  pos += kStacksMarker.length();
+  char buf[20] = {0};
+  for (const auto& s : profile.stacks_) {
+    std::string line;
+    for (const auto& ptr : s.ptrs) {
+      size_t n = snprintf(buf, sizeof(buf), "%#018lx ", reinterpret_cast<uintptr_t>(ptr));
+      line.append(buf, n);
+    }
+    line.append("\n");
+    EXPECT_EQ(report.compare(pos, line.size(), line), 0);
+    pos += line.size();
+  }
+  EXPECT_EQ(report.compare(pos, 18, "distinct ptr num: "), 0);
+  EXPECT_EQ(report.back(), '\n');
+}
+
 TEST(CPUProfile, ParseMapsText) {
   CPUProfile profile{kCPUProfileSample};
   std::string text{"build=/path/to/binary\n40000000-40015000 r-xp 00000000 03:01 12845071   /lib/ld-2.3.2.so\n"};
@@ -0,0 +1,140 @@
+/*
+ * FileName: heap_growth.cc
+ * Author: jattle
+ * Descrption:
+ */
+
+#include "profiling/heap_growth.h"
+
+#include <algorithm>
+
+namespace pprofcpp {
+
+HeapGrowthRetCode HeapGrowthTracker::AddSnapshot(const HeapProfile& profile, double timestamp) {
+  if (snapshot_num_ > 0 && timestamp <= last_timestamp_) {
+    return HeapGrowthRetCode::kInvalidTimestamp;
+  }
+  if (snapshot_num_ == 0) {
+    first_timestamp_ = timestamp;
+  }
+  double t = timestamp - first_timestamp_;
+  size_t seen_mark = snapshot_num_ + 1;
+  for (const auto& r : profile.GetRecords()) {
+    uint32_t id = stacks_.Intern(profile.GetStackPtrs(r), r.pc_num);
+    if (id >= series_.size()) {
+      series_.resize(id + 1);
+    }
+    auto& s = series_[id];
+    auto y = static_cast<double>(r.sample.inuse_bytes);
+    // same stack may be listed more than once in a snapshot, sum them up
+    s.last_inuse_bytes = (s.last_snapshot == seen_mark ? s.last_inuse_bytes : 0) + r.sample.inuse_bytes;
+    s.last_snapshot = seen_mark;
+    s.sum_y += y;
+    s.sum_ty += t * y;
+    if (snapshot_num_ == 0) {
+      s.first_inuse_bytes += r.sample.inuse_bytes;
+    }
+  }
+  sum_t_ += t;
+  sum_tt_ += t * t;
+  last_timestamp_ = timestamp;
+  snapshot_num_++;
+  return HeapGrowthRetCode::kOK;
+}
+
+HeapGrowthTracker::GrowthSums HeapGrowthTracker::GetStackSums(uint32_t stack_id) const {
+  const auto& s = series_[stack_id];
+  GrowthSums sums;
+  sums.sum_y = s.sum_y;
+  sums.sum_ty = s.sum_ty;
+  // absent from last snapshot means freed
+  sums.last_inuse_bytes = s.last_snapshot == snapshot_num_ ? s.last_inuse_bytes : 0;
+  sums.growth = static_cast<int64_t>(sums.last_inuse_bytes) - static_cast<int64_t>(s.first_inuse_bytes);
+  return sums;
+}
+
+HeapGrowth HeapGrowthTracker::ToGrowth(const GrowthSums& sums) const {
+  HeapGrowth growth;
+  growth.growth = sums.growth;
+  growth.last_inuse_bytes = sums.last_inuse_bytes;
+  auto n = static_cast<double>(snapshot_num_);
+  double denom = n * sum_tt_ - sum_t_ * sum_t_;
+  if (snapshot_num_ >= 2 && denom > 0) {
+    growth.slope = (n * sums.sum_ty - sum_t_ * sums.sum_y) / denom;
+  }
+  return growth;
+}
+
+std::vector<StackGrowth> HeapGrowthTracker::TopGrowingStacks(size_t n) const {
+  std::vector<StackGrowth> result;
+  result.reserve(series_.size());
+  for (uint32_t id = 0; id < series_.size(); id++) {
+    result.push_back(StackGrowth{id, ToGrowth(GetStackSums(id))});
+  }
+  n = std::min(n, result.size());
+  std::partial_sort(result.begin(), result.begin() + n, result.end(),
+                    [](const StackGrowth& l, const StackGrowth& r) { return l.growth.slope > r.growth.slope; });
+  result.resize(n);
+  return result;
+}
+
+HeapGrowthRetCode HeapGrowthTracker::TopGrowingFunctions(SymbolLocator* locator, size_t n, bool order_by_cum,
+                                                         std::vector<FunctionGrowth>* functions) {
+  if (snapshot_num_ == 0) {
+    return HeapGrowthRetCode::kNoSnapshot;
+  }
+  if (symbolizer_.Update(stacks_, locator) != LocatorRetCode::kOK) {
+    return HeapGrowthRetCode::kSearchSymbolFailed;
+  }
+  const SymbolTable* table = symbolizer_.GetSymbolTable();
+  if (table == nullptr) {
+    functions->clear();
+    return HeapGrowthRetCode::kOK;
+  }
+  size_t sym_num = table->Size();
+  std::vector<GrowthSums> flat(sym_num), cum(sym_num);
+  std::vector<uint32_t> last_stack(sym_num, StackTable::kNotFound);
+  auto add = [](GrowthSums* dst, const GrowthSums& src) {
+    dst->sum_y += src.sum_y;
+    dst->sum_ty += src.sum_ty;
+    dst->growth += src.growth;
+    dst->last_inuse_bytes += src.last_inuse_bytes;
+  };
+  for (uint32_t id = 0; id < series_.size(); id++) {
+    GrowthSums sums = GetStackSums(id);
+    const uint32_t* sym_ids = symbolizer_.GetSymIds(id);
+    size_t depth = symbolizer_.GetDepth(id);
+    if (depth == 0) {
+      continue;
+    }
+    add(&flat[sym_ids[0]], sums);
+    for (size_t i = 0; i < depth; i++) {
+      // recursive function is counted once per stack
+      uint32_t sym_id = sym_ids[i];
+      if (last_stack[sym_id] != id) {
+        last_stack[sym_id] = id;
+        add(&cum[sym_id], sums);
+      }
+    }
+  }
+  functions->clear();
+  for (uint32_t sym_id = 0; sym_id < sym_num; sym_id++) {
+    if (sym_id == SymbolTable::kUnknownSymbolId || last_stack[sym_id] == StackTable::kNotFound) {
+      continue;
+    }
+    functions->push_back(
+        FunctionGrowth{table->GetName(sym_id), ToGrowth(flat[sym_id]), ToGrowth(cum[sym_id])});
+  }
+  n = std::min(n, functions->size());
+  std::partial_sort(functions->begin(), functions->begin() + n, functions->end(),
+                    [order_by_cum](const FunctionGrowth& l, const FunctionGrowth& r) {
+                      double ls = order_by_cum ? l.cum.slope : l.flat.slope;
+                      double rs = order_by_cum ? r.cum.slope : r.flat.slope;
+                      // break ties by name to keep output stable
+                      return ls != rs ? ls > rs : l.name < r.name;
+                    });
+  functions->resize(n);
+  return HeapGrowthRetCode::kOK;
+}
+
+}  // namespace pprofcpp
@@ -0,0 +1,93 @@
+/*
+ * FileName: heap_growth.h
+ * Author: jattle
+ * Descrption: track in-use bytes growth across a sequence of gperftools heap profile snapshots
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "profiling/heap_profile.h"
+#include "profiling/stack_symbolizer.h"
+#include "profiling/stack_table.h"
+#include "profiling/symbol/profile_symbol.h"
+
+namespace pprofcpp {
+
+enum class HeapGrowthRetCode {
+  kOK = 0,
+  kInvalidTimestamp = 1,  // timestamp is not increasing
+  kNoSnapshot = 2,
+  kSearchSymbolFailed = 3,
+};
+
+/// @brief in-use bytes growth of a stack or function over all ingested snapshots
+struct HeapGrowth {
+  double slope{0};          // least squares slope of in-use bytes, bytes per second
+  int64_t growth{0};        // in-use bytes of last snapshot - in-use bytes of first snapshot
+  size_t last_inuse_bytes{0};
+};
+
+struct StackGrowth {
+  uint32_t stack_id{0};  // id of HeapGrowthTracker::GetStackTable()
+  HeapGrowth growth;
+};
+
+struct FunctionGrowth {
+  std::string_view name;  // refers to tracker's symbol table
+  HeapGrowth flat;        // stacks whose leaf is this function
+  HeapGrowth cum;         // stacks containing this function
+};
+
+/// @brief ingest heap profile snapshots in time order and report per-stack & per-function in-use growth
+// stacks are interned across snapshots, every stack keeps only running regression sums,
+// so memory is proportional to distinct stacks rather than snapshot num
+// a stack absent from a snapshot is regarded as 0 in-use bytes at that time
+// not thread-safe
+class HeapGrowthTracker {
+ public:
+  HeapGrowthTracker() = default;
+  ~HeapGrowthTracker() = default;
+  // @brief ingest snapshot taken at timestamp(in seconds), timestamps must be strictly increasing
+  HeapGrowthRetCode AddSnapshot(const HeapProfile& profile, double timestamp);
+  // @brief top n stacks ordered by slope descending
+  std::vector<StackGrowth> TopGrowingStacks(size_t n) const;
+  // @brief top n functions ordered by cum(or flat) slope descending, symbols are searched for new stacks only
+  HeapGrowthRetCode TopGrowingFunctions(SymbolLocator* locator, size_t n, bool order_by_cum,
+                                        std::vector<FunctionGrowth>* functions);
+  const StackTable& GetStackTable() const { return stacks_; }
+  size_t GetSnapshotNum() const { return snapshot_num_; }
+
+ private:
+  // running sums of single stack, t is relative to the first snapshot
+  struct StackSeries {
+    double sum_y{0};
+    double sum_ty{0};
+    size_t first_inuse_bytes{0};  // in-use bytes in first snapshot
+    size_t last_inuse_bytes{0};
+    size_t last_snapshot{0};      // 1-based index of snapshot it was last seen in, 0 means never
+  };
+  // accumulated linear sums, slope is linear in them so that function sums are sum of stack sums
+  struct GrowthSums {
+    double sum_y{0};
+    double sum_ty{0};
+    int64_t growth{0};
+    size_t last_inuse_bytes{0};
+  };
+  GrowthSums GetStackSums(uint32_t stack_id) const;
+  HeapGrowth ToGrowth(const GrowthSums& sums) const;
+
+  StackTable stacks_;
+  std::vector<StackSeries> series_;  // parallel to stack id
+  size_t snapshot_num_{0};
+  double first_timestamp_{0};
+  double last_timestamp_{0};
+  double sum_t_{0};
+  double sum_tt_{0};
+  StackSymbolizer symbolizer_;
+};
+
+}  // namespace pprofcpp
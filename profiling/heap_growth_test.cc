@@ -0,0 +1,71 @@
+/*
+ * FileName: heap_growth_test.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/heap_growth.h"
+
+#include "fmt/format.h"
+#include "gtest/gtest.h"
+
+#include "profiling/symbol/fake_locator.h"
+
+using namespace pprofcpp;
+
+static std::string GrowthName(uintptr_t pc) { return pc < 0x2000 ? "leaker" : (pc < 0x3000 ? "stable" : "main"); }
+
+// leaker stack grows 1024 bytes per snapshot, stable stack keeps 4096 bytes
+static HeapProfile MakeSnapshot(size_t index) {
+  std::string text = fmt::format("heap profile: 2: {} [2: {}] @ heapprofile\n", 4096 + 1024 * index,
+                                 4096 + 1024 * index);
+  text += fmt::format("1: {} [1: {}] @ 0x1000 0x3001\n", 1024 * index, 1024 * index);
+  text += "1: 4096 [1: 4096] @ 0x2000 0x3001\n";
+  HeapProfile profile;
+  EXPECT_EQ(profile.ParseText(text), HeapProfileRetCode::kOK);
+  return profile;
+}
+
+TEST(HeapGrowthTracker, TopGrowingStacks) {
+  HeapGrowthTracker tracker;
+  for (size_t i = 0; i < 5; i++) {
+    EXPECT_EQ(tracker.AddSnapshot(MakeSnapshot(i), 10.0 * i), HeapGrowthRetCode::kOK);
+  }
+  EXPECT_EQ(tracker.AddSnapshot(MakeSnapshot(5), 10.0), HeapGrowthRetCode::kInvalidTimestamp);
+  EXPECT_EQ(tracker.GetSnapshotNum(), 5u);
+  EXPECT_EQ(tracker.GetStackTable().Size(), 2u);
+  auto top = tracker.TopGrowingStacks(1);
+  ASSERT_EQ(top.size(), 1u);
+  EXPECT_EQ(tracker.GetStackTable().GetPtrs(top[0].stack_id)[0], reinterpret_cast<const void*>(0x1000));
+  EXPECT_DOUBLE_EQ(top[0].growth.slope, 102.4);
+  EXPECT_EQ(top[0].growth.growth, 4096);
+  EXPECT_EQ(top[0].growth.last_inuse_bytes, 4096u);
+  auto all = tracker.TopGrowingStacks(10);
+  ASSERT_EQ(all.size(), 2u);
+  EXPECT_NEAR(all[1].growth.slope, 0, 1e-9);
+  EXPECT_EQ(all[1].growth.growth, 0);
+}
+
+TEST(HeapGrowthTracker, TopGrowingFunctions) {
+  HeapGrowthTracker tracker;
+  FakeLocator locator{GrowthName};
+  std::vector<FunctionGrowth> functions;
+  EXPECT_EQ(tracker.TopGrowingFunctions(&locator, 10, true, &functions), HeapGrowthRetCode::kNoSnapshot);
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_EQ(tracker.AddSnapshot(MakeSnapshot(i), 10.0 * i), HeapGrowthRetCode::kOK);
+  }
+  EXPECT_EQ(tracker.TopGrowingFunctions(&locator, 10, false, &functions), HeapGrowthRetCode::kOK);
+  ASSERT_EQ(functions.size(), 3u);
+  EXPECT_EQ(functions[0].name, "leaker");
+  EXPECT_DOUBLE_EQ(functions[0].flat.slope, 102.4);
+  size_t search_num = locator.GetSearchedNum();
+  // no new stacks, no new search
+  EXPECT_EQ(tracker.TopGrowingFunctions(&locator, 10, true, &functions), HeapGrowthRetCode::kOK);
+  EXPECT_EQ(locator.GetSearchedNum(), search_num);
+  ASSERT_EQ(functions.size(), 3u);
+  // main is on both stacks, ties with leaker on cum slope
+  EXPECT_EQ(functions[0].name, "leaker");
+  EXPECT_EQ(functions[1].name, "main");
+  EXPECT_DOUBLE_EQ(functions[1].cum.slope, 102.4);
+  EXPECT_EQ(functions[1].cum.last_inuse_bytes, 4096u + 2048u);
+  EXPECT_EQ(functions[1].flat.last_inuse_bytes, 0u);
+}
@@ -0,0 +1,249 @@
+/*
+ * FileName: heap_profile.cc
+ * Author: jattle
+ * Descrption:
+ */
+
+#include "profiling/heap_profile.h"
+
+#include <algorithm>
+#include <charconv>
+
+#include "fmt/format.h"
+
+#include "profiling/io/profile_io.h"
+#include "profiling/util/utils.h"
+
+namespace pprofcpp {
+
+namespace {
+
+constexpr std::string_view kHeaderPrefix{"heap profile:"};
+constexpr std::string_view kMappedLibsMarker{"MAPPED_LIBRARIES:"};
+constexpr std::string_view kHeapV2Prefix{"heap_v2/"};
+
+void SkipSpaces(std::string_view* sv) {
+  size_t n = 0;
+  while (n < sv->size() && ((*sv)[n] == ' ' || (*sv)[n] == '\t')) {
+    n++;
+  }
+  sv->remove_prefix(n);
+}
+
+bool ConsumeChar(std::string_view* sv, char c) {
+  SkipSpaces(sv);
+  if (sv->empty() || sv->front() != c) {
+    return false;
+  }
+  sv->remove_prefix(1);
+  return true;
+}
+
+template <typename T>
+bool ConsumeNumber(std::string_view* sv, T* val, int base = 10) {
+  SkipSpaces(sv);
+  auto [ptr, ec] = std::from_chars(sv->data(), sv->data() + sv->size(), *val, base);
+  if (ec != std::errc()) {
+    return false;
+  }
+  sv->remove_prefix(ptr - sv->data());
+  return true;
+}
+
+/// @brief consume "n: m [n: m] @"
+bool ConsumeSample(std::string_view* sv, HeapSample* sample) {
+  return ConsumeNumber(sv, &sample->inuse_objects) && ConsumeChar(sv, ':') &&
+         ConsumeNumber(sv, &sample->inuse_bytes) && ConsumeChar(sv, '[') &&
+         ConsumeNumber(sv, &sample->alloc_objects) && ConsumeChar(sv, ':') &&
+         ConsumeNumber(sv, &sample->alloc_bytes) && ConsumeChar(sv, ']') && ConsumeChar(sv, '@');
+}
+
+void FormatSample(const HeapSample& sample, fmt::memory_buffer* buf) {
+  fmt::format_to(std::back_inserter(*buf), "{:6}: {:8} [{:6}: {:8}] @", sample.inuse_objects, sample.inuse_bytes,
+                 sample.alloc_objects, sample.alloc_bytes);
+}
+
+}  // namespace
+
+HeapProfileRetCode HeapProfile::Parse() {
+  MappedFile file;
+  if (file.Open(this->profile_file_) != 0) {
+    return HeapProfileRetCode::kOpenFileFailed;
+  }
+  return ParseText(file.View());
+}
+
+HeapProfileRetCode HeapProfile::ParseText(std::string_view text) {
+  this->header_ = HeapProfileHeader{};
+  this->records_.clear();
+  this->pcs_.clear();
+  this->maps_text_.clear();
+  this->lib_mappings_ = DynamicLibMappings{};
+  this->interned_symbols_ = InternedSymbols{};
+  bool header_parsed{false};
+  for (size_t pos = 0; pos < text.size();) {
+    size_t end = text.find('\n', pos);
+    if (end == std::string_view::npos) {
+      end = text.size();
+    }
+    std::string_view line = text.substr(pos, end - pos);
+    pos = end + 1;
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    if (!header_parsed) {
+      if (auto ret = ParseHeader(line); ret != HeapProfileRetCode::kOK) {
+        return ret;
+      }
+      header_parsed = true;
+      continue;
+    }
+    if (line.compare(0, kMappedLibsMarker.size(), kMappedLibsMarker) == 0) {
+      // rest of file is proc maps content
+      if (pos < text.size()) {
+        this->maps_text_.assign(text.substr(pos));
+        this->lib_mappings_.ParseProcMaps(this->maps_text_);
+      }
+      break;
+    }
+    SkipSpaces(&line);
+    if (line.empty()) {
+      continue;
+    }
+    if (auto ret = ParseRecord(line); ret != HeapProfileRetCode::kOK) {
+      return ret;
+    }
+  }
+  return header_parsed ? HeapProfileRetCode::kOK : HeapProfileRetCode::kInvalidHeader;
+}
+
+HeapProfileRetCode HeapProfile::ParseHeader(std::string_view line) {
+  // heap profile:   14:   123456 [    30:   654321] @ heapprofile
+  // heap profile:    1:   262144 [     1:   262144] @ heap_v2/524288
+  if (line.compare(0, kHeaderPrefix.size(), kHeaderPrefix) != 0) {
+    return HeapProfileRetCode::kInvalidHeader;
+  }
+  line.remove_prefix(kHeaderPrefix.size());
+  if (!ConsumeSample(&line, &this->header_.total)) {
+    return HeapProfileRetCode::kInvalidHeader;
+  }
+  SkipSpaces(&line);
+  this->header_.profile_type.assign(Trim(line));
+  std::string_view type{this->header_.profile_type};
+  if (type.compare(0, kHeapV2Prefix.size(), kHeapV2Prefix) == 0) {
+    type.remove_prefix(kHeapV2Prefix.size());
+    if (!ConsumeNumber(&type, &this->header_.sampling_period)) {
+      return HeapProfileRetCode::kInvalidHeader;
+    }
+  }
+  return HeapProfileRetCode::kOK;
+}
+
+HeapProfileRetCode HeapProfile::ParseRecord(std::string_view line) {
+  // 1:     1024 [     2:     2048] @ 0x4005d6 0x4006a8
+  HeapRecord record;
+  if (!ConsumeSample(&line, &record.sample)) {
+    return HeapProfileRetCode::kInvalidRecord;
+  }
+  record.pc_offset = this->pcs_.size();
+  for (SkipSpaces(&line); !line.empty(); SkipSpaces(&line)) {
+    if (line.size() > 2 && line[0] == '0' && (line[1] == 'x' || line[1] == 'X')) {
+      line.remove_prefix(2);
+    }
+    uintptr_t pc{0};
+    if (!ConsumeNumber(&line, &pc, 16)) {
+      this->pcs_.resize(record.pc_offset);
+      return HeapProfileRetCode::kInvalidRecord;
+    }
+    this->pcs_.push_back(reinterpret_cast<void*>(pc));
+  }
+  record.pc_num = this->pcs_.size() - record.pc_offset;
+  if (record.pc_num == 0) {
+    return HeapProfileRetCode::kInvalidRecord;
+  }
+  this->records_.push_back(record);
+  return HeapProfileRetCode::kOK;
+}
+
+HeapProfileRetCode HeapProfile::GenerateSymbolMapping(SymbolLocator* locator) {
+  if (this->records_.empty()) {
+    return HeapProfileRetCode::kEmptyStack;
+  }
+  std::vector<void*> addrs;
+  addrs.reserve(this->pcs_.size());
+  for (const auto& r : this->records_) {
+    const void* const* ptrs = GetStackPtrs(r);
+    addrs.push_back(const_cast<void*>(ptrs[0]));
+    for (size_t i = 1; i < r.pc_num; i++) {
+      // subtract by 1 to get call ptr, same as pprof
+      addrs.push_back(reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(ptrs[i]) - 1));
+    }
+  }
+  std::sort(addrs.begin(), addrs.end());
+  addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+  InternedSymbols interned;
+  interned.addrs = std::move(addrs);
+  if (auto ret = locator->SearchSymbolIds(&interned); ret.ret != LocatorRetCode::kOK) {
+    return HeapProfileRetCode::kSearchSymbolFailed;
+  }
+  this->interned_symbols_ = std::move(interned);
+  return HeapProfileRetCode::kOK;
+}
+
+void HeapProfile::WriteHeapText(std::ostream& os) const {
+  fmt::memory_buffer buf;
+  buf.append(kHeaderPrefix);
+  buf.push_back(' ');
+  FormatSample(this->header_.total, &buf);
+  buf.push_back(' ');
+  buf.append(std::string_view{this->header_.profile_type});
+  buf.push_back('\n');
+  for (const auto& r : this->records_) {
+    FormatSample(r.sample, &buf);
+    const void* const* ptrs = GetStackPtrs(r);
+    char addr[kHexAddrLen];
+    for (size_t i = 0; i < r.pc_num; i++) {
+      buf.push_back(' ');
+      buf.append(addr, FormatHexAddr(reinterpret_cast<uintptr_t>(ptrs[i]), addr));
+    }
+    buf.push_back('\n');
+    if (buf.size() >= kDefaultChunkSize) {
+      os.write(buf.data(), buf.size());
+      buf.clear();
+    }
+  }
+  os.write(buf.data(), buf.size());
+  os << "\n" << kMappedLibsMarker << "\n" << this->maps_text_;
+}
+
+HeapProfileRetCode HeapProfile::GenerateRawProfile(const std::string& program_path, SymbolLocator* locator,
+                                                   std::ostream& os) {
+  if (program_path.empty()) {
+    return HeapProfileRetCode::kNoProgramPath;
+  }
+  if (!records_.empty() && interned_symbols_.table == nullptr) {
+    if (auto ret = GenerateSymbolMapping(locator); ret != HeapProfileRetCode::kOK) {
+      return ret;
+    }
+  }
+  os << "--- symbol\n";
+  os << "binary=" << program_path << "\n";
+  WriteRawSymbols(this->interned_symbols_, os);
+  os << "---\n";
+  os << "--- heap\n";
+  WriteHeapText(os);
+  os.flush();
+  return os.good() ? HeapProfileRetCode::kOK : HeapProfileRetCode::kWriteOutputFailed;
+}
+
+HeapProfileRetCode HeapProfile::GenerateRawProfile(const std::string& program_path, SymbolLocator* locator,
+                                                   std::string* profile) {
+  ChunkStreamBuf buf{[profile](const char* data, size_t len) -> bool {
+    profile->append(data, len);
+    return true;
+  }};
+  std::ostream os{&buf};
+  return GenerateRawProfile(program_path, locator, os);
+}
+
+}  // namespace pprofcpp
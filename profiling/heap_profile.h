@@ -0,0 +1,102 @@
+/*
+ * FileName: heap_profile.h
+ * Author: jattle
+ * Descrption: parse gperftools heap profile(text format) and convert it to symbolized raw profile
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "profiling/symbol/profile_symbol.h"
+
+namespace pprofcpp {
+
+enum class HeapProfileRetCode {
+  kOK = 0,
+  kOpenFileFailed = 1,
+  kInvalidHeader = 2,
+  kInvalidRecord = 3,
+  kNoProgramPath = 4,
+  kEmptyStack = 5,
+  kSearchSymbolFailed = 6,
+  kWriteOutputFailed = 7,
+};
+
+/// @brief in-use & allocated counters of a heap profile line
+struct HeapSample {
+  size_t inuse_objects{0};
+  size_t inuse_bytes{0};
+  size_t alloc_objects{0};
+  size_t alloc_bytes{0};
+};
+
+/// @brief heap profile header line: heap profile: <sample> @ heapprofile or heap_v2/<sampling_period>
+struct HeapProfileHeader {
+  HeapSample total;
+  std::string profile_type;  // heapprofile, heap_v2 etc.
+  size_t sampling_period{0};  // only present for heap_v2
+};
+
+/// @brief single stack record, pcs are stored in HeapProfile's flat pc array
+struct HeapRecord {
+  HeapSample sample;
+  size_t pc_offset{0};
+  size_t pc_num{0};
+};
+
+/// @brief gperftools heap profile
+// text format: header line, one line per stack(n: m [n: m] @ addrs...), followed by MAPPED_LIBRARIES section
+// not thread-safe
+class HeapProfile {
+ public:
+  explicit HeapProfile(const std::string& filename) : profile_file_(filename) {}
+  HeapProfile() = default;
+  ~HeapProfile() = default;
+  // @brief mmap & parse whole profile file
+  HeapProfileRetCode Parse();
+  // @brief parse profile text in memory, text is only scanned, nothing refers to it after return
+  HeapProfileRetCode ParseText(std::string_view text);
+  // @brief return distinct addrs(sorted, caller addrs subtracted by 1) and their interned symbol ids
+  const InternedSymbols& GetInternedSymbols(SymbolLocator* locator) {
+    if (!records_.empty() && interned_symbols_.table == nullptr) {
+      GenerateSymbolMapping(locator);
+    }
+    return interned_symbols_;
+  }
+  // @brief stream raw profile(similar to output of pprof --raw for heap profile) into os
+  HeapProfileRetCode GenerateRawProfile(const std::string& program_path, SymbolLocator* locator, std::ostream& os);
+  // @brief generate raw profile, appended to profile
+  HeapProfileRetCode GenerateRawProfile(const std::string& program_path, SymbolLocator* locator,
+                                        std::string* profile);
+  const HeapProfileHeader& GetHeader() const { return header_; }
+  const std::vector<HeapRecord>& GetRecords() const { return records_; }
+  // @brief return pcs of record, leaf first
+  const void* const* GetStackPtrs(const HeapRecord& record) const { return pcs_.data() + record.pc_offset; }
+  size_t GetRecordNum() const { return records_.size(); }
+  // @brief get MAPPED_LIBRARIES content
+  const std::string& GetMapsText() const { return maps_text_; }
+  // @brief shared libs of MAPPED_LIBRARIES parsed by DynamicLibMappings, the same view BfdSymbolLocator builds from
+  // maps text, so addrs can be matched to libs(and their load bases) without a locator
+  const DynamicLibMappings& GetLibMappings() const { return lib_mappings_; }
+
+ private:
+  HeapProfileRetCode ParseHeader(std::string_view line);
+  HeapProfileRetCode ParseRecord(std::string_view line);
+  HeapProfileRetCode GenerateSymbolMapping(SymbolLocator* locator);
+  void WriteHeapText(std::ostream& os) const;
+
+  std::string profile_file_;
+  HeapProfileHeader header_;
+  std::vector<HeapRecord> records_;
+  std::vector<void*> pcs_;  // pcs of all records, flattened
+  std::string maps_text_;
+  DynamicLibMappings lib_mappings_;
+  InternedSymbols interned_symbols_;
+};
+
+}  // namespace pprofcpp
@@ -0,0 +1,67 @@
+/*
+ * FileName: heap_profile_benchmark.cc
+ * Author: jattle
+ * Descrption: HeapProfile text parse at 1k/100k/1M records, next to CPUProfile parse benchmarks
+ */
+#include <iterator>
+#include <random>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "fmt/format.h"
+
+#include "profiling/heap_profile.h"
+
+using namespace pprofcpp;
+
+namespace {
+
+constexpr size_t kDepth = 8;
+constexpr uintptr_t kTextBase = 0x400000;
+constexpr size_t kTextSize = 16 * 1024 * 1024;
+constexpr char kMapsText[] =
+    "00400000-01400000 r-xp 00000000 08:01 1234   /path/to/binary\n"
+    "7f0000000000-7f0000200000 r-xp 00000000 08:01 5678   /usr/lib64/libc.so.6\n";
+
+// heap profile text of record_num records, only the latest size is cached to bound memory
+const std::string& GetProfileText(size_t record_num) {
+  static size_t cached_num = 0;
+  static std::string text;
+  if (cached_num != record_num) {
+    std::mt19937_64 rng{record_num};
+    fmt::memory_buffer buf;
+    fmt::format_to(std::back_inserter(buf), "heap profile: {:6}: {:8} [{:6}: {:8}] @ heap_v2/524288\n", record_num,
+                   record_num * 64, record_num * 2, record_num * 128);
+    for (size_t i = 0; i < record_num; i++) {
+      fmt::format_to(std::back_inserter(buf), "{:6}: {:8} [{:6}: {:8}] @", 1, 64, 2, 128);
+      for (size_t d = 0; d < kDepth; d++) {
+        fmt::format_to(std::back_inserter(buf), " {:#018x}", kTextBase + rng() % kTextSize);
+      }
+      buf.push_back('\n');
+    }
+    fmt::format_to(std::back_inserter(buf), "\nMAPPED_LIBRARIES:\n{}", kMapsText);
+    text.assign(buf.data(), buf.size());
+    cached_num = record_num;
+  }
+  return text;
+}
+
+}  // namespace
+
+static void BM_HeapParse(benchmark::State& state) {
+  auto record_num = static_cast<size_t>(state.range(0));
+  const auto& text = GetProfileText(record_num);
+  for (auto _ : state) {
+    HeapProfile profile;
+    if (profile.ParseText(text) != HeapProfileRetCode::kOK) {
+      state.SkipWithError("parse failed");
+      return;
+    }
+    benchmark::DoNotOptimize(profile.GetRecords().data());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * text.size()));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * record_num));
+}
+BENCHMARK(BM_HeapParse)->Arg(1000)->Arg(100000)->Arg(1000000)->ArgName("records")->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,130 @@
+/*
+ * FileName: heap_profile_test.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/heap_profile.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+using namespace pprofcpp;
+
+static constexpr char kHeapProfileText[] =
+    "heap profile:    3:     4096 [    10:    65536] @ heap_v2/524288\n"
+    "     1:     1024 [     2:     2048] @ 0x00000000004005d6 0x00000000004006a8 0x0000000000400700\n"
+    "     2:     3072 [     8:    63488] @ 0x4005d6 0x400800\n"
+    "\n"
+    "MAPPED_LIBRARIES:\n"
+    "00400000-00401000 r-xp 00000000 08:01 123   /usr/bin/test\n";
+
+class FakeHeapLocator : public SymbolLocator {
+ public:
+  LocatorStatus SearchSymbols(const std::vector<void*>& addrs,
+                              std::unordered_map<void*, SymbolInfo>* sym_mapping) override {
+    for (const auto& addr : addrs) {
+      sym_mapping->emplace(addr, SymbolInfo{addr, reinterpret_cast<uintptr_t>(addr) < 0x400700 ? "alloc" : "main"});
+    }
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  }
+};
+
+TEST(HeapProfile, ParseText) {
+  HeapProfile profile;
+  EXPECT_EQ(profile.ParseText(kHeapProfileText), HeapProfileRetCode::kOK);
+  const auto& header = profile.GetHeader();
+  EXPECT_EQ(header.total.inuse_objects, 3u);
+  EXPECT_EQ(header.total.inuse_bytes, 4096u);
+  EXPECT_EQ(header.total.alloc_objects, 10u);
+  EXPECT_EQ(header.total.alloc_bytes, 65536u);
+  EXPECT_EQ(header.profile_type, "heap_v2/524288");
+  EXPECT_EQ(header.sampling_period, 524288u);
+  ASSERT_EQ(profile.GetRecordNum(), 2u);
+  const auto& r0 = profile.GetRecords().at(0);
+  EXPECT_EQ(r0.sample.inuse_bytes, 1024u);
+  EXPECT_EQ(r0.sample.alloc_objects, 2u);
+  ASSERT_EQ(r0.pc_num, 3u);
+  EXPECT_EQ(profile.GetStackPtrs(r0)[0], reinterpret_cast<void*>(0x4005d6));
+  EXPECT_EQ(profile.GetStackPtrs(r0)[2], reinterpret_cast<void*>(0x400700));
+  const auto& r1 = profile.GetRecords().at(1);
+  EXPECT_EQ(r1.pc_num, 2u);
+  EXPECT_EQ(profile.GetStackPtrs(r1)[1], reinterpret_cast<void*>(0x400800));
+  EXPECT_EQ(profile.GetMapsText(), "00400000-00401000 r-xp 00000000 08:01 123   /usr/bin/test\n");
+}
+
+TEST(HeapProfile, LibMappings) {
+  HeapProfile profile;
+  ASSERT_EQ(profile.ParseText("heap profile: 1: 2 [3: 4] @ heapprofile\n"
+                              "1: 2 [3: 4] @ 0x7f0000001100\n"
+                              "MAPPED_LIBRARIES:\n"
+                              "00400000-00401000 r-xp 00000000 08:01 123   /usr/bin/test\n"
+                              "7f0000000000-7f0000002000 r-xp 00000000 08:01 456   /usr/lib64/libfoo.so\n"
+                              "7f0000002000-7f0000003000 r--p 00002000 08:01 456   /usr/lib64/libfoo.so\n"),
+            HeapProfileRetCode::kOK);
+  const auto& libs = profile.GetLibMappings().GetLibMappings();
+  ASSERT_EQ(libs.size(), 1u);
+  EXPECT_EQ(libs[0].path, "/usr/lib64/libfoo.so");
+  EXPECT_EQ(libs[0].base, 0x7f0000000000u);
+  EXPECT_EQ(libs[0].upper_bound, 0x7f0000003000u);
+  EXPECT_EQ(libs[0].items.size(), 2u);
+  ProcLibMapping lib;
+  EXPECT_TRUE(profile.GetLibMappings().FindMatchedLib(profile.GetStackPtrs(profile.GetRecords()[0])[0], &lib));
+  EXPECT_EQ(lib.path, "/usr/lib64/libfoo.so");
+  // reparse without maps resets mappings
+  ASSERT_EQ(profile.ParseText("heap profile: 1: 2 [3: 4] @ heapprofile\n1: 2 [3: 4] @ 0x1\n"),
+            HeapProfileRetCode::kOK);
+  EXPECT_TRUE(profile.GetLibMappings().GetLibMappings().empty());
+}
+
+TEST(HeapProfile, InvalidText) {
+  HeapProfile profile;
+  EXPECT_EQ(profile.ParseText(""), HeapProfileRetCode::kInvalidHeader);
+  EXPECT_EQ(profile.ParseText("heap profile: 1: 2 @ heapprofile\n"), HeapProfileRetCode::kInvalidHeader);
+  EXPECT_EQ(profile.ParseText("heap profile: 1: 2 [3: 4] @ heapprofile\n1: 2 [3: 4] @ zz\n"),
+            HeapProfileRetCode::kInvalidRecord);
+  EXPECT_EQ(profile.ParseText("heap profile: 1: 2 [3: 4] @ heapprofile\n1: 2 [3: 4] @\n"),
+            HeapProfileRetCode::kInvalidRecord);
+}
+
+TEST(HeapProfile, ParseFile) {
+  char path[] = "/tmp/heap_profile_test_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(write(fd, kHeapProfileText, sizeof(kHeapProfileText) - 1), sizeof(kHeapProfileText) - 1);
+  close(fd);
+  HeapProfile profile{path};
+  EXPECT_EQ(profile.Parse(), HeapProfileRetCode::kOK);
+  EXPECT_EQ(profile.GetRecordNum(), 2u);
+  unlink(path);
+  HeapProfile missing{"file_not_exists"};
+  EXPECT_EQ(missing.Parse(), HeapProfileRetCode::kOpenFileFailed);
+}
+
+TEST(HeapProfile, GenerateRawProfile) {
+  HeapProfile profile;
+  EXPECT_EQ(profile.ParseText(kHeapProfileText), HeapProfileRetCode::kOK);
+  FakeHeapLocator locator;
+  std::string raw;
+  EXPECT_EQ(profile.GenerateRawProfile("", &locator, &raw), HeapProfileRetCode::kNoProgramPath);
+  EXPECT_EQ(profile.GenerateRawProfile("/usr/bin/test", &locator, &raw), HeapProfileRetCode::kOK);
+  EXPECT_EQ(raw.find("--- symbol\nbinary=/usr/bin/test\n"), 0u);
+  // leaf addr as is, caller addr subtracted by 1
+  EXPECT_NE(raw.find("0x00000000004005d6 alloc\n"), std::string::npos);
+  EXPECT_NE(raw.find("0x00000000004006a7 alloc\n"), std::string::npos);
+  EXPECT_NE(raw.find("0x00000000004007ff main\n"), std::string::npos);
+  const std::string kHeapMarker{"---\n--- heap\n"};
+  auto pos = raw.find(kHeapMarker);
+  ASSERT_NE(pos, std::string::npos);
+  // heap section can be parsed again
+  HeapProfile reparsed;
+  EXPECT_EQ(reparsed.ParseText(std::string_view{raw}.substr(pos + kHeapMarker.size())), HeapProfileRetCode::kOK);
+  EXPECT_EQ(reparsed.GetHeader().profile_type, profile.GetHeader().profile_type);
+  EXPECT_EQ(reparsed.GetRecordNum(), profile.GetRecordNum());
+  EXPECT_EQ(reparsed.pcs_, profile.pcs_);
+  EXPECT_EQ(reparsed.GetMapsText(), profile.GetMapsText());
+}
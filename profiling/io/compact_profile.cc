@@ -0,0 +1,456 @@
+/*
+ * FileName: compact_profile.cc
+ * Author: jattle
+ * Description:
+ */
+#include "profiling/io/compact_profile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+namespace pprofcpp {
+
+namespace {
+
+constexpr size_t kMagicLen = 4;
+constexpr size_t kPreambleLen = kMagicLen + 2;
+constexpr size_t kMaxVarintLen = 10;
+constexpr size_t kCompactBufferSize = 64 * 1024;
+// sanity limits of decoded lengths, beyond them data is treated as corrupted
+constexpr uint64_t kMaxNameLen = 1 << 20;
+constexpr uint64_t kMaxMapsLen = 1 << 30;
+
+inline uint64_t ZigZagEncode(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+inline int64_t ZigZagDecode(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+}  // namespace
+
+CompactProfileWriter::CompactProfileWriter(std::ostream& os, CompactCompression compression, int level)
+    : os_(os), compression_(compression), raw_(kCompactBufferSize), out_(kCompactBufferSize) {
+  memset(&zs_, 0, sizeof(zs_));
+  if (compression_ == CompactCompression::kZlib) {
+    if (deflateInit(&zs_, level) != Z_OK) {
+      status_ = CompactRetCode::kCompressError;
+      return;
+    }
+    zs_inited_ = true;
+  } else if (compression_ != CompactCompression::kNone) {
+    status_ = CompactRetCode::kCompressError;
+    return;
+  }
+  os_.write(kCompactProfileMagic, kMagicLen);
+  os_.put(static_cast<char>(kCompactProfileVersion));
+  os_.put(static_cast<char>(compression_));
+  if (!os_.good()) {
+    status_ = CompactRetCode::kWriteError;
+  }
+}
+
+CompactProfileWriter::~CompactProfileWriter() {
+  if (!finished_ && status_ == CompactRetCode::kOK) {
+    Finish();
+  }
+  if (zs_inited_) {
+    deflateEnd(&zs_);
+  }
+}
+
+CompactRetCode CompactProfileWriter::Expect(Stage stage) {
+  if (status_ != CompactRetCode::kOK) {
+    return status_;
+  }
+  return stage_ == stage ? CompactRetCode::kOK : CompactRetCode::kInvalidStage;
+}
+
+void CompactProfileWriter::PutVarint(uint64_t v) {
+  if (raw_used_ + kMaxVarintLen > raw_.size()) {
+    FlushRaw(false);
+  }
+  char* p = raw_.data() + raw_used_;
+  while (v >= 0x80) {
+    *p++ = static_cast<char>(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = static_cast<char>(v);
+  raw_used_ = p - raw_.data();
+}
+
+void CompactProfileWriter::PutBytes(const char* data, size_t len) {
+  while (len > 0) {
+    if (raw_used_ == raw_.size()) {
+      FlushRaw(false);
+    }
+    size_t n = std::min(len, raw_.size() - raw_used_);
+    memcpy(raw_.data() + raw_used_, data, n);
+    raw_used_ += n;
+    data += n;
+    len -= n;
+  }
+}
+
+CompactRetCode CompactProfileWriter::FlushRaw(bool finish) {
+  if (status_ != CompactRetCode::kOK) {
+    raw_used_ = 0;
+    return status_;
+  }
+  raw_bytes_ += raw_used_;
+  if (compression_ == CompactCompression::kNone) {
+    os_.write(raw_.data(), raw_used_);
+    raw_used_ = 0;
+    if (!os_.good()) {
+      status_ = CompactRetCode::kWriteError;
+    }
+    return status_;
+  }
+  zs_.next_in = reinterpret_cast<Bytef*>(raw_.data());
+  zs_.avail_in = static_cast<uInt>(raw_used_);
+  int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+  int ret{Z_OK};
+  do {
+    zs_.next_out = reinterpret_cast<Bytef*>(out_.data());
+    zs_.avail_out = static_cast<uInt>(out_.size());
+    ret = deflate(&zs_, flush);
+    if (ret == Z_STREAM_ERROR) {
+      status_ = CompactRetCode::kCompressError;
+      break;
+    }
+    os_.write(out_.data(), out_.size() - zs_.avail_out);
+    if (!os_.good()) {
+      status_ = CompactRetCode::kWriteError;
+      break;
+    }
+  } while (zs_.avail_out == 0 || (finish && ret != Z_STREAM_END));
+  raw_used_ = 0;
+  return status_;
+}
+
+CompactRetCode CompactProfileWriter::WriteHeader(const CPUProfileBinaryHeader& header) {
+  if (auto ret = Expect(Stage::kHeader); ret != CompactRetCode::kOK) {
+    return ret;
+  }
+  PutVarint(header.hdr_words);
+  PutVarint(header.version);
+  PutVarint(header.sampling_period);
+  PutVarint(header.padding);
+  stage_ = Stage::kStrings;
+  return status_;
+}
+
+CompactRetCode CompactProfileWriter::WriteStringTable(const std::vector<std::string_view>& names) {
+  if (auto ret = Expect(Stage::kStrings); ret != CompactRetCode::kOK) {
+    return ret;
+  }
+  std::vector<uint32_t> order(names.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&names](uint32_t l, uint32_t r) { return names[l] < names[r]; });
+  name_remap_.resize(names.size());
+  PutVarint(names.size());
+  std::string_view prev;
+  for (uint32_t i = 0; i < order.size(); i++) {
+    std::string_view name = names[order[i]];
+    name_remap_[order[i]] = i;
+    size_t shared = 0;
+    size_t limit = std::min(prev.size(), name.size());
+    while (shared < limit && prev[shared] == name[shared]) {
+      shared++;
+    }
+    PutVarint(shared);
+    PutVarint(name.size() - shared);
+    PutBytes(name.data() + shared, name.size() - shared);
+    prev = name;
+  }
+  stage_ = Stage::kSymbols;
+  return status_;
+}
+
+CompactRetCode CompactProfileWriter::WriteSymbols(const void* const* addrs, const uint32_t* name_ids, size_t n) {
+  if (auto ret = Expect(Stage::kSymbols); ret != CompactRetCode::kOK) {
+    return ret;
+  }
+  PutVarint(n);
+  uintptr_t prev{0};
+  for (size_t i = 0; i < n; i++) {
+    auto addr = reinterpret_cast<uintptr_t>(addrs[i]);
+    if (addr < prev || name_ids[i] >= name_remap_.size()) {
+      status_ = CompactRetCode::kInvalidStage;
+      return status_;
+    }
+    PutVarint(addr - prev);
+    PutVarint(name_remap_[name_ids[i]]);
+    prev = addr;
+  }
+  stage_ = Stage::kStacks;
+  return status_;
+}
+
+CompactRetCode CompactProfileWriter::BeginStacks(size_t stack_num) {
+  if (auto ret = Expect(Stage::kStacks); ret != CompactRetCode::kOK) {
+    return ret;
+  }
+  PutVarint(stack_num);
+  stacks_left_ = stack_num;
+  prev_first_pc_ = 0;
+  if (stack_num == 0) {
+    stage_ = Stage::kMaps;
+  }
+  return status_;
+}
+
+CompactRetCode CompactProfileWriter::AppendStack(size_t sample_count, const void* const* pcs, size_t num_pcs) {
+  if (auto ret = Expect(Stage::kStacks); ret != CompactRetCode::kOK) {
+    return ret;
+  }
+  if (stacks_left_ == 0) {
+    return CompactRetCode::kInvalidStage;
+  }
+  if (num_pcs > kCompactMaxStackDepth) {
+    // reader rejects it, fail instead of writing a stream that can not be read back
+    status_ = CompactRetCode::kStackTooDeep;
+    return status_;
+  }
+  PutVarint(sample_count);
+  PutVarint(num_pcs);
+  uintptr_t prev = prev_first_pc_;
+  for (size_t i = 0; i < num_pcs; i++) {
+    auto pc = reinterpret_cast<uintptr_t>(pcs[i]);
+    PutVarint(ZigZagEncode(static_cast<int64_t>(pc - prev)));
+    prev = pc;
+  }
+  if (num_pcs > 0) {
+    prev_first_pc_ = reinterpret_cast<uintptr_t>(pcs[0]);
+  }
+  if (--stacks_left_ == 0) {
+    stage_ = Stage::kMaps;
+  }
+  return status_;
+}
+
+CompactRetCode CompactProfileWriter::WriteMapsText(std::string_view maps_text) {
+  if (auto ret = Expect(Stage::kMaps); ret != CompactRetCode::kOK) {
+    return ret;
+  }
+  PutVarint(maps_text.size());
+  PutBytes(maps_text.data(), maps_text.size());
+  stage_ = Stage::kFinished;
+  return status_;
+}
+
+CompactRetCode CompactProfileWriter::Finish() {
+  if (status_ != CompactRetCode::kOK || finished_) {
+    return status_;
+  }
+  if (stage_ == Stage::kMaps) {
+    // maps text is optional
+    WriteMapsText("");
+  }
+  if (stage_ != Stage::kFinished) {
+    // incomplete profile is never emitted as a valid one
+    status_ = CompactRetCode::kInvalidStage;
+    return status_;
+  }
+  finished_ = true;
+  if (FlushRaw(true) != CompactRetCode::kOK) {
+    return status_;
+  }
+  os_.flush();
+  if (!os_.good()) {
+    status_ = CompactRetCode::kWriteError;
+  }
+  return status_;
+}
+
+CompactProfileReader::CompactProfileReader(std::istream& is)
+    : is_(is), in_(kCompactBufferSize), raw_(kCompactBufferSize) {
+  memset(&zs_, 0, sizeof(zs_));
+}
+
+CompactProfileReader::~CompactProfileReader() {
+  if (zs_inited_) {
+    inflateEnd(&zs_);
+  }
+}
+
+bool CompactProfileReader::Fill() {
+  // keep unconsumed tail, varints may straddle two fills
+  size_t left = raw_size_ - raw_pos_;
+  memmove(raw_.data(), raw_.data() + raw_pos_, left);
+  raw_pos_ = 0;
+  raw_size_ = left;
+  if (compression_ == CompactCompression::kNone) {
+    is_.read(raw_.data() + raw_size_, static_cast<std::streamsize>(raw_.size() - raw_size_));
+    raw_size_ += static_cast<size_t>(is_.gcount());
+    if (is_.bad()) {
+      status_ = CompactRetCode::kInvalidStream;
+    }
+    return raw_size_ > left;
+  }
+  while (raw_size_ == left && !zs_end_) {
+    if (zs_.avail_in == 0) {
+      is_.read(in_.data(), static_cast<std::streamsize>(in_.size()));
+      zs_.next_in = reinterpret_cast<Bytef*>(in_.data());
+      zs_.avail_in = static_cast<uInt>(is_.gcount());
+      if (zs_.avail_in == 0) {
+        // truncated stream
+        status_ = CompactRetCode::kDecompressError;
+        return false;
+      }
+    }
+    zs_.next_out = reinterpret_cast<Bytef*>(raw_.data() + raw_size_);
+    zs_.avail_out = static_cast<uInt>(raw_.size() - raw_size_);
+    int ret = inflate(&zs_, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+      status_ = CompactRetCode::kDecompressError;
+      return false;
+    }
+    zs_end_ = ret == Z_STREAM_END;
+    raw_size_ = raw_.size() - zs_.avail_out;
+  }
+  return raw_size_ > left;
+}
+
+bool CompactProfileReader::GetVarint(uint64_t* v) {
+  if (raw_size_ - raw_pos_ < kMaxVarintLen) {
+    Fill();
+  }
+  const char* p = raw_.data() + raw_pos_;
+  const char* end = raw_.data() + raw_size_;
+  uint64_t result{0};
+  for (int shift = 0; shift < 64 && p < end; shift += 7) {
+    auto byte = static_cast<uint8_t>(*p++);
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      raw_pos_ = p - raw_.data();
+      *v = result;
+      return true;
+    }
+  }
+  if (status_ == CompactRetCode::kOK) {
+    status_ = CompactRetCode::kCorrupted;
+  }
+  return false;
+}
+
+bool CompactProfileReader::GetBytes(char* data, size_t len) {
+  while (len > 0) {
+    if (raw_pos_ == raw_size_ && !Fill()) {
+      if (status_ == CompactRetCode::kOK) {
+        status_ = CompactRetCode::kCorrupted;
+      }
+      return false;
+    }
+    size_t n = std::min(len, raw_size_ - raw_pos_);
+    memcpy(data, raw_.data() + raw_pos_, n);
+    raw_pos_ += n;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+CompactRetCode CompactProfileReader::Read(CompactProfileData* data) {
+  char preamble[kPreambleLen];
+  if (!is_.read(preamble, kPreambleLen)) {
+    return CompactRetCode::kInvalidStream;
+  }
+  if (memcmp(preamble, kCompactProfileMagic, kMagicLen) != 0) {
+    return CompactRetCode::kBadMagic;
+  }
+  if (static_cast<uint8_t>(preamble[kMagicLen]) != kCompactProfileVersion) {
+    return CompactRetCode::kUnsupportedVersion;
+  }
+  compression_ = static_cast<CompactCompression>(preamble[kMagicLen + 1]);
+  if (compression_ == CompactCompression::kZlib) {
+    if (inflateInit(&zs_) != Z_OK) {
+      return CompactRetCode::kDecompressError;
+    }
+    zs_inited_ = true;
+  } else if (compression_ != CompactCompression::kNone) {
+    return CompactRetCode::kUnsupportedVersion;
+  }
+#define RETURN_IF_FALSE(expr)                                                  \
+  do {                                                                         \
+    if (!(expr)) {                                                             \
+      return status_ == CompactRetCode::kOK ? CompactRetCode::kCorrupted : status_; \
+    }                                                                          \
+  } while (0)
+  uint64_t v{0};
+  RETURN_IF_FALSE(GetVarint(&v));
+  data->header.hdr_words = v;
+  RETURN_IF_FALSE(GetVarint(&v));
+  data->header.version = v;
+  RETURN_IF_FALSE(GetVarint(&v));
+  data->header.sampling_period = v;
+  RETURN_IF_FALSE(GetVarint(&v));
+  data->header.padding = v;
+  // strings
+  uint64_t name_num{0};
+  RETURN_IF_FALSE(GetVarint(&name_num));
+  data->names.clear();
+  data->names.reserve(std::min<uint64_t>(name_num, kCompactBufferSize));
+  for (uint64_t i = 0; i < name_num; i++) {
+    uint64_t shared{0}, suffix{0};
+    RETURN_IF_FALSE(GetVarint(&shared) && GetVarint(&suffix));
+    RETURN_IF_FALSE(suffix <= kMaxNameLen && (i == 0 ? shared == 0 : shared <= data->names.back().size()));
+    std::string name;
+    name.resize(shared + suffix);
+    if (shared > 0) {
+      memcpy(name.data(), data->names.back().data(), shared);
+    }
+    RETURN_IF_FALSE(GetBytes(name.data() + shared, suffix));
+    data->names.emplace_back(std::move(name));
+  }
+  // symbols
+  uint64_t addr_num{0};
+  RETURN_IF_FALSE(GetVarint(&addr_num));
+  data->addrs.clear();
+  data->addr_names.clear();
+  uintptr_t addr{0};
+  for (uint64_t i = 0; i < addr_num; i++) {
+    uint64_t delta{0}, name{0};
+    RETURN_IF_FALSE(GetVarint(&delta) && GetVarint(&name));
+    RETURN_IF_FALSE(name < name_num);
+    addr += delta;
+    data->addrs.push_back(addr);
+    data->addr_names.push_back(static_cast<uint32_t>(name));
+  }
+  // stacks
+  uint64_t stack_num{0};
+  RETURN_IF_FALSE(GetVarint(&stack_num));
+  data->counts.clear();
+  data->offsets.assign(1, 0);
+  data->pcs.clear();
+  uintptr_t prev_first_pc{0};
+  for (uint64_t i = 0; i < stack_num; i++) {
+    uint64_t count{0}, depth{0};
+    RETURN_IF_FALSE(GetVarint(&count) && GetVarint(&depth));
+    RETURN_IF_FALSE(depth <= kCompactMaxStackDepth);
+    uintptr_t pc = prev_first_pc;
+    for (uint64_t j = 0; j < depth; j++) {
+      RETURN_IF_FALSE(GetVarint(&v));
+      pc += static_cast<uintptr_t>(ZigZagDecode(v));
+      data->pcs.push_back(pc);
+      if (j == 0) {
+        prev_first_pc = pc;
+      }
+    }
+    data->counts.push_back(count);
+    data->offsets.push_back(data->pcs.size());
+  }
+  // maps
+  uint64_t maps_len{0};
+  RETURN_IF_FALSE(GetVarint(&maps_len));
+  RETURN_IF_FALSE(maps_len <= kMaxMapsLen);
+  // length is untrusted, grow buffer with data actually read instead of allocating it up front
+  data->maps_text.clear();
+  while (data->maps_text.size() < maps_len) {
+    size_t offset = data->maps_text.size();
+    size_t n = std::min<uint64_t>(maps_len - offset, kCompactBufferSize);
+    data->maps_text.resize(offset + n);
+    RETURN_IF_FALSE(GetBytes(data->maps_text.data() + offset, n));
+  }
+#undef RETURN_IF_FALSE
+  return CompactRetCode::kOK;
+}
+
+}  // namespace pprofcpp
@@ -0,0 +1,144 @@
+/*
+ * FileName: compact_profile.h
+ * Author: jattle
+ * Description: compact binary transport format of symbolized CPU profile,
+ * varint/delta encoded pcs, front-coded string table, streaming zlib compression
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <zlib.h>
+
+#include "profiling/io/profile_io.h"
+
+namespace pprofcpp {
+
+/// Layout, all integers are LEB128 varints unless noted
+///   magic "PPCF"(4 bytes) | version(1 byte) | compression(1 byte)  -- never compressed
+///   payload(compressed as a whole):
+///   header:  hdr_words, version, sampling_period, padding
+///   strings: name_num, per name: shared prefix len with previous name, suffix len, suffix bytes(sorted by name)
+///   symbols: addr_num, per addr: delta from previous addr(ascending), name index
+///   stacks:  stack_num, per stack: sample_count, depth, zigzag delta of every pc
+///            (first pc against first pc of previous stack, others against previous pc of the same stack)
+///   maps:    len, bytes
+constexpr char kCompactProfileMagic[] = "PPCF";
+constexpr uint8_t kCompactProfileVersion = 1;
+// max pcs of a stack, deeper stacks are rejected by both writer and reader
+constexpr size_t kCompactMaxStackDepth = 1 << 16;
+
+enum class CompactCompression : uint8_t {
+  kNone = 0,
+  kZlib = 1,
+};
+
+enum class CompactRetCode {
+  kOK = 0,
+  kInvalidStream = 30,
+  kWriteError = 31,
+  kCompressError = 32,
+  kBadMagic = 33,
+  kUnsupportedVersion = 34,
+  kCorrupted = 35,
+  kDecompressError = 36,
+  kInvalidStage = 37,
+  kStackTooDeep = 38,
+};
+
+/// @brief decoded compact profile, stacks are stored in CSR form
+struct CompactProfileData {
+  CPUProfileBinaryHeader header;
+  std::vector<std::string> names;    // string table, sorted
+  std::vector<uintptr_t> addrs;      // symbol addrs, sorted
+  std::vector<uint32_t> addr_names;  // name index of every addr
+  std::vector<size_t> counts;        // sample count of every stack
+  std::vector<size_t> offsets{0};    // pcs of stack i are pcs[offsets[i], offsets[i + 1])
+  std::vector<uintptr_t> pcs;
+  std::string maps_text;
+};
+
+/// @brief streaming writer, sections must be written in order: header, string table, symbols, stacks, maps text,
+// then Finish. memory is bounded by two fixed-size buffers regardless of profile size
+class CompactProfileWriter {
+ public:
+  explicit CompactProfileWriter(std::ostream& os, CompactCompression compression = CompactCompression::kZlib,
+                                int level = Z_BEST_SPEED);
+  ~CompactProfileWriter();
+  CompactProfileWriter(const CompactProfileWriter&) = delete;
+  CompactProfileWriter& operator=(const CompactProfileWriter&) = delete;
+  CompactRetCode WriteHeader(const CPUProfileBinaryHeader& header);
+  // @brief names are indexed by id, they are sorted for front coding and ids are remapped internally
+  CompactRetCode WriteStringTable(const std::vector<std::string_view>& names);
+  // @brief sorted addrs and their name ids(index of names given to WriteStringTable)
+  CompactRetCode WriteSymbols(const void* const* addrs, const uint32_t* name_ids, size_t n);
+  CompactRetCode BeginStacks(size_t stack_num);
+  CompactRetCode AppendStack(size_t sample_count, const void* const* pcs, size_t num_pcs);
+  CompactRetCode WriteMapsText(std::string_view maps_text);
+  // @brief flush compressor & stream, called by destructor if not called
+  CompactRetCode Finish();
+  size_t GetRawBytes() const { return raw_bytes_; }
+
+ private:
+  enum class Stage {
+    kHeader = 0,
+    kStrings = 1,
+    kSymbols = 2,
+    kStacks = 3,
+    kMaps = 4,
+    kFinished = 5,
+  };
+  CompactRetCode Expect(Stage stage);
+  void PutVarint(uint64_t v);
+  void PutBytes(const char* data, size_t len);
+  CompactRetCode FlushRaw(bool finish);
+
+  std::ostream& os_;
+  CompactCompression compression_;
+  z_stream zs_;
+  bool zs_inited_{false};
+  Stage stage_{Stage::kHeader};
+  bool finished_{false};
+  CompactRetCode status_{CompactRetCode::kOK};
+  std::vector<char> raw_;   // uncompressed payload not flushed yet
+  size_t raw_used_{0};
+  std::vector<char> out_;   // compressed output buffer
+  std::vector<uint32_t> name_remap_;  // name id -> sorted index
+  size_t stacks_left_{0};
+  uintptr_t prev_first_pc_{0};
+  size_t raw_bytes_{0};  // uncompressed payload bytes
+};
+
+/// @brief streaming reader, payload is inflated & decoded through fixed-size buffers
+class CompactProfileReader {
+ public:
+  explicit CompactProfileReader(std::istream& is);
+  ~CompactProfileReader();
+  CompactProfileReader(const CompactProfileReader&) = delete;
+  CompactProfileReader& operator=(const CompactProfileReader&) = delete;
+  CompactRetCode Read(CompactProfileData* data);
+
+ private:
+  bool Fill();
+  bool GetVarint(uint64_t* v);
+  bool GetBytes(char* data, size_t len);
+
+  std::istream& is_;
+  CompactCompression compression_{CompactCompression::kNone};
+  z_stream zs_;
+  bool zs_inited_{false};
+  bool zs_end_{false};
+  std::vector<char> in_;   // compressed input
+  std::vector<char> raw_;  // inflated payload
+  size_t raw_pos_{0};
+  size_t raw_size_{0};
+  CompactRetCode status_{CompactRetCode::kOK};
+};
+
+}  // namespace pprofcpp
@@ -0,0 +1,122 @@
+/*
+ * FileName: compact_profile_test.cc
+ * Author: jattle
+ * Description:
+ */
+#include "profiling/io/compact_profile.h"
+
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+using namespace pprofcpp;
+
+static std::string WriteSample(CompactCompression compression) {
+  std::ostringstream oss;
+  CompactProfileWriter writer{oss, compression};
+  CPUProfileBinaryHeader header;
+  header.sampling_period = 10000;
+  EXPECT_EQ(writer.WriteHeader(header), CompactRetCode::kOK);
+  // id 0 is empty name, like SymbolTable
+  std::vector<std::string_view> names{"", "ns::Foo::Bar()", "ns::Foo::Baz()", "main"};
+  EXPECT_EQ(writer.WriteStringTable(names), CompactRetCode::kOK);
+  std::vector<void*> addrs{reinterpret_cast<void*>(0x400100), reinterpret_cast<void*>(0x400200),
+                           reinterpret_cast<void*>(0x7f0000001000)};
+  std::vector<uint32_t> name_ids{3, 1, 2};
+  EXPECT_EQ(writer.WriteSymbols(addrs.data(), name_ids.data(), addrs.size()), CompactRetCode::kOK);
+  EXPECT_EQ(writer.BeginStacks(2), CompactRetCode::kOK);
+  std::vector<void*> stack1{reinterpret_cast<void*>(0x7f0000001000), reinterpret_cast<void*>(0x400201),
+                            reinterpret_cast<void*>(0x400101)};
+  std::vector<void*> stack2{reinterpret_cast<void*>(0x400200), reinterpret_cast<void*>(0x400101)};
+  EXPECT_EQ(writer.AppendStack(3, stack1.data(), stack1.size()), CompactRetCode::kOK);
+  EXPECT_EQ(writer.AppendStack(1, stack2.data(), stack2.size()), CompactRetCode::kOK);
+  EXPECT_EQ(writer.WriteMapsText("400000-401000 r-xp 00000000 00:00 0 /bin/a\n"), CompactRetCode::kOK);
+  EXPECT_EQ(writer.Finish(), CompactRetCode::kOK);
+  return oss.str();
+}
+
+TEST(CompactProfile, RoundTrip) {
+  for (auto compression : {CompactCompression::kNone, CompactCompression::kZlib}) {
+    std::istringstream iss{WriteSample(compression)};
+    CompactProfileReader reader{iss};
+    CompactProfileData data;
+    ASSERT_EQ(reader.Read(&data), CompactRetCode::kOK);
+    EXPECT_EQ(data.header.sampling_period, 10000);
+    EXPECT_EQ(data.names, (std::vector<std::string>{"", "main", "ns::Foo::Bar()", "ns::Foo::Baz()"}));
+    EXPECT_EQ(data.addrs, (std::vector<uintptr_t>{0x400100, 0x400200, 0x7f0000001000}));
+    std::vector<std::string> addr_names;
+    for (auto index : data.addr_names) {
+      addr_names.push_back(data.names[index]);
+    }
+    EXPECT_EQ(addr_names, (std::vector<std::string>{"main", "ns::Foo::Bar()", "ns::Foo::Baz()"}));
+    EXPECT_EQ(data.counts, (std::vector<size_t>{3, 1}));
+    EXPECT_EQ(data.offsets, (std::vector<size_t>{0, 3, 5}));
+    EXPECT_EQ(data.pcs, (std::vector<uintptr_t>{0x7f0000001000, 0x400201, 0x400101, 0x400200, 0x400101}));
+    EXPECT_EQ(data.maps_text, "400000-401000 r-xp 00000000 00:00 0 /bin/a\n");
+  }
+}
+
+TEST(CompactProfile, InvalidStage) {
+  std::ostringstream oss;
+  CompactProfileWriter writer{oss};
+  // string table before header
+  EXPECT_EQ(writer.WriteStringTable({}), CompactRetCode::kInvalidStage);
+  EXPECT_EQ(writer.WriteHeader(CPUProfileBinaryHeader{}), CompactRetCode::kOK);
+  // incomplete profile
+  EXPECT_EQ(writer.Finish(), CompactRetCode::kInvalidStage);
+}
+
+TEST(CompactProfile, Corrupted) {
+  std::string content = WriteSample(CompactCompression::kZlib);
+  {
+    std::istringstream iss{"PPCX" + content.substr(4)};
+    CompactProfileData data;
+    EXPECT_EQ(CompactProfileReader{iss}.Read(&data), CompactRetCode::kBadMagic);
+  }
+  {
+    std::istringstream iss{content.substr(0, content.size() / 2)};
+    CompactProfileData data;
+    EXPECT_NE(CompactProfileReader{iss}.Read(&data), CompactRetCode::kOK);
+  }
+  {
+    std::string raw = WriteSample(CompactCompression::kNone);
+    std::istringstream iss{raw.substr(0, raw.size() - 3)};
+    CompactProfileData data;
+    EXPECT_EQ(CompactProfileReader{iss}.Read(&data), CompactRetCode::kCorrupted);
+  }
+}
+
+TEST(CompactProfile, StackTooDeep) {
+  std::ostringstream oss;
+  CompactProfileWriter writer{oss};
+  EXPECT_EQ(writer.WriteHeader(CPUProfileBinaryHeader{}), CompactRetCode::kOK);
+  EXPECT_EQ(writer.WriteStringTable({""}), CompactRetCode::kOK);
+  EXPECT_EQ(writer.WriteSymbols(nullptr, nullptr, 0), CompactRetCode::kOK);
+  EXPECT_EQ(writer.BeginStacks(2), CompactRetCode::kOK);
+  // the deepest stack reader accepts is written, a deeper one fails the writer
+  std::vector<void*> pcs(kCompactMaxStackDepth + 1, reinterpret_cast<void*>(0x400100));
+  EXPECT_EQ(writer.AppendStack(1, pcs.data(), kCompactMaxStackDepth), CompactRetCode::kOK);
+  EXPECT_EQ(writer.AppendStack(1, pcs.data(), pcs.size()), CompactRetCode::kStackTooDeep);
+  EXPECT_EQ(writer.WriteMapsText(""), CompactRetCode::kStackTooDeep);
+  EXPECT_EQ(writer.Finish(), CompactRetCode::kStackTooDeep);
+}
+
+TEST(CompactProfile, HugeMapsLen) {
+  std::ostringstream oss;
+  CompactProfileWriter writer{oss, CompactCompression::kNone};
+  EXPECT_EQ(writer.WriteHeader(CPUProfileBinaryHeader{}), CompactRetCode::kOK);
+  EXPECT_EQ(writer.WriteStringTable({""}), CompactRetCode::kOK);
+  EXPECT_EQ(writer.WriteSymbols(nullptr, nullptr, 0), CompactRetCode::kOK);
+  EXPECT_EQ(writer.BeginStacks(0), CompactRetCode::kOK);
+  EXPECT_EQ(writer.WriteMapsText(""), CompactRetCode::kOK);
+  EXPECT_EQ(writer.Finish(), CompactRetCode::kOK);
+  std::string raw = oss.str();
+  ASSERT_EQ(raw.back(), '\0');
+  // maps length of 512MB followed by a few bytes only
+  raw.pop_back();
+  raw.append("\x80\x80\x80\x80\x02" "abc");
+  std::istringstream iss{raw};
+  CompactProfileData data;
+  EXPECT_EQ(CompactProfileReader{iss}.Read(&data), CompactRetCode::kCorrupted);
+  EXPECT_LE(data.maps_text.size(), 64 * 1024);
+}
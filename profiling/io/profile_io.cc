@@ -7,18 +7,28 @@
 
 #include "profiling/util/endian.h"
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cstring>
 
 namespace fustsdk {
 
-CPUProfileReader::CPUProfileReader(const std::string& file) : file_name_(file) {
-  this->is_ = std::make_unique<std::ifstream>(file.c_str(), std::ios_base::binary);
-  this->init_status_ = Init();
+CPUProfileReader::CPUProfileReader(const std::string& file, ProcessingStats* stats)
+    : CPUProfileReader(std::make_unique<std::ifstream>(file.c_str(), std::ios_base::binary), stats) {
+  this->file_name_ = file;
 }
 
-CPUProfileReader::CPUProfileReader(std::unique_ptr<std::istream> is) {
+CPUProfileReader::CPUProfileReader(std::unique_ptr<std::istream> is, ProcessingStats* stats) : stats_(stats) {
   this->is_ = std::move(is);
+  if (stats != nullptr && this->is_ != nullptr && this->is_->good()) {
+    // slots are read a few bytes at a time, read through a chunk buffer so that only real reads are timed
+    this->source_ = std::move(this->is_);
+    this->stats_buf_ = std::make_unique<StatsStreamBuf>(this->source_.get(), stats);
+    this->is_ = std::make_unique<std::istream>(this->stats_buf_.get());
+  }
   this->init_status_ = Init();
 }
 
@@ -49,7 +59,7 @@ ReaderRetCode CPUProfileReader::Init() {
 
   // 以下只解析header的前两个slot，对于32位address len，每个Slot占用4字节，对于64位address len，每个Slot占用8字节
   // 首先根据第一个Slot确定address len，再根据第二个Slot判断pack类型是big endian还是little endian
-  if (!this->is_->good()) {
+  if (this->is_ == nullptr || !this->is_->good()) {
     this->init_status_ = ReaderRetCode::kInvalidStream;
     return ReaderRetCode::kInvalidStream;
   }
@@ -92,6 +102,9 @@ ReaderRetCode CPUProfileReader::Init() {
   }
   slots_.emplace_back(0);
   slots_.emplace_back(hdr_words_);
+  if (this->stats_ != nullptr) {
+    this->stats_->slots_decoded += slots_.size();
+  }
   this->init_status_ = ReaderRetCode::kOK;
   return ReaderRetCode::kOK;
 }
@@ -123,34 +136,91 @@ bool CPUProfileReader::Bit64Convert(char (&buffer)[k64BitSize], size_t* val) {
 }
 
 ReaderRetCode CPUProfileReader::NextSlot() {
+  size_t val{0};
+  if (auto ret = ReadSlot(&val); ret != ReaderRetCode::kOK) {
+    return ret;
+  }
+  slots_.emplace_back(val);
+  return ReaderRetCode::kOK;
+}
+
+ReaderRetCode CPUProfileReader::ReadSlot(size_t* val) {
+  if (this->stats_ != nullptr) {
+    this->stats_->slots_decoded++;
+  }
   if (address_len_ == ProfileAddressLen::k32Bit) {
     char buffer[k32BitSize];
     if (auto ret = ReadNextNChar<sizeof(buffer)>(buffer); ret != sizeof(buffer)) {
       return ReaderRetCode::kReadError;
     }
-    size_t val{0};
-    if (Bit32Convert(buffer, &val)) {
-      slots_.emplace_back(val);
-      return ReaderRetCode::kOK;
-    }
-    return ReaderRetCode::kConvertErr;
+    return Bit32Convert(buffer, val) ? ReaderRetCode::kOK : ReaderRetCode::kConvertErr;
   }
   if (address_len_ == ProfileAddressLen::k64Bit) {
     char buffer[k64BitSize];
     if (auto ret = ReadNextNChar<sizeof(buffer)>(buffer); ret != sizeof(buffer)) {
       return ReaderRetCode::kReadError;
     }
-    size_t val{0};
-    if (Bit64Convert(buffer, &val)) {
-      slots_.emplace_back(val);
-      return ReaderRetCode::kOK;
-    }
-    return ReaderRetCode::kConvertErr;
+    return Bit64Convert(buffer, val) ? ReaderRetCode::kOK : ReaderRetCode::kConvertErr;
   }
   // unexpected address len
   return ReaderRetCode::kInvalidAddressLen;
 }
 
+ReaderRetCode CPUProfileReader::ReadHeader(CPUProfileBinaryHeader* header) {
+  size_t* fields[] = {&header->hdr_count, &header->hdr_words, &header->version, &header->sampling_period,
+                      &header->padding};
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    if (auto ret = GetSlot(i, fields[i]); ret != ReaderRetCode::kOK) {
+      return ret;
+    }
+  }
+  // header slots unknown to this reader
+  for (size_t i = 3; i < header->hdr_words; i++) {
+    size_t val;
+    if (auto ret = ReadSlot(&val); ret != ReaderRetCode::kOK) {
+      return ret;
+    }
+  }
+  return ReaderRetCode::kOK;
+}
+
+ReaderRetCode CPUProfileReader::ReadRecords(const RecordCallback& callback, size_t* record_num) {
+  // max stack depth of gperftools is 254, anything far beyond it is corrupted data
+  constexpr size_t kMaxRecordPcs = 1 << 16;
+  if (init_status_ != ReaderRetCode::kOK) {
+    return init_status_;
+  }
+  if (record_num != nullptr) {
+    *record_num = 0;
+  }
+  while (true) {
+    size_t sample_count, num_pcs, pc;
+    for (auto* val : {&sample_count, &num_pcs, &pc}) {
+      if (auto ret = ReadSlot(val); ret != ReaderRetCode::kOK) {
+        return ret;
+      }
+    }
+    if (pc == 0) {
+      // binary trailer
+      return ReaderRetCode::kOK;
+    }
+    if (num_pcs == 0 || num_pcs > kMaxRecordPcs) {
+      return ReaderRetCode::kInvalidRecord;
+    }
+    pcs_.resize(num_pcs);
+    pcs_[0] = pc;
+    for (size_t i = 1; i < num_pcs; i++) {
+      if (auto ret = ReadSlot(&pcs_[i]); ret != ReaderRetCode::kOK) {
+        return ret;
+      }
+    }
+    callback(sample_count, pcs_.data(), num_pcs);
+    if (record_num != nullptr) {
+      (*record_num)++;
+    }
+  }
+}
+
 /// @brief read content left in file
 ReaderRetCode CPUProfileReader::ReadLeftContent(std::string* content) {
   char buffer[1024] = {0};
@@ -166,10 +236,155 @@ ReaderRetCode CPUProfileReader::ReadLeftContent(std::string* content) {
   return ReaderRetCode::kReadError;
 }
 
+CPUProfileFollowReader::CPUProfileFollowReader(const std::string& file, ProcessingStats* stats)
+    : file_(file), stats_(stats) {
+  auto is = std::make_unique<std::ifstream>(file.c_str(), std::ios_base::binary);
+  file_is_ = is.get();
+  is_ = std::move(is);
+}
+
+CPUProfileFollowReader::CPUProfileFollowReader(std::unique_ptr<std::istream> is, ProcessingStats* stats)
+    : is_(std::move(is)), stats_(stats) {}
+
+ReaderRetCode CPUProfileFollowReader::ReadAppended() {
+  if (file_is_ != nullptr && !file_is_->is_open()) {
+    // followed file may be created after reader, e.g. profiler is not started yet
+    file_is_->clear();
+    file_is_->open(file_.c_str(), std::ios_base::binary);
+    if (!file_is_->is_open()) {
+      return ReaderRetCode::kOK;
+    }
+  }
+  if (is_ == nullptr || is_->bad()) {
+    return ReaderRetCode::kInvalidStream;
+  }
+  // eof of last poll is not final while file is being written
+  is_->clear();
+  ScopedPhase phase(stats_, StatsPhase::kRead);
+  size_t size = pending_.size();
+  char buffer[4096];
+  while (is_->read(buffer, sizeof(buffer)), is_->gcount() > 0) {
+    pending_.append(buffer, static_cast<size_t>(is_->gcount()));
+  }
+  if (stats_ != nullptr) {
+    stats_->bytes_read += pending_.size() - size;
+  }
+  return is_->bad() ? ReaderRetCode::kReadError : ReaderRetCode::kOK;
+}
+
+size_t CPUProfileFollowReader::WordAt(size_t pos) const {
+  const char* p = pending_.data() + pos * word_size_;
+  if (word_size_ == k64BitSize) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return unpack_type_ == UnpackType::kBigEndian ? be64toh(v) : le64toh(v);
+  }
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return unpack_type_ == UnpackType::kBigEndian ? be32toh(v) : le32toh(v);
+}
+
+ReaderRetCode CPUProfileFollowReader::DecodeHeader(size_t* pos) {
+  // same detection as CPUProfileReader::Init, hdr_count(0) decides address len, hdr_words decides byte order
+  if (pending_.size() < 2 * k64BitSize) {
+    // 16 bytes is enough for both address lens, header of 32bit profile is 20 bytes
+    return ReaderRetCode::kOK;
+  }
+  uint64_t first;
+  memcpy(&first, pending_.data(), sizeof(first));
+  word_size_ = first == 0 ? k64BitSize : k32BitSize;
+  const char* second = pending_.data() + word_size_;
+  if (word_size_ == k64BitSize) {
+    uint32_t high, low;
+    memcpy(&high, second, sizeof(high));
+    memcpy(&low, second + 4, sizeof(low));
+    unpack_type_ = high == 0 ? UnpackType::kBigEndian : (low == 0 ? UnpackType::kLittleEndian : UnpackType::kNone);
+  } else {
+    uint16_t high, low;
+    memcpy(&high, second, sizeof(high));
+    memcpy(&low, second + 2, sizeof(low));
+    unpack_type_ = high == 0 ? UnpackType::kBigEndian : (low == 0 ? UnpackType::kLittleEndian : UnpackType::kNone);
+  }
+  if (unpack_type_ == UnpackType::kNone) {
+    return ReaderRetCode::kInvalidUnpackType;
+  }
+  size_t hdr_words = WordAt(1);
+  if (hdr_words < 3) {
+    return ReaderRetCode::kInvalidRecord;
+  }
+  if (pending_.size() < (hdr_words + 2) * word_size_) {
+    return ReaderRetCode::kOK;
+  }
+  header_.hdr_count = 0;
+  header_.hdr_words = hdr_words;
+  header_.version = WordAt(2);
+  header_.sampling_period = WordAt(3);
+  header_.padding = WordAt(4);
+  *pos = hdr_words + 2;
+  stage_ = Stage::kRecords;
+  return ReaderRetCode::kOK;
+}
+
+ReaderRetCode CPUProfileFollowReader::Poll(const RecordCallback& callback, size_t* record_num) {
+  // max stack depth of gperftools is 254, anything far beyond it is corrupted data
+  constexpr size_t kMaxRecordPcs = 1 << 16;
+  if (record_num != nullptr) {
+    *record_num = 0;
+  }
+  if (auto ret = ReadAppended(); ret != ReaderRetCode::kOK) {
+    return ret;
+  }
+  size_t pos = 0;  // in words
+  ReaderRetCode ret{ReaderRetCode::kOK};
+  if (stage_ == Stage::kHeader) {
+    ret = DecodeHeader(&pos);
+  }
+  size_t words = stage_ == Stage::kRecords ? pending_.size() / word_size_ : 0;
+  while (ret == ReaderRetCode::kOK && stage_ == Stage::kRecords && pos + 2 <= words) {
+    size_t sample_count = WordAt(pos), num_pcs = WordAt(pos + 1);
+    if (num_pcs == 0 || num_pcs > kMaxRecordPcs) {
+      ret = ReaderRetCode::kInvalidRecord;
+      break;
+    }
+    if (pos + 2 + num_pcs > words) {
+      // partial record, wait for the rest
+      break;
+    }
+    if (WordAt(pos + 2) == 0) {
+      // binary trailer
+      pos += 2 + num_pcs;
+      stage_ = Stage::kMapsText;
+      break;
+    }
+    pcs_.resize(num_pcs);
+    for (size_t i = 0; i < num_pcs; i++) {
+      pcs_[i] = WordAt(pos + 2 + i);
+    }
+    callback(sample_count, pcs_.data(), num_pcs);
+    pos += 2 + num_pcs;
+    if (record_num != nullptr) {
+      (*record_num)++;
+    }
+  }
+  if (stats_ != nullptr) {
+    stats_->slots_decoded += pos;
+  }
+  size_t consumed = pos * word_size_;
+  consumed_offset_ += consumed;
+  pending_.erase(0, consumed);
+  if (stage_ == Stage::kMapsText) {
+    maps_text_.append(pending_);
+    consumed_offset_ += pending_.size();
+    pending_.clear();
+  }
+  return ret;
+}
+
 WriterRetCode CPUProfileWriter::Init() {
   if (os_->fail()) {
     return WriterRetCode::kInvalidStream;
   }
+  buffer_.resize(kDefaultChunkSize);
   // writer binary header
   AppendSlot(header_.hdr_count);
   AppendSlot(header_.hdr_words);
@@ -180,58 +395,172 @@ WriterRetCode CPUProfileWriter::Init() {
   return WriterRetCode::kOK;
 }
 
-bool CPUProfileWriter::Bit32Convert(size_t val, char (&buffer)[k32BitSize]) {
-  uint32_t v{0};
-  switch (meta_.unpack_type) {
-    case UnpackType::kLittleEndian:
-      v = htole32(val);
-      break;
-    case UnpackType::kBigEndian:
-      v = htobe32(val);
-      break;
-    default:
-      return false;
-  }
-  memcpy(buffer, &v, sizeof(buffer));
-  return true;
-}
+namespace {
 
-bool CPUProfileWriter::Bit64Convert(size_t val, char (&buffer)[k64BitSize]) {
-  uint64_t v{0};
-  switch (meta_.unpack_type) {
-    case UnpackType::kLittleEndian:
-      v = htole64(val);
-      break;
-    case UnpackType::kBigEndian:
-      v = htobe64(val);
-      break;
-    default:
-      return false;
+inline uintptr_t SlotValue(uintptr_t v) { return v; }
+inline uintptr_t SlotValue(const void* v) { return reinterpret_cast<uintptr_t>(v); }
+
+/// @brief encode n slots as U in given byte order, branch free inner loop so that compiler can vectorize it
+template <typename U, bool kBigEndian, typename T>
+void EncodeSlots(const T* slots, size_t n, uintptr_t adjust, char* out) {
+  for (size_t i = 0; i < n; i++) {
+    U v = static_cast<U>(SlotValue(slots[i]) - adjust);
+    if constexpr (sizeof(U) == k64BitSize) {
+      v = kBigEndian ? htobe64(v) : htole64(v);
+    } else {
+      v = kBigEndian ? htobe32(v) : htole32(v);
+    }
+    memcpy(out + i * sizeof(U), &v, sizeof(U));
   }
-  memcpy(buffer, &v, sizeof(buffer));
-  return true;
 }
 
-WriterRetCode CPUProfileWriter::AppendSlot(size_t val) {
+}  // namespace
+
+template <typename T>
+WriterRetCode CPUProfileWriter::AppendEncoded(const T* slots, size_t n, uintptr_t adjust) {
+  size_t slot_size{0};
   if (meta_.address_len == ProfileAddressLen::k32Bit) {
-    char buffer[k32BitSize];
-    if (!Bit32Convert(val, buffer)) {
-      return WriterRetCode::kConvertErr;
-    }
-    return WriteNextNChar<k32BitSize>(buffer) == k32BitSize ? WriterRetCode::kOK : WriterRetCode::kWriteError;
+    slot_size = k32BitSize;
   } else if (meta_.address_len == ProfileAddressLen::k64Bit) {
-    char buffer[k64BitSize];
-    if (!Bit64Convert(val, buffer)) {
-      return WriterRetCode::kConvertErr;
+    slot_size = k64BitSize;
+  } else {
+    return WriterRetCode::kInvalidAddrLen;
+  }
+  if (meta_.unpack_type != UnpackType::kLittleEndian && meta_.unpack_type != UnpackType::kBigEndian) {
+    return WriterRetCode::kConvertErr;
+  }
+  bool big_endian = meta_.unpack_type == UnpackType::kBigEndian;
+  while (n > 0) {
+    if (buffered_ + slot_size > buffer_.size()) {
+      if (auto ret = Flush(); ret != WriterRetCode::kOK) {
+        return ret;
+      }
     }
-    return WriteNextNChar<k64BitSize>(buffer) == k64BitSize ? WriterRetCode::kOK : WriterRetCode::kWriteError;
+    size_t batch = std::min(n, (buffer_.size() - buffered_) / slot_size);
+    char* out = buffer_.data() + buffered_;
+    if (slot_size == k64BitSize) {
+      big_endian ? EncodeSlots<uint64_t, true>(slots, batch, adjust, out)
+                 : EncodeSlots<uint64_t, false>(slots, batch, adjust, out);
+    } else {
+      big_endian ? EncodeSlots<uint32_t, true>(slots, batch, adjust, out)
+                 : EncodeSlots<uint32_t, false>(slots, batch, adjust, out);
+    }
+    buffered_ += batch * slot_size;
+    slots += batch;
+    n -= batch;
   }
-  return WriterRetCode::kInvalidAddrLen;
+  return WriterRetCode::kOK;
+}
+
+WriterRetCode CPUProfileWriter::AppendSlot(size_t val) {
+  uintptr_t slot = val;
+  return AppendEncoded(&slot, 1, 0);
+}
+
+WriterRetCode CPUProfileWriter::AppendSlots(const uintptr_t* slots, size_t n, uintptr_t adjust) {
+  return AppendEncoded(slots, n, adjust);
+}
+
+WriterRetCode CPUProfileWriter::AppendRecord(size_t sample_count, const void* const* pcs, size_t num_pcs,
+                                             uintptr_t pc_adjust) {
+  uintptr_t head[] = {sample_count, num_pcs};
+  if (auto ret = AppendEncoded(head, 2, 0); ret != WriterRetCode::kOK) {
+    return ret;
+  }
+  if (num_pcs == 0) {
+    return WriterRetCode::kOK;
+  }
+  if (auto ret = AppendEncoded(pcs, 1, 0); ret != WriterRetCode::kOK) {
+    return ret;
+  }
+  return AppendEncoded(pcs + 1, num_pcs - 1, pc_adjust);
+}
+
+WriterRetCode CPUProfileWriter::Flush() {
+  if (buffered_ == 0) {
+    return os_->good() ? WriterRetCode::kOK : WriterRetCode::kWriteError;
+  }
+  os_->write(buffer_.data(), buffered_);
+  buffered_ = 0;
+  return os_->good() ? WriterRetCode::kOK : WriterRetCode::kWriteError;
 }
 
 WriterRetCode CPUProfileWriter::AppendMapsText(const std::string& text) {
+  if (auto ret = Flush(); ret != WriterRetCode::kOK) {
+    return ret;
+  }
   os_->write(text.data(), text.size());
   return os_->good() ? WriterRetCode::kOK : WriterRetCode::kWriteError;
 }
 
+ChunkCallback FdChunkCallback(int fd) {
+  return [fd](const char* data, size_t len) -> bool {
+    while (len > 0) {
+      ssize_t n = ::write(fd, data, len);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      data += n;
+      len -= static_cast<size_t>(n);
+    }
+    return true;
+  };
+}
+
+ChunkStreamBuf::ChunkStreamBuf(ChunkCallback callback, size_t chunk_size)
+    : callback_(std::move(callback)), buffer_(chunk_size > 0 ? chunk_size : kDefaultChunkSize) {
+  setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+bool ChunkStreamBuf::FlushBuffer() {
+  size_t len = pptr() - pbase();
+  if (len > 0 && !failed_) {
+    failed_ = !callback_(pbase(), len);
+  }
+  setp(buffer_.data(), buffer_.data() + buffer_.size());
+  return !failed_;
+}
+
+ChunkStreamBuf::int_type ChunkStreamBuf::overflow(int_type ch) {
+  if (!FlushBuffer()) {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+std::streamsize ChunkStreamBuf::xsputn(const char* s, std::streamsize n) {
+  if (failed_) {
+    return 0;
+  }
+  auto len = static_cast<size_t>(n);
+  if (len <= static_cast<size_t>(epptr() - pptr())) {
+    memcpy(pptr(), s, len);
+    pbump(static_cast<int>(len));
+    return n;
+  }
+  // not enough room, flush pending data
+  if (!FlushBuffer()) {
+    return 0;
+  }
+  // hand whole chunks to callback without copying
+  for (; len >= buffer_.size() && !failed_; s += buffer_.size(), len -= buffer_.size()) {
+    failed_ = !callback_(s, buffer_.size());
+  }
+  if (failed_) {
+    return 0;
+  }
+  memcpy(pptr(), s, len);
+  pbump(static_cast<int>(len));
+  return n;
+}
+
+int ChunkStreamBuf::sync() { return FlushBuffer() ? 0 : -1; }
+
 }  // namespace fustsdk
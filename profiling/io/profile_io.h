@@ -10,10 +10,14 @@
 #include <cstdio>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <memory>
+#include <streambuf>
 #include <string>
 #include <vector>
 
+#include "profiling/util/stats.h"
+
 namespace fustsdk {
 
 /// @brief binary header of gperftool generated cpu profile
@@ -54,20 +58,34 @@ enum class ReaderRetCode {
   kInvalidUnpackType = 14,
   kConvertErr = 15,
   kEmptyMapsText = 16,
+  kInvalidRecord = 17,
+  kCancelled = 18,
+  kDeadlineExceeded = 19,
 };
 
+/// @brief consumer of a decoded profile record, pcs are valid only during the call
+using RecordCallback = std::function<void(size_t sample_count, const size_t* pcs, size_t num_pcs)>;
+
 class CPUProfileReader {
  public:
-  explicit CPUProfileReader(const std::string& file);
-  explicit CPUProfileReader(std::unique_ptr<std::istream> is);
+  // @brief stats(nullable) collects bytes read, read time & slots decoded, it must outlive reader
+  explicit CPUProfileReader(const std::string& file, ProcessingStats* stats = nullptr);
+  explicit CPUProfileReader(std::unique_ptr<std::istream> is, ProcessingStats* stats = nullptr);
   ~CPUProfileReader() = default;
   ReaderRetCode GetSlot(size_t index, size_t* val);
+  /// @brief streaming alternative of GetSlot: read binary header, then ReadRecords, then ReadLeftContent for maps
+  // text. slots of records are decoded on the fly and not kept, memory is bounded by the deepest record
+  ReaderRetCode ReadHeader(CPUProfileBinaryHeader* header);
+  // @brief call callback for every record until binary trailer, record_num(nullable) is set to records read
+  ReaderRetCode ReadRecords(const RecordCallback& callback, size_t* record_num = nullptr);
   /// @brief read content left in file
   ReaderRetCode ReadLeftContent(std::string* content);
+  ProfileAddressLen GetAddressLen() const { return address_len_; }
 
  private:
   ReaderRetCode Init();
   ReaderRetCode NextSlot();
+  ReaderRetCode ReadSlot(size_t* val);
   template <size_t N>
   int ReadNextNChar(char (&buffer)[N]) {
     if (is_->read(buffer, N); !is_->good()) {
@@ -84,13 +102,64 @@ class CPUProfileReader {
   bool Bit64Convert(char (&buffer)[k64BitSize], size_t* val);
 
   std::string file_name_;
+  std::unique_ptr<std::istream> source_;          // wrapped by is_ if stats is set
+  std::unique_ptr<StatsStreamBuf> stats_buf_;
   std::unique_ptr<std::istream> is_;
+  ProcessingStats* stats_{nullptr};
   ReaderRetCode init_status_{ReaderRetCode::kNotInited};
   UnpackType unpack_type_{UnpackType::kNone};
   ProfileAddressLen address_len_{ProfileAddressLen::kNone};
   size_t hdr_count_{0};
   size_t hdr_words_{0};
   std::vector<size_t> slots_;
+  std::vector<size_t> pcs_;  // record being read by ReadRecords
+};
+
+/// @brief incremental reader of a profile file which is still being written(e.g. ProfilerStart is active)
+// file is kept open, every Poll reads bytes appended since last poll and decodes complete records only,
+// a partial trailing record is kept and decoded once the rest of it arrives.
+class CPUProfileFollowReader {
+ public:
+  // @brief stats(nullable) collects bytes read, read time & slots decoded, it must outlive reader
+  // file not created yet is opened by a later poll, polls before that decode nothing and return kOK
+  explicit CPUProfileFollowReader(const std::string& file, ProcessingStats* stats = nullptr);
+  explicit CPUProfileFollowReader(std::unique_ptr<std::istream> is, ProcessingStats* stats = nullptr);
+  ~CPUProfileFollowReader() = default;
+  // @brief decode records appended since last poll, callback is called for every complete record
+  // record_num(nullable) is set to records decoded by this poll
+  ReaderRetCode Poll(const RecordCallback& callback, size_t* record_num = nullptr);
+  // @brief whether binary header is complete
+  bool HeaderReady() const { return stage_ != Stage::kHeader; }
+  const CPUProfileBinaryHeader& GetHeader() const { return header_; }
+  // @brief whether binary trailer is found, only maps text may be appended after it
+  bool Finished() const { return stage_ == Stage::kMapsText; }
+  // @brief maps text read so far, complete once writer closes file
+  const std::string& GetMapsText() const { return maps_text_; }
+  // @brief bytes of file consumed by decoded header & records
+  size_t GetOffset() const { return consumed_offset_; }
+
+ private:
+  enum class Stage {
+    kHeader = 0,
+    kRecords = 1,
+    kMapsText = 2,
+  };
+  ReaderRetCode ReadAppended();
+  ReaderRetCode DecodeHeader(size_t* pos);
+  size_t WordAt(size_t pos) const;
+
+  std::unique_ptr<std::istream> is_;
+  std::string file_;                 // followed file, empty when reading given stream
+  std::ifstream* file_is_{nullptr};  // is_ opened from file_, reopened by polls until file exists
+  ProcessingStats* stats_{nullptr};
+  Stage stage_{Stage::kHeader};
+  UnpackType unpack_type_{UnpackType::kNone};
+  size_t word_size_{0};
+  CPUProfileBinaryHeader header_;
+  std::string pending_;         // bytes read but not decoded yet
+  size_t consumed_offset_{0};  // file offset of pending_ begin
+  std::vector<size_t> pcs_;    // decode buffer of current record
+  std::string maps_text_;
 };
 
 enum class WriterRetCode {
@@ -100,6 +169,7 @@ enum class WriterRetCode {
   kConvertErr = 22,
   kInvalidStream = 23,
   kInvalidAddrLen = 24,
+  kInvalidOptions = 25,
 };
 
 struct CPUProfileMetaData {
@@ -107,6 +177,10 @@ struct CPUProfileMetaData {
   ProfileAddressLen address_len{ProfileAddressLen::k64Bit};
 };
 
+constexpr size_t kDefaultChunkSize = 64 * 1024;
+
+/// @brief slots are encoded into an internal buffer and written to stream in large blocks,
+// buffered data is flushed by Flush/AppendMapsText/destructor
 class CPUProfileWriter {
  public:
   CPUProfileWriter(std::shared_ptr<std::ostream> os, const CPUProfileBinaryHeader& header,
@@ -121,27 +195,54 @@ class CPUProfileWriter {
     meta_ = meta;
     Init();
   }
-  ~CPUProfileWriter() = default;
+  ~CPUProfileWriter() { Flush(); }
   WriterRetCode AppendSlot(size_t val);
+  // @brief append n slots in bulk, every slot is subtracted by adjust
+  WriterRetCode AppendSlots(const uintptr_t* slots, size_t n, uintptr_t adjust = 0);
+  // @brief append whole record: sample_count, num_pcs, pcs, every pc except the first(leaf) is subtracted by pc_adjust
+  WriterRetCode AppendRecord(size_t sample_count, const void* const* pcs, size_t num_pcs, uintptr_t pc_adjust = 0);
   WriterRetCode AppendMapsText(const std::string& text);
+  // @brief write buffered slots to stream
+  WriterRetCode Flush();
 
  private:
   WriterRetCode Init();
-  bool Bit32Convert(size_t val, char (&buffer)[k32BitSize]);
-  bool Bit64Convert(size_t val, char (&buffer)[k64BitSize]);
-  template <size_t N>
-  int WriteNextNChar(char (&buffer)[N]) {
-    if (os_->write(buffer, N); !os_->good()) {
-      return -1;
-    }
-    return N;
-  }
+  template <typename T>
+  WriterRetCode AppendEncoded(const T* slots, size_t n, uintptr_t adjust);
 
   std::shared_ptr<std::ostream> os_;
   CPUProfileBinaryHeader header_;
   CPUProfileMetaData meta_;
   WriterRetCode init_status_{WriterRetCode::kNotInited};
   std::string error_msg_;
+  std::vector<char> buffer_;  // encoded slots not written yet
+  size_t buffered_{0};        // bytes used in buffer_
+};
+
+/// @brief output chunk consumer, return false to abort writing
+using ChunkCallback = std::function<bool(const char* data, size_t len)>;
+
+/// @brief return chunk callback which writes every chunk to fd(retry on EINTR & partial write)
+ChunkCallback FdChunkCallback(int fd);
+
+/// @brief streambuf with fixed-size buffer, hands full chunks to callback,
+// so that memory of std::ostream built on it does not grow with output size
+class ChunkStreamBuf : public std::streambuf {
+ public:
+  explicit ChunkStreamBuf(ChunkCallback callback, size_t chunk_size = kDefaultChunkSize);
+  ~ChunkStreamBuf() override { sync(); }
+
+ protected:
+  int_type overflow(int_type ch) override;
+  std::streamsize xsputn(const char* s, std::streamsize n) override;
+  int sync() override;
+
+ private:
+  bool FlushBuffer();
+
+  ChunkCallback callback_;
+  std::vector<char> buffer_;
+  bool failed_{false};
 };
 
 }  // namespace fustsdk
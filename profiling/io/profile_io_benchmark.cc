@@ -0,0 +1,145 @@
+/*
+ * FileName: profile_io_benchmark.cc
+ * Author: jattle
+ * Descrption: reader & writer throughput of every profile format(32/64-bit address, little/big endian)
+ */
+#include <map>
+#include <random>
+#include <sstream>
+#include <tuple>
+
+#include "benchmark/benchmark.h"
+
+#include "profiling/io/profile_io.h"
+
+using namespace pprofcpp;
+
+namespace {
+
+constexpr size_t kRecordNum = 100000;
+constexpr size_t kDepth = 16;
+
+CPUProfileMetaData ToMeta(const benchmark::State& state) {
+  CPUProfileMetaData meta;
+  meta.address_len = static_cast<ProfileAddressLen>(state.range(0));
+  meta.unpack_type = static_cast<UnpackType>(state.range(1));
+  return meta;
+}
+
+std::string ToLabel(const CPUProfileMetaData& meta) {
+  std::string label = meta.address_len == ProfileAddressLen::k32Bit ? "32bit" : "64bit";
+  return label + (meta.unpack_type == UnpackType::kBigEndian ? "_be" : "_le");
+}
+
+// deterministic records, pcs fit in 32 bits so that every format can encode them
+std::vector<uintptr_t> MakeSlots() {
+  std::mt19937_64 rng{0};
+  std::vector<uintptr_t> slots;
+  slots.reserve(kRecordNum * (kDepth + 2));
+  for (size_t i = 0; i < kRecordNum; i++) {
+    slots.push_back(rng() % 100 + 1);
+    slots.push_back(kDepth);
+    for (size_t d = 0; d < kDepth; d++) {
+      slots.push_back(0x400000 + rng() % 0x100000);
+    }
+  }
+  return slots;
+}
+
+const std::vector<uintptr_t>& GetSlots() {
+  static const std::vector<uintptr_t> slots = MakeSlots();
+  return slots;
+}
+
+// encoded profile of every format, built once
+const std::string& GetProfileBytes(const CPUProfileMetaData& meta) {
+  static std::map<std::tuple<ProfileAddressLen, UnpackType>, std::string> cache;
+  auto& bytes = cache[{meta.address_len, meta.unpack_type}];
+  if (bytes.empty()) {
+    auto os = std::make_shared<std::stringstream>();
+    {
+      CPUProfileWriter writer{os, CPUProfileBinaryHeader{}, meta};
+      writer.AppendSlots(GetSlots().data(), GetSlots().size());
+      // binary trailer
+      writer.AppendSlot(0);
+      writer.AppendSlot(1);
+      writer.AppendSlot(0);
+    }
+    bytes = os->str();
+  }
+  return bytes;
+}
+
+void FormatArgs(benchmark::internal::Benchmark* b) {
+  for (auto len : {ProfileAddressLen::k64Bit, ProfileAddressLen::k32Bit}) {
+    for (auto endian : {UnpackType::kLittleEndian, UnpackType::kBigEndian}) {
+      b->Args({static_cast<int64_t>(len), static_cast<int64_t>(endian)});
+    }
+  }
+  b->ArgNames({"addr_len", "endian"})->Unit(benchmark::kMillisecond);
+}
+
+}  // namespace
+
+static void BM_ReaderGetSlot(benchmark::State& state) {
+  auto meta = ToMeta(state);
+  const auto& bytes = GetProfileBytes(meta);
+  size_t slot_num = 0;
+  for (auto _ : state) {
+    CPUProfileReader reader{std::make_unique<std::istringstream>(bytes)};
+    size_t val;
+    for (slot_num = 0; reader.GetSlot(slot_num, &val) == ReaderRetCode::kOK; slot_num++) {
+      benchmark::DoNotOptimize(val);
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes.size()));
+  state.counters["slots"] = static_cast<double>(slot_num);
+  state.SetLabel(ToLabel(meta));
+}
+BENCHMARK(BM_ReaderGetSlot)->Apply(FormatArgs);
+
+static void BM_FollowReaderPoll(benchmark::State& state) {
+  auto meta = ToMeta(state);
+  const auto& bytes = GetProfileBytes(meta);
+  size_t record_num = 0;
+  for (auto _ : state) {
+    CPUProfileFollowReader reader{std::make_unique<std::istringstream>(bytes)};
+    size_t pc_sum = 0;
+    reader.Poll([&pc_sum](size_t, const size_t* pcs, size_t) { pc_sum += pcs[0]; }, &record_num);
+    benchmark::DoNotOptimize(pc_sum);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes.size()));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * record_num));
+  state.SetLabel(ToLabel(meta));
+}
+BENCHMARK(BM_FollowReaderPoll)->Apply(FormatArgs);
+
+static void BM_WriterAppendRecord(benchmark::State& state) {
+  auto meta = ToMeta(state);
+  const auto& slots = GetSlots();
+  size_t bytes = 0;
+  for (auto _ : state) {
+    bytes = 0;
+    ChunkStreamBuf buf{[&bytes](const char*, size_t len) -> bool {
+      bytes += len;
+      return true;
+    }};
+    auto os = std::make_shared<std::ostream>(&buf);
+    CPUProfileWriter writer{os, CPUProfileBinaryHeader{}, meta};
+    std::vector<const void*> pcs(kDepth);
+    for (size_t pos = 0; pos < slots.size(); pos += kDepth + 2) {
+      for (size_t d = 0; d < kDepth; d++) {
+        pcs[d] = reinterpret_cast<const void*>(slots[pos + 2 + d]);
+      }
+      writer.AppendRecord(slots[pos], pcs.data(), kDepth);
+    }
+    writer.Flush();
+    os->flush();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kRecordNum));
+  state.SetLabel(ToLabel(meta));
+}
+BENCHMARK(BM_WriterAppendRecord)->Apply(FormatArgs);
+
+BENCHMARK_MAIN();
@@ -3,7 +3,11 @@
  * Author jattle
  * Description:
  */
+#include <cstdio>
+#include <fstream>
+#include <iterator>
 #include <memory>
+#include <sstream>
 
 #include "profiling/io/profile_io.h"
 
@@ -63,6 +67,84 @@ TEST(CPUProfileReader, ReadLeftContent) {
   EXPECT_TRUE(!content.empty());
 }
 
+TEST(CPUProfileReader, ReadRecords) {
+  // same records as slot by slot reading
+  CPUProfileReader slots(kCPUProfileSample);
+  std::vector<std::vector<size_t>> expected;
+  size_t index = 5, sample_count, num_pcs, pc;
+  while (true) {
+    ASSERT_EQ(slots.GetSlot(index++, &sample_count), ReaderRetCode::kOK);
+    ASSERT_EQ(slots.GetSlot(index++, &num_pcs), ReaderRetCode::kOK);
+    ASSERT_EQ(slots.GetSlot(index, &pc), ReaderRetCode::kOK);
+    if (pc == 0) {
+      break;
+    }
+    std::vector<size_t> record{sample_count};
+    for (size_t i = 0; i < num_pcs; i++) {
+      ASSERT_EQ(slots.GetSlot(index++, &pc), ReaderRetCode::kOK);
+      record.push_back(pc);
+    }
+    expected.emplace_back(std::move(record));
+  }
+  CPUProfileReader reader(kCPUProfileSample);
+  CPUProfileBinaryHeader header;
+  ASSERT_EQ(reader.ReadHeader(&header), ReaderRetCode::kOK);
+  EXPECT_EQ(header.hdr_words, 3);
+  EXPECT_EQ(header.sampling_period, 10000);
+  std::vector<std::vector<size_t>> records;
+  size_t record_num{0};
+  auto callback = [&records](size_t sample_count, const size_t* pcs, size_t num_pcs) {
+    std::vector<size_t> record{sample_count};
+    record.insert(record.end(), pcs, pcs + num_pcs);
+    records.emplace_back(std::move(record));
+  };
+  ASSERT_EQ(reader.ReadRecords(callback, &record_num), ReaderRetCode::kOK);
+  EXPECT_EQ(records, expected);
+  EXPECT_EQ(record_num, expected.size());
+  // record slots are not kept
+  EXPECT_EQ(reader.slots_.size(), 5);
+  std::string maps_text;
+  EXPECT_EQ(reader.ReadLeftContent(&maps_text), ReaderRetCode::kEndOfFile);
+  EXPECT_FALSE(maps_text.empty());
+  // truncated file
+  std::ifstream ifs{kCPUProfileSample, std::ios_base::binary};
+  std::string content{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+  CPUProfileReader truncated(std::make_unique<std::istringstream>(content.substr(0, 1000)));
+  ASSERT_EQ(truncated.ReadHeader(&header), ReaderRetCode::kOK);
+  EXPECT_EQ(truncated.ReadRecords(callback), ReaderRetCode::kReadError);
+}
+
+TEST(CPUProfileReader, Stats) {
+  std::ifstream ifs(kCPUProfileSample, std::ios_base::binary);
+  std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  ProcessingStats stats;
+  CPUProfileReader reader(kCPUProfileSample, &stats);
+  CPUProfileReader plain(kCPUProfileSample);
+  EXPECT_EQ(reader.init_status_, ReaderRetCode::kOK);
+  size_t val{0}, expected{0};
+  for (size_t i = 0; i < 8; i++) {
+    ASSERT_EQ(reader.GetSlot(i, &val), ReaderRetCode::kOK);
+    ASSERT_EQ(plain.GetSlot(i, &expected), ReaderRetCode::kOK);
+    ASSERT_EQ(val, expected);
+  }
+  EXPECT_EQ(stats.slots_decoded, 8);
+  std::string left, expected_left;
+  EXPECT_EQ(reader.ReadLeftContent(&left), ReaderRetCode::kEndOfFile);
+  EXPECT_EQ(plain.ReadLeftContent(&expected_left), ReaderRetCode::kEndOfFile);
+  EXPECT_EQ(left, expected_left);
+  // whole file is read through stats buffer
+  EXPECT_EQ(stats.bytes_read, content.size());
+  EXPECT_GT(stats.GetPhase(StatsPhase::kRead).calls, 0);
+  // follow reader
+  ProcessingStats follow_stats;
+  CPUProfileFollowReader follower(std::make_unique<std::stringstream>(content), &follow_stats);
+  ASSERT_EQ(follower.Poll([](size_t, const size_t*, size_t) {}), ReaderRetCode::kOK);
+  ASSERT_TRUE(follower.Finished());
+  EXPECT_EQ(follow_stats.bytes_read, content.size());
+  EXPECT_GT(follow_stats.slots_decoded, 5);
+  EXPECT_EQ(follow_stats.GetPhase(StatsPhase::kRead).calls, 1);
+}
+
 void WriteThenRead(const CPUProfileMetaData& meta) {
   // serialize
   std::shared_ptr<std::ostream> os = std::make_shared<std::stringstream>();
@@ -145,3 +227,156 @@ TEST(CPUProfileWriter, Meta3) {
   meta.unpack_type = UnpackType::kBigEndian;
   WriteThenRead(meta);
 }
+
+TEST(ChunkStreamBuf, FixedSizeChunks) {
+  constexpr size_t kChunkSize = 16;
+  std::string output;
+  size_t max_chunk{0};
+  {
+    ChunkStreamBuf buf{[&](const char* data, size_t len) -> bool {
+                         output.append(data, len);
+                         max_chunk = std::max(max_chunk, len);
+                         return true;
+                       },
+                       kChunkSize};
+    std::ostream os{&buf};
+    os << "header\n";
+    for (int i = 0; i < 100; i++) {
+      os.put('a' + i % 26);
+    }
+    os << "tail\n";
+  }
+  EXPECT_EQ(output.size(), 7u + 100u + 5u);
+  EXPECT_EQ(output.substr(0, 7), "header\n");
+  EXPECT_LE(max_chunk, kChunkSize);
+}
+
+TEST(ChunkStreamBuf, AbortWriting) {
+  ChunkStreamBuf buf{[](const char*, size_t) -> bool { return false; }, 8};
+  std::ostream os{&buf};
+  os << "more than eight bytes";
+  os.flush();
+  EXPECT_FALSE(os.good());
+}
+
+TEST(CPUProfileWriter, AppendRecord) {
+  for (auto address_len : {ProfileAddressLen::k32Bit, ProfileAddressLen::k64Bit}) {
+    for (auto unpack_type : {UnpackType::kLittleEndian, UnpackType::kBigEndian}) {
+      CPUProfileMetaData meta;
+      meta.address_len = address_len;
+      meta.unpack_type = unpack_type;
+      CPUProfileBinaryHeader header;
+      std::shared_ptr<std::ostream> bulk_os = std::make_shared<std::stringstream>();
+      std::shared_ptr<std::ostream> slot_os = std::make_shared<std::stringstream>();
+      {
+        CPUProfileWriter bulk{bulk_os, header, meta};
+        CPUProfileWriter slot{slot_os, header, meta};
+        // enough records to span several internal buffers
+        std::vector<void*> pcs{reinterpret_cast<void*>(0x1000), reinterpret_cast<void*>(0x2001),
+                               reinterpret_cast<void*>(0x3001)};
+        for (size_t i = 0; i < 10000; i++) {
+          EXPECT_EQ(bulk.AppendRecord(i, pcs.data(), pcs.size(), 1), WriterRetCode::kOK);
+          for (auto v : {uintptr_t{i}, uintptr_t{3}, uintptr_t{0x1000}, uintptr_t{0x2000}, uintptr_t{0x3000}}) {
+            EXPECT_EQ(slot.AppendSlot(v), WriterRetCode::kOK);
+          }
+        }
+        std::vector<uintptr_t> trailer{0, 1, 0};
+        EXPECT_EQ(bulk.AppendSlots(trailer.data(), trailer.size()), WriterRetCode::kOK);
+        for (auto v : trailer) {
+          EXPECT_EQ(slot.AppendSlot(v), WriterRetCode::kOK);
+        }
+        EXPECT_EQ(bulk.Flush(), WriterRetCode::kOK);
+      }
+      EXPECT_EQ(static_cast<std::stringstream*>(bulk_os.get())->str(),
+                static_cast<std::stringstream*>(slot_os.get())->str());
+    }
+  }
+}
+
+TEST(CPUProfileFollowReader, PartialRecords) {
+  std::ifstream ifs(kCPUProfileSample, std::ios_base::binary);
+  std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  ASSERT_FALSE(content.empty());
+  const std::string file = "./follow_reader_test.prof";
+  std::ofstream ofs(file, std::ios_base::binary | std::ios_base::trunc);
+  CPUProfileFollowReader reader(file);
+  size_t total_records{0}, total_samples{0}, record_num{0};
+  auto callback = [&total_samples](size_t sample_count, const size_t* pcs, size_t num_pcs) {
+    EXPECT_GE(num_pcs, 1);
+    EXPECT_NE(pcs[0], 0);
+    total_samples += sample_count;
+  };
+  // empty file, nothing to decode yet
+  ASSERT_EQ(reader.Poll(callback, &record_num), ReaderRetCode::kOK);
+  ASSERT_FALSE(reader.HeaderReady());
+  // append in odd sized pieces so that header & records are split across polls
+  for (size_t pos = 0; pos < content.size(); pos += 37) {
+    ofs.write(content.data() + pos, std::min<size_t>(37, content.size() - pos));
+    ofs.flush();
+    ASSERT_EQ(reader.Poll(callback, &record_num), ReaderRetCode::kOK);
+    total_records += record_num;
+  }
+  ASSERT_TRUE(reader.HeaderReady());
+  ASSERT_TRUE(reader.Finished());
+  ASSERT_EQ(reader.GetHeader().sampling_period, 10000);
+  ASSERT_EQ(reader.GetOffset(), content.size());
+  ASSERT_FALSE(reader.GetMapsText().empty());
+  ASSERT_EQ(content.compare(content.size() - reader.GetMapsText().size(), std::string::npos, reader.GetMapsText()),
+            0);
+  // compare with full reader
+  CPUProfileReader full(kCPUProfileSample);
+  size_t index{5}, records{0}, samples{0}, sample_count{0}, num_pcs{0}, pc{0};
+  while (full.GetSlot(index, &sample_count) == ReaderRetCode::kOK && full.GetSlot(index + 1, &num_pcs) ==
+         ReaderRetCode::kOK && full.GetSlot(index + 2, &pc) == ReaderRetCode::kOK && pc != 0) {
+    records++;
+    samples += sample_count;
+    index += 2 + num_pcs;
+  }
+  ASSERT_EQ(total_records, records);
+  ASSERT_EQ(total_samples, samples);
+  remove(file.c_str());
+}
+
+TEST(CPUProfileFollowReader, FileCreatedLater) {
+  std::ifstream ifs(kCPUProfileSample, std::ios_base::binary);
+  std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  ASSERT_FALSE(content.empty());
+  const std::string file = "./follow_reader_later_test.prof";
+  remove(file.c_str());
+  CPUProfileFollowReader reader(file);
+  size_t total_records{0}, record_num{0};
+  auto callback = [](size_t, const size_t*, size_t) {};
+  // writer has not created file yet
+  ASSERT_EQ(reader.Poll(callback, &record_num), ReaderRetCode::kOK);
+  ASSERT_EQ(record_num, 0);
+  ASSERT_FALSE(reader.HeaderReady());
+  {
+    std::ofstream ofs(file, std::ios_base::binary | std::ios_base::trunc);
+    ofs.write(content.data(), content.size() / 2);
+    ofs.flush();
+    ASSERT_EQ(reader.Poll(callback, &record_num), ReaderRetCode::kOK);
+    ASSERT_TRUE(reader.HeaderReady());
+    total_records += record_num;
+    ofs.write(content.data() + content.size() / 2, content.size() - content.size() / 2);
+  }
+  ASSERT_EQ(reader.Poll(callback, &record_num), ReaderRetCode::kOK);
+  total_records += record_num;
+  ASSERT_TRUE(reader.Finished());
+  ASSERT_EQ(reader.GetOffset(), content.size());
+  CPUProfileFollowReader whole(std::make_unique<std::stringstream>(content));
+  ASSERT_EQ(whole.Poll(callback, &record_num), ReaderRetCode::kOK);
+  ASSERT_EQ(total_records, record_num);
+  remove(file.c_str());
+}
+
+TEST(CPUProfileFollowReader, InvalidRecord) {
+  auto ss = std::make_shared<std::stringstream>();
+  {
+    CPUProfileWriter writer(ss, CPUProfileBinaryHeader{});
+    // zero pcs is not allowed
+    writer.AppendSlot(1);
+    writer.AppendSlot(0);
+  }
+  CPUProfileFollowReader reader(std::make_unique<std::stringstream>(ss->str()));
+  ASSERT_EQ(reader.Poll([](size_t, const size_t*, size_t) {}), ReaderRetCode::kInvalidRecord);
+}
@@ -0,0 +1,314 @@
+/*
+ * FileName: synthetic_profile.cc
+ * Author: jattle
+ * Description:
+ */
+#include "profiling/io/synthetic_profile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "profiling/util/endian.h"
+
+namespace pprofcpp {
+
+namespace {
+
+// recent distinct stacks kept for duplicates
+constexpr size_t kDuplicatePoolSize = 4096;
+constexpr uint16_t kElfMachineX86_64 = 62;
+constexpr uint16_t kElfMachine386 = 3;
+constexpr uint16_t kElfMachinePPC64 = 21;
+constexpr uint16_t kElfMachinePPC = 20;
+constexpr char kShStrTab[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+constexpr uint32_t kTextName = 1;
+constexpr uint32_t kSymTabName = 7;
+constexpr uint32_t kStrTabName = 15;
+constexpr uint32_t kShStrTabName = 23;
+
+bool ValidateOptions(const SyntheticProfileOptions& options) {
+  if (options.min_depth == 0 || options.min_depth > options.max_depth || options.func_num == 0 ||
+      options.func_size < 2 || options.max_sample_count == 0 || options.duplicate_ratio < 0 ||
+      options.duplicate_ratio > 1) {
+    return false;
+  }
+  // geometric tail needs a positive mean, its p = 1 / (mean_depth - min_depth + 1) must be in (0, 1)
+  return options.depth_distribution != DepthDistribution::kGeometric || options.mean_depth > options.min_depth;
+}
+
+uint64_t TextEnd(const SyntheticProfileOptions& options) {
+  return options.text_base + static_cast<uint64_t>(options.func_num) * options.func_size;
+}
+
+bool AddressFits(const SyntheticProfileOptions& options) {
+  return options.meta.address_len != ProfileAddressLen::k32Bit || TextEnd(options) <= UINT32_MAX;
+}
+
+/// @brief sequential writer of ELF fields in target class & byte order, buffered
+class ElfEmitter {
+ public:
+  ElfEmitter(std::ostream& os, bool is_64bit, bool big_endian) : os_(os), is_64bit_(is_64bit), big_endian_(big_endian) {
+    buffer_.reserve(kDefaultChunkSize);
+  }
+  ~ElfEmitter() { Flush(); }
+  void U8(uint8_t v) { Put(&v, 1); }
+  void U16(uint16_t v) {
+    v = big_endian_ ? htobe16(v) : htole16(v);
+    Put(&v, sizeof(v));
+  }
+  void U32(uint32_t v) {
+    v = big_endian_ ? htobe32(v) : htole32(v);
+    Put(&v, sizeof(v));
+  }
+  void U64(uint64_t v) {
+    v = big_endian_ ? htobe64(v) : htole64(v);
+    Put(&v, sizeof(v));
+  }
+  // @brief class sized field: Addr, Off & Xword of ELF64, Addr, Off & Word of ELF32
+  void Word(uint64_t v) { is_64bit_ ? U64(v) : U32(static_cast<uint32_t>(v)); }
+  void Bytes(const char* data, size_t len) { Put(data, len); }
+  void PadTo(size_t offset) {
+    while (offset_ < offset) {
+      U8(0);
+    }
+  }
+  bool Flush() {
+    os_.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+    return os_.good();
+  }
+
+ private:
+  void Put(const void* data, size_t len) {
+    buffer_.append(static_cast<const char*>(data), len);
+    offset_ += len;
+    if (buffer_.size() >= kDefaultChunkSize) {
+      Flush();
+    }
+  }
+
+  std::ostream& os_;
+  bool is_64bit_;
+  bool big_endian_;
+  std::string buffer_;
+  size_t offset_{0};
+};
+
+size_t AlignUp(size_t v, size_t align) { return (v + align - 1) / align * align; }
+
+}  // namespace
+
+std::string SyntheticFunctionName(size_t index, bool mangled) {
+  std::string cls = "Class" + std::to_string(index % 97);
+  std::string method = "Method" + std::to_string(index);
+  if (!mangled) {
+    return "synth_" + cls + "_" + method;
+  }
+  return "_ZN5synth" + std::to_string(cls.size()) + cls + std::to_string(method.size()) + method + "Ev";
+}
+
+std::string MakeSyntheticMapsText(const SyntheticProfileOptions& options) {
+  bool is_64bit = options.meta.address_len != ProfileAddressLen::k32Bit;
+  constexpr size_t kLineSize = 128;
+  char line[kLineSize];
+  std::string text;
+  auto page_end = AlignUp(TextEnd(options), 4096);
+  snprintf(line, kLineSize, "%08lx-%08lx r-xp 00000000 08:01 %d   %s\n", static_cast<unsigned long>(options.text_base),
+           static_cast<unsigned long>(page_end), 1000, options.program_path.c_str());
+  text += line;
+  // shared libs far above program text
+  uint64_t lib_base = is_64bit ? 0x7f0000000000 : 0xb0000000;
+  constexpr uint64_t kLibSpan = 0x100000;
+  for (size_t i = 0; i < options.maps_lib_num; i++) {
+    uint64_t start = lib_base + i * kLibSpan;
+    snprintf(line, kLineSize, "%08lx-%08lx r-xp 00000000 08:01 %zu   /usr/lib/libsynthetic%zu.so\n",
+             static_cast<unsigned long>(start), static_cast<unsigned long>(start + kLibSpan), 2000 + i, i);
+    text += line;
+  }
+  return text;
+}
+
+WriterRetCode WriteSyntheticProfile(const SyntheticProfileOptions& options, std::shared_ptr<std::ostream> os,
+                                    SyntheticProfileStats* stats) {
+  if (!ValidateOptions(options)) {
+    return WriterRetCode::kInvalidOptions;
+  }
+  if (!AddressFits(options)) {
+    return WriterRetCode::kInvalidAddrLen;
+  }
+  SyntheticProfileStats local_stats;
+  if (stats == nullptr) {
+    stats = &local_stats;
+  }
+  *stats = SyntheticProfileStats{};
+  CPUProfileBinaryHeader header;
+  header.sampling_period = options.sampling_period;
+  CPUProfileWriter writer{std::move(os), header, options.meta};
+  std::mt19937_64 rng{options.seed};
+  std::uniform_int_distribution<size_t> depth_uniform{options.min_depth, options.max_depth};
+  std::optional<std::geometric_distribution<size_t>> depth_tail;
+  if (options.depth_distribution == DepthDistribution::kGeometric) {
+    depth_tail.emplace(1.0 / (options.mean_depth - options.min_depth + 1));
+  }
+  std::uniform_int_distribution<size_t> func_dist{0, options.func_num - 1};
+  std::uniform_int_distribution<size_t> offset_dist{1, options.func_size - 1};
+  std::uniform_int_distribution<size_t> count_dist{1, options.max_sample_count};
+  std::bernoulli_distribution duplicate_dist{options.duplicate_ratio};
+  auto next_depth = [&]() -> size_t {
+    switch (options.depth_distribution) {
+      case DepthDistribution::kFixed:
+        return options.max_depth;
+      case DepthDistribution::kUniform:
+        return depth_uniform(rng);
+      case DepthDistribution::kGeometric:
+        return std::min(options.min_depth + (*depth_tail)(rng), options.max_depth);
+    }
+    return options.max_depth;
+  };
+  // ring of recent distinct stacks, flat storage so that nothing is allocated per record
+  std::vector<const void*> pool_pcs(kDuplicatePoolSize * options.max_depth);
+  std::vector<size_t> pool_depths(kDuplicatePoolSize);
+  size_t pool_size = 0, pool_next = 0;
+  std::vector<const void*> pcs(options.max_depth);
+  for (size_t r = 0; r < options.record_num; r++) {
+    const void* const* record_pcs;
+    size_t depth;
+    if (pool_size > 0 && duplicate_dist(rng)) {
+      size_t slot = std::uniform_int_distribution<size_t>{0, pool_size - 1}(rng);
+      record_pcs = pool_pcs.data() + slot * options.max_depth;
+      depth = pool_depths[slot];
+      stats->duplicate_record_num++;
+    } else {
+      depth = next_depth();
+      for (size_t d = 0; d < depth; d++) {
+        // leaf may be anywhere in function, return address of caller is after call instruction
+        uint64_t start = options.text_base + func_dist(rng) * options.func_size;
+        pcs[d] = reinterpret_cast<const void*>(start + (d == 0 ? offset_dist(rng) - 1 : offset_dist(rng)));
+      }
+      std::copy(pcs.begin(), pcs.begin() + depth, pool_pcs.begin() + pool_next * options.max_depth);
+      pool_depths[pool_next] = depth;
+      pool_next = (pool_next + 1) % kDuplicatePoolSize;
+      pool_size = std::min(pool_size + 1, kDuplicatePoolSize);
+      record_pcs = pcs.data();
+    }
+    size_t sample_count = count_dist(rng);
+    if (auto ret = writer.AppendRecord(sample_count, record_pcs, depth); ret != WriterRetCode::kOK) {
+      return ret;
+    }
+    stats->record_num++;
+    stats->pc_num += depth;
+    stats->sample_count += sample_count;
+  }
+  // binary trailer
+  for (size_t slot : {0, 1, 0}) {
+    if (auto ret = writer.AppendSlot(slot); ret != WriterRetCode::kOK) {
+      return ret;
+    }
+  }
+  return writer.AppendMapsText(MakeSyntheticMapsText(options));
+}
+
+WriterRetCode WriteSyntheticElf(const SyntheticProfileOptions& options, std::ostream& os) {
+  if (!ValidateOptions(options)) {
+    return WriterRetCode::kInvalidOptions;
+  }
+  if (!AddressFits(options)) {
+    return WriterRetCode::kInvalidAddrLen;
+  }
+  bool is_64bit = options.meta.address_len != ProfileAddressLen::k32Bit;
+  bool big_endian = options.meta.unpack_type == UnpackType::kBigEndian;
+  size_t ehdr_size = is_64bit ? 64 : 52;
+  size_t shdr_size = is_64bit ? 64 : 40;
+  size_t sym_size = is_64bit ? 24 : 16;
+  constexpr size_t kSectionNum = 5;
+  // layout: ehdr | .symtab | .strtab | .shstrtab | section headers
+  size_t symtab_offset = AlignUp(ehdr_size, 8);
+  size_t symtab_size = (options.func_num + 1) * sym_size;
+  size_t strtab_offset = symtab_offset + symtab_size;
+  size_t strtab_size = 1;
+  for (size_t i = 0; i < options.func_num; i++) {
+    strtab_size += SyntheticFunctionName(i, options.mangled_names).size() + 1;
+  }
+  size_t shstrtab_offset = strtab_offset + strtab_size;
+  size_t shstrtab_size = sizeof(kShStrTab);
+  size_t shdr_offset = AlignUp(shstrtab_offset + shstrtab_size, 8);
+
+  ElfEmitter e{os, is_64bit, big_endian};
+  // ELF header
+  const char ident[16] = {0x7f, 'E', 'L', 'F', static_cast<char>(is_64bit ? 2 : 1), static_cast<char>(big_endian ? 2 : 1),
+                          1};
+  e.Bytes(ident, sizeof(ident));
+  e.U16(2);  // ET_EXEC
+  e.U16(big_endian ? (is_64bit ? kElfMachinePPC64 : kElfMachinePPC) : (is_64bit ? kElfMachineX86_64 : kElfMachine386));
+  e.U32(1);  // EV_CURRENT
+  e.Word(options.text_base);  // entry
+  e.Word(0);                  // no program header
+  e.Word(shdr_offset);
+  e.U32(0);  // flags
+  e.U16(static_cast<uint16_t>(ehdr_size));
+  e.U16(0);
+  e.U16(0);
+  e.U16(static_cast<uint16_t>(shdr_size));
+  e.U16(kSectionNum);
+  e.U16(kSectionNum - 1);  // .shstrtab
+  e.PadTo(symtab_offset);
+  // .symtab, null symbol first, then one global function per synthetic function in .text(section 1)
+  e.Bytes(std::string(sym_size, '\0').data(), sym_size);
+  uint32_t name_offset = 1;
+  constexpr uint8_t kGlobalFunc = (1 << 4) | 2;  // STB_GLOBAL, STT_FUNC
+  for (size_t i = 0; i < options.func_num; i++) {
+    uint64_t value = options.text_base + i * options.func_size;
+    e.U32(name_offset);
+    if (is_64bit) {
+      e.U8(kGlobalFunc);
+      e.U8(0);
+      e.U16(1);
+      e.U64(value);
+      e.U64(options.func_size);
+    } else {
+      e.U32(static_cast<uint32_t>(value));
+      e.U32(static_cast<uint32_t>(options.func_size));
+      e.U8(kGlobalFunc);
+      e.U8(0);
+      e.U16(1);
+    }
+    name_offset += static_cast<uint32_t>(SyntheticFunctionName(i, options.mangled_names).size() + 1);
+  }
+  // .strtab
+  e.U8(0);
+  for (size_t i = 0; i < options.func_num; i++) {
+    std::string name = SyntheticFunctionName(i, options.mangled_names);
+    e.Bytes(name.c_str(), name.size() + 1);
+  }
+  e.Bytes(kShStrTab, shstrtab_size);
+  e.PadTo(shdr_offset);
+  // section headers
+  auto section = [&](uint32_t name, uint32_t type, uint64_t flags, uint64_t addr, uint64_t offset, uint64_t size,
+                     uint32_t link, uint32_t info, uint64_t align, uint64_t entsize) {
+    e.U32(name);
+    e.U32(type);
+    e.Word(flags);
+    e.Word(addr);
+    e.Word(offset);
+    e.Word(size);
+    e.U32(link);
+    e.U32(info);
+    e.Word(align);
+    e.Word(entsize);
+  };
+  constexpr uint32_t kSymTab = 2, kStrTab = 3, kNoBits = 8;
+  constexpr uint64_t kAllocExec = 0x2 | 0x4;  // SHF_ALLOC | SHF_EXECINSTR
+  section(0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  section(kTextName, kNoBits, kAllocExec, options.text_base, symtab_offset, TextEnd(options) - options.text_base, 0, 0,
+          16, 0);
+  section(kSymTabName, kSymTab, 0, 0, symtab_offset, symtab_size, 3, 1, 8, sym_size);
+  section(kStrTabName, kStrTab, 0, 0, strtab_offset, strtab_size, 0, 0, 1, 0);
+  section(kShStrTabName, kStrTab, 0, 0, shstrtab_offset, shstrtab_size, 0, 0, 1, 0);
+  return e.Flush() ? WriterRetCode::kOK : WriterRetCode::kWriteError;
+}
+
+}  // namespace pprofcpp
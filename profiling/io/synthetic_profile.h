@@ -0,0 +1,67 @@
+/*
+ * FileName: synthetic_profile.h
+ * Author: jattle
+ * Description: synthetic gperftools CPU profile and matching ELF symbol table generator for scale testing
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "profiling/io/profile_io.h"
+
+namespace pprofcpp {
+
+enum class DepthDistribution {
+  kFixed = 0,      // every stack is max_depth deep
+  kUniform = 1,    // uniform in [min_depth, max_depth]
+  kGeometric = 2,  // min_depth + geometric tail with mean mean_depth(> min_depth), clipped to max_depth
+};
+
+/// @brief synthetic program: func_num functions of func_size bytes laid out from text_base,
+// function i is named by SyntheticFunctionName(i), every pc of generated profile falls into one of them
+struct SyntheticProfileOptions {
+  size_t record_num{100000};
+  DepthDistribution depth_distribution{DepthDistribution::kUniform};
+  size_t min_depth{4};
+  size_t max_depth{32};
+  double mean_depth{12};
+  double duplicate_ratio{0.5};  // fraction of records repeating an earlier stack
+  size_t max_sample_count{10};  // sample count of record is uniform in [1, max_sample_count]
+  size_t sampling_period{10000};
+  CPUProfileMetaData meta;      // address length & byte order of profile and ELF
+  size_t func_num{16384};
+  size_t func_size{256};
+  uintptr_t text_base{0x400000};
+  bool mangled_names{true};     // C++ mangled names, so that symbolization pays for demangling
+  std::string program_path{"/usr/local/bin/synthetic"};
+  size_t maps_lib_num{16};      // extra shared lib mappings in maps text, never hit by pcs
+  uint64_t seed{0};
+};
+
+struct SyntheticProfileStats {
+  size_t record_num{0};
+  size_t duplicate_record_num{0};
+  size_t pc_num{0};
+  size_t sample_count{0};
+};
+
+/// @brief name of synthetic function index, mangled one demangles to "synth::Class{index % 97}::Method{index}()"
+std::string SyntheticFunctionName(size_t index, bool mangled);
+
+/// @brief maps text of synthetic program, program mapping first then maps_lib_num shared libs
+std::string MakeSyntheticMapsText(const SyntheticProfileOptions& options);
+
+/// @brief stream synthetic profile in gperftools format into os, memory is bounded regardless of record_num
+// stats is nullable
+WriterRetCode WriteSyntheticProfile(const SyntheticProfileOptions& options, std::shared_ptr<std::ostream> os,
+                                    SyntheticProfileStats* stats = nullptr);
+
+/// @brief write ELF executable of synthetic program into os, only .symtab carries content, .text is NOBITS.
+// class & byte order follow options.meta: x86-64/i386 for little endian, ppc64/ppc for big endian
+WriterRetCode WriteSyntheticElf(const SyntheticProfileOptions& options, std::ostream& os);
+
+}  // namespace pprofcpp
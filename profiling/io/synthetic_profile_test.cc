@@ -0,0 +1,157 @@
+/*
+ * FileName: synthetic_profile_test.cc
+ * Author: jattle
+ * Description:
+ */
+#include "profiling/io/synthetic_profile.h"
+
+#include <elf.h>
+
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+using namespace pprofcpp;
+
+struct ReadBack {
+  CPUProfileBinaryHeader header;
+  size_t record_num{0};
+  size_t sample_count{0};
+  size_t min_depth{SIZE_MAX};
+  size_t max_depth{0};
+  bool pcs_in_text{true};
+  std::string maps_text;
+};
+
+static ReadBack Generate(const SyntheticProfileOptions& options, SyntheticProfileStats* stats) {
+  auto os = std::make_shared<std::stringstream>();
+  EXPECT_EQ(WriteSyntheticProfile(options, os, stats), WriterRetCode::kOK);
+  ReadBack result;
+  CPUProfileFollowReader reader{std::make_unique<std::stringstream>(os->str())};
+  uint64_t text_end = options.text_base + options.func_num * options.func_size;
+  EXPECT_EQ(reader.Poll([&](size_t sample_count, const size_t* pcs, size_t num_pcs) {
+    result.record_num++;
+    result.sample_count += sample_count;
+    result.min_depth = std::min(result.min_depth, num_pcs);
+    result.max_depth = std::max(result.max_depth, num_pcs);
+    for (size_t i = 0; i < num_pcs; i++) {
+      result.pcs_in_text = result.pcs_in_text && pcs[i] >= options.text_base && pcs[i] < text_end;
+    }
+  }),
+            ReaderRetCode::kOK);
+  EXPECT_TRUE(reader.Finished());
+  result.header = reader.GetHeader();
+  result.maps_text = reader.GetMapsText();
+  return result;
+}
+
+TEST(SyntheticProfile, EveryFormat) {
+  for (auto len : {ProfileAddressLen::k64Bit, ProfileAddressLen::k32Bit}) {
+    for (auto endian : {UnpackType::kLittleEndian, UnpackType::kBigEndian}) {
+      SyntheticProfileOptions options;
+      options.record_num = 2000;
+      options.meta.address_len = len;
+      options.meta.unpack_type = endian;
+      options.duplicate_ratio = 0.25;
+      SyntheticProfileStats stats;
+      auto result = Generate(options, &stats);
+      EXPECT_EQ(result.record_num, options.record_num);
+      EXPECT_EQ(stats.record_num, options.record_num);
+      EXPECT_EQ(result.sample_count, stats.sample_count);
+      EXPECT_EQ(result.header.sampling_period, options.sampling_period);
+      EXPECT_GE(result.min_depth, options.min_depth);
+      EXPECT_LE(result.max_depth, options.max_depth);
+      EXPECT_TRUE(result.pcs_in_text);
+      EXPECT_NEAR(static_cast<double>(stats.duplicate_record_num) / stats.record_num, 0.25, 0.05);
+      EXPECT_EQ(result.maps_text, MakeSyntheticMapsText(options));
+    }
+  }
+}
+
+TEST(SyntheticProfile, DepthAndOptions) {
+  SyntheticProfileOptions options;
+  options.record_num = 500;
+  options.depth_distribution = DepthDistribution::kFixed;
+  options.max_depth = 7;
+  SyntheticProfileStats stats;
+  auto result = Generate(options, &stats);
+  EXPECT_EQ(result.min_depth, 7u);
+  EXPECT_EQ(result.max_depth, 7u);
+  EXPECT_EQ(stats.pc_num, 500u * 7);
+  options.depth_distribution = DepthDistribution::kGeometric;
+  options.min_depth = 2;
+  options.mean_depth = 4;
+  options.max_depth = 64;
+  options.record_num = 5000;
+  options.duplicate_ratio = 0;
+  result = Generate(options, &stats);
+  EXPECT_GE(result.min_depth, 2u);
+  EXPECT_NEAR(static_cast<double>(stats.pc_num) / stats.record_num, 4, 0.3);
+  EXPECT_EQ(stats.duplicate_record_num, 0u);
+  // same seed, same bytes
+  auto os1 = std::make_shared<std::stringstream>();
+  auto os2 = std::make_shared<std::stringstream>();
+  WriteSyntheticProfile(options, os1);
+  WriteSyntheticProfile(options, os2);
+  EXPECT_EQ(os1->str(), os2->str());
+  options.min_depth = 0;
+  EXPECT_EQ(WriteSyntheticProfile(options, std::make_shared<std::stringstream>()), WriterRetCode::kInvalidOptions);
+  options.min_depth = 2;
+  // geometric tail needs mean_depth > min_depth, other distributions ignore mean_depth
+  options.mean_depth = 2;
+  EXPECT_EQ(WriteSyntheticProfile(options, std::make_shared<std::stringstream>()), WriterRetCode::kInvalidOptions);
+  options.depth_distribution = DepthDistribution::kUniform;
+  options.min_depth = 8;
+  EXPECT_EQ(WriteSyntheticProfile(options, std::make_shared<std::stringstream>()), WriterRetCode::kOK);
+  options.min_depth = 2;
+  options.meta.address_len = ProfileAddressLen::k32Bit;
+  options.text_base = 0xfffff000;
+  EXPECT_EQ(WriteSyntheticProfile(options, std::make_shared<std::stringstream>()), WriterRetCode::kInvalidAddrLen);
+}
+
+TEST(SyntheticProfile, FunctionName) {
+  EXPECT_EQ(SyntheticFunctionName(12, true), "_ZN5synth7Class128Method12Ev");
+  EXPECT_EQ(SyntheticFunctionName(12, false), "synth_Class12_Method12");
+}
+
+TEST(SyntheticProfile, Elf) {
+  SyntheticProfileOptions options;
+  options.func_num = 100;
+  std::stringstream ss;
+  ASSERT_EQ(WriteSyntheticElf(options, ss), WriterRetCode::kOK);
+  std::string elf = ss.str();
+  ASSERT_GE(elf.size(), sizeof(Elf64_Ehdr));
+  const auto* ehdr = reinterpret_cast<const Elf64_Ehdr*>(elf.data());
+  ASSERT_EQ(memcmp(ehdr->e_ident, ELFMAG, SELFMAG), 0);
+  EXPECT_EQ(ehdr->e_ident[EI_CLASS], ELFCLASS64);
+  EXPECT_EQ(ehdr->e_machine, EM_X86_64);
+  ASSERT_EQ(ehdr->e_shnum, 5);
+  ASSERT_EQ(ehdr->e_shoff + ehdr->e_shnum * sizeof(Elf64_Shdr), elf.size());
+  const auto* shdrs = reinterpret_cast<const Elf64_Shdr*>(elf.data() + ehdr->e_shoff);
+  const auto& text = shdrs[1];
+  EXPECT_EQ(text.sh_type, static_cast<uint32_t>(SHT_NOBITS));
+  EXPECT_EQ(text.sh_addr, options.text_base);
+  EXPECT_EQ(text.sh_size, options.func_num * options.func_size);
+  const auto& symtab = shdrs[2];
+  ASSERT_EQ(symtab.sh_type, static_cast<uint32_t>(SHT_SYMTAB));
+  ASSERT_EQ(symtab.sh_size / sizeof(Elf64_Sym), options.func_num + 1);
+  const auto* syms = reinterpret_cast<const Elf64_Sym*>(elf.data() + symtab.sh_offset);
+  const char* strtab = elf.data() + shdrs[symtab.sh_link].sh_offset;
+  for (size_t i = 0; i < options.func_num; i++) {
+    const auto& sym = syms[i + 1];
+    EXPECT_EQ(sym.st_value, options.text_base + i * options.func_size);
+    EXPECT_EQ(sym.st_shndx, 1);
+    EXPECT_EQ(ELF64_ST_TYPE(sym.st_info), STT_FUNC);
+    EXPECT_EQ(std::string(strtab + sym.st_name), SyntheticFunctionName(i, true));
+  }
+  const char* shstrtab = elf.data() + shdrs[ehdr->e_shstrndx].sh_offset;
+  EXPECT_STREQ(shstrtab + text.sh_name, ".text");
+  // 32-bit big endian header
+  options.meta.address_len = ProfileAddressLen::k32Bit;
+  options.meta.unpack_type = UnpackType::kBigEndian;
+  std::stringstream ss32;
+  ASSERT_EQ(WriteSyntheticElf(options, ss32), WriterRetCode::kOK);
+  elf = ss32.str();
+  EXPECT_EQ(elf[EI_CLASS], ELFCLASS32);
+  EXPECT_EQ(elf[EI_DATA], ELFDATA2MSB);
+}
@@ -0,0 +1,163 @@
+/*
+ * FileName: profile_snapshot.cc
+ * Author: jattle
+ * Descrption:
+ */
+
+#include "profiling/profile_snapshot.h"
+
+#include <algorithm>
+#include <string>
+
+#include "profiling/util/utils.h"
+
+namespace pprofcpp {
+
+namespace {
+
+constexpr uint32_t kUnmapped = UINT32_MAX;
+
+}  // namespace
+
+CPUProfileRetCode ProfileSnapshot::Build(CPUProfile* profile, SymbolLocator* locator,
+                                         std::shared_ptr<const ProfileSnapshot>* snapshot) {
+  const auto& stacks = profile->GetCallStacks();
+  if (stacks.empty()) {
+    return CPUProfileRetCode::kEmptyStack;
+  }
+  const auto& interned = profile->GetInternedSymbols(locator);
+  if (interned.table == nullptr) {
+    return CPUProfileRetCode::kSearchSymbolFailed;
+  }
+  std::shared_ptr<ProfileSnapshot> snap{new ProfileSnapshot};
+  snap->header_ = profile->GetHeader();
+  snap->maps_text_ = profile->GetMapsText();
+  // only names referenced by this profile are copied, ids are renumbered densely, id 0 stays the empty name
+  std::vector<uint32_t> remap(interned.table->Size(), kUnmapped);
+  remap[SymbolTable::kUnknownSymbolId] = 0;
+  snap->addrs_.assign(interned.addrs.cbegin(), interned.addrs.cend());
+  snap->addr_syms_.reserve(interned.addrs.size());
+  for (size_t i = 0; i < interned.addrs.size(); i++) {
+    uint32_t& id = remap[interned.sym_ids[i]];
+    if (id == kUnmapped) {
+      id = static_cast<uint32_t>(snap->name_offsets_.size() - 1);
+      snap->name_data_.append(interned.table->GetName(interned.sym_ids[i]));
+      snap->name_offsets_.push_back(snap->name_data_.size());
+    }
+    snap->addr_syms_.push_back(id);
+  }
+  size_t pc_num{0};
+  for (const auto& s : stacks) {
+    pc_num += s.ptrs.size();
+  }
+  snap->counts_.reserve(stacks.size());
+  snap->offsets_.reserve(stacks.size() + 1);
+  snap->pcs_.reserve(pc_num);
+  snap->frame_syms_.reserve(pc_num);
+  for (const auto& s : stacks) {
+    for (size_t i = 0; i < s.ptrs.size(); i++) {
+      auto addr = ToSymbolAddr(s.ptrs.data(), i);
+      auto iter = std::lower_bound(snap->addrs_.cbegin(), snap->addrs_.cend(), addr);
+      bool found = iter != snap->addrs_.cend() && *iter == addr;
+      snap->pcs_.push_back(s.ptrs[i]);
+      snap->frame_syms_.push_back(found ? snap->addr_syms_[iter - snap->addrs_.cbegin()] : 0);
+    }
+    snap->counts_.push_back(s.sample_count);
+    snap->offsets_.push_back(snap->pcs_.size());
+    snap->total_samples_ += s.sample_count;
+  }
+  *snapshot = std::move(snap);
+  return CPUProfileRetCode::kOK;
+}
+
+std::vector<uint32_t> ProfileSnapshot::FindSymbols(std::string_view pattern) const {
+  std::vector<uint32_t> sym_ids;
+  for (uint32_t id = 1; id < GetNameNum(); id++) {
+    if (GetName(id).find(pattern) != std::string_view::npos) {
+      sym_ids.push_back(id);
+    }
+  }
+  return sym_ids;
+}
+
+std::vector<uint32_t> ProfileSnapshot::FilterStacks(const std::vector<uint32_t>& sym_ids) const {
+  std::vector<bool> wanted(GetNameNum());
+  for (auto id : sym_ids) {
+    if (id < wanted.size()) {
+      wanted[id] = true;
+    }
+  }
+  std::vector<uint32_t> stack_ids;
+  for (uint32_t id = 0; id < Size(); id++) {
+    const uint32_t* syms = GetSymIds(id);
+    if (std::any_of(syms, syms + GetDepth(id), [&wanted](uint32_t sym) { return wanted[sym]; })) {
+      stack_ids.push_back(id);
+    }
+  }
+  return stack_ids;
+}
+
+void ProfileSnapshot::TopFunctions(size_t n, bool order_by_cum, std::vector<FunctionSamples>* functions,
+                                   const std::vector<uint32_t>* stack_ids) const {
+  size_t stack_num = stack_ids == nullptr ? Size() : stack_ids->size();
+  CollectTopFunctions(
+      stack_num,
+      [this, stack_ids](size_t k) {
+        uint32_t id = stack_ids == nullptr ? static_cast<uint32_t>(k) : (*stack_ids)[k];
+        return SymbolizedStack{GetSymIds(id), GetDepth(id), counts_[id]};
+      },
+      GetNameNum(), [this](uint32_t sym_id) { return GetName(sym_id); }, n, order_by_cum, functions);
+}
+
+CPUProfileRetCode ProfileSnapshot::GenerateRawProfile(const RawProfileMeta& meta, std::ostream& os,
+                                                      const std::vector<uint32_t>* stack_ids) const {
+  return WriteRawProfile(
+      meta, header_, addrs_.data(), addrs_.size(),
+      [this](size_t i) -> std::string_view { return GetName(addr_syms_[i]); },
+      [this, stack_ids](const RawRecordSink& sink) {
+        size_t stack_num = stack_ids == nullptr ? Size() : stack_ids->size();
+        for (size_t k = 0; k < stack_num; k++) {
+          uint32_t id = stack_ids == nullptr ? static_cast<uint32_t>(k) : (*stack_ids)[k];
+          if (!sink(counts_[id], GetPcs(id), GetDepth(id))) {
+            return CPUProfileRetCode::kGenProfileFailed;
+          }
+        }
+        return CPUProfileRetCode::kOK;
+      },
+      os);
+}
+
+CPUProfileRetCode ProfileSnapshot::GenerateFoldedProfile(std::ostream& os,
+                                                         const std::vector<uint32_t>* stack_ids) const {
+  std::string line;
+  char hex_addr[kHexAddrLen];
+  auto append = [&](uint32_t id) {
+    line.clear();
+    const auto* pcs = GetPcs(id);
+    const auto* sym_ids = GetSymIds(id);
+    for (size_t i = GetDepth(id); i > 0; i--) {
+      if (sym_ids[i - 1] == 0) {
+        line.append(hex_addr, FormatHexAddr(reinterpret_cast<uintptr_t>(pcs[i - 1]), hex_addr));
+      } else {
+        line.append(GetName(sym_ids[i - 1]));
+      }
+      line.push_back(i > 1 ? ';' : ' ');
+    }
+    line.append(std::to_string(counts_[id]));
+    line.push_back('\n');
+    os.write(line.data(), line.size());
+  };
+  if (stack_ids == nullptr) {
+    for (uint32_t id = 0; id < Size(); id++) {
+      append(id);
+    }
+  } else {
+    for (auto id : *stack_ids) {
+      append(id);
+    }
+  }
+  os.flush();
+  return os.good() ? CPUProfileRetCode::kOK : CPUProfileRetCode::kWriteOutputFailed;
+}
+
+}  // namespace pprofcpp
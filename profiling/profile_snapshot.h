@@ -0,0 +1,85 @@
+/*
+ * FileName: profile_snapshot.h
+ * Author: jattle
+ * Descrption: immutable symbolized CPU profile shared by concurrent readers
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "profiling/cpu_profile.h"
+#include "profiling/stack_symbolizer.h"
+#include "profiling/symbol/profile_symbol.h"
+
+namespace pprofcpp {
+
+/// @brief frozen view of a parsed & symbolized CPUProfile.
+// Build compacts the profile in a single pass: stacks in CSR form with a symbol id for every frame, sorted symbol
+// addrs and names referenced by the profile in one contiguous buffer. nothing is mutated after Build, so every
+// query may run from any number of threads at once without locking, share it as shared_ptr<const ProfileSnapshot>.
+// the snapshot owns all its data, later changes of source profile or locator do not affect it
+class ProfileSnapshot {
+ public:
+  // @brief symbolize profile(if not yet) and freeze it, profile is left untouched otherwise
+  static CPUProfileRetCode Build(CPUProfile* profile, SymbolLocator* locator,
+                                 std::shared_ptr<const ProfileSnapshot>* snapshot);
+  ~ProfileSnapshot() = default;
+  ProfileSnapshot(const ProfileSnapshot&) = delete;
+  ProfileSnapshot& operator=(const ProfileSnapshot&) = delete;
+  // @brief stack num
+  size_t Size() const { return counts_.size(); }
+  size_t GetSampleCount(size_t id) const { return counts_[id]; }
+  size_t GetDepth(size_t id) const { return offsets_[id + 1] - offsets_[id]; }
+  const void* const* GetPcs(size_t id) const { return pcs_.data() + offsets_[id]; }
+  // @brief symbol id of every frame, leaf first, parallel to GetPcs
+  const uint32_t* GetSymIds(size_t id) const { return frame_syms_.data() + offsets_[id]; }
+  // @brief name num, id 0 is the empty name of unresolved addrs
+  size_t GetNameNum() const { return name_offsets_.size() - 1; }
+  std::string_view GetName(uint32_t sym_id) const {
+    size_t begin = name_offsets_[sym_id];
+    return std::string_view{name_data_.data() + begin, name_offsets_[sym_id + 1] - begin};
+  }
+  size_t GetTotalSamples() const { return total_samples_; }
+  const CPUProfileBinaryHeader& GetHeader() const { return header_; }
+  const std::string& GetMapsText() const { return maps_text_; }
+  // @brief ids(ascending) of symbols whose name contains pattern
+  std::vector<uint32_t> FindSymbols(std::string_view pattern) const;
+  // @brief ids(ascending) of stacks containing any of sym_ids
+  std::vector<uint32_t> FilterStacks(const std::vector<uint32_t>& sym_ids) const;
+  // @brief top n functions by cum or flat samples over stack_ids(nullable, all stacks if null), names refer to
+  // snapshot. unresolved addrs are not reported
+  void TopFunctions(size_t n, bool order_by_cum, std::vector<FunctionSamples>* functions,
+                    const std::vector<uint32_t>* stack_ids = nullptr) const;
+  // @brief export as raw profile(same layout as CPUProfile::GenerateRawProfile) with stacks of stack_ids(nullable,
+  // all stacks if null), symbol section always covers the whole snapshot
+  CPUProfileRetCode GenerateRawProfile(const RawProfileMeta& meta, std::ostream& os,
+                                       const std::vector<uint32_t>* stack_ids = nullptr) const;
+  // @brief export stacks of stack_ids(nullable, all stacks if null) in folded format of flamegraph tools, one
+  // "root;...;leaf count" line per stack, unresolved frames are written as hex pc. stacks folding to the same names
+  // are not merged, flamegraph tools sum them up
+  CPUProfileRetCode GenerateFoldedProfile(std::ostream& os, const std::vector<uint32_t>* stack_ids = nullptr) const;
+
+ private:
+  ProfileSnapshot() = default;
+
+  CPUProfileBinaryHeader header_;
+  size_t total_samples_{0};
+  std::vector<size_t> counts_;              // sample count of every stack
+  std::vector<size_t> offsets_{0};          // frames of stack i are [offsets_[i], offsets_[i + 1])
+  std::vector<const void*> pcs_;
+  std::vector<uint32_t> frame_syms_;        // parallel to pcs_
+  std::vector<const void*> addrs_;          // sorted symbol addrs
+  std::vector<uint32_t> addr_syms_;         // parallel to addrs_
+  std::vector<size_t> name_offsets_{0, 0};  // name i is name_data_[name_offsets_[i], name_offsets_[i + 1])
+  std::string name_data_;
+  std::string maps_text_;
+};
+
+}  // namespace pprofcpp
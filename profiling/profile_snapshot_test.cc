@@ -0,0 +1,171 @@
+/*
+ * FileName: profile_snapshot_test.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/profile_snapshot.h"
+
+#include <sstream>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "profiling/symbol/fake_locator.h"
+
+using namespace pprofcpp;
+
+constexpr char kCPUProfileSample[] = "./profiling/io/cpu_profile_sample";
+
+// every 0x1000 bytes is a function, addrs below 0x1000 are unresolved
+static std::string SnapshotName(uintptr_t addr) { return (addr >> 12) == 0 ? "" : "func" + std::to_string(addr >> 12); }
+
+TEST(ProfileSnapshot, Build) {
+  CPUProfile empty{std::make_unique<std::stringstream>()};
+  FakeLocator locator{SnapshotName};
+  std::shared_ptr<const ProfileSnapshot> snapshot;
+  EXPECT_EQ(ProfileSnapshot::Build(&empty, &locator, &snapshot), CPUProfileRetCode::kEmptyStack);
+  EXPECT_EQ(snapshot, nullptr);
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  ASSERT_EQ(ProfileSnapshot::Build(&profile, &locator, &snapshot), CPUProfileRetCode::kOK);
+  ASSERT_NE(snapshot, nullptr);
+  EXPECT_EQ(snapshot->GetHeader(), profile.GetHeader());
+  EXPECT_EQ(snapshot->GetMapsText(), profile.GetMapsText());
+  const auto& stacks = profile.GetCallStacks();
+  ASSERT_EQ(snapshot->Size(), stacks.size());
+  size_t total{0};
+  for (size_t id = 0; id < snapshot->Size(); id++) {
+    ASSERT_EQ(snapshot->GetSampleCount(id), stacks[id].sample_count);
+    ASSERT_EQ(snapshot->GetDepth(id), stacks[id].ptrs.size());
+    ASSERT_TRUE(std::equal(stacks[id].ptrs.cbegin(), stacks[id].ptrs.cend(), snapshot->GetPcs(id)));
+    for (size_t i = 0; i < snapshot->GetDepth(id); i++) {
+      auto addr = reinterpret_cast<uintptr_t>(stacks[id].ptrs[i]) - (i == 0 ? 0 : 1);
+      auto name = snapshot->GetName(snapshot->GetSymIds(id)[i]);
+      ASSERT_EQ(name, (addr >> 12) == 0 ? "" : "func" + std::to_string(addr >> 12));
+    }
+    total += stacks[id].sample_count;
+  }
+  EXPECT_EQ(snapshot->GetTotalSamples(), total);
+  EXPECT_EQ(snapshot->GetName(0), "");
+  // same output as the profile it is built from
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  std::string expected;
+  ASSERT_EQ(profile.GenerateRawProfile(meta, &locator, &expected), CPUProfileRetCode::kOK);
+  std::ostringstream oss;
+  ASSERT_EQ(snapshot->GenerateRawProfile(meta, oss), CPUProfileRetCode::kOK);
+  EXPECT_EQ(oss.str(), expected);
+  // later changes of profile are not visible
+  ReduceOptions reduce;
+  reduce.max_depth = 1;
+  ASSERT_EQ(profile.Reduce(reduce), CPUProfileRetCode::kOK);
+  std::ostringstream after;
+  ASSERT_EQ(snapshot->GenerateRawProfile(meta, after), CPUProfileRetCode::kOK);
+  EXPECT_EQ(after.str(), expected);
+}
+
+TEST(ProfileSnapshot, Queries) {
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  FakeLocator locator{SnapshotName};
+  std::shared_ptr<const ProfileSnapshot> snapshot;
+  ASSERT_EQ(ProfileSnapshot::Build(&profile, &locator, &snapshot), CPUProfileRetCode::kOK);
+  std::vector<FunctionSamples> top;
+  snapshot->TopFunctions(SIZE_MAX, true, &top);
+  ASSERT_FALSE(top.empty());
+  for (size_t i = 1; i < top.size(); i++) {
+    ASSERT_GE(top[i - 1].cum, top[i].cum);
+    ASSERT_LE(top[i].flat, top[i].cum);
+  }
+  const auto& hottest = top[0];
+  // focus on hottest function: every stack containing it, samples add up to its cum
+  auto sym_ids = snapshot->FindSymbols(hottest.name);
+  ASSERT_FALSE(sym_ids.empty());
+  std::vector<uint32_t> exact;
+  for (auto id : sym_ids) {
+    if (snapshot->GetName(id) == hottest.name) {
+      exact.push_back(id);
+    }
+  }
+  ASSERT_EQ(exact.size(), 1);
+  auto stack_ids = snapshot->FilterStacks(exact);
+  size_t focused{0};
+  for (auto id : stack_ids) {
+    focused += snapshot->GetSampleCount(id);
+  }
+  EXPECT_EQ(focused, hottest.cum);
+  std::vector<FunctionSamples> focused_top;
+  snapshot->TopFunctions(1, true, &focused_top, &stack_ids);
+  ASSERT_EQ(focused_top.size(), 1);
+  EXPECT_EQ(focused_top[0].name, hottest.name);
+  EXPECT_EQ(focused_top[0].cum, hottest.cum);
+  // export of focused stacks only
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  std::ostringstream all, part;
+  ASSERT_EQ(snapshot->GenerateRawProfile(meta, all), CPUProfileRetCode::kOK);
+  ASSERT_EQ(snapshot->GenerateRawProfile(meta, part, &stack_ids), CPUProfileRetCode::kOK);
+  EXPECT_LE(part.str().size(), all.str().size());
+  // folded lines are root first and carry sample counts
+  std::ostringstream folded;
+  ASSERT_EQ(snapshot->GenerateFoldedProfile(folded, &stack_ids), CPUProfileRetCode::kOK);
+  std::istringstream lines{folded.str()};
+  std::string line;
+  size_t line_num{0}, folded_samples{0};
+  while (std::getline(lines, line)) {
+    auto id = stack_ids[line_num++];
+    auto space = line.rfind(' ');
+    ASSERT_NE(space, std::string::npos);
+    folded_samples += std::stoul(line.substr(space + 1));
+    auto leaf = line.substr(line.rfind(';', space) + 1, space - line.rfind(';', space) - 1);
+    uint32_t leaf_sym = snapshot->GetSymIds(id)[0];
+    if (leaf_sym != 0) {
+      EXPECT_EQ(leaf, snapshot->GetName(leaf_sym));
+    }
+    EXPECT_NE(line.find(hottest.name), std::string::npos);
+  }
+  EXPECT_EQ(line_num, stack_ids.size());
+  EXPECT_EQ(folded_samples, hottest.cum);
+  EXPECT_TRUE(snapshot->FindSymbols("no_such_function").empty());
+  EXPECT_TRUE(snapshot->FilterStacks({}).empty());
+}
+
+TEST(ProfileSnapshot, ConcurrentReaders) {
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  FakeLocator locator{SnapshotName};
+  std::shared_ptr<const ProfileSnapshot> snapshot;
+  ASSERT_EQ(ProfileSnapshot::Build(&profile, &locator, &snapshot), CPUProfileRetCode::kOK);
+  std::vector<FunctionSamples> expected_top;
+  snapshot->TopFunctions(10, false, &expected_top);
+  RawProfileMeta meta;
+  meta.program_path = "./fustcpp";
+  std::ostringstream expected_raw;
+  ASSERT_EQ(snapshot->GenerateRawProfile(meta, expected_raw), CPUProfileRetCode::kOK);
+  constexpr size_t kThreadNum = 8;
+  std::vector<int> ok(kThreadNum);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreadNum; t++) {
+    threads.emplace_back([&, t, shared = snapshot] {
+      bool same = true;
+      for (int round = 0; round < 20; round++) {
+        std::vector<FunctionSamples> top;
+        shared->TopFunctions(10, false, &top);
+        same = same && top.size() == expected_top.size();
+        for (size_t i = 0; same && i < top.size(); i++) {
+          same = top[i].name == expected_top[i].name && top[i].flat == expected_top[i].flat;
+        }
+        std::ostringstream raw;
+        same = same && shared->GenerateRawProfile(meta, raw) == CPUProfileRetCode::kOK &&
+               raw.str() == expected_raw.str();
+      }
+      ok[t] = same;
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (size_t t = 0; t < kThreadNum; t++) {
+    EXPECT_TRUE(ok[t]) << "thread " << t;
+  }
+}
@@ -0,0 +1,250 @@
+/*
+ * FileName: profile_store.cc
+ * Author: jattle
+ * Descrption:
+ */
+
+#include "profiling/profile_store.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace pprofcpp {
+
+namespace {
+
+constexpr size_t kStoreAlignment = 8;
+constexpr size_t kStoreHeadLen = sizeof(kProfileStoreMagic);
+
+/// @brief sequential column writer, pads every column to kStoreAlignment
+class ColumnWriter {
+ public:
+  explicit ColumnWriter(std::ofstream* os) : os_(os) {}
+  void Align() {
+    static const char kZeros[kStoreAlignment] = {0};
+    if (size_t rem = offset_ % kStoreAlignment; rem != 0) {
+      Write(kZeros, kStoreAlignment - rem);
+    }
+  }
+  void Begin(StoreColumn column) {
+    Align();
+    column_ = static_cast<size_t>(column);
+    footer_.offsets[column_] = offset_;
+  }
+  void Write(const void* data, size_t len) {
+    os_->write(static_cast<const char*>(data), static_cast<std::streamsize>(len));
+    offset_ += len;
+  }
+  // @brief write values as uint64 through a small buffer
+  template <typename Iter, typename Fn>
+  void WriteU64(Iter begin, Iter end, Fn&& fn) {
+    constexpr size_t kBatch = 1024;
+    uint64_t buffer[kBatch];
+    size_t n = 0;
+    for (auto iter = begin; iter != end; ++iter) {
+      buffer[n++] = fn(*iter);
+      if (n == kBatch) {
+        Write(buffer, sizeof(buffer));
+        n = 0;
+      }
+    }
+    Write(buffer, n * sizeof(uint64_t));
+  }
+  void End() { footer_.sizes[column_] = offset_ - footer_.offsets[column_]; }
+  StoreFooter& Footer() { return footer_; }
+
+ private:
+  std::ofstream* os_;
+  size_t offset_{0};
+  size_t column_{0};
+  StoreFooter footer_{};
+};
+
+}  // namespace
+
+ProfileStoreRetCode WriteProfileStore(CPUProfile* profile, SymbolLocator* locator, const std::string& file) {
+  const auto& stacks = profile->GetCallStacks();
+  const InternedSymbols* interned{nullptr};
+  InternedSymbols empty;
+  if (stacks.empty()) {
+    interned = &empty;
+  } else {
+    interned = &profile->GetInternedSymbols(locator);
+    if (interned->table == nullptr) {
+      return ProfileStoreRetCode::kSearchSymbolFailed;
+    }
+  }
+  std::ofstream os(file, std::ios_base::binary | std::ios_base::trunc);
+  if (!os.good()) {
+    return ProfileStoreRetCode::kOpenFileFailed;
+  }
+  ColumnWriter writer{&os};
+  writer.Write(kProfileStoreMagic, kStoreHeadLen);
+
+  writer.Begin(StoreColumn::kCounts);
+  writer.WriteU64(stacks.cbegin(), stacks.cend(), [](const CallStack& s) -> uint64_t { return s.sample_count; });
+  writer.End();
+
+  writer.Begin(StoreColumn::kOffsets);
+  uint64_t pc_num{0};
+  writer.Write(&pc_num, sizeof(pc_num));
+  writer.WriteU64(stacks.cbegin(), stacks.cend(),
+                  [&pc_num](const CallStack& s) -> uint64_t { return pc_num += s.ptrs.size(); });
+  writer.End();
+
+  writer.Begin(StoreColumn::kPcs);
+  for (const auto& s : stacks) {
+    writer.WriteU64(s.ptrs.cbegin(), s.ptrs.cend(), [](void* pc) { return reinterpret_cast<uintptr_t>(pc); });
+  }
+  writer.End();
+
+  writer.Begin(StoreColumn::kAddrs);
+  writer.WriteU64(interned->addrs.cbegin(), interned->addrs.cend(),
+                  [](void* addr) { return reinterpret_cast<uintptr_t>(addr); });
+  writer.End();
+
+  writer.Begin(StoreColumn::kAddrNames);
+  writer.Write(interned->sym_ids.data(), interned->sym_ids.size() * sizeof(uint32_t));
+  writer.End();
+
+  size_t name_num = interned->table == nullptr ? 1 : interned->table->Size();
+  auto name_of = [interned](uint32_t id) -> std::string_view {
+    return interned->table == nullptr ? std::string_view{} : std::string_view{interned->table->GetName(id)};
+  };
+  writer.Begin(StoreColumn::kNameOffsets);
+  std::vector<uint32_t> ids(name_num);
+  for (uint32_t id = 0; id < name_num; id++) {
+    ids[id] = id;
+  }
+  uint64_t name_offset{0};
+  writer.Write(&name_offset, sizeof(name_offset));
+  writer.WriteU64(ids.cbegin(), ids.cend(),
+                  [&name_offset, &name_of](uint32_t id) -> uint64_t { return name_offset += name_of(id).size(); });
+  writer.End();
+
+  writer.Begin(StoreColumn::kNameData);
+  for (uint32_t id = 0; id < name_num; id++) {
+    auto name = name_of(id);
+    writer.Write(name.data(), name.size());
+  }
+  writer.End();
+
+  writer.Begin(StoreColumn::kMaps);
+  writer.Write(profile->GetMapsText().data(), profile->GetMapsText().size());
+  writer.End();
+
+  StoreFooter& footer = writer.Footer();
+  const auto& header = profile->GetHeader();
+  footer.hdr_words = header.hdr_words;
+  footer.version = header.version;
+  footer.sampling_period = header.sampling_period;
+  footer.padding = header.padding;
+  footer.format_version = kProfileStoreVersion;
+  memcpy(footer.magic, kProfileStoreMagic, sizeof(footer.magic));
+  writer.Align();
+  writer.Write(&footer, sizeof(footer));
+  os.flush();
+  return os.good() ? ProfileStoreRetCode::kOK : ProfileStoreRetCode::kWriteError;
+}
+
+template <typename T>
+const T* ProfileStoreReader::Column(const StoreFooter& footer, StoreColumn column, size_t num) const {
+  auto index = static_cast<size_t>(column);
+  auto view = file_.View();
+  uint64_t offset = footer.offsets[index], size = footer.sizes[index];
+  if (offset % alignof(T) != 0 || size != num * sizeof(T) || offset > view.size() - sizeof(StoreFooter) ||
+      size > view.size() - sizeof(StoreFooter) - offset) {
+    return nullptr;
+  }
+  return reinterpret_cast<const T*>(view.data() + offset);
+}
+
+ProfileStoreRetCode ProfileStoreReader::Open(const std::string& file) {
+  if (file_.Open(file) != 0) {
+    return ProfileStoreRetCode::kOpenFileFailed;
+  }
+  auto view = file_.View();
+  if (view.size() < kStoreHeadLen + sizeof(StoreFooter) || memcmp(view.data(), kProfileStoreMagic, kStoreHeadLen)) {
+    return ProfileStoreRetCode::kBadFormat;
+  }
+  StoreFooter footer;
+  memcpy(&footer, view.data() + view.size() - sizeof(StoreFooter), sizeof(footer));
+  if (memcmp(footer.magic, kProfileStoreMagic, sizeof(footer.magic)) != 0 ||
+      footer.format_version != kProfileStoreVersion) {
+    return ProfileStoreRetCode::kBadFormat;
+  }
+  auto column_num = [&footer](StoreColumn column, size_t elem_size) {
+    return footer.sizes[static_cast<size_t>(column)] / elem_size;
+  };
+  size_t stack_num = column_num(StoreColumn::kCounts, sizeof(uint64_t));
+  size_t pc_num = column_num(StoreColumn::kPcs, sizeof(uint64_t));
+  size_t addr_num = column_num(StoreColumn::kAddrs, sizeof(uint64_t));
+  size_t name_num = column_num(StoreColumn::kNameOffsets, sizeof(uint64_t));
+  size_t name_data_len = footer.sizes[static_cast<size_t>(StoreColumn::kNameData)];
+  size_t maps_len = footer.sizes[static_cast<size_t>(StoreColumn::kMaps)];
+  if (name_num == 0) {
+    return ProfileStoreRetCode::kBadFormat;
+  }
+  name_num--;
+  counts_ = Column<uint64_t>(footer, StoreColumn::kCounts, stack_num);
+  offsets_ = Column<uint64_t>(footer, StoreColumn::kOffsets, stack_num + 1);
+  pcs_ = Column<uint64_t>(footer, StoreColumn::kPcs, pc_num);
+  addrs_ = Column<uint64_t>(footer, StoreColumn::kAddrs, addr_num);
+  addr_names_ = Column<uint32_t>(footer, StoreColumn::kAddrNames, addr_num);
+  name_offsets_ = Column<uint64_t>(footer, StoreColumn::kNameOffsets, name_num + 1);
+  name_data_ = Column<char>(footer, StoreColumn::kNameData, name_data_len);
+  const char* maps = Column<char>(footer, StoreColumn::kMaps, maps_len);
+  if (counts_ == nullptr || offsets_ == nullptr || pcs_ == nullptr || addrs_ == nullptr || addr_names_ == nullptr ||
+      name_offsets_ == nullptr || name_data_ == nullptr || maps == nullptr) {
+    return ProfileStoreRetCode::kBadFormat;
+  }
+  // only ends of offset columns are checked here, interior ones are clamped on access or checked by Validate
+  if (offsets_[0] != 0 || offsets_[stack_num] != pc_num || name_offsets_[0] != 0 ||
+      name_offsets_[name_num] != name_data_len) {
+    return ProfileStoreRetCode::kBadFormat;
+  }
+  maps_ = std::string_view{maps, maps_len};
+  header_.hdr_words = footer.hdr_words;
+  header_.version = footer.version;
+  header_.sampling_period = footer.sampling_period;
+  header_.padding = footer.padding;
+  stack_num_ = stack_num;
+  addr_num_ = addr_num;
+  name_num_ = name_num;
+  pc_num_ = pc_num;
+  name_data_len_ = name_data_len;
+  return ProfileStoreRetCode::kOK;
+}
+
+ProfileStoreRetCode ProfileStoreReader::Validate() const {
+  auto monotonic = [](const uint64_t* offsets, size_t num) {
+    for (size_t i = 0; i < num; i++) {
+      if (offsets[i] > offsets[i + 1]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  if (offsets_ == nullptr || !monotonic(offsets_, stack_num_) || !monotonic(name_offsets_, name_num_)) {
+    return ProfileStoreRetCode::kBadFormat;
+  }
+  for (size_t i = 0; i < addr_num_; i++) {
+    if (addr_names_[i] >= name_num_ || (i > 0 && addrs_[i - 1] > addrs_[i])) {
+      return ProfileStoreRetCode::kBadFormat;
+    }
+  }
+  return ProfileStoreRetCode::kOK;
+}
+
+std::string_view ProfileStoreReader::FindSymbolName(const void* addr) const {
+  auto target = reinterpret_cast<uintptr_t>(addr);
+  const uint64_t* iter = std::lower_bound(addrs_, addrs_ + addr_num_, target);
+  if (iter == addrs_ + addr_num_ || *iter != target) {
+    return std::string_view{};
+  }
+  return GetName(addr_names_[iter - addrs_]);
+}
+
+}  // namespace pprofcpp
@@ -0,0 +1,122 @@
+/*
+ * FileName: profile_store.h
+ * Author: jattle
+ * Descrption: columnar on-disk store of symbolized CPU profile, reopened by mmap without parsing
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "profiling/cpu_profile.h"
+#include "profiling/symbol/profile_symbol.h"
+#include "profiling/util/utils.h"
+
+namespace pprofcpp {
+
+enum class ProfileStoreRetCode {
+  kOK = 0,
+  kOpenFileFailed = 1,
+  kWriteError = 2,
+  kBadFormat = 3,
+  kSearchSymbolFailed = 4,
+};
+
+/// @brief columns of store file, every column starts at 8 bytes aligned offset
+enum class StoreColumn : uint32_t {
+  kCounts = 0,       // uint64[stack_num], sample count of every stack
+  kOffsets = 1,      // uint64[stack_num + 1], CSR offsets into kPcs
+  kPcs = 2,          // uint64[pc_num]
+  kAddrs = 3,        // uint64[addr_num], sorted symbol addrs
+  kAddrNames = 4,    // uint32[addr_num], name id of every addr
+  kNameOffsets = 5,  // uint64[name_num + 1], offsets into kNameData, id 0 is the empty name
+  kNameData = 6,     // chars
+  kMaps = 7,         // chars, maps text
+  kColumnNum = 8,
+};
+
+/// @brief footer index at the end of file, native byte order
+struct StoreFooter {
+  uint64_t offsets[static_cast<size_t>(StoreColumn::kColumnNum)];
+  uint64_t sizes[static_cast<size_t>(StoreColumn::kColumnNum)];  // in bytes
+  uint64_t hdr_words;
+  uint64_t version;
+  uint64_t sampling_period;
+  uint64_t padding;
+  uint64_t format_version;
+  char magic[8];
+};
+
+constexpr char kProfileStoreMagic[8] = {'P', 'P', 'R', 'O', 'F', 'S', 'T', '1'};
+constexpr uint64_t kProfileStoreVersion = 1;
+
+/// @brief symbolize profile(if not yet) and write it to file in store format
+ProfileStoreRetCode WriteProfileStore(CPUProfile* profile, SymbolLocator* locator, const std::string& file);
+
+/// @brief mmap based store reader, Open is O(1): it checks footer and column bounds only, columns are touched lazily
+// by queries. accessors clamp offsets & name ids read from file, so a corrupted file never makes them read outside
+// the mapping(a broken stack has depth 0, a broken name is empty), call Validate to reject such files up front.
+// stack iteration mirrors StackTable(Size/GetPtrs/GetDepth), returned pointers refer to mapped file
+class ProfileStoreReader {
+ public:
+  ProfileStoreReader() = default;
+  ~ProfileStoreReader() = default;
+  ProfileStoreReader(const ProfileStoreReader&) = delete;
+  ProfileStoreReader& operator=(const ProfileStoreReader&) = delete;
+  ProfileStoreRetCode Open(const std::string& file);
+  // @brief opt-in O(stacks + addrs + names) check of every offset, name id & addr order, kBadFormat if any is broken
+  ProfileStoreRetCode Validate() const;
+  // @brief stack num
+  size_t Size() const { return stack_num_; }
+  const void* const* GetPtrs(size_t id) const {
+    return reinterpret_cast<const void* const*>(pcs_ + std::min<uint64_t>(offsets_[id], pc_num_));
+  }
+  size_t GetDepth(size_t id) const {
+    uint64_t begin = offsets_[id], end = offsets_[id + 1];
+    return begin <= end && end <= pc_num_ ? end - begin : 0;
+  }
+  size_t GetSampleCount(size_t id) const { return counts_[id]; }
+  const CPUProfileBinaryHeader& GetHeader() const { return header_; }
+  // @brief symbol addrs are sorted, name of addrs[i] is GetName(GetAddrNameId(i))
+  size_t GetAddrNum() const { return addr_num_; }
+  const void* GetAddr(size_t i) const { return reinterpret_cast<const void*>(addrs_[i]); }
+  uint32_t GetAddrNameId(size_t i) const { return addr_names_[i]; }
+  size_t GetNameNum() const { return name_num_; }
+  std::string_view GetName(uint32_t id) const {
+    if (id >= name_num_) {
+      return std::string_view{};
+    }
+    uint64_t begin = name_offsets_[id], end = name_offsets_[id + 1];
+    return begin <= end && end <= name_data_len_ ? std::string_view{name_data_ + begin, end - begin}
+                                                 : std::string_view{};
+  }
+  // @brief name of symbol addr(pc of leaf, or call ptr(pc - 1) of caller), empty if not found
+  std::string_view FindSymbolName(const void* addr) const;
+  std::string_view GetMapsText() const { return maps_; }
+
+ private:
+  template <typename T>
+  const T* Column(const StoreFooter& footer, StoreColumn column, size_t num) const;
+
+  MappedFile file_;
+  CPUProfileBinaryHeader header_;
+  size_t stack_num_{0};
+  size_t addr_num_{0};
+  size_t name_num_{0};
+  size_t pc_num_{0};
+  size_t name_data_len_{0};
+  const uint64_t* counts_{nullptr};
+  const uint64_t* offsets_{nullptr};
+  const uint64_t* pcs_{nullptr};
+  const uint64_t* addrs_{nullptr};
+  const uint32_t* addr_names_{nullptr};
+  const uint64_t* name_offsets_{nullptr};
+  const char* name_data_{nullptr};
+  std::string_view maps_;
+};
+
+}  // namespace pprofcpp
@@ -0,0 +1,134 @@
+/*
+ * FileName: profile_store_test.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/profile_store.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "gtest/gtest.h"
+
+#include "profiling/symbol/fake_locator.h"
+
+using namespace pprofcpp;
+
+constexpr char kCPUProfileSample[] = "./profiling/io/cpu_profile_sample";
+
+// every 0x1000 bytes is a function
+static std::string StoreName(uintptr_t addr) { return "func" + std::to_string(addr >> 12); }
+
+TEST(ProfileStore, RoundTrip) {
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  FakeLocator locator{StoreName};
+  const std::string file = "./profile_store_test.store";
+  ASSERT_EQ(WriteProfileStore(&profile, &locator, file), ProfileStoreRetCode::kOK);
+  ProfileStoreReader reader;
+  ASSERT_EQ(reader.Open(file), ProfileStoreRetCode::kOK);
+  EXPECT_EQ(reader.GetHeader(), profile.GetHeader());
+  EXPECT_EQ(reader.GetMapsText(), profile.GetMapsText());
+  const auto& stacks = profile.GetCallStacks();
+  ASSERT_EQ(reader.Size(), stacks.size());
+  for (size_t id = 0; id < reader.Size(); id++) {
+    ASSERT_EQ(reader.GetSampleCount(id), stacks[id].sample_count);
+    ASSERT_EQ(reader.GetDepth(id), stacks[id].ptrs.size());
+    ASSERT_TRUE(std::equal(stacks[id].ptrs.cbegin(), stacks[id].ptrs.cend(), reader.GetPtrs(id)));
+  }
+  const auto& interned = profile.GetInternedSymbols(&locator);
+  ASSERT_EQ(reader.GetAddrNum(), interned.addrs.size());
+  ASSERT_EQ(reader.GetNameNum(), interned.table->Size());
+  for (size_t i = 0; i < interned.addrs.size(); i++) {
+    const auto& name = interned.table->GetName(interned.sym_ids[i]);
+    ASSERT_EQ(reader.GetAddr(i), interned.addrs[i]);
+    ASSERT_EQ(reader.GetName(reader.GetAddrNameId(i)), name);
+    ASSERT_EQ(reader.FindSymbolName(interned.addrs[i]), name);
+  }
+  ASSERT_TRUE(reader.FindSymbolName(reinterpret_cast<void*>(0x1)).empty());
+  remove(file.c_str());
+}
+
+TEST(ProfileStore, BadFormat) {
+  ProfileStoreReader reader;
+  ASSERT_EQ(reader.Open("file_not_exists"), ProfileStoreRetCode::kOpenFileFailed);
+  const std::string file = "./profile_store_bad.store";
+  {
+    std::ofstream ofs(file, std::ios_base::binary);
+    ofs << std::string(256, 'x');
+  }
+  ProfileStoreReader bad;
+  ASSERT_EQ(bad.Open(file), ProfileStoreRetCode::kBadFormat);
+  // truncated store
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  FakeLocator locator{StoreName};
+  ASSERT_EQ(WriteProfileStore(&profile, &locator, file), ProfileStoreRetCode::kOK);
+  std::string content;
+  ASSERT_EQ(LoadFileContent(file, &content), 0);
+  {
+    std::ofstream ofs(file, std::ios_base::binary | std::ios_base::trunc);
+    ofs << content.substr(0, content.size() / 2) << content.substr(content.size() - sizeof(StoreFooter));
+  }
+  ProfileStoreReader truncated;
+  ASSERT_EQ(truncated.Open(file), ProfileStoreRetCode::kBadFormat);
+  remove(file.c_str());
+}
+
+TEST(ProfileStore, CorruptedColumns) {
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  FakeLocator locator{StoreName};
+  const std::string file = "./profile_store_corrupted.store";
+  ASSERT_EQ(WriteProfileStore(&profile, &locator, file), ProfileStoreRetCode::kOK);
+  std::string content;
+  ASSERT_EQ(LoadFileContent(file, &content), 0);
+  StoreFooter footer;
+  memcpy(&footer, content.data() + content.size() - sizeof(StoreFooter), sizeof(footer));
+  auto column_data = [&content, &footer](StoreColumn column) {
+    return content.data() + footer.offsets[static_cast<size_t>(column)];
+  };
+  // corrupted interior columns are not read by Open, queries stay inside the mapping and Validate rejects the file
+  auto open_patched = [&file](const std::string& patched) {
+    {
+      std::ofstream ofs(file, std::ios_base::binary | std::ios_base::trunc);
+      ofs << patched;
+    }
+    ProfileStoreReader reader;
+    EXPECT_EQ(reader.Open(file), ProfileStoreRetCode::kOK);
+    size_t bytes = 0;
+    for (size_t id = 0; id < reader.Size(); id++) {
+      const void* const* ptrs = reader.GetPtrs(id);
+      for (size_t i = 0; i < reader.GetDepth(id); i++) {
+        bytes += ptrs[i] != nullptr ? 1 : 0;
+      }
+    }
+    for (size_t i = 0; i < reader.GetAddrNum(); i++) {
+      bytes += reader.GetName(reader.GetAddrNameId(i)).size();
+    }
+    EXPECT_GT(bytes, 0);
+    return reader.Validate();
+  };
+  ASSERT_EQ(open_patched(content), ProfileStoreRetCode::kOK);
+  ASSERT_GT(footer.sizes[static_cast<size_t>(StoreColumn::kCounts)], 2 * sizeof(uint64_t));
+  ASSERT_GT(footer.sizes[static_cast<size_t>(StoreColumn::kAddrs)], 0);
+  // interior stack offset out of range, last one is intact
+  std::string patched = content;
+  uint64_t bad = UINT64_MAX / 2;
+  memcpy(patched.data() + (column_data(StoreColumn::kOffsets) - content.data()) + sizeof(uint64_t), &bad,
+         sizeof(bad));
+  EXPECT_EQ(open_patched(patched), ProfileStoreRetCode::kBadFormat);
+  // interior name offset decreasing
+  patched = content;
+  size_t name_num = footer.sizes[static_cast<size_t>(StoreColumn::kNameOffsets)] / sizeof(uint64_t) - 1;
+  memcpy(patched.data() + (column_data(StoreColumn::kNameOffsets) - content.data()) + name_num / 2 * sizeof(uint64_t),
+         &bad, sizeof(bad));
+  EXPECT_EQ(open_patched(patched), ProfileStoreRetCode::kBadFormat);
+  // name id out of range
+  patched = content;
+  uint32_t bad_id = static_cast<uint32_t>(name_num);
+  memcpy(patched.data() + (column_data(StoreColumn::kAddrNames) - content.data()), &bad_id, sizeof(bad_id));
+  EXPECT_EQ(open_patched(patched), ProfileStoreRetCode::kBadFormat);
+  remove(file.c_str());
+}
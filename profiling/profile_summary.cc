@@ -0,0 +1,162 @@
+/*
+ * FileName: profile_summary.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/profile_summary.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#include "fmt/format.h"
+#include "profiling/util/utils.h"
+
+namespace pprofcpp {
+
+namespace {
+
+constexpr size_t kMinStackCapacity = 4096;
+
+}  // namespace
+
+ProfileSummarizer::ProfileSummarizer(size_t top_n, size_t capacity)
+    : top_n_(top_n), capacity_(capacity > 0 ? capacity : std::max(64 * top_n, kMinStackCapacity)) {}
+
+void ProfileSummarizer::Add(size_t sample_count, const size_t* pcs, size_t num_pcs) {
+  summary_.record_num++;
+  summary_.total_samples += sample_count;
+  summary_.pc_num += num_pcs;
+  summary_.max_depth = std::max(summary_.max_depth, num_pcs);
+  if (summary_.depth_records.size() <= num_pcs) {
+    summary_.depth_records.resize(num_pcs + 1);
+  }
+  summary_.depth_records[num_pcs]++;
+  pcs_.insert(pcs, pcs + num_pcs);
+  if (top_n_ == 0) {
+    return;
+  }
+  key_.assign(reinterpret_cast<const char*>(pcs), num_pcs * sizeof(size_t));
+  auto it = stacks_.find(key_);
+  if (it == stacks_.end()) {
+    // an untracked stack may have been dropped before, with at most dropped_max_ samples
+    it = stacks_.emplace(key_, TrackedStack{dropped_max_, dropped_max_, 0}).first;
+  }
+  it->second.samples += sample_count;
+  it->second.records++;
+  if (stacks_.size() >= 2 * capacity_) {
+    Prune();
+  }
+}
+
+void ProfileSummarizer::Prune() {
+  std::vector<size_t> samples;
+  samples.reserve(stacks_.size());
+  for (const auto& [key, stack] : stacks_) {
+    samples.push_back(stack.samples);
+  }
+  std::nth_element(samples.begin(), samples.begin() + capacity_, samples.end(), std::greater<size_t>());
+  // keep stacks above the (capacity + 1)th largest, ties are dropped together
+  size_t threshold = samples[capacity_];
+  for (auto it = stacks_.begin(); it != stacks_.end();) {
+    if (it->second.samples <= threshold) {
+      dropped_max_ = std::max(dropped_max_, it->second.samples);
+      it = stacks_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void ProfileSummarizer::Finish(const CPUProfileBinaryHeader& header, ProfileSummary* summary) {
+  summary_.header = header;
+  summary_.distinct_pc_num = pcs_.size();
+  std::vector<std::pair<const std::string*, const TrackedStack*>> stacks;
+  stacks.reserve(stacks_.size());
+  for (const auto& [key, stack] : stacks_) {
+    stacks.emplace_back(&key, &stack);
+  }
+  size_t n = std::min(top_n_, stacks.size());
+  auto by_samples = [](const auto& l, const auto& r) {
+    // pcs break ties so that output is stable
+    return l.second->samples != r.second->samples ? l.second->samples > r.second->samples : *l.first < *r.first;
+  };
+  std::partial_sort(stacks.begin(), stacks.begin() + n, stacks.end(), by_samples);
+  summary_.top_stacks.clear();
+  for (size_t i = 0; i < n; i++) {
+    StackSamples top;
+    const auto& key = *stacks[i].first;
+    top.pcs.resize(key.size() / sizeof(size_t));
+    memcpy(top.pcs.data(), key.data(), key.size());
+    top.samples = stacks[i].second->samples;
+    top.error = stacks[i].second->error;
+    top.records = stacks[i].second->records;
+    summary_.top_stacks.emplace_back(std::move(top));
+  }
+  *summary = summary_;
+}
+
+std::string ProfileSummary::ToText() const {
+  std::string text;
+  text.append("---------------Header:\n");
+  text.append(fmt::format("hdr_count: {}\n", header.hdr_count));
+  text.append(fmt::format("hdr_words: {}\n", header.hdr_words));
+  text.append(fmt::format("version: {}\n", header.version));
+  text.append(fmt::format("sampling_period: {}\n", header.sampling_period));
+  text.append(fmt::format("padding: {}\n", header.padding));
+  text.append("---------------Summary:\n");
+  text.append(fmt::format("record num: {}, total sample num: {}, ptr num: {}, distinct ptr num: {}\n", record_num,
+                          total_samples, pc_num, distinct_pc_num));
+  double mean_depth = record_num == 0 ? 0 : static_cast<double>(pc_num) / static_cast<double>(record_num);
+  text.append(fmt::format("depth mean: {:.1f}, max: {}\n", mean_depth, max_depth));
+  text.append("---------------Depth histogram:\n");
+  // power of 2 buckets
+  for (size_t low = 1; low < depth_records.size(); low *= 2) {
+    size_t high = std::min(low * 2, depth_records.size());
+    size_t records{0};
+    for (size_t d = low; d < high; d++) {
+      records += depth_records[d];
+    }
+    if (records > 0) {
+      text.append(fmt::format("[{:>4}, {:>4}): {:>12} {:6.2f}%\n", low, high, records,
+                              100.0 * static_cast<double>(records) / static_cast<double>(record_num)));
+    }
+  }
+  text.append(fmt::format("---------------Top {} stacks:\n", top_stacks.size()));
+  char hex_addr[kHexAddrLen];
+  for (const auto& stack : top_stacks) {
+    double percent =
+        total_samples == 0 ? 0 : 100.0 * static_cast<double>(stack.samples) / static_cast<double>(total_samples);
+    text.append(fmt::format("samples: {} {:.2f}%", stack.samples, percent));
+    if (stack.error > 0) {
+      text.append(fmt::format(" (error <= {})", stack.error));
+    }
+    text.append(fmt::format(", records: {}, depth: {}\n ", stack.records, stack.pcs.size()));
+    for (auto pc : stack.pcs) {
+      text.push_back(' ');
+      text.append(hex_addr, FormatHexAddr(pc, hex_addr));
+    }
+    text.push_back('\n');
+  }
+  return text;
+}
+
+ReaderRetCode SummarizeProfile(CPUProfileReader* reader, size_t top_n, ProfileSummary* summary,
+                               const RecordCallback& callback) {
+  CPUProfileBinaryHeader header;
+  if (auto ret = reader->ReadHeader(&header); ret != ReaderRetCode::kOK) {
+    return ret;
+  }
+  ProfileSummarizer summarizer{top_n};
+  auto ret = reader->ReadRecords([&](size_t sample_count, const size_t* pcs, size_t num_pcs) {
+    summarizer.Add(sample_count, pcs, num_pcs);
+    if (callback) {
+      callback(sample_count, pcs, num_pcs);
+    }
+  });
+  // records read before an error are summarized too
+  summarizer.Finish(header, summary);
+  return ret;
+}
+
+}  // namespace pprofcpp
@@ -0,0 +1,74 @@
+/*
+ * FileName: profile_summary.h
+ * Author: jattle
+ * Descrption: one pass summary of CPU profile records with bounded memory
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "profiling/io/profile_io.h"
+
+namespace pprofcpp {
+
+/// @brief stack reported by top stacks of ProfileSummary
+struct StackSamples {
+  std::vector<uintptr_t> pcs;  // leaf first
+  size_t samples{0};           // upper bound of samples, exact if error is 0
+  size_t error{0};             // samples - error is the lower bound
+  size_t records{0};           // records of this stack since it is tracked
+};
+
+/// @brief summary of profile records
+struct ProfileSummary {
+  CPUProfileBinaryHeader header;
+  size_t record_num{0};
+  size_t total_samples{0};
+  size_t pc_num{0};
+  size_t distinct_pc_num{0};
+  size_t max_depth{0};
+  std::vector<size_t> depth_records;  // record num of every depth, index is depth
+  std::vector<StackSamples> top_stacks;  // by samples desc
+  std::string ToText() const;
+};
+
+/// @brief incremental summarizer, feed every record by Add then call Finish.
+// memory is bounded by distinct pcs(program code size) and top stack capacity instead of record num: stacks are
+// counted by space saving, when more than 2 * capacity stacks are tracked, all but the top capacity ones are dropped.
+// top stacks are exact unless stacks dropped, then every count may exceed its true value by at most its error.
+// not thread-safe
+class ProfileSummarizer {
+ public:
+  // @brief top_n stacks are reported, capacity(0 means 64 * top_n, at least 4096) stacks are kept
+  explicit ProfileSummarizer(size_t top_n, size_t capacity = 0);
+  void Add(size_t sample_count, const size_t* pcs, size_t num_pcs);
+  void Finish(const CPUProfileBinaryHeader& header, ProfileSummary* summary);
+
+ private:
+  struct TrackedStack {
+    size_t samples{0};
+    size_t error{0};
+    size_t records{0};
+  };
+  void Prune();
+
+  size_t top_n_;
+  size_t capacity_;
+  ProfileSummary summary_;
+  std::unordered_set<size_t> pcs_;
+  std::unordered_map<std::string, TrackedStack> stacks_;  // key is raw bytes of pcs
+  std::string key_;
+  size_t dropped_max_{0};  // max samples of dropped stacks, bounds samples of any untracked stack
+};
+
+/// @brief summarize profile in one pass over reader: header, records(callback is nullable, called for every record
+// as well, e.g. to stream it out) and maps text(skipped)
+ReaderRetCode SummarizeProfile(CPUProfileReader* reader, size_t top_n, ProfileSummary* summary,
+                               const RecordCallback& callback = nullptr);
+
+}  // namespace pprofcpp
@@ -0,0 +1,102 @@
+/*
+ * FileName: profile_summary_test.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/profile_summary.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
+
+#include "gtest/gtest.h"
+#include "profiling/cpu_profile.h"
+
+using namespace pprofcpp;
+
+constexpr char kCPUProfileSample[] = "./profiling/io/cpu_profile_sample";
+
+TEST(ProfileSummary, MatchesParsedProfile) {
+  CPUProfile profile{kCPUProfileSample};
+  ASSERT_EQ(profile.Parse(), ReaderRetCode::kOK);
+  // exact aggregation of parsed stacks
+  std::map<std::vector<uintptr_t>, size_t> stack_samples;
+  std::set<uintptr_t> pcs;
+  size_t pc_num{0}, total_samples{0};
+  for (const auto& s : profile.GetCallStacks()) {
+    std::vector<uintptr_t> stack;
+    for (auto* ptr : s.ptrs) {
+      stack.push_back(reinterpret_cast<uintptr_t>(ptr));
+    }
+    pcs.insert(stack.begin(), stack.end());
+    pc_num += stack.size();
+    total_samples += s.sample_count;
+    stack_samples[stack] += s.sample_count;
+  }
+  CPUProfileReader reader{kCPUProfileSample};
+  ProfileSummary summary;
+  size_t streamed{0};
+  auto count = [&streamed](size_t, const size_t*, size_t) { streamed++; };
+  ASSERT_EQ(SummarizeProfile(&reader, 5, &summary, count), ReaderRetCode::kOK);
+  EXPECT_EQ(summary.header, profile.GetHeader());
+  EXPECT_EQ(summary.record_num, profile.GetRecordNum());
+  EXPECT_EQ(streamed, profile.GetRecordNum());
+  EXPECT_EQ(summary.total_samples, total_samples);
+  EXPECT_EQ(summary.pc_num, pc_num);
+  EXPECT_EQ(summary.distinct_pc_num, pcs.size());
+  size_t depth_records{0};
+  for (size_t d = 0; d < summary.depth_records.size(); d++) {
+    depth_records += summary.depth_records[d];
+    if (summary.depth_records[d] > 0) {
+      EXPECT_LE(d, summary.max_depth);
+    }
+  }
+  EXPECT_EQ(depth_records, summary.record_num);
+  // few distinct stacks, top stacks are exact
+  ASSERT_EQ(summary.top_stacks.size(), 5);
+  std::vector<size_t> expected;
+  for (const auto& [stack, samples] : stack_samples) {
+    expected.push_back(samples);
+  }
+  std::sort(expected.begin(), expected.end(), std::greater<size_t>());
+  for (size_t i = 0; i < summary.top_stacks.size(); i++) {
+    const auto& top = summary.top_stacks[i];
+    EXPECT_EQ(top.error, 0);
+    EXPECT_EQ(top.samples, expected[i]);
+    EXPECT_EQ(stack_samples[top.pcs], top.samples);
+  }
+  auto text = summary.ToText();
+  EXPECT_NE(text.find("Depth histogram"), std::string::npos);
+  EXPECT_NE(text.find("Top 5 stacks"), std::string::npos);
+}
+
+TEST(ProfileSummary, BoundedStacks) {
+  ProfileSummarizer summarizer{2, 8};
+  // two heavy stacks among many light ones, interleaved
+  size_t heavy1[] = {0x1000, 0x2000}, heavy2[] = {0x3000};
+  for (size_t i = 0; i < 1000; i++) {
+    size_t light[] = {0x10000 + i, 0x2000};
+    summarizer.Add(1, light, 2);
+    summarizer.Add(3, heavy1, 2);
+    if (i % 2 == 0) {
+      summarizer.Add(2, heavy2, 1);
+    }
+  }
+  ProfileSummary summary;
+  summarizer.Finish(CPUProfileBinaryHeader{}, &summary);
+  EXPECT_LE(summarizer.stacks_.size(), 16);
+  ASSERT_EQ(summary.top_stacks.size(), 2);
+  EXPECT_EQ(summary.top_stacks[0].pcs, (std::vector<uintptr_t>{0x1000, 0x2000}));
+  EXPECT_EQ(summary.top_stacks[1].pcs, (std::vector<uintptr_t>{0x3000}));
+  // counts are upper bounds within error
+  for (const auto& [top, truth] : {std::make_pair(summary.top_stacks[0], 3000), std::make_pair(summary.top_stacks[1], 1000)}) {
+    EXPECT_GE(top.samples, static_cast<size_t>(truth));
+    EXPECT_LE(top.samples - top.error, static_cast<size_t>(truth));
+  }
+  EXPECT_EQ(summary.record_num, 2500);
+  EXPECT_EQ(summary.total_samples, 1000 + 3000 + 1000);
+  EXPECT_EQ(summary.distinct_pc_num, 1000 + 3);
+  EXPECT_EQ(summary.depth_records[1], 500);
+  EXPECT_EQ(summary.depth_records[2], 2000);
+}
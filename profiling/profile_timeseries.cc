@@ -0,0 +1,310 @@
+/*
+ * FileName: profile_timeseries.cc
+ * Author: jattle
+ * Descrption:
+ */
+
+#include "profiling/profile_timeseries.h"
+
+#include <algorithm>
+
+namespace pprofcpp {
+
+namespace {
+
+bool ValidateOptions(const TimeSeriesOptions& options) {
+  if (options.tiers.empty()) {
+    return false;
+  }
+  for (size_t i = 0; i < options.tiers.size(); i++) {
+    const auto& tier = options.tiers[i];
+    if (tier.window <= 0 || tier.retention == 0) {
+      return false;
+    }
+    if (i > 0 && tier.window % options.tiers[i - 1].window != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+ProfileTimeSeries::ProfileTimeSeries(const TimeSeriesOptions& options)
+    : options_(options), valid_(ValidateOptions(options)), tiers_(options.tiers.size()) {}
+
+int64_t ProfileTimeSeries::FloorTo(int64_t t, int64_t window) {
+  int64_t q = t / window;
+  if (t % window != 0 && t < 0) {
+    q--;
+  }
+  return q * window;
+}
+
+TimeSeriesRetCode ProfileTimeSeries::AddProfile(const CPUProfile& profile, int64_t timestamp) {
+  if (!valid_) {
+    return TimeSeriesRetCode::kInvalidOptions;
+  }
+  const auto& finest = options_.tiers.front();
+  if (has_watermark_ && timestamp < watermark_ &&
+      watermark_ - timestamp >= finest.window * static_cast<int64_t>(finest.retention)) {
+    return TimeSeriesRetCode::kExpiredTimestamp;
+  }
+  Advance(timestamp);
+  StackCounts counts;
+  counts.reserve(profile.GetCallStacks().size());
+  for (const auto& stack : profile.GetCallStacks()) {
+    if (stack.sample_count == 0 || stack.ptrs.empty()) {
+      continue;
+    }
+    counts.emplace_back(stacks_.Intern(stack.ptrs.data(), stack.ptrs.size()), stack.sample_count);
+  }
+  refs_.resize(stacks_.Size());
+  std::sort(counts.begin(), counts.end());
+  // same stack may be listed more than once in a profile, sum them up
+  size_t n = 0;
+  for (size_t i = 0; i < counts.size(); i++) {
+    if (n > 0 && counts[n - 1].first == counts[i].first) {
+      counts[n - 1].second += counts[i].second;
+    } else {
+      counts[n++] = counts[i];
+    }
+  }
+  counts.resize(n);
+  AddCounts(0, timestamp, counts);
+  for (size_t k = 0; k < tiers_.size(); k++) {
+    Evict(k);
+  }
+  return TimeSeriesRetCode::kOK;
+}
+
+void ProfileTimeSeries::AddCounts(size_t tier, int64_t timestamp, const StackCounts& counts) {
+  for (size_t k = tier; k < tiers_.size(); k++) {
+    int64_t window = options_.tiers[k].window;
+    int64_t start = FloorTo(timestamp, window);
+    auto [iter, inserted] = tiers_[k].try_emplace(start);
+    Window& w = iter->second;
+    if (inserted && has_watermark_ && start + window <= watermark_) {
+      // late window, Advance will never visit it again
+      w.sealed = true;
+    }
+    if (!w.sealed) {
+      for (const auto& [id, count] : counts) {
+        auto [count_iter, fresh] = w.open_counts.try_emplace(id, 0);
+        if (fresh) {
+          Ref(id);
+        }
+        count_iter->second += count;
+      }
+      break;
+    }
+    // sealed window has been merged into next tier already, late samples go on to next tier as well
+    StackCounts merged;
+    merged.reserve(w.counts.size() + counts.size());
+    size_t i = 0, j = 0;
+    while (i < w.counts.size() || j < counts.size()) {
+      if (j == counts.size() || (i < w.counts.size() && w.counts[i].first < counts[j].first)) {
+        merged.push_back(w.counts[i++]);
+      } else if (i == w.counts.size() || counts[j].first < w.counts[i].first) {
+        Ref(counts[j].first);
+        merged.push_back(counts[j++]);
+      } else {
+        merged.emplace_back(counts[j].first, w.counts[i].second + counts[j].second);
+        i++;
+        j++;
+      }
+    }
+    w.counts = std::move(merged);
+  }
+}
+
+void ProfileTimeSeries::Seal(size_t tier, Window* window, int64_t start) {
+  window->counts.assign(window->open_counts.begin(), window->open_counts.end());
+  std::sort(window->counts.begin(), window->counts.end());
+  window->open_counts = std::unordered_map<uint32_t, size_t>{};
+  window->sealed = true;
+  if (tier + 1 < tiers_.size()) {
+    AddCounts(tier + 1, start, window->counts);
+  }
+}
+
+void ProfileTimeSeries::Evict(size_t tier) {
+  auto& windows = tiers_[tier];
+  while (windows.size() > options_.tiers[tier].retention && windows.begin()->second.sealed) {
+    for (const auto& [id, count] : windows.begin()->second.counts) {
+      Unref(id);
+    }
+    windows.erase(windows.begin());
+  }
+  // amortized: every compaction drops at least as many stacks as it keeps
+  size_t dead = stacks_.Size() - live_stack_num_;
+  if (dead > 0 && dead >= live_stack_num_) {
+    Compact();
+  }
+}
+
+void ProfileTimeSeries::Ref(uint32_t id) {
+  if (refs_[id]++ == 0) {
+    live_stack_num_++;
+  }
+}
+
+void ProfileTimeSeries::Unref(uint32_t id) {
+  if (--refs_[id] == 0) {
+    live_stack_num_--;
+  }
+}
+
+void ProfileTimeSeries::Compact() {
+  StackTable live;
+  std::vector<uint32_t> remap(stacks_.Size(), StackTable::kNotFound);
+  std::vector<uint32_t> refs;
+  refs.reserve(live_stack_num_);
+  for (uint32_t id = 0; id < stacks_.Size(); id++) {
+    if (refs_[id] > 0) {
+      remap[id] = live.Intern(stacks_.GetPtrs(id), stacks_.GetDepth(id));
+      refs.push_back(refs_[id]);
+    }
+  }
+  for (auto& windows : tiers_) {
+    for (auto& [start, w] : windows) {
+      for (auto& entry : w.counts) {
+        entry.first = remap[entry.first];
+      }
+      if (!w.open_counts.empty()) {
+        std::unordered_map<uint32_t, size_t> open_counts;
+        open_counts.reserve(w.open_counts.size());
+        for (const auto& [id, count] : w.open_counts) {
+          open_counts.emplace(remap[id], count);
+        }
+        w.open_counts = std::move(open_counts);
+      }
+    }
+  }
+  symbolizer_.Compact(live, remap);
+  stacks_ = std::move(live);
+  refs_ = std::move(refs);
+}
+
+TimeSeriesRetCode ProfileTimeSeries::Advance(int64_t now) {
+  if (!valid_) {
+    return TimeSeriesRetCode::kInvalidOptions;
+  }
+  if (has_watermark_ && now <= watermark_) {
+    return TimeSeriesRetCode::kOK;
+  }
+  bool had_watermark = has_watermark_;
+  int64_t old_watermark = watermark_;
+  has_watermark_ = true;
+  watermark_ = now;
+  // finer tiers first, so that windows they seal into next tier are sealed in the same pass
+  for (size_t k = 0; k < tiers_.size(); k++) {
+    int64_t window = options_.tiers[k].window;
+    auto& windows = tiers_[k];
+    // windows ended before old watermark are sealed already
+    auto iter = had_watermark ? windows.lower_bound(old_watermark - window + 1) : windows.begin();
+    for (; iter != windows.end() && iter->first + window <= now; ++iter) {
+      if (!iter->second.sealed) {
+        Seal(k, &iter->second, iter->first);
+      }
+    }
+    Evict(k);
+  }
+  return TimeSeriesRetCode::kOK;
+}
+
+void ProfileTimeSeries::Collect(size_t tier, int64_t t0, int64_t t1,
+                                std::vector<std::pair<int64_t, const Window*>>* windows,
+                                TimeRangeStats* stats) const {
+  if (t0 >= t1) {
+    return;
+  }
+  int64_t window = options_.tiers[tier].window;
+  const auto& tier_windows = tiers_[tier];
+  auto add = [&](int64_t start, const Window* w) {
+    stats->begin = stats->window_num == 0 ? start : std::min(stats->begin, start);
+    stats->end = stats->window_num == 0 ? start + window : std::max(stats->end, start + window);
+    stats->window_num++;
+    windows->emplace_back(start, w);
+  };
+  if (tier == 0) {
+    // finest tier covers edges, partially overlapped window is included as a whole
+    for (auto iter = tier_windows.lower_bound(FloorTo(t0, window)); iter != tier_windows.end() && iter->first < t1;
+         ++iter) {
+      add(iter->first, &iter->second);
+    }
+    return;
+  }
+  int64_t first = FloorTo(t0, window) == t0 ? t0 : FloorTo(t0, window) + window;
+  int64_t last = FloorTo(t1, window);
+  if (first >= last) {
+    Collect(tier - 1, t0, t1, windows, stats);
+    return;
+  }
+  Collect(tier - 1, t0, first, windows, stats);
+  int64_t cursor = first;
+  for (auto iter = tier_windows.lower_bound(first); iter != tier_windows.end() && iter->first < last; ++iter) {
+    // open window only holds samples of sealed finer windows, finer tiers cover its range instead
+    if (!iter->second.sealed) {
+      continue;
+    }
+    Collect(tier - 1, cursor, iter->first, windows, stats);
+    add(iter->first, &iter->second);
+    cursor = iter->first + window;
+  }
+  Collect(tier - 1, cursor, t1, windows, stats);
+}
+
+TimeSeriesRetCode ProfileTimeSeries::TopFunctions(SymbolLocator* locator, int64_t t0, int64_t t1, size_t n,
+                                                  bool order_by_cum, std::vector<FunctionSamples>* functions,
+                                                  TimeRangeStats* stats) {
+  if (!valid_) {
+    return TimeSeriesRetCode::kInvalidOptions;
+  }
+  if (t0 >= t1) {
+    return TimeSeriesRetCode::kInvalidRange;
+  }
+  TimeRangeStats local_stats;
+  if (stats == nullptr) {
+    stats = &local_stats;
+  }
+  *stats = TimeRangeStats{};
+  std::vector<std::pair<int64_t, const Window*>> windows;
+  Collect(tiers_.size() - 1, t0, t1, &windows, stats);
+  // sum up counts of touched windows only, by sorting (stack id, count) pairs
+  StackCounts stack_counts;
+  for (const auto& [start, w] : windows) {
+    stack_counts.insert(stack_counts.end(), w->counts.begin(), w->counts.end());
+    stack_counts.insert(stack_counts.end(), w->open_counts.begin(), w->open_counts.end());
+  }
+  std::sort(stack_counts.begin(), stack_counts.end());
+  size_t m = 0;
+  for (size_t i = 0; i < stack_counts.size(); i++) {
+    stats->sample_num += stack_counts[i].second;
+    if (m > 0 && stack_counts[m - 1].first == stack_counts[i].first) {
+      stack_counts[m - 1].second += stack_counts[i].second;
+    } else {
+      stack_counts[m++] = stack_counts[i];
+    }
+  }
+  stack_counts.resize(m);
+  if (symbolizer_.Update(stacks_, locator) != LocatorRetCode::kOK) {
+    return TimeSeriesRetCode::kSearchSymbolFailed;
+  }
+  functions->clear();
+  const SymbolTable* table = symbolizer_.GetSymbolTable();
+  if (table == nullptr) {
+    return TimeSeriesRetCode::kOK;
+  }
+  CollectTopFunctions(
+      stack_counts.size(),
+      [this, &stack_counts](size_t k) {
+        uint32_t id = stack_counts[k].first;
+        return SymbolizedStack{symbolizer_.GetSymIds(id), symbolizer_.GetDepth(id), stack_counts[k].second};
+      },
+      table->Size(), [table](uint32_t sym_id) -> std::string_view { return table->GetName(sym_id); }, n,
+      order_by_cum, functions);
+  return TimeSeriesRetCode::kOK;
+}
+
+}  // namespace pprofcpp
@@ -0,0 +1,108 @@
+/*
+ * FileName: profile_timeseries.h
+ * Author: jattle
+ * Descrption: rolling time-series aggregation of CPU profiles with tiered downsampling windows
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "profiling/cpu_profile.h"
+#include "profiling/stack_symbolizer.h"
+#include "profiling/stack_table.h"
+#include "profiling/symbol/profile_symbol.h"
+
+namespace pprofcpp {
+
+enum class TimeSeriesRetCode {
+  kOK = 0,
+  kInvalidOptions = 1,
+  kExpiredTimestamp = 2,  // older than retention of the finest tier
+  kInvalidRange = 3,
+  kSearchSymbolFailed = 4,
+};
+
+/// @brief downsampling tier, windows are aligned to multiples of window length
+struct TimeSeriesTier {
+  int64_t window{60};    // window length in seconds, must be a multiple of window of previous tier
+  size_t retention{60};  // max windows kept, oldest sealed windows are evicted first
+};
+
+struct TimeSeriesOptions {
+  // 1m windows for a day, 1h windows for 30 days, 1d windows for a year
+  std::vector<TimeSeriesTier> tiers{{60, 24 * 60}, {3600, 24 * 30}, {86400, 365}};
+};
+
+/// @brief what a range query actually merged
+struct TimeRangeStats {
+  int64_t begin{0};  // covered range, query range aligned outward to window boundaries
+  int64_t end{0};
+  size_t window_num{0};  // windows merged, bounded by tiers touched rather than range length
+  size_t sample_num{0};
+};
+
+/// @brief ingest per-window CPU profiles and answer top functions queries over arbitrary time ranges.
+// stacks are interned into one StackTable shared by all windows, every window only keeps
+// (stack id, sample count) pairs. a window is sealed once time moves past its end and its counts are then
+// merged into the enclosing window of next tier, so coarse windows never re-merge raw profiles.
+// range queries use the coarsest sealed windows fully inside the range and finer tiers for the edges.
+// every stack is reference counted by windows holding it, once evicted windows leave as many unreferenced stacks
+// as live ones, stack table and its symbolization are compacted, so memory is bounded by retention of tiers.
+// not thread-safe
+class ProfileTimeSeries {
+ public:
+  explicit ProfileTimeSeries(const TimeSeriesOptions& options = TimeSeriesOptions{});
+  ~ProfileTimeSeries() = default;
+  // @brief add samples of profile(already parsed) to window containing timestamp(in seconds),
+  // time advances to timestamp if it is newer, late profile is accepted within retention of the finest tier
+  TimeSeriesRetCode AddProfile(const CPUProfile& profile, int64_t timestamp);
+  // @brief seal windows ended before now, without adding samples
+  TimeSeriesRetCode Advance(int64_t now);
+  // @brief top n functions over [t0, t1) ordered by cum(or flat) samples descending,
+  // symbols are searched for stacks not seen by previous queries only, cost depends on windows touched only.
+  // names are valid until next AddProfile/Advance, which may compact symbol table
+  TimeSeriesRetCode TopFunctions(SymbolLocator* locator, int64_t t0, int64_t t1, size_t n, bool order_by_cum,
+                                 std::vector<FunctionSamples>* functions, TimeRangeStats* stats = nullptr);
+  size_t GetTierNum() const { return options_.tiers.size(); }
+  size_t GetWindowNum(size_t tier) const { return tiers_[tier].size(); }
+  const StackTable& GetStackTable() const { return stacks_; }
+  const StackSymbolizer& GetSymbolizer() const { return symbolizer_; }
+
+ private:
+  using StackCounts = std::vector<std::pair<uint32_t, size_t>>;  // sorted by stack id
+  struct Window {
+    bool sealed{false};
+    std::unordered_map<uint32_t, size_t> open_counts;  // before sealed
+    StackCounts counts;                                 // after sealed
+  };
+  static int64_t FloorTo(int64_t t, int64_t window);
+  void AddCounts(size_t tier, int64_t timestamp, const StackCounts& counts);
+  void Seal(size_t tier, Window* window, int64_t start);
+  void Evict(size_t tier);
+  void Ref(uint32_t id);
+  void Unref(uint32_t id);
+  // @brief drop unreferenced stacks and renumber the others in the same order, so sorted counts stay sorted
+  void Compact();
+  // @brief windows covering [t0, t1) using tier and finer tiers, every instant is covered at most once
+  void Collect(size_t tier, int64_t t0, int64_t t1, std::vector<std::pair<int64_t, const Window*>>* windows,
+               TimeRangeStats* stats) const;
+
+  TimeSeriesOptions options_;
+  bool valid_{false};
+  std::vector<std::map<int64_t, Window>> tiers_;  // window start -> window, per tier
+  bool has_watermark_{false};
+  int64_t watermark_{0};  // latest time seen, windows ended before it are sealed
+  StackTable stacks_;
+  std::vector<uint32_t> refs_;  // stack id -> windows(of all tiers) holding it
+  size_t live_stack_num_{0};    // stacks with refs
+  StackSymbolizer symbolizer_;
+};
+
+}  // namespace pprofcpp
@@ -0,0 +1,190 @@
+/*
+ * FileName: profile_timeseries_test.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/profile_timeseries.h"
+
+#include <algorithm>
+
+#include "gtest/gtest.h"
+
+#include "profiling/symbol/fake_locator.h"
+
+using namespace pprofcpp;
+
+static std::string SeriesName(uintptr_t pc) { return pc < 0x2000 ? "hot" : (pc < 0x3000 ? "cold" : "main"); }
+
+// hot stack gets 1 sample per profile, cold stack gets 1 sample when with_cold
+static CPUProfile MakeProfile(bool with_cold) {
+  std::vector<CallStack> stacks;
+  stacks.push_back(CallStack{1, {reinterpret_cast<void*>(0x1000), reinterpret_cast<void*>(0x3001)}});
+  if (with_cold) {
+    stacks.push_back(CallStack{1, {reinterpret_cast<void*>(0x2000), reinterpret_cast<void*>(0x3001)}});
+  }
+  return CPUProfile{CPUProfileBinaryHeader{}, std::move(stacks), ""};
+}
+
+static TimeSeriesOptions MakeOptions() {
+  TimeSeriesOptions options;
+  options.tiers = {{10, 100}, {60, 100}, {360, 100}};
+  return options;
+}
+
+// one profile every 10 seconds over [0, 720), cold stack once per minute
+static void Fill(ProfileTimeSeries* series) {
+  for (int64_t t = 0; t < 720; t += 10) {
+    ASSERT_EQ(series->AddProfile(MakeProfile(t % 60 == 0), t), TimeSeriesRetCode::kOK);
+  }
+  ASSERT_EQ(series->Advance(720), TimeSeriesRetCode::kOK);
+}
+
+static const FunctionSamples* FindFunction(const std::vector<FunctionSamples>& functions, std::string_view name) {
+  for (const auto& f : functions) {
+    if (f.name == name) {
+      return &f;
+    }
+  }
+  return nullptr;
+}
+
+TEST(ProfileTimeSeries, Rollup) {
+  ProfileTimeSeries series{MakeOptions()};
+  Fill(&series);
+  EXPECT_EQ(series.GetStackTable().Size(), 2u);
+  EXPECT_EQ(series.GetWindowNum(0), 72u);
+  EXPECT_EQ(series.GetWindowNum(1), 12u);
+  EXPECT_EQ(series.GetWindowNum(2), 2u);
+  FakeLocator locator{SeriesName};
+  std::vector<FunctionSamples> functions;
+  TimeRangeStats stats;
+  ASSERT_EQ(series.TopFunctions(&locator, 0, 720, 10, true, &functions, &stats), TimeSeriesRetCode::kOK);
+  // whole range is served by two coarsest windows
+  EXPECT_EQ(stats.window_num, 2u);
+  EXPECT_EQ(stats.begin, 0);
+  EXPECT_EQ(stats.end, 720);
+  EXPECT_EQ(stats.sample_num, 84u);
+  ASSERT_EQ(functions.size(), 3u);
+  EXPECT_EQ(functions[0].name, "main");
+  EXPECT_EQ(functions[0].cum, 84u);
+  EXPECT_EQ(functions[0].flat, 0u);
+  EXPECT_EQ(functions[1].name, "hot");
+  EXPECT_EQ(functions[1].flat, 72u);
+  EXPECT_EQ(functions[2].name, "cold");
+  EXPECT_EQ(functions[2].flat, 12u);
+  size_t search_num = locator.GetSearchedNum();
+  ASSERT_EQ(series.TopFunctions(&locator, 0, 720, 1, false, &functions, &stats), TimeSeriesRetCode::kOK);
+  EXPECT_EQ(locator.GetSearchedNum(), search_num);
+  ASSERT_EQ(functions.size(), 1u);
+  EXPECT_EQ(functions[0].name, "hot");
+}
+
+TEST(ProfileTimeSeries, RangeEdges) {
+  ProfileTimeSeries series{MakeOptions()};
+  Fill(&series);
+  FakeLocator locator{SeriesName};
+  std::vector<FunctionSamples> functions;
+  TimeRangeStats stats;
+  // [5, 60) & [660, 705) by 10s windows, [60, 660) by 1m windows
+  ASSERT_EQ(series.TopFunctions(&locator, 5, 705, 10, true, &functions, &stats), TimeSeriesRetCode::kOK);
+  EXPECT_EQ(stats.window_num, 6u + 10u + 5u);
+  EXPECT_EQ(stats.begin, 0);
+  EXPECT_EQ(stats.end, 710);
+  auto hot = FindFunction(functions, "hot");
+  ASSERT_NE(hot, nullptr);
+  EXPECT_EQ(hot->flat, 71u);
+  auto cold = FindFunction(functions, "cold");
+  ASSERT_NE(cold, nullptr);
+  EXPECT_EQ(cold->flat, 12u);
+  // open window is answered by finer tier
+  ASSERT_EQ(series.AddProfile(MakeProfile(true), 725), TimeSeriesRetCode::kOK);
+  ASSERT_EQ(series.TopFunctions(&locator, 0, 730, 10, true, &functions, &stats), TimeSeriesRetCode::kOK);
+  EXPECT_EQ(stats.window_num, 3u);
+  EXPECT_EQ(stats.sample_num, 86u);
+  EXPECT_EQ(series.TopFunctions(&locator, 10, 10, 10, true, &functions, &stats), TimeSeriesRetCode::kInvalidRange);
+  ASSERT_EQ(series.TopFunctions(&locator, 5000, 6000, 10, true, &functions, &stats), TimeSeriesRetCode::kOK);
+  EXPECT_EQ(stats.window_num, 0u);
+  EXPECT_TRUE(functions.empty());
+}
+
+TEST(ProfileTimeSeries, LateAndExpired) {
+  ProfileTimeSeries series{MakeOptions()};
+  Fill(&series);
+  FakeLocator locator{SeriesName};
+  std::vector<FunctionSamples> functions;
+  TimeRangeStats stats;
+  // late profile lands in sealed windows of every tier
+  ASSERT_EQ(series.AddProfile(MakeProfile(false), 15), TimeSeriesRetCode::kOK);
+  ASSERT_EQ(series.TopFunctions(&locator, 0, 360, 10, true, &functions, &stats), TimeSeriesRetCode::kOK);
+  EXPECT_EQ(stats.window_num, 1u);
+  auto hot = FindFunction(functions, "hot");
+  ASSERT_NE(hot, nullptr);
+  EXPECT_EQ(hot->flat, 37u);
+  ASSERT_EQ(series.TopFunctions(&locator, 10, 20, 10, true, &functions, &stats), TimeSeriesRetCode::kOK);
+  hot = FindFunction(functions, "hot");
+  ASSERT_NE(hot, nullptr);
+  EXPECT_EQ(hot->flat, 2u);
+  ASSERT_EQ(series.Advance(2000), TimeSeriesRetCode::kOK);
+  EXPECT_EQ(series.AddProfile(MakeProfile(false), 1000), TimeSeriesRetCode::kExpiredTimestamp);
+}
+
+TEST(ProfileTimeSeries, Retention) {
+  TimeSeriesOptions options;
+  options.tiers = {{10, 6}, {60, 2}};
+  ProfileTimeSeries series{options};
+  for (int64_t t = 0; t < 600; t += 10) {
+    ASSERT_EQ(series.AddProfile(MakeProfile(false), t), TimeSeriesRetCode::kOK);
+  }
+  EXPECT_EQ(series.GetWindowNum(0), 6u);
+  EXPECT_EQ(series.GetWindowNum(1), 2u);
+  FakeLocator locator{SeriesName};
+  std::vector<FunctionSamples> functions;
+  TimeRangeStats stats;
+  ASSERT_EQ(series.TopFunctions(&locator, 0, 600, 10, true, &functions, &stats), TimeSeriesRetCode::kOK);
+  // sealed [480, 540) from 1m tier, open [540, 600) from 10s tier
+  EXPECT_EQ(stats.begin, 480);
+  EXPECT_EQ(stats.end, 600);
+  EXPECT_EQ(stats.sample_num, 12u);
+}
+
+TEST(ProfileTimeSeries, EvictStacks) {
+  TimeSeriesOptions options;
+  options.tiers = {{10, 3}, {60, 1}};
+  ProfileTimeSeries series{options};
+  FakeLocator locator{SeriesName};
+  std::vector<FunctionSamples> functions;
+  TimeRangeStats stats;
+  // every profile has its own stack besides the hot one, evicted ones must be released
+  for (int64_t t = 0; t < 6000; t += 10) {
+    auto profile = MakeProfile(false);
+    auto stacks = profile.GetCallStacks();
+    stacks.push_back(CallStack{1, {reinterpret_cast<void*>(0x4000 + t), reinterpret_cast<void*>(0x3001)}});
+    ASSERT_EQ(series.AddProfile(CPUProfile{CPUProfileBinaryHeader{}, std::move(stacks), ""}, t),
+              TimeSeriesRetCode::kOK);
+    ASSERT_EQ(series.TopFunctions(&locator, t - 20, t + 10, 10, true, &functions, &stats), TimeSeriesRetCode::kOK);
+    EXPECT_LE(series.GetStackTable().Size(), 2 * 12u);
+    ASSERT_NE(series.GetSymbolizer().GetSymbolTable(), nullptr);
+    EXPECT_LE(series.GetSymbolizer().GetInternedSymbols().addrs.size(), 2 * 14u);
+    auto hot = FindFunction(functions, "hot");
+    ASSERT_NE(hot, nullptr);
+    EXPECT_EQ(hot->flat, static_cast<size_t>(std::min<int64_t>(t / 10 + 1, 3)));
+    auto main = FindFunction(functions, "main");
+    ASSERT_NE(main, nullptr);
+    EXPECT_EQ(main->cum, 2 * hot->flat);
+  }
+  // 1m window is still open, whole range is served by the last 3 10s windows
+  ASSERT_EQ(series.TopFunctions(&locator, 0, 6000, 10, true, &functions, &stats), TimeSeriesRetCode::kOK);
+  EXPECT_EQ(stats.begin, 5970);
+  EXPECT_EQ(stats.sample_num, 2 * 3u);
+}
+
+TEST(ProfileTimeSeries, InvalidOptions) {
+  TimeSeriesOptions options;
+  options.tiers = {{10, 6}, {15, 2}};
+  ProfileTimeSeries series{options};
+  EXPECT_EQ(series.AddProfile(MakeProfile(false), 0), TimeSeriesRetCode::kInvalidOptions);
+  EXPECT_EQ(series.Advance(0), TimeSeriesRetCode::kInvalidOptions);
+  options.tiers.clear();
+  ProfileTimeSeries empty{options};
+  EXPECT_EQ(empty.AddProfile(MakeProfile(false), 0), TimeSeriesRetCode::kInvalidOptions);
+}
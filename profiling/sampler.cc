@@ -0,0 +1,406 @@
+/*
+ * FileName: sampler.cc
+ * Author: jattle
+ * Descrption:
+ */
+
+#include "profiling/sampler.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "profiling/util/utils.h"
+
+namespace pprofcpp {
+
+namespace {
+
+constexpr char kSelfMapsPath[] = "/proc/self/maps";
+// a single caller frame is never assumed to be larger than this
+constexpr uintptr_t kMaxFrameStep = 256 * 1024;
+
+/// @brief single producer(signal handler of owner thread), single consumer(collector) sample ring
+struct SampleRing {
+  std::atomic<pid_t> owner{0};     // tid of owner thread, 0 means free
+  std::atomic<uint64_t> head{0};   // written by producer
+  std::atomic<uint64_t> tail{0};   // written by consumer
+  std::atomic<uint64_t> dropped{0};
+  uint32_t* depths{nullptr};       // capacity
+  const void** pcs{nullptr};       // capacity * max_depth
+};
+
+/// @brief ring storage shared with signal handler
+// never freed: a handler started before Stop may still touch it
+struct SamplerState {
+  size_t ring_num{0};
+  size_t capacity{0};
+  size_t max_depth{0};
+  std::unique_ptr<SampleRing[]> rings;
+  std::unique_ptr<uint32_t[]> depths;
+  std::unique_ptr<const void*[]> pcs;
+  std::atomic<uint64_t> dropped{0};  // no ring available
+};
+
+std::atomic<CPUSampler*> g_active_sampler{nullptr};
+std::atomic<SamplerState*> g_state{nullptr};
+std::atomic<uint64_t> g_generation{0};
+SamplerState* g_cached_state{nullptr};
+struct sigaction g_old_action;
+
+/// @brief ring claimed by current thread, initial-exec tls is safe to access in signal handler
+struct ThreadRing {
+  uint64_t generation{0};
+  SampleRing* ring{nullptr};
+  uintptr_t stack_lo{0};  // readable mapping holding the stack of current thread, [stack_lo, stack_hi)
+  uintptr_t stack_hi{0};
+};
+__thread ThreadRing tls_ring __attribute__((tls_model("initial-exec")));
+
+size_t RoundUpPowerOf2(size_t v) {
+  size_t r = 1;
+  while (r < v) {
+    r <<= 1;
+  }
+  return r;
+}
+
+SamplerState* GetOrCreateState(const SamplerOptions& options) {
+  size_t capacity = RoundUpPowerOf2(std::max<size_t>(options.ring_capacity, 2));
+  size_t max_depth = std::max<size_t>(options.max_depth, 1);
+  size_t ring_num = std::max<size_t>(options.max_threads, 1);
+  SamplerState* st = g_cached_state;
+  if (st == nullptr || st->capacity != capacity || st->max_depth != max_depth || st->ring_num != ring_num) {
+    st = new SamplerState;
+    st->ring_num = ring_num;
+    st->capacity = capacity;
+    st->max_depth = max_depth;
+    st->rings = std::make_unique<SampleRing[]>(ring_num);
+    st->depths = std::make_unique<uint32_t[]>(ring_num * capacity);
+    st->pcs = std::make_unique<const void*[]>(ring_num * capacity * max_depth);
+    for (size_t i = 0; i < ring_num; i++) {
+      st->rings[i].depths = st->depths.get() + i * capacity;
+      st->rings[i].pcs = st->pcs.get() + i * capacity * max_depth;
+    }
+    g_cached_state = st;
+  }
+  for (size_t i = 0; i < st->ring_num; i++) {
+    st->rings[i].owner.store(0);
+    st->rings[i].head.store(0);
+    st->rings[i].tail.store(0);
+    st->rings[i].dropped.store(0);
+  }
+  st->dropped.store(0);
+  return st;
+}
+
+SampleRing* ClaimRing(SamplerState* st) {
+  auto tid = static_cast<pid_t>(syscall(SYS_gettid));
+  for (size_t i = 0; i < st->ring_num; i++) {
+    pid_t expected = 0;
+    if (st->rings[i].owner.load(std::memory_order_relaxed) == 0 &&
+        st->rings[i].owner.compare_exchange_strong(expected, tid, std::memory_order_acq_rel)) {
+      return &st->rings[i];
+    }
+  }
+  return nullptr;
+}
+
+int HexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+/// @brief find readable mapping containing addr by scanning /proc/self/maps, async-signal-safe(open/read/close
+// only, no allocation), pthread_getattr_np is not: it allocates and reads maps through stdio for main thread
+bool FindReadableMapping(uintptr_t addr, uintptr_t* lo, uintptr_t* hi) {
+  int fd = open(kSelfMapsPath, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  // per line state: 0 start addr, 1 end addr, 2 first perm char, 3 skip to end of line
+  int state = 0;
+  uintptr_t start = 0;
+  uintptr_t end = 0;
+  bool found = false;
+  char buf[4096];
+  ssize_t n = 0;
+  while (!found && (n = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < n && !found; i++) {
+      char c = buf[i];
+      if (c == '\n') {
+        state = 0;
+        start = 0;
+        end = 0;
+        continue;
+      }
+      int digit = HexDigit(c);
+      if (state == 0) {
+        state = digit >= 0 ? 0 : (c == '-' ? 1 : 3);
+        start = digit >= 0 ? (start << 4) | static_cast<uintptr_t>(digit) : start;
+      } else if (state == 1) {
+        state = digit >= 0 ? 1 : (c == ' ' ? 2 : 3);
+        end = digit >= 0 ? (end << 4) | static_cast<uintptr_t>(digit) : end;
+      } else if (state == 2) {
+        found = c == 'r' && start <= addr && addr < end;
+        state = 3;
+      }
+    }
+  }
+  close(fd);
+  if (found) {
+    *lo = start;
+    *hi = end;
+  }
+  return found;
+}
+
+/// @brief frame pointer unwinding, leaf pc first then return addresses
+// without frame pointers fp is an arbitrary register value, so every load is bounded by the readable mapping
+// of current thread stack(looked up once per thread, again when sp leaves it e.g. coroutine stacks) and aligned
+size_t Unwind(void* ucontext, const void** pcs, size_t max_depth) {
+  auto* uc = static_cast<ucontext_t*>(ucontext);
+#if defined(__x86_64__)
+  auto pc = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RIP]);
+  auto fp = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RBP]);
+  auto sp = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RSP]);
+#elif defined(__aarch64__)
+  auto pc = static_cast<uintptr_t>(uc->uc_mcontext.pc);
+  auto fp = static_cast<uintptr_t>(uc->uc_mcontext.regs[29]);
+  auto sp = static_cast<uintptr_t>(uc->uc_mcontext.sp);
+#else
+  return 0;
+#endif
+  size_t n = 0;
+  pcs[n++] = reinterpret_cast<const void*>(pc);
+  if (sp < tls_ring.stack_lo || sp >= tls_ring.stack_hi) {
+    if (!FindReadableMapping(sp, &tls_ring.stack_lo, &tls_ring.stack_hi)) {
+      tls_ring.stack_lo = 0;
+      tls_ring.stack_hi = 0;
+      return n;
+    }
+  }
+  uintptr_t lo = std::max(sp, tls_ring.stack_lo);
+  uintptr_t hi = tls_ring.stack_hi;
+  // frame layout: [fp] = caller fp, [fp + 1 word] = return address
+  while (n < max_depth) {
+    if (fp < lo || fp > hi - 2 * sizeof(uintptr_t) || (fp & (sizeof(uintptr_t) - 1)) != 0) {
+      break;
+    }
+    const auto* frame = reinterpret_cast<const uintptr_t*>(fp);
+    uintptr_t next_fp = frame[0];
+    uintptr_t ret = frame[1];
+    if (ret == 0) {
+      break;
+    }
+    pcs[n++] = reinterpret_cast<const void*>(ret);
+    // stack grows down, caller frame must be above and not far away
+    if (next_fp <= fp || next_fp - fp > kMaxFrameStep) {
+      break;
+    }
+    fp = next_fp;
+  }
+  return n;
+}
+
+void SigprofHandler(int, siginfo_t*, void* ucontext) {
+  int saved_errno = errno;
+  SamplerState* st = g_state.load(std::memory_order_acquire);
+  if (st != nullptr) {
+    uint64_t generation = g_generation.load(std::memory_order_acquire);
+    if (tls_ring.generation != generation) {
+      tls_ring.generation = generation;
+      tls_ring.ring = ClaimRing(st);
+      tls_ring.stack_lo = 0;
+      tls_ring.stack_hi = 0;
+    }
+    SampleRing* ring = tls_ring.ring;
+    if (ring == nullptr) {
+      st->dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      uint64_t head = ring->head.load(std::memory_order_relaxed);
+      if (head - ring->tail.load(std::memory_order_acquire) >= st->capacity) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        size_t index = head & (st->capacity - 1);
+        ring->depths[index] =
+            static_cast<uint32_t>(Unwind(ucontext, ring->pcs + index * st->max_depth, st->max_depth));
+        ring->head.store(head + 1, std::memory_order_release);
+      }
+    }
+  }
+  errno = saved_errno;
+}
+
+bool IsThreadAlive(pid_t tid) {
+  return syscall(SYS_tgkill, getpid(), tid, 0) == 0 || errno != ESRCH;
+}
+
+}  // namespace
+
+CPUSampler::CPUSampler(const SamplerOptions& options) : options_(options) {}
+
+bool CPUSampler::Start() {
+  std::lock_guard<std::mutex> locker(mutex_);
+  if (running_ || options_.frequency <= 0) {
+    return false;
+  }
+  CPUSampler* expected{nullptr};
+  if (!g_active_sampler.compare_exchange_strong(expected, this)) {
+    return false;
+  }
+  g_state.store(GetOrCreateState(options_), std::memory_order_release);
+  g_generation.fetch_add(1, std::memory_order_acq_rel);
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = SigprofHandler;
+  action.sa_flags = SA_RESTART | SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &g_old_action) != 0) {
+    g_state.store(nullptr, std::memory_order_release);
+    g_active_sampler.store(nullptr);
+    return false;
+  }
+  struct itimerval timer;
+  int interval_us = std::max(1000000 / options_.frequency, 1);
+  timer.it_interval.tv_sec = interval_us / 1000000;
+  timer.it_interval.tv_usec = interval_us % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    sigaction(SIGPROF, &g_old_action, nullptr);
+    g_state.store(nullptr, std::memory_order_release);
+    g_active_sampler.store(nullptr);
+    return false;
+  }
+  running_ = true;
+  stopping_.store(false);
+  collect_thread_ = std::thread(&CPUSampler::CollectLoop, this);
+  return true;
+}
+
+void CPUSampler::Stop() {
+  {
+    std::lock_guard<std::mutex> locker(mutex_);
+    if (!running_) {
+      return;
+    }
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    // SIGPROF raised before the timer was disarmed may still be pending, under restored disposition(usually
+    // SIG_DFL) it would kill the process. ignoring it discards pending ones, and no new one is raised after disarm
+    struct sigaction ignore;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGPROF, &ignore, nullptr);
+    sigaction(SIGPROF, &g_old_action, nullptr);
+    stopping_.store(true);
+  }
+  cv_.notify_all();
+  collect_thread_.join();
+  std::lock_guard<std::mutex> locker(mutex_);
+  Drain();
+  g_state.store(nullptr, std::memory_order_release);
+  g_active_sampler.store(nullptr);
+  running_ = false;
+}
+
+void CPUSampler::CollectLoop() {
+  std::unique_lock<std::mutex> locker(mutex_);
+  while (!stopping_.load()) {
+    cv_.wait_for(locker, options_.drain_interval, [this] { return stopping_.load(); });
+    Drain();
+  }
+}
+
+void CPUSampler::Drain() {
+  SamplerState* st = g_state.load(std::memory_order_acquire);
+  if (st == nullptr) {
+    return;
+  }
+  for (size_t i = 0; i < st->ring_num; i++) {
+    SampleRing& ring = st->rings[i];
+    pid_t owner = ring.owner.load(std::memory_order_acquire);
+    if (owner == 0) {
+      continue;
+    }
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    for (; tail != head; tail++) {
+      size_t index = tail & (st->capacity - 1);
+      if (ring.depths[index] == 0) {
+        continue;
+      }
+      uint32_t id = stacks_.Intern(ring.pcs + index * st->max_depth, ring.depths[index]);
+      if (id >= counts_.size()) {
+        counts_.resize(id + 1);
+      }
+      counts_[id]++;
+      sample_num_++;
+    }
+    ring.tail.store(tail, std::memory_order_release);
+    // release ring of exited thread, so that long running process with thread churn does not run out of rings
+    if (!IsThreadAlive(owner) && ring.head.load(std::memory_order_acquire) == tail) {
+      ring.owner.store(0, std::memory_order_release);
+    }
+  }
+}
+
+std::unique_ptr<CPUProfile> CPUSampler::TakeProfile(bool reset) {
+  std::vector<CallStack> stacks;
+  CPUProfileBinaryHeader header;
+  header.sampling_period = 1000000 / std::max(options_.frequency, 1);
+  {
+    std::lock_guard<std::mutex> locker(mutex_);
+    Drain();
+    stacks.reserve(stacks_.Size());
+    for (uint32_t id = 0; id < stacks_.Size(); id++) {
+      CallStack stack;
+      stack.sample_count = counts_[id];
+      const void* const* ptrs = stacks_.GetPtrs(id);
+      for (size_t i = 0; i < stacks_.GetDepth(id); i++) {
+        stack.ptrs.push_back(const_cast<void*>(ptrs[i]));
+      }
+      stacks.emplace_back(std::move(stack));
+    }
+    if (reset) {
+      stacks_.Clear();
+      counts_.clear();
+    }
+  }
+  std::string maps_text;
+  LoadFileContent(kSelfMapsPath, &maps_text);
+  return std::make_unique<CPUProfile>(header, std::move(stacks), std::move(maps_text));
+}
+
+uint64_t CPUSampler::GetDroppedNum() const {
+  SamplerState* st = g_cached_state;
+  if (st == nullptr) {
+    return 0;
+  }
+  uint64_t dropped = st->dropped.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < st->ring_num; i++) {
+    dropped += st->rings[i].dropped.load(std::memory_order_relaxed);
+  }
+  return dropped;
+}
+
+uint64_t CPUSampler::GetSampleNum() const {
+  std::lock_guard<std::mutex> locker(mutex_);
+  return sample_num_;
+}
+
+}  // namespace pprofcpp
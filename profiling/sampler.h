@@ -0,0 +1,72 @@
+/*
+ * FileName: sampler.h
+ * Author: jattle
+ * Descrption: built-in SIGPROF CPU sampler, samples are aggregated in memory without gperftools profile file
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "profiling/cpu_profile.h"
+#include "profiling/stack_table.h"
+
+namespace pprofcpp {
+
+/// @brief ring memory is preallocated: max_threads * ring_capacity * max_depth pointers, 4MB by default
+struct SamplerOptions {
+  int frequency{100};         // samples per second of consumed CPU time
+  size_t max_depth{64};       // max frames unwound per sample
+  size_t ring_capacity{128};  // samples buffered per thread before drained, rounded up to power of 2
+  size_t max_threads{64};     // max threads sampled concurrently, samples of more threads are dropped
+  std::chrono::milliseconds drain_interval{std::chrono::milliseconds(10)};
+};
+
+/// @brief SIGPROF based CPU sampler
+// ITIMER_PROF delivers SIGPROF to the thread consuming CPU, the signal handler unwinds the stack with frame pointers
+// and pushes it into a lock-free single-producer ring owned by that thread, a collector thread drains all rings
+// into an in-memory stack table. only one sampler can be active in a process, since SIGPROF is process wide.
+// binaries must keep frame pointers(-fno-omit-frame-pointer) for callers to be unwound, x86_64 & aarch64 only.
+// unwinding never reads outside the stack mapping of interrupted thread, a frame without frame pointer ends it.
+class CPUSampler {
+ public:
+  explicit CPUSampler(const SamplerOptions& options = SamplerOptions{});
+  ~CPUSampler() { Stop(); }
+  CPUSampler(const CPUSampler&) = delete;
+  CPUSampler& operator=(const CPUSampler&) = delete;
+  // @brief install handler & start timer, return false if another sampler is active or setup failed
+  bool Start();
+  // @brief stop timer, restore previous handler and drain left samples
+  void Stop();
+  // @brief build profile from samples collected so far, with /proc/self/maps attached
+  // collected samples are cleared if reset is true
+  std::unique_ptr<CPUProfile> TakeProfile(bool reset = true);
+  // @brief samples dropped because ring is full or no ring is available
+  uint64_t GetDroppedNum() const;
+  // @brief samples aggregated so far
+  uint64_t GetSampleNum() const;
+
+ private:
+  void CollectLoop();
+  void Drain();
+
+  SamplerOptions options_;
+  bool running_{false};
+  std::atomic<bool> stopping_{false};
+  mutable std::mutex mutex_;  // guards stacks_ & counts_
+  std::condition_variable cv_;
+  StackTable stacks_;
+  std::vector<size_t> counts_;  // stack id -> sample count
+  uint64_t sample_num_{0};
+  std::thread collect_thread_;
+};
+
+}  // namespace pprofcpp
@@ -0,0 +1,52 @@
+/*
+ * FileName: sampler_benchmark.cc
+ * Author: jattle
+ * Descrption: cost of one SIGPROF sample taken by CPUSampler, compared with an empty handler
+ */
+#include <signal.h>
+
+#include <cstring>
+
+#include "benchmark/benchmark.h"
+
+#include "profiling/sampler.h"
+
+using namespace pprofcpp;
+
+static void EmptyHandler(int, siginfo_t*, void*) {}
+
+static void BM_RaiseEmptyHandler(benchmark::State& state) {
+  struct sigaction action, old_action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = EmptyHandler;
+  action.sa_flags = SA_RESTART | SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, &old_action);
+  for (auto _ : state) {
+    raise(SIGPROF);
+  }
+  sigaction(SIGPROF, &old_action, nullptr);
+}
+BENCHMARK(BM_RaiseEmptyHandler);
+
+static void BM_RaiseSampler(benchmark::State& state) {
+  SamplerOptions options;
+  options.frequency = 1;  // samples are driven by raise, keep timer out of the way
+  options.ring_capacity = 1 << 14;
+  options.max_threads = 4;
+  options.drain_interval = std::chrono::milliseconds(1);
+  CPUSampler sampler{options};
+  if (!sampler.Start()) {
+    state.SkipWithError("start sampler failed");
+    return;
+  }
+  for (auto _ : state) {
+    raise(SIGPROF);
+  }
+  sampler.Stop();
+  state.counters["dropped"] = static_cast<double>(sampler.GetDroppedNum());
+  state.counters["stacks"] = static_cast<double>(sampler.TakeProfile()->GetRecordNum());
+}
+BENCHMARK(BM_RaiseSampler);
+
+BENCHMARK_MAIN();
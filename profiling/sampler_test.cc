@@ -0,0 +1,145 @@
+/*
+ * FileName: sampler_test.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/sampler.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "profiling/symbol/fake_locator.h"
+
+using namespace pprofcpp;
+
+static std::string SamplerName(uintptr_t) { return "func"; }
+
+static double BurnCPU(std::chrono::milliseconds duration) {
+  volatile double sink = 0;
+  auto deadline = std::chrono::steady_clock::now() + duration;
+  while (std::chrono::steady_clock::now() < deadline) {
+    for (int i = 1; i < 10000; i++) {
+      sink = sink + std::sqrt(static_cast<double>(i));
+    }
+  }
+  return sink;
+}
+
+TEST(CPUSampler, TakeProfile) {
+  SamplerOptions options;
+  options.frequency = 1000;
+  CPUSampler sampler{options};
+  ASSERT_TRUE(sampler.Start());
+  // only one sampler can be active
+  CPUSampler another;
+  ASSERT_FALSE(another.Start());
+  BurnCPU(std::chrono::milliseconds(300));
+  sampler.Stop();
+  ASSERT_GT(sampler.GetSampleNum(), 0);
+  auto profile = sampler.TakeProfile();
+  ASSERT_NE(profile, nullptr);
+  ASSERT_GT(profile->GetRecordNum(), 0);
+  ASSERT_GT(profile->total_sample_cnt_, 0);
+  ASSERT_EQ(profile->binary_header_.sampling_period, 1000);
+  ASSERT_FALSE(profile->GetMapsText().empty());
+  FakeLocator locator{SamplerName};
+  RawProfileMeta meta;
+  meta.program_path = "/proc/self/exe";
+  std::string raw;
+  ASSERT_EQ(profile->GenerateRawProfile(meta, &locator, &raw), CPUProfileRetCode::kOK);
+  ASSERT_NE(raw.find("--- profile"), std::string::npos);
+  // collected samples were reset
+  ASSERT_EQ(sampler.TakeProfile()->GetRecordNum(), 0);
+  // restart after stop
+  ASSERT_TRUE(sampler.Start());
+  sampler.Stop();
+}
+
+TEST(CPUSampler, StartStopStress) {
+  // SIGPROF still pending at Stop must not reach the restored default action(which terminates the process)
+  std::atomic<bool> done{false};
+  std::vector<std::thread> burners;
+  for (int i = 0; i < 4; i++) {
+    burners.emplace_back([&done] {
+      while (!done.load()) {
+        BurnCPU(std::chrono::milliseconds(1));
+      }
+    });
+  }
+  SamplerOptions options;
+  options.frequency = 10000;
+  CPUSampler sampler{options};
+  for (int i = 0; i < 200; i++) {
+    ASSERT_TRUE(sampler.Start());
+    BurnCPU(std::chrono::milliseconds(5));
+    sampler.Stop();
+  }
+  done.store(true);
+  for (auto& burner : burners) {
+    burner.join();
+  }
+  ASSERT_GT(sampler.GetSampleNum(), 0);
+}
+
+#if defined(__x86_64__)
+// @brief spin with rbp holding bogus, as code built without frame pointers may do
+static void SpinWithBogusFramePointer(uintptr_t bogus, uint64_t iterations) {
+  asm volatile(
+      "sub $128, %%rsp\n"  // skip red zone
+      "push %%rbp\n"
+      "mov %%rdi, %%rbp\n"
+      "1: dec %%rcx\n"
+      "jnz 1b\n"
+      "pop %%rbp\n"
+      "add $128, %%rsp\n"
+      : "+D"(bogus), "+c"(iterations)
+      :
+      : "cc", "memory");
+}
+
+static void* SpinOnOwnStack(void* arg) {
+  auto bogus = *static_cast<uintptr_t*>(arg);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+  while (std::chrono::steady_clock::now() < deadline) {
+    SpinWithBogusFramePointer(bogus, 1000000);
+    // garbage pointing into readable heap memory is bounded as well
+    std::vector<uintptr_t> heap(64, bogus);
+    SpinWithBogusFramePointer(reinterpret_cast<uintptr_t>(heap.data()), 1000000);
+  }
+  return nullptr;
+}
+
+TEST(CPUSampler, BogusFramePointer) {
+  // thread stack followed by an unreadable page, bogus rbp points right into it: above sp and close to it,
+  // only the bound of stack mapping keeps handler from touching it
+  constexpr size_t kStackSize = 256 * 1024;
+  constexpr size_t kPageSize = 4096;
+  void* region = mmap(nullptr, kStackSize + kPageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(region, MAP_FAILED);
+  char* guard = static_cast<char*>(region) + kStackSize;
+  ASSERT_EQ(mprotect(guard, kPageSize, PROT_NONE), 0);
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  ASSERT_EQ(pthread_attr_setstack(&attr, region, kStackSize), 0);
+  uintptr_t bogus = reinterpret_cast<uintptr_t>(guard);
+  SamplerOptions options;
+  options.frequency = 1000;
+  CPUSampler sampler{options};
+  ASSERT_TRUE(sampler.Start());
+  pthread_t thread;
+  ASSERT_EQ(pthread_create(&thread, &attr, SpinOnOwnStack, &bogus), 0);
+  pthread_join(thread, nullptr);
+  sampler.Stop();
+  pthread_attr_destroy(&attr);
+  munmap(region, kStackSize + kPageSize);
+  ASSERT_GT(sampler.GetSampleNum(), 0);
+}
+#endif
@@ -0,0 +1,163 @@
+/*
+ * FileName: stack_symbolizer.cc
+ * Author: jattle
+ * Descrption:
+ */
+
+#include "profiling/stack_symbolizer.h"
+
+#include <algorithm>
+#include <memory>
+
+namespace pprofcpp {
+
+void CollectTopFunctions(size_t stack_num, const std::function<SymbolizedStack(size_t)>& stack_of, size_t sym_num,
+                         const std::function<std::string_view(uint32_t)>& name_of, size_t n, bool order_by_cum,
+                         std::vector<FunctionSamples>* functions) {
+  constexpr size_t kNoStack = static_cast<size_t>(-1);
+  std::vector<size_t> flat(sym_num), cum(sym_num);
+  std::vector<size_t> last_stack(sym_num, kNoStack);
+  for (size_t k = 0; k < stack_num; k++) {
+    auto stack = stack_of(k);
+    if (stack.depth == 0) {
+      continue;
+    }
+    flat[stack.sym_ids[0]] += stack.count;
+    for (size_t i = 0; i < stack.depth; i++) {
+      // recursive function is counted once per stack
+      uint32_t sym_id = stack.sym_ids[i];
+      if (last_stack[sym_id] != k) {
+        last_stack[sym_id] = k;
+        cum[sym_id] += stack.count;
+      }
+    }
+  }
+  functions->clear();
+  for (uint32_t sym_id = SymbolTable::kUnknownSymbolId + 1; sym_id < sym_num; sym_id++) {
+    if (last_stack[sym_id] != kNoStack) {
+      functions->push_back(FunctionSamples{name_of(sym_id), flat[sym_id], cum[sym_id]});
+    }
+  }
+  n = std::min(n, functions->size());
+  std::partial_sort(functions->begin(), functions->begin() + n, functions->end(),
+                    [order_by_cum](const FunctionSamples& l, const FunctionSamples& r) {
+                      size_t ls = order_by_cum ? l.cum : l.flat;
+                      size_t rs = order_by_cum ? r.cum : r.flat;
+                      // break ties by name to keep output stable
+                      return ls != rs ? ls > rs : l.name < r.name;
+                    });
+  functions->resize(n);
+}
+
+LocatorRetCode StackSymbolizer::Update(const StackTable& stacks, SymbolLocator* locator) {
+  auto begin = static_cast<uint32_t>(GetSymbolizedNum());
+  auto end = static_cast<uint32_t>(stacks.Size());
+  if (begin >= end) {
+    return LocatorRetCode::kOK;
+  }
+  InternedSymbols fresh;
+  fresh.table = interned_.table;
+  for (uint32_t id = begin; id < end; id++) {
+    const void* const* ptrs = stacks.GetPtrs(id);
+    for (size_t i = 0; i < stacks.GetDepth(id); i++) {
+      void* addr = ToSymbolAddr(ptrs, i);
+      if (!std::binary_search(interned_.addrs.cbegin(), interned_.addrs.cend(), addr)) {
+        fresh.addrs.push_back(addr);
+      }
+    }
+  }
+  std::sort(fresh.addrs.begin(), fresh.addrs.end());
+  fresh.addrs.erase(std::unique(fresh.addrs.begin(), fresh.addrs.end()), fresh.addrs.end());
+  if (!fresh.addrs.empty()) {
+    if (auto ret = locator->SearchSymbolIds(&fresh); ret.ret != LocatorRetCode::kOK) {
+      return ret.ret;
+    }
+    // merge new addrs into sorted interned addrs, both share the same table
+    InternedSymbols merged;
+    merged.table = fresh.table;
+    merged.addrs.reserve(interned_.addrs.size() + fresh.addrs.size());
+    merged.sym_ids.reserve(merged.addrs.capacity());
+    merged.func_addrs.reserve(merged.addrs.capacity());
+    size_t i = 0, j = 0;
+    while (i < interned_.addrs.size() || j < fresh.addrs.size()) {
+      if (j == fresh.addrs.size() || (i < interned_.addrs.size() && interned_.addrs[i] < fresh.addrs[j])) {
+        merged.addrs.push_back(interned_.addrs[i]);
+        merged.func_addrs.push_back(interned_.func_addrs[i]);
+        merged.sym_ids.push_back(interned_.sym_ids[i++]);
+      } else {
+        merged.addrs.push_back(fresh.addrs[j]);
+        merged.func_addrs.push_back(fresh.func_addrs[j]);
+        merged.sym_ids.push_back(fresh.sym_ids[j++]);
+      }
+    }
+    interned_ = std::move(merged);
+  }
+  for (uint32_t id = begin; id < end; id++) {
+    const void* const* ptrs = stacks.GetPtrs(id);
+    for (size_t i = 0; i < stacks.GetDepth(id); i++) {
+      auto iter = std::lower_bound(interned_.addrs.cbegin(), interned_.addrs.cend(), ToSymbolAddr(ptrs, i));
+      stack_sym_ids_.push_back(interned_.sym_ids[iter - interned_.addrs.cbegin()]);
+    }
+    stack_sym_offsets_.push_back(static_cast<uint32_t>(stack_sym_ids_.size()));
+  }
+  return LocatorRetCode::kOK;
+}
+
+void StackSymbolizer::Compact(const StackTable& stacks, const std::vector<uint32_t>& remap) {
+  if (interned_.table == nullptr) {
+    stack_sym_offsets_.assign(1, 0);
+    return;
+  }
+  // kept symbolized stacks are the first ones of compacted table since remap is increasing
+  std::vector<uint32_t> offsets{0};
+  std::vector<uint32_t> sym_ids;
+  for (uint32_t id = 0; id < GetSymbolizedNum(); id++) {
+    if (remap[id] == StackTable::kNotFound) {
+      continue;
+    }
+    sym_ids.insert(sym_ids.end(), GetSymIds(id), GetSymIds(id) + GetDepth(id));
+    offsets.push_back(static_cast<uint32_t>(sym_ids.size()));
+  }
+  std::vector<void*> addrs;
+  for (uint32_t id = 0; id + 1 < offsets.size(); id++) {
+    const void* const* ptrs = stacks.GetPtrs(id);
+    for (size_t i = 0; i < stacks.GetDepth(id); i++) {
+      addrs.push_back(ToSymbolAddr(ptrs, i));
+    }
+  }
+  std::sort(addrs.begin(), addrs.end());
+  addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+  InternedSymbols kept;
+  kept.table = std::make_shared<SymbolTable>();
+  kept.addrs.reserve(addrs.size());
+  kept.sym_ids.reserve(addrs.size());
+  kept.func_addrs.reserve(addrs.size());
+  std::vector<uint32_t> sym_remap(interned_.table->Size(), SymbolTable::kUnknownSymbolId);
+  size_t j = 0;
+  for (void* addr : addrs) {
+    while (interned_.addrs[j] < addr) {
+      j++;
+    }
+    uint32_t sym_id = interned_.sym_ids[j];
+    if (sym_id != SymbolTable::kUnknownSymbolId && sym_remap[sym_id] == SymbolTable::kUnknownSymbolId) {
+      sym_remap[sym_id] = kept.table->Intern(interned_.table->GetName(sym_id));
+    }
+    kept.addrs.push_back(addr);
+    kept.sym_ids.push_back(sym_remap[sym_id]);
+    kept.func_addrs.push_back(interned_.func_addrs[j]);
+  }
+  for (auto& sym_id : sym_ids) {
+    sym_id = sym_remap[sym_id];
+  }
+  interned_ = std::move(kept);
+  stack_sym_offsets_ = std::move(offsets);
+  stack_sym_ids_ = std::move(sym_ids);
+}
+
+void StackSymbolizer::Clear() {
+  interned_ = InternedSymbols{};
+  stack_sym_offsets_.assign(1, 0);
+  stack_sym_ids_.clear();
+}
+
+}  // namespace pprofcpp
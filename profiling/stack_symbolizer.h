@@ -0,0 +1,71 @@
+/*
+ * FileName: stack_symbolizer.h
+ * Author: jattle
+ * Descrption: incremental symbolization of interned call stacks into shared symbol ids
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+#include "profiling/stack_table.h"
+#include "profiling/symbol/profile_symbol.h"
+
+namespace pprofcpp {
+
+/// @brief samples of one function in top functions queries
+struct FunctionSamples {
+  std::string_view name;  // refers to symbol table of the queried object
+  size_t flat{0};         // samples of stacks whose leaf is this function
+  size_t cum{0};          // samples of stacks containing this function
+};
+
+/// @brief one symbolized stack with its samples, sym_ids is leaf first
+struct SymbolizedStack {
+  const uint32_t* sym_ids{nullptr};
+  size_t depth{0};
+  size_t count{0};
+};
+
+/// @brief top n functions over stack_num stacks(stack_of(i) is the i-th one) ordered by cum(or flat) samples
+// descending, ties broken by name. sym ids are in [0, sym_num) and named by name_of, recursive function is counted
+// once per stack, unknown symbol(id 0) is not reported
+void CollectTopFunctions(size_t stack_num, const std::function<SymbolizedStack(size_t)>& stack_of, size_t sym_num,
+                         const std::function<std::string_view(uint32_t)>& name_of, size_t n, bool order_by_cum,
+                         std::vector<FunctionSamples>* functions);
+
+/// @brief map every stack of an append-only StackTable to symbol ids of one shared SymbolTable
+// addrs of stack are leaf as is & callers subtracted by 1, every distinct addr is searched only once,
+// so repeated Update calls only pay for addrs of stacks interned since last call
+// not thread-safe
+class StackSymbolizer {
+ public:
+  StackSymbolizer() = default;
+  ~StackSymbolizer() = default;
+  // @brief symbolize stacks [GetSymbolizedNum(), stacks.Size()), stacks must be the same table as before
+  LocatorRetCode Update(const StackTable& stacks, SymbolLocator* locator);
+  // @brief stack num symbolized so far
+  size_t GetSymbolizedNum() const { return stack_sym_offsets_.size() - 1; }
+  // @brief symbol ids of stack id, leaf first, parallel to StackTable::GetPtrs
+  const uint32_t* GetSymIds(uint32_t id) const { return stack_sym_ids_.data() + stack_sym_offsets_[id]; }
+  size_t GetDepth(uint32_t id) const { return stack_sym_offsets_[id + 1] - stack_sym_offsets_[id]; }
+  // @brief shared name table, null before any addr is searched
+  const SymbolTable* GetSymbolTable() const { return interned_.table.get(); }
+  const InternedSymbols& GetInternedSymbols() const { return interned_; }
+  // @brief follow compaction of stack table: remap is old stack id -> new id(StackTable::kNotFound if dropped),
+  // increasing over kept ids, stacks is the compacted table. addrs & names only referenced by dropped stacks are
+  // released, symbol ids are renumbered so names got before are invalidated
+  void Compact(const StackTable& stacks, const std::vector<uint32_t>& remap);
+  void Clear();
+
+ private:
+  InternedSymbols interned_;                    // sorted addrs searched so far
+  std::vector<uint32_t> stack_sym_offsets_{0};  // stack id -> range of stack_sym_ids_
+  std::vector<uint32_t> stack_sym_ids_;
+};
+
+}  // namespace pprofcpp
@@ -0,0 +1,79 @@
+/*
+ * FileName: stack_symbolizer_test.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/stack_symbolizer.h"
+
+#include "gtest/gtest.h"
+
+using namespace pprofcpp;
+
+class CountingLocator : public SymbolLocator {
+ public:
+  LocatorStatus SearchSymbols(const std::vector<void*>& addrs,
+                              std::unordered_map<void*, SymbolInfo>* sym_mapping) override {
+    search_num += addrs.size();
+    for (const auto& addr : addrs) {
+      auto pc = reinterpret_cast<uintptr_t>(addr);
+      sym_mapping->emplace(addr, SymbolInfo{addr, pc < 0x2000 ? "leaf" : "main"});
+    }
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  }
+  size_t search_num{0};
+};
+
+static const void* ToPtr(uintptr_t addr) { return reinterpret_cast<const void*>(addr); }
+
+TEST(StackSymbolizer, Update) {
+  StackTable stacks;
+  StackSymbolizer symbolizer;
+  CountingLocator locator;
+  const void* s1[] = {ToPtr(0x1000), ToPtr(0x3001)};
+  const void* s2[] = {ToPtr(0x1010), ToPtr(0x3001)};
+  uint32_t id1 = stacks.Intern(s1, 2);
+  ASSERT_EQ(symbolizer.Update(stacks, &locator), LocatorRetCode::kOK);
+  EXPECT_EQ(symbolizer.GetSymbolizedNum(), 1u);
+  EXPECT_EQ(locator.search_num, 2u);
+  uint32_t id2 = stacks.Intern(s2, 2);
+  ASSERT_EQ(symbolizer.Update(stacks, &locator), LocatorRetCode::kOK);
+  // caller addr 0x3000 was searched before
+  EXPECT_EQ(locator.search_num, 3u);
+  ASSERT_EQ(symbolizer.Update(stacks, &locator), LocatorRetCode::kOK);
+  EXPECT_EQ(locator.search_num, 3u);
+  ASSERT_EQ(symbolizer.GetDepth(id2), 2u);
+  const SymbolTable* table = symbolizer.GetSymbolTable();
+  ASSERT_NE(table, nullptr);
+  EXPECT_EQ(table->GetName(symbolizer.GetSymIds(id1)[0]), "leaf");
+  EXPECT_EQ(symbolizer.GetSymIds(id1)[0], symbolizer.GetSymIds(id2)[0]);
+  EXPECT_EQ(table->GetName(symbolizer.GetSymIds(id2)[1]), "main");
+  EXPECT_EQ(symbolizer.GetInternedSymbols().addrs.size(), 3u);
+  symbolizer.Clear();
+  EXPECT_EQ(symbolizer.GetSymbolizedNum(), 0u);
+  EXPECT_EQ(symbolizer.GetSymbolTable(), nullptr);
+}
+
+TEST(StackSymbolizer, CollectTopFunctions) {
+  // names: 0 unknown, 1 "a", 2 "b", 3 "c"
+  const char* names[] = {"", "a", "b", "c"};
+  const uint32_t s1[] = {1, 2, 1, 3};  // recursive a
+  const uint32_t s2[] = {2, 3};
+  const uint32_t s3[] = {0, 3};  // unresolved leaf
+  std::vector<SymbolizedStack> stacks = {{s1, 4, 5}, {s2, 2, 3}, {s3, 2, 2}};
+  std::vector<FunctionSamples> functions;
+  auto stack_of = [&stacks](size_t k) { return stacks[k]; };
+  auto name_of = [&names](uint32_t sym_id) { return std::string_view{names[sym_id]}; };
+  CollectTopFunctions(stacks.size(), stack_of, 4, name_of, 10, true, &functions);
+  ASSERT_EQ(functions.size(), 3u);
+  EXPECT_EQ(functions[0].name, "c");
+  EXPECT_EQ(functions[0].cum, 10u);
+  EXPECT_EQ(functions[1].name, "b");
+  EXPECT_EQ(functions[1].cum, 8u);
+  EXPECT_EQ(functions[1].flat, 3u);
+  EXPECT_EQ(functions[2].name, "a");
+  EXPECT_EQ(functions[2].cum, 5u);
+  EXPECT_EQ(functions[2].flat, 5u);
+  CollectTopFunctions(stacks.size(), stack_of, 4, name_of, 1, false, &functions);
+  ASSERT_EQ(functions.size(), 1u);
+  EXPECT_EQ(functions[0].name, "a");
+}
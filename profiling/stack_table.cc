@@ -0,0 +1,88 @@
+/*
+ * FileName: stack_table.cc
+ * Author: jattle
+ * Descrption:
+ */
+
+#include "profiling/stack_table.h"
+
+#include <algorithm>
+
+namespace pprofcpp {
+
+namespace {
+
+constexpr size_t kMinSlotNum = 64;
+
+}  // namespace
+
+uint64_t StackTable::Hash(const void* const* pcs, size_t n) {
+  uint64_t h = 0xcbf29ce484222325ULL ^ n;
+  for (size_t i = 0; i < n; i++) {
+    h ^= reinterpret_cast<uintptr_t>(pcs[i]);
+    h *= 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+bool StackTable::Equal(uint32_t id, const void* const* pcs, size_t n) const {
+  return GetDepth(id) == n && std::equal(pcs, pcs + n, GetPtrs(id));
+}
+
+size_t StackTable::Probe(uint64_t hash, const void* const* pcs, size_t n) const {
+  size_t mask = slots_.size() - 1;
+  for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    uint32_t v = slots_[slot];
+    if (v == 0 || (hashes_[v - 1] == hash && Equal(v - 1, pcs, n))) {
+      return slot;
+    }
+  }
+}
+
+void StackTable::Rehash(size_t slot_num) {
+  slots_.assign(slot_num, 0);
+  size_t mask = slot_num - 1;
+  for (uint32_t id = 0; id < hashes_.size(); id++) {
+    size_t slot = hashes_[id] & mask;
+    while (slots_[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    slots_[slot] = id + 1;
+  }
+}
+
+uint32_t StackTable::Find(const void* const* pcs, size_t n) const {
+  if (slots_.empty()) {
+    return kNotFound;
+  }
+  uint32_t v = slots_[Probe(Hash(pcs, n), pcs, n)];
+  return v == 0 ? kNotFound : v - 1;
+}
+
+uint32_t StackTable::Intern(const void* const* pcs, size_t n) {
+  // keep load factor <= 0.5
+  if ((Size() + 1) * 2 > slots_.size()) {
+    Rehash(std::max(kMinSlotNum, slots_.size() * 2));
+  }
+  uint64_t hash = Hash(pcs, n);
+  size_t slot = Probe(hash, pcs, n);
+  if (slots_[slot] != 0) {
+    return slots_[slot] - 1;
+  }
+  uint32_t id = static_cast<uint32_t>(Size());
+  pcs_.insert(pcs_.end(), pcs, pcs + n);
+  offsets_.push_back(pcs_.size());
+  hashes_.push_back(hash);
+  slots_[slot] = id + 1;
+  return id;
+}
+
+void StackTable::Clear() {
+  pcs_.clear();
+  offsets_.assign(1, 0);
+  hashes_.clear();
+  slots_.clear();
+}
+
+}  // namespace pprofcpp
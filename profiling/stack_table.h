@@ -0,0 +1,50 @@
+/*
+ * FileName: stack_table.h
+ * Author: jattle
+ * Descrption: interned call stack table, identical stacks share one id
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pprofcpp {
+
+/// @brief call stacks interned into one flat pc array(CSR layout), no allocation per stack
+// stack id is dense and stable, starting from 0
+// not thread-safe
+class StackTable {
+ public:
+  StackTable() = default;
+  ~StackTable() = default;
+  // @brief return id of stack pcs[0, n), stack is copied only when first seen
+  uint32_t Intern(const void* const* pcs, size_t n);
+  // @brief return id of stack, or kNotFound
+  uint32_t Find(const void* const* pcs, size_t n) const;
+  // @brief distinct stack num
+  size_t Size() const { return offsets_.size() - 1; }
+  // @brief pcs of stack id, leaf first
+  const void* const* GetPtrs(uint32_t id) const { return pcs_.data() + offsets_[id]; }
+  size_t GetDepth(uint32_t id) const { return offsets_[id + 1] - offsets_[id]; }
+  // @brief total pc num of all distinct stacks
+  size_t PtrNum() const { return pcs_.size(); }
+  void Clear();
+
+  static constexpr uint32_t kNotFound = UINT32_MAX;
+
+ private:
+  static uint64_t Hash(const void* const* pcs, size_t n);
+  bool Equal(uint32_t id, const void* const* pcs, size_t n) const;
+  // @brief slot of stack, or empty slot it should be inserted into
+  size_t Probe(uint64_t hash, const void* const* pcs, size_t n) const;
+  void Rehash(size_t slot_num);
+
+  std::vector<const void*> pcs_;
+  std::vector<size_t> offsets_{0};  // stack id -> [offsets_[id], offsets_[id + 1]) of pcs_
+  std::vector<uint64_t> hashes_;    // stack id -> hash
+  std::vector<uint32_t> slots_;     // open addressing index, id + 1, 0 means empty
+};
+
+}  // namespace pprofcpp
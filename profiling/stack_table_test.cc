@@ -0,0 +1,45 @@
+/*
+ * FileName: stack_table_test.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/stack_table.h"
+
+#include "gtest/gtest.h"
+
+using namespace pprofcpp;
+
+static const void* ToPtr(uintptr_t addr) { return reinterpret_cast<const void*>(addr); }
+
+TEST(StackTable, Intern) {
+  StackTable table;
+  std::vector<const void*> s1{ToPtr(0x1), ToPtr(0x2), ToPtr(0x3)};
+  std::vector<const void*> s2{ToPtr(0x1), ToPtr(0x2)};
+  EXPECT_EQ(table.Find(s1.data(), s1.size()), StackTable::kNotFound);
+  uint32_t id1 = table.Intern(s1.data(), s1.size());
+  uint32_t id2 = table.Intern(s2.data(), s2.size());
+  EXPECT_NE(id1, id2);
+  EXPECT_EQ(table.Intern(s1.data(), s1.size()), id1);
+  EXPECT_EQ(table.Find(s2.data(), s2.size()), id2);
+  EXPECT_EQ(table.Size(), 2u);
+  EXPECT_EQ(table.PtrNum(), 5u);
+  ASSERT_EQ(table.GetDepth(id1), 3u);
+  EXPECT_EQ(table.GetPtrs(id1)[2], ToPtr(0x3));
+  table.Clear();
+  EXPECT_EQ(table.Size(), 0u);
+  EXPECT_EQ(table.Find(s1.data(), s1.size()), StackTable::kNotFound);
+}
+
+TEST(StackTable, Rehash) {
+  StackTable table;
+  constexpr size_t kStackNum = 10000;
+  for (size_t i = 0; i < kStackNum; i++) {
+    const void* pcs[] = {ToPtr(i), ToPtr(i * 7 + 1)};
+    EXPECT_EQ(table.Intern(pcs, 2), i);
+  }
+  EXPECT_EQ(table.Size(), kStackNum);
+  for (size_t i = 0; i < kStackNum; i++) {
+    const void* pcs[] = {ToPtr(i), ToPtr(i * 7 + 1)};
+    EXPECT_EQ(table.Find(pcs, 2), i);
+  }
+}
@@ -0,0 +1,44 @@
+/*
+ * FileName: fake_locator.h
+ * Author: jattle
+ * Descrption: test only symbol locator
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "profiling/symbol/profile_symbol.h"
+
+namespace pprofcpp {
+
+/// @brief names every addr by name_of(addr), empty name leaves addr unresolved. every resolved addr is the start
+// address of its own function. searched addrs are counted, so tests can check what reaches the locator
+class FakeLocator : public SymbolLocator {
+ public:
+  explicit FakeLocator(std::function<std::string(uintptr_t)> name_of) : name_of_(std::move(name_of)) {}
+  LocatorStatus SearchSymbols(const std::vector<void*>& addrs,
+                              std::unordered_map<void*, SymbolInfo>* sym_mapping) override {
+    searched_num_ += addrs.size();
+    for (auto addr : addrs) {
+      auto name = name_of_(reinterpret_cast<uintptr_t>(addr));
+      if (!name.empty()) {
+        sym_mapping->emplace(addr, SymbolInfo{addr, std::move(name), addr});
+      }
+    }
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  }
+  // @brief addrs passed to SearchSymbols so far
+  size_t GetSearchedNum() const { return searched_num_; }
+
+ private:
+  std::function<std::string(uintptr_t)> name_of_;
+  size_t searched_num_{0};
+};
+
+}  // namespace pprofcpp
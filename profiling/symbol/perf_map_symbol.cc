@@ -0,0 +1,272 @@
+/*
+ * FileName: perf_map_symbol.cc
+ * Author: jattle
+ * Descrption: symbol source of JIT code from perf map files(/tmp/perf-<pid>.map), composed with other locators
+ */
+#include "profiling/symbol/perf_map_symbol.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <queue>
+
+#include "fmt/format.h"
+
+#include "profiling/util/utils.h"
+
+namespace pprofcpp {
+
+namespace {
+
+bool ParseHex(std::string_view sv, uintptr_t* value) {
+  if (sv.size() > 2 && sv[0] == '0' && (sv[1] == 'x' || sv[1] == 'X')) {
+    sv.remove_prefix(2);
+  }
+  auto res = std::from_chars(sv.data(), sv.data() + sv.size(), *value, 16);
+  return res.ec == std::errc{} && res.ptr == sv.data() + sv.size();
+}
+
+// @brief parse "START SIZE name", name may contain spaces
+bool ParsePerfMapLine(std::string_view line, uintptr_t* start, uintptr_t* size, std::string_view* name) {
+  auto pos = line.find(' ');
+  if (pos == std::string_view::npos || !ParseHex(line.substr(0, pos), start)) {
+    return false;
+  }
+  line = TrimFront(line.substr(pos + 1));
+  pos = line.find(' ');
+  if (pos == std::string_view::npos || !ParseHex(line.substr(0, pos), size)) {
+    return false;
+  }
+  *name = Trim(line.substr(pos + 1));
+  return *size != 0 && *start + *size > *start;
+}
+
+}  // namespace
+
+std::string PerfMapPath(pid_t pid) { return fmt::format("/tmp/perf-{}.map", pid); }
+
+size_t PerfMapIndex::Append(std::string_view text) {
+  std::vector<Entry> batch;
+  size_t consumed = 0;
+  while (consumed < text.size()) {
+    auto eol = text.find('\n', consumed);
+    if (eol == std::string_view::npos) {
+      break;
+    }
+    auto line = TrimBack(text.substr(consumed, eol - consumed));
+    consumed = eol + 1;
+    if (line.empty()) {
+      continue;
+    }
+    uintptr_t start = 0;
+    uintptr_t size = 0;
+    std::string_view name;
+    if (!ParsePerfMapLine(line, &start, &size, &name)) {
+      bad_line_num_++;
+      continue;
+    }
+    batch.push_back(Entry{start, start + size, static_cast<uint32_t>(names_.size())});
+    names_.emplace_back(name);
+  }
+  if (!batch.empty()) {
+    Merge(&batch);
+  }
+  return consumed;
+}
+
+void PerfMapIndex::Merge(std::vector<Entry>* batch) {
+  // name ids grow in file order, so the later entry of an overlap is the one with larger name id: paint batch
+  // into disjoint pieces by sweeping its boundaries with a max heap of covering entries(lazily dropped once ended)
+  std::sort(batch->begin(), batch->end(), [](const Entry& l, const Entry& r) { return l.start < r.start; });
+  std::vector<uintptr_t> bounds;
+  bounds.reserve(2 * batch->size());
+  for (const auto& entry : *batch) {
+    bounds.push_back(entry.start);
+    bounds.push_back(entry.end);
+  }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+  auto later = [](const Entry& l, const Entry& r) { return l.name_id < r.name_id; };
+  std::priority_queue<Entry, std::vector<Entry>, decltype(later)> covering{later};
+  std::vector<Entry> pieces;
+  size_t next = 0;
+  for (size_t i = 0; i + 1 < bounds.size(); i++) {
+    while (next < batch->size() && (*batch)[next].start == bounds[i]) {
+      covering.push((*batch)[next++]);
+    }
+    while (!covering.empty() && covering.top().end <= bounds[i]) {
+      covering.pop();
+    }
+    if (covering.empty()) {
+      continue;
+    }
+    uint32_t name_id = covering.top().name_id;
+    if (!pieces.empty() && pieces.back().end == bounds[i] && pieces.back().name_id == name_id) {
+      pieces.back().end = bounds[i + 1];
+    } else {
+      pieces.push_back(Entry{bounds[i], bounds[i + 1], name_id});
+    }
+  }
+  // every piece is later than indexed entries: cut them by pieces, then merge the two sorted disjoint lists
+  std::vector<Entry> rest;
+  rest.reserve(entries_.size() + pieces.size());
+  size_t first = 0;
+  for (const auto& entry : entries_) {
+    while (first < pieces.size() && pieces[first].end <= entry.start) {
+      first++;
+    }
+    uintptr_t cursor = entry.start;
+    for (size_t k = first; k < pieces.size() && pieces[k].start < entry.end; k++) {
+      if (pieces[k].start > cursor) {
+        rest.push_back(Entry{cursor, pieces[k].start, entry.name_id});
+      }
+      cursor = std::max(cursor, pieces[k].end);
+    }
+    if (cursor < entry.end) {
+      rest.push_back(Entry{cursor, entry.end, entry.name_id});
+    }
+  }
+  entries_.clear();
+  entries_.reserve(rest.size() + pieces.size());
+  std::merge(rest.begin(), rest.end(), pieces.begin(), pieces.end(), std::back_inserter(entries_),
+             [](const Entry& l, const Entry& r) { return l.start < r.start; });
+}
+
+const PerfMapIndex::Entry* PerfMapIndex::Find(uintptr_t addr) const {
+  auto iter = std::upper_bound(entries_.begin(), entries_.end(), addr,
+                               [](uintptr_t a, const Entry& entry) { return a < entry.start; });
+  if (iter == entries_.begin()) {
+    return nullptr;
+  }
+  --iter;
+  return addr < iter->end ? &*iter : nullptr;
+}
+
+void PerfMapIndex::Clear() {
+  entries_.clear();
+  names_.clear();
+  bad_line_num_ = 0;
+}
+
+PerfMapSymbolLocator::PerfMapSymbolLocator(const std::string& map_file, SymbolLocator* fallback)
+    : map_file_(map_file), fallback_(fallback) {
+  this->Reload();
+}
+
+LocatorStatus PerfMapSymbolLocator::Reload() {
+  struct stat st;
+  if (stat(map_file_.c_str(), &st) != 0) {
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  }
+  {
+    std::shared_lock<std::shared_mutex> lock(rw_mutex_);
+    if (st.st_ino == inode_ && st.st_size == loaded_size_) {
+      return LocatorStatus{LocatorRetCode::kOK, ""};
+    }
+  }
+  std::unique_lock<std::shared_mutex> lock(rw_mutex_);
+  if (st.st_ino != inode_ || st.st_size < loaded_size_) {
+    // replaced(e.g. pid reused) or truncated, reparse from scratch
+    index_.Clear();
+    pending_.clear();
+    loaded_size_ = 0;
+    inode_ = st.st_ino;
+  }
+  std::unique_ptr<FILE, decltype(&std::fclose)> fp{std::fopen(map_file_.c_str(), "rb"), std::fclose};
+  if (!fp || std::fseek(fp.get(), loaded_size_, SEEK_SET) != 0) {
+    return LocatorStatus{LocatorRetCode::kOpenFileFailed, fmt::format("open perf map {} failed", map_file_)};
+  }
+  char buffer[16 * 1024];
+  size_t bytes = 0;
+  while ((bytes = std::fread(buffer, 1, sizeof(buffer), fp.get())) > 0) {
+    pending_.append(buffer, bytes);
+    loaded_size_ += static_cast<off_t>(bytes);
+  }
+  pending_.erase(0, index_.Append(pending_));
+  return LocatorStatus{LocatorRetCode::kOK, ""};
+}
+
+size_t PerfMapSymbolLocator::Size() {
+  std::shared_lock<std::shared_mutex> lock(rw_mutex_);
+  return index_.Size();
+}
+
+LocatorStatus PerfMapSymbolLocator::SearchSymbols(const std::vector<void*>& addrs,
+                                                  std::unordered_map<void*, SymbolInfo>* sym_mapping) {
+  if (addrs.empty()) {
+    return LocatorStatus{LocatorRetCode::kNoAddr, "no addrs provided"};
+  }
+  if (auto ret = this->Reload(); ret.ret != LocatorRetCode::kOK) {
+    return ret;
+  }
+  std::vector<void*> rest;
+  {
+    std::shared_lock<std::shared_mutex> lock(rw_mutex_);
+    for (auto addr : addrs) {
+      const auto* entry = index_.Find(reinterpret_cast<uintptr_t>(addr));
+      if (entry == nullptr) {
+        rest.push_back(addr);
+        continue;
+      }
+      sym_mapping->emplace(addr, SymbolInfo{addr, index_.GetName(entry->name_id),
+                                            reinterpret_cast<const void*>(entry->start)});
+    }
+  }
+  if (rest.empty() || fallback_ == nullptr) {
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  }
+  return fallback_->SearchSymbols(rest, sym_mapping);
+}
+
+LocatorStatus PerfMapSymbolLocator::SearchSymbolIds(InternedSymbols* result) {
+  if (result->addrs.empty()) {
+    return LocatorStatus{LocatorRetCode::kNoAddr, "no addrs provided"};
+  }
+  if (auto ret = this->Reload(); ret.ret != LocatorRetCode::kOK) {
+    return ret;
+  }
+  if (result->table == nullptr) {
+    result->table = std::make_shared<SymbolTable>();
+  }
+  result->sym_ids.assign(result->addrs.size(), SymbolTable::kUnknownSymbolId);
+  result->func_addrs.assign(result->addrs.size(), nullptr);
+  InternedSymbols rest;
+  rest.table = result->table;
+  std::vector<size_t> rest_index;
+  {
+    std::shared_lock<std::shared_mutex> lock(rw_mutex_);
+    std::unordered_map<uint32_t, uint32_t> name_ids;  // perf map name id -> symbol id
+    for (size_t i = 0; i < result->addrs.size(); i++) {
+      const auto* entry = index_.Find(reinterpret_cast<uintptr_t>(result->addrs[i]));
+      if (entry == nullptr) {
+        rest.addrs.push_back(result->addrs[i]);
+        rest_index.push_back(i);
+        continue;
+      }
+      auto iter = name_ids.find(entry->name_id);
+      if (iter == name_ids.end()) {
+        iter = name_ids.emplace(entry->name_id, result->table->Intern(index_.GetName(entry->name_id))).first;
+      }
+      result->sym_ids[i] = iter->second;
+      result->func_addrs[i] = reinterpret_cast<void*>(entry->start);
+    }
+  }
+  if (rest.addrs.empty() || fallback_ == nullptr) {
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  }
+  if (auto ret = fallback_->SearchSymbolIds(&rest); ret.ret != LocatorRetCode::kOK) {
+    return ret;
+  }
+  for (size_t i = 0; i < rest_index.size(); i++) {
+    result->sym_ids[rest_index[i]] = rest.sym_ids[i];
+    result->func_addrs[rest_index[i]] = rest.func_addrs[i];
+  }
+  return LocatorStatus{LocatorRetCode::kOK, ""};
+}
+
+}  // namespace pprofcpp
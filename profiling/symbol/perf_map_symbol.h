@@ -0,0 +1,83 @@
+/*
+ * FileName: perf_map_symbol.h
+ * Author: jattle
+ * Descrption: symbol source of JIT code from perf map files(/tmp/perf-<pid>.map), composed with other locators
+ */
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "profiling/symbol/profile_symbol.h"
+
+namespace pprofcpp {
+
+/// @brief default perf map file written by JITs(LuaJIT, V8 --perf-basic-prof, ...) for process pid
+std::string PerfMapPath(pid_t pid);
+
+/// @brief sorted interval index of perf map entries, every line is "START SIZE name" with hex START & SIZE.
+// intervals are kept disjoint and sorted by start: a later entry overlapping earlier ones(code region reused by
+// JIT) takes over the overlapped range, the remaining parts of earlier entries are kept
+class PerfMapIndex {
+ public:
+  struct Entry {
+    uintptr_t start{0};
+    uintptr_t end{0};     // exclusive
+    uint32_t name_id{0};  // index of names
+  };
+  PerfMapIndex() = default;
+  ~PerfMapIndex() = default;
+  // @brief parse complete lines of text and merge them into index, return bytes consumed(up to the last newline),
+  // the trailing partial line is left to next call. malformed lines are skipped and counted
+  size_t Append(std::string_view text);
+  // @brief entry containing addr, nullptr if not found
+  const Entry* Find(uintptr_t addr) const;
+  const std::string& GetName(uint32_t name_id) const { return names_[name_id]; }
+  void Clear();
+  // @brief disjoint entry num
+  size_t Size() const { return entries_.size(); }
+  size_t GetBadLineNum() const { return bad_line_num_; }
+
+ private:
+  // @brief merge parsed entries(in file order) with disjoint entries_ in O((N + M) log M), batch is reordered
+  void Merge(std::vector<Entry>* batch);
+
+  std::vector<Entry> entries_;
+  std::vector<std::string> names_;
+  size_t bad_line_num_{0};
+};
+
+/// @brief locator resolving addrs in JIT code by perf map file, addrs outside every perf map entry are passed to
+// fallback(nullable, not owned, usually BfdSymbolLocator). perf map is reloaded incrementally before every search:
+// only bytes appended since last load are parsed, the whole file is reparsed if it was replaced or truncated
+class PerfMapSymbolLocator : public SymbolLocator {
+ public:
+  explicit PerfMapSymbolLocator(const std::string& map_file, SymbolLocator* fallback = nullptr);
+  ~PerfMapSymbolLocator() override = default;
+  // @brief load newly appended lines, missing map file is not an error(JIT may not have written it yet)
+  LocatorStatus Reload();
+  // @brief disjoint entry num of current index
+  size_t Size();
+  LocatorStatus SearchSymbols(const std::vector<void*>& addrs,
+                              std::unordered_map<void*, SymbolInfo>* sym_mapping) override;
+  // @brief addrs not in perf map are searched by fallback->SearchSymbolIds with the same table
+  LocatorStatus SearchSymbolIds(InternedSymbols* result) override;
+
+ private:
+  std::string map_file_;
+  SymbolLocator* fallback_{nullptr};
+  std::shared_mutex rw_mutex_;
+  PerfMapIndex index_;
+  ino_t inode_{0};
+  off_t loaded_size_{0};  // bytes of map file read, including pending_
+  std::string pending_;   // trailing partial line
+};
+
+}  // namespace pprofcpp
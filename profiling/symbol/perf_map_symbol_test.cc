@@ -0,0 +1,192 @@
+/*
+ * FileName: perf_map_symbol_test.cc
+ * Author: jattle
+ * Descrption: perf map index & locator test
+ */
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "profiling/symbol/fake_locator.h"
+#include "profiling/symbol/perf_map_symbol.h"
+
+#include "gtest/gtest.h"
+
+using namespace pprofcpp;
+
+namespace {
+
+// names every addr by its value, stands for bfd locator of ELF code
+std::string ElfName(uintptr_t addr) { return "elf_" + std::to_string(addr); }
+
+class TempFile {
+ public:
+  TempFile() {
+    char path[] = "/tmp/perf_map_symbol_test_XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    path_ = path;
+  }
+  ~TempFile() { unlink(path_.c_str()); }
+  const std::string& Path() const { return path_; }
+  void Write(const std::string& content, const char* mode) {
+    FILE* fp = fopen(path_.c_str(), mode);
+    fwrite(content.data(), 1, content.size(), fp);
+    fclose(fp);
+  }
+
+ private:
+  std::string path_;
+};
+
+void* Addr(uintptr_t addr) { return reinterpret_cast<void*>(addr); }
+
+}  // namespace
+
+TEST(PerfMapIndex, Append) {
+  PerfMapIndex index;
+  std::string text =
+      "7f0000001000 100 LuaJIT::trace_1\n"
+      "0x7f0000000000 0x40 LazyCompile:~foo /app/main.js:10\n"
+      "bad line\n"
+      "7f0000002000 0 empty\n"
+      "\n"
+      "7f0000003000 20 partial";
+  auto consumed = index.Append(text);
+  EXPECT_EQ(consumed, text.rfind('\n') + 1);
+  EXPECT_EQ(index.Size(), 2);
+  EXPECT_EQ(index.GetBadLineNum(), 2);
+  const auto* entry = index.Find(0x7f0000000020);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->start, 0x7f0000000000);
+  EXPECT_EQ(index.GetName(entry->name_id), "LazyCompile:~foo /app/main.js:10");
+  entry = index.Find(0x7f00000010ff);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(index.GetName(entry->name_id), "LuaJIT::trace_1");
+  EXPECT_EQ(index.Find(0x7f0000001100), nullptr);
+  EXPECT_EQ(index.Find(0x7f0000000040), nullptr);
+  EXPECT_EQ(index.Find(0x1000), nullptr);
+  // rest of partial line arrives later
+  EXPECT_EQ(index.Append("7f0000003000 20 partial\n"), 24);
+  EXPECT_EQ(index.Size(), 3);
+  ASSERT_NE(index.Find(0x7f0000003010), nullptr);
+}
+
+TEST(PerfMapIndex, Overlap) {
+  PerfMapIndex index;
+  index.Append("1000 100 old\n2000 100 keep\n");
+  // reused region in the middle of old, later entry takes over
+  index.Append("1040 40 new\n1f00 180 span\n");
+  ASSERT_EQ(index.Size(), 5);
+  EXPECT_EQ(index.GetName(index.Find(0x1000)->name_id), "old");
+  EXPECT_EQ(index.GetName(index.Find(0x1050)->name_id), "new");
+  EXPECT_EQ(index.GetName(index.Find(0x1080)->name_id), "old");
+  EXPECT_EQ(index.Find(0x1080)->start, 0x1080);
+  EXPECT_EQ(index.GetName(index.Find(0x2000)->name_id), "span");
+  EXPECT_EQ(index.GetName(index.Find(0x207f)->name_id), "span");
+  EXPECT_EQ(index.GetName(index.Find(0x2080)->name_id), "keep");
+  EXPECT_EQ(index.Find(0x2100), nullptr);
+  // overlap inside one batch follows file order
+  PerfMapIndex batch;
+  batch.Append("3000 100 first\n3000 100 second\n");
+  ASSERT_EQ(batch.Size(), 1);
+  EXPECT_EQ(batch.GetName(batch.Find(0x3000)->name_id), "second");
+}
+
+TEST(PerfMapIndex, RandomOverlap) {
+  // every addr of a small region is painted by hand in file order and compared with index
+  constexpr uintptr_t kBase = 0x10000;
+  constexpr size_t kSpan = 512;
+  std::mt19937 rng{42};
+  PerfMapIndex index;
+  std::vector<std::string> expected(kSpan);
+  for (int batch = 0; batch < 20; batch++) {
+    std::string text;
+    for (int i = 0; i < 30; i++) {
+      size_t start = rng() % kSpan;
+      size_t size = 1 + rng() % std::min<size_t>(64, kSpan - start);
+      std::string name = "f" + std::to_string(batch) + "_" + std::to_string(i);
+      text += fmt::format("{:x} {:x} {}\n", kBase + start, size, name);
+      for (size_t a = start; a < start + size; a++) {
+        expected[a] = name;
+      }
+    }
+    index.Append(text);
+    for (size_t a = 0; a < kSpan; a++) {
+      const auto* entry = index.Find(kBase + a);
+      ASSERT_EQ(entry == nullptr ? "" : index.GetName(entry->name_id), expected[a])
+          << "batch " << batch << " addr " << a;
+    }
+  }
+}
+
+TEST(PerfMapSymbolLocator, SearchSymbols) {
+  TempFile file;
+  file.Write("7f0000000000 100 jit_a\n", "w");
+  FakeLocator fallback{ElfName};
+  PerfMapSymbolLocator locator{file.Path(), &fallback};
+  EXPECT_EQ(locator.Size(), 1);
+  std::unordered_map<void*, SymbolInfo> sym_mapping;
+  std::vector<void*> addrs{Addr(0x7f0000000010), Addr(0x400100), Addr(0x7f0000001010)};
+  ASSERT_EQ(locator.SearchSymbols(addrs, &sym_mapping).ret, LocatorRetCode::kOK);
+  EXPECT_EQ(sym_mapping[addrs[0]].symbol_name, "jit_a");
+  EXPECT_EQ(sym_mapping[addrs[0]].start_address, Addr(0x7f0000000000));
+  EXPECT_EQ(sym_mapping[addrs[1]].symbol_name, "elf_" + std::to_string(0x400100));
+  EXPECT_EQ(sym_mapping[addrs[2]].symbol_name, "elf_" + std::to_string(0x7f0000001010));
+  EXPECT_EQ(fallback.GetSearchedNum(), 2);
+  // JIT appends a partial line then completes it, only new bytes are parsed
+  file.Write("7f0000001000 100 jit_", "a");
+  sym_mapping.clear();
+  ASSERT_EQ(locator.SearchSymbols({addrs[2]}, &sym_mapping).ret, LocatorRetCode::kOK);
+  EXPECT_EQ(sym_mapping[addrs[2]].symbol_name, "elf_" + std::to_string(0x7f0000001010));
+  file.Write("b\n", "a");
+  sym_mapping.clear();
+  ASSERT_EQ(locator.SearchSymbols({addrs[2]}, &sym_mapping).ret, LocatorRetCode::kOK);
+  EXPECT_EQ(sym_mapping[addrs[2]].symbol_name, "jit_b");
+  EXPECT_EQ(locator.Size(), 2);
+  // truncated & rewritten, reparsed from scratch
+  file.Write("7f0000000000 20 jit_c\n", "w");
+  sym_mapping.clear();
+  ASSERT_EQ(locator.SearchSymbols({addrs[0], addrs[2]}, &sym_mapping).ret, LocatorRetCode::kOK);
+  EXPECT_EQ(sym_mapping[addrs[0]].symbol_name, "jit_c");
+  EXPECT_EQ(sym_mapping[addrs[2]].symbol_name, "elf_" + std::to_string(0x7f0000001010));
+  EXPECT_EQ(locator.Size(), 1);
+}
+
+TEST(PerfMapSymbolLocator, SearchSymbolIds) {
+  TempFile file;
+  file.Write("7f0000000000 100 jit_a\n7f0000000100 100 jit_b\n", "w");
+  FakeLocator fallback{ElfName};
+  PerfMapSymbolLocator locator{file.Path(), &fallback};
+  InternedSymbols result;
+  result.addrs = {Addr(0x7f0000000010), Addr(0x400100), Addr(0x7f0000000020), Addr(0x7f0000000110)};
+  ASSERT_EQ(locator.SearchSymbolIds(&result).ret, LocatorRetCode::kOK);
+  ASSERT_EQ(result.sym_ids.size(), 4);
+  ASSERT_EQ(result.func_addrs.size(), 4);
+  EXPECT_EQ(result.sym_ids[0], result.sym_ids[2]);
+  EXPECT_EQ(result.table->GetName(result.sym_ids[0]), "jit_a");
+  EXPECT_EQ(result.table->GetName(result.sym_ids[1]), "elf_" + std::to_string(0x400100));
+  EXPECT_EQ(result.table->GetName(result.sym_ids[3]), "jit_b");
+  EXPECT_EQ(result.func_addrs[2], Addr(0x7f0000000000));
+  EXPECT_EQ(result.func_addrs[1], Addr(0x400100));
+  EXPECT_EQ(result.func_addrs[3], Addr(0x7f0000000100));
+  EXPECT_EQ(fallback.GetSearchedNum(), 1);
+  // without fallback, addrs out of perf map are unresolved
+  PerfMapSymbolLocator alone{file.Path()};
+  InternedSymbols unresolved;
+  unresolved.addrs = {Addr(0x400100)};
+  ASSERT_EQ(alone.SearchSymbolIds(&unresolved).ret, LocatorRetCode::kOK);
+  EXPECT_EQ(unresolved.sym_ids[0], SymbolTable::kUnknownSymbolId);
+  // missing map file is not an error
+  PerfMapSymbolLocator missing{PerfMapPath(0), &fallback};
+  EXPECT_EQ(missing.Size(), 0);
+  ASSERT_EQ(missing.SearchSymbolIds(&unresolved).ret, LocatorRetCode::kOK);
+  EXPECT_EQ(PerfMapPath(123), "/tmp/perf-123.map");
+}
@@ -9,10 +9,15 @@
 #include <dlfcn.h>
 #include <execinfo.h>
 #include <link.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstring>
+#include <ostream>
 #include <sstream>
 
 #include "fmt/format.h"
 
+#include "profiling/util/control.h"
 #include "profiling/util/utils.h"
 
 namespace pprofcpp {
@@ -20,33 +25,141 @@ namespace pprofcpp {
 constexpr char kSelfExePath[] = "/proc/self/exe";
 constexpr char kSelfMapsPath[] = "/proc/self/maps";
 
+namespace {
 
-BfdSymbolLocator::BfdSymbolLocator() {
+// @brief check control of current thread every kControlCheckInterval addrs, true if search should stop
+bool StopSearch(size_t i, LocatorRetCode* code) {
+  if ((i & (kControlCheckInterval - 1)) != 0) {
+    return false;
+  }
+  switch (CheckCurrentControl()) {
+    case ControlStatus::kCancelled:
+      *code = LocatorRetCode::kCancelled;
+      return true;
+    case ControlStatus::kDeadlineExceeded:
+      *code = LocatorRetCode::kDeadlineExceeded;
+      return true;
+    default:
+      return false;
+  }
+}
+
+void InitBfd() {
+  std::lock_guard<std::mutex> lock(GetBfdMutex());
+  bfd_init();
+}
+
+}  // namespace
+
+
+std::mutex& GetBfdMutex() {
+  static std::mutex bfd_mutex;
+  return bfd_mutex;
+}
+
+BfdSymbolLocator::BfdSymbolLocator(ProcessingStats* stats) : stats_(stats) {
   this->is_self_analysis_ = true;
   this->program_path_ = kSelfExePath;
   LoadFileContent(kSelfMapsPath, &this->proc_mapping_content_);
-  bfd_init();
+  InitBfd();
   LoadSelfSymbols();
 }
 
-BfdSymbolLocator::BfdSymbolLocator(const std::string& prog_path, const std::string& proc_map_data) {
+BfdSymbolLocator::BfdSymbolLocator(const std::string& prog_path, const std::string& proc_map_data,
+                                   ProcessingStats* stats)
+    : stats_(stats) {
   this->program_path_ = prog_path;
   this->proc_mapping_content_ = proc_map_data;
-  bfd_init();
+  InitBfd();
+  LoadSelfSymbols();
+}
+
+BfdSymbolLocator::BfdSymbolLocator(const std::string& prog_path, const std::string& proc_map_data,
+                                   std::shared_ptr<ObjectFileCache> object_cache, ProcessingStats* stats)
+    : object_cache_(std::move(object_cache)), stats_(stats) {
+  this->program_path_ = prog_path;
+  this->proc_mapping_content_ = proc_map_data;
+  InitBfd();
   LoadSelfSymbols();
 }
 
 LocatorStatus BfdSymbolLocator::LoadSelfSymbols() {
   // load self static symbols
-  BfdAccessor bfd_info;
-  if (auto ret = this->LoadMiniSymbols(this->program_path_, false, &bfd_info); ret.ret != LocatorRetCode::kOK) {
+  std::shared_ptr<const BfdAccessor> bfd_info;
+  if (auto ret = this->LoadObject(this->program_path_, false, &bfd_info); ret.ret != LocatorRetCode::kOK) {
     return ret;
   }
   this->self_bfd_ = std::move(bfd_info);
   return LocatorStatus{LocatorRetCode::kOK, ""};
 }
 
+LocatorStatus BfdSymbolLocator::LoadObject(const std::string& file, bool dynamic_fallback,
+                                           std::shared_ptr<const BfdAccessor>* bfd_info) {
+  auto loader = [this, &file, dynamic_fallback](BfdAccessor* loaded) {
+    // load normal symbols first
+    auto ret = this->LoadMiniSymbols(file, false, loaded);
+    if (ret.ret != LocatorRetCode::kOK && dynamic_fallback) {
+      // no normal symbols, maybe stripped, close it and load dynamic symbols
+      { BfdAccessor failed{std::move(*loaded)}; }
+      ret = this->LoadMiniSymbols(file, true, loaded);
+    }
+    return ret;
+  };
+  if (this->object_cache_ != nullptr) {
+    return this->object_cache_->Get(file, dynamic_fallback ? 1 : 0, loader, bfd_info);
+  }
+  BfdAccessor loaded;
+  auto ret = loader(&loaded);
+  if (ret.ret == LocatorRetCode::kOK) {
+    *bfd_info = std::make_shared<const BfdAccessor>(std::move(loaded));
+  }
+  return ret;
+}
+
+LocatorStatus ObjectFileCache::Get(const std::string& file, int variant, const Loader& loader,
+                                   std::shared_ptr<const BfdAccessor>* bfd_info) {
+  struct stat st;
+  if (stat(file.c_str(), &st) != 0) {
+    return LocatorStatus{LocatorRetCode::kOpenFileFailed, fmt::format("stat file {} failed", file)};
+  }
+  std::string key = fmt::format("{}\n{}\n{}.{}\n{}", file, variant, st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+                                st.st_size);
+  std::shared_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second.second);
+      entry = it->second.first;
+    } else {
+      if (entries_.size() >= capacity_) {
+        entries_.erase(lru_.back());
+        lru_.pop_back();
+      }
+      lru_.push_front(key);
+      entry = std::make_shared<Entry>();
+      entries_.emplace(std::move(key), std::make_pair(entry, lru_.begin()));
+    }
+  }
+  // loading runs outside of cache lock, concurrent users of the same entry wait for it
+  std::call_once(entry->once, [&]() {
+    BfdAccessor loaded;
+    entry->status = loader(&loaded);
+    if (entry->status.ret == LocatorRetCode::kOK) {
+      entry->bfd_info = std::make_shared<const BfdAccessor>(std::move(loaded));
+    }
+    loaded_++;
+  });
+  if (entry->status.ret != LocatorRetCode::kOK) {
+    return LocatorStatus{entry->status.ret, std::string{entry->status.err}};
+  }
+  *bfd_info = entry->bfd_info;
+  return LocatorStatus{LocatorRetCode::kOK, ""};
+}
+
 LocatorStatus BfdSymbolLocator::LoadMiniSymbols(const std::string& filename, bool only_dynamic, BfdAccessor* bfd_info) {
+  ScopedPhase phase(this->stats_, StatsPhase::kLoadLibs);
+  std::unique_lock<std::mutex> bfd_lock(GetBfdMutex());
   bfd_info->bfd_ptr = bfd_openr(filename.c_str(), nullptr);
   if (bfd_info->bfd_ptr == nullptr) {
     return LocatorStatus{LocatorRetCode::kOpenFileFailed, fmt::format("open file {} failed", filename)};
@@ -64,7 +177,18 @@ LocatorStatus BfdSymbolLocator::LoadMiniSymbols(const std::string& filename, boo
   if (bfd_info->sym_count == 0) {
     return LocatorStatus{LocatorRetCode::kReadSymbolsFailed, "Failed to read symbols"};
   }
+  bfd_lock.unlock();
   asymbol** symbol_table = bfd_info->mini_syms;
+  // symbols & names live in bfd internal storage, count what is reachable from loaded table
+  bfd_info->mem_bytes = static_cast<size_t>(bfd_info->sym_count) * (psize + sizeof(asymbol));
+  for (int i = 0; i < bfd_info->sym_count; i++) {
+    bfd_info->mem_bytes += symbol_table[i]->name != nullptr ? strlen(symbol_table[i]->name) + 1 : 0;
+  }
+  if (this->stats_ != nullptr) {
+    this->stats_->libs_loaded++;
+    this->stats_->alloc_num++;
+    this->stats_->alloc_bytes += bfd_info->mem_bytes;
+  }
   std::sort(symbol_table, symbol_table + bfd_info->sym_count, [](const asymbol* l, const asymbol* r) -> bool {
     return l->section->vma + l->value < r->section->vma + r->value;
   });
@@ -74,9 +198,11 @@ LocatorStatus BfdSymbolLocator::LoadMiniSymbols(const std::string& filename, boo
 int DynamicLibMappings::ParseProcMaps(const std::string& proc_mapping_content) {
   // parse content, extract dynamic libs loaded by program
   this->lib_mappings_.clear();
+  this->lower_bound_ = UINTPTR_MAX;
+  this->upper_bound_ = 0;
   std::istringstream iss{proc_mapping_content};
-  // for lib mapping info aggregation
-  std::unordered_map<int, ProcLibMapping*> ref_map;
+  // for lib mapping info aggregation, inode -> index of lib_mappings_(element address changes as it grows)
+  std::unordered_map<int, size_t> ref_map;
   for (std::string line; std::getline(iss, line);) {
     int inode{0};
     char pathname[1024] = {0};
@@ -103,18 +229,18 @@ int DynamicLibMappings::ParseProcMaps(const std::string& proc_mapping_content) {
           lib_item.inode = inode;
           lib_item.path = pathname;
           lib_item.items.emplace_back(std::move(item));
+          ref_map.emplace(inode, this->lib_mappings_.size());
           this->lib_mappings_.emplace_back(std::move(lib_item));
-          auto& back_item = this->lib_mappings_.back();
-          ref_map.emplace(back_item.inode, &back_item);
         } else {
           // every LibMaping may has many ProcMapItems, add item and update its bound
-          if (item.start_addr < iter->second->base) {
-            iter->second->base = item.start_addr;
+          auto& lib = this->lib_mappings_[iter->second];
+          if (item.start_addr < lib.base) {
+            lib.base = item.start_addr;
           }
-          if (item.end_addr > iter->second->upper_bound) {
-            iter->second->upper_bound = item.end_addr;
+          if (item.end_addr > lib.upper_bound) {
+            lib.upper_bound = item.end_addr;
           }
-          iter->second->items.emplace_back(std::move(item));
+          lib.items.emplace_back(std::move(item));
         }
       }
     }
@@ -122,7 +248,7 @@ int DynamicLibMappings::ParseProcMaps(const std::string& proc_mapping_content) {
   return 0;
 }
 
-bool DynamicLibMappings::GetLibPaths(std::vector<std::string>* paths) {
+bool DynamicLibMappings::GetLibPaths(std::vector<std::string>* paths) const {
   if (this->lib_mappings_.empty()) {
     return false;
   }
@@ -132,7 +258,15 @@ bool DynamicLibMappings::GetLibPaths(std::vector<std::string>* paths) {
   return true;
 }
 
-bool DynamicLibMappings::FindMatchedLib(const void* target_addr, ProcLibMapping* lib_mapping) {
+size_t DynamicLibMappings::MemoryUsage() const {
+  size_t bytes = this->lib_mappings_.capacity() * sizeof(ProcLibMapping);
+  for (const auto& lib : this->lib_mappings_) {
+    bytes += StringHeapBytes(lib.path) + lib.items.capacity() * sizeof(ProcMapItem);
+  }
+  return bytes;
+}
+
+bool DynamicLibMappings::FindMatchedLib(const void* target_addr, ProcLibMapping* lib_mapping) const {
   uintptr_t addr = reinterpret_cast<uintptr_t>(target_addr);
   if (addr < this->lower_bound_ || addr >= this->upper_bound_) {
     return false;
@@ -162,48 +296,67 @@ bool BfdSymbolLocator::FindMatchedLib(FileMatchMeta* meta) {
   return false;
 }
 
-LocatorStatus BfdSymbolLocator::GetOrCreateDynBfd(const std::string& file, BfdAccessor** bfd_info_ptr) {
+LocatorStatus BfdSymbolLocator::GetOrCreateDynBfd(const std::string& file, const BfdAccessor** bfd_info_ptr) {
   {
     std::shared_lock<std::shared_mutex> locker(rw_mutex_);
     if (auto iter = this->dynamic_bfds_.find(file); iter != this->dynamic_bfds_.cend()) {
-      *bfd_info_ptr = &iter->second;
+      *bfd_info_ptr = iter->second.get();
+      if (this->stats_ != nullptr) {
+        this->stats_->lib_cache_hits++;
+      }
       return LocatorStatus{LocatorRetCode::kOK, ""};
     }
   }
   std::unique_lock<std::shared_mutex> locker(rw_mutex_);
   if (auto iter = this->dynamic_bfds_.find(file); iter != this->dynamic_bfds_.cend()) {
-    *bfd_info_ptr = &iter->second;
+    *bfd_info_ptr = iter->second.get();
     return LocatorStatus{LocatorRetCode::kOK, ""};
   }
   // not loaded yet
-  BfdAccessor bfd_info;
-  // load normal symbols first
-  auto ret = this->LoadMiniSymbols(file, false, &bfd_info);
-  if (ret.ret != LocatorRetCode::kOK) {
-    // no normal symbols, maybe stripped, load dynamic symbols
-    ret = this->LoadMiniSymbols(file, true, &bfd_info);
+  if (this->stats_ != nullptr) {
+    this->stats_->lib_cache_misses++;
   }
+  std::shared_ptr<const BfdAccessor> bfd_info;
+  auto ret = this->LoadObject(file, true, &bfd_info);
   if (ret.ret == LocatorRetCode::kOK) {
-    *bfd_info_ptr = &(this->dynamic_bfds_.emplace(file, std::move(bfd_info)).first->second);
+    *bfd_info_ptr = this->dynamic_bfds_.emplace(file, std::move(bfd_info)).first->second.get();
   }
   return ret;
 }
 
 LocatorStatus BfdSymbolLocator::SearchSymbol(const void* addr, SymbolInfo* sym_info) {
-  if (this->self_bfd_.sym_count == 0) {
+  const asymbol* sym{nullptr};
+  const void* start{nullptr};
+  if (auto ret = this->LocateSymbol(addr, &sym, &start); ret.ret != LocatorRetCode::kOK) {
+    return ret;
+  }
+  sym_info->address = addr;
+  // no demangle cache on this path, only time it
+  ScopedPhase phase(this->stats_, StatsPhase::kDemangle);
+  sym_info->symbol_name = DemangleName(sym->name);
+  sym_info->start_address = start;
+  return LocatorStatus{LocatorRetCode::kOK, ""};
+}
+
+LocatorStatus BfdSymbolLocator::LocateSymbol(const void* addr, const asymbol** sym, const void** start) {
+  if (this->self_bfd_ == nullptr || this->self_bfd_->sym_count == 0) {
     return LocatorStatus{LocatorRetCode::kNoSymbols, "no symbols, maybe not inited yet"};
   }
   // search dynamic first
   FileMatchMeta match;
   match.address = addr;
-  if (FindMatchedLib(&match) && !match.file.empty()) {
-    return SearchDynamic(match, sym_info);
+  bool is_dynamic = FindMatchedLib(&match) && !match.file.empty();
+  auto ret = is_dynamic ? SearchDynamic(match, sym) : SearchStatic(addr, sym);
+  if (ret.ret == LocatorRetCode::kOK && start != nullptr) {
+    // symbol value of dynamic lib is relative to its load base
+    uintptr_t base = is_dynamic ? reinterpret_cast<uintptr_t>(match.base) : 0;
+    *start = reinterpret_cast<const void*>(base + (*sym)->section->vma + (*sym)->value);
   }
-  return SearchStatic(addr, sym_info);
+  return ret;
 }
 
-LocatorStatus BfdSymbolLocator::SearchDynamic(const FileMatchMeta& match, SymbolInfo* sym_info) {
-  BfdAccessor* bfd_info_ptr{nullptr};
+LocatorStatus BfdSymbolLocator::SearchDynamic(const FileMatchMeta& match, const asymbol** sym) {
+  const BfdAccessor* bfd_info_ptr{nullptr};
   if (auto ret = this->GetOrCreateDynBfd(match.file, &bfd_info_ptr); ret.ret != LocatorRetCode::kOK) {
     return ret;
   }
@@ -212,14 +365,14 @@ LocatorStatus BfdSymbolLocator::SearchDynamic(const FileMatchMeta& match, Symbol
   }
   void* raddr =
       reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(match.address) - reinterpret_cast<uintptr_t>(match.base));
-  return this->SearchBfd(raddr, bfd_info_ptr, sym_info);
+  return this->SearchBfd(raddr, bfd_info_ptr, sym);
 }
 
-LocatorStatus BfdSymbolLocator::SearchStatic(const void* addr, SymbolInfo* sym_info) {
-  return this->SearchBfd(addr, &self_bfd_, sym_info);
+LocatorStatus BfdSymbolLocator::SearchStatic(const void* addr, const asymbol** sym) {
+  return this->SearchBfd(addr, self_bfd_.get(), sym);
 }
 
-LocatorStatus BfdSymbolLocator::SearchBfd(const void* addr, const BfdAccessor* bfd_info_ptr, SymbolInfo* sym_info) {
+LocatorStatus BfdSymbolLocator::SearchBfd(const void* addr, const BfdAccessor* bfd_info_ptr, const asymbol** sym) {
   // nearest line: largest addr which <= target addr
   auto pc = reinterpret_cast<bfd_vma>(addr);
   asymbol fake_symbol;
@@ -237,8 +390,7 @@ LocatorStatus BfdSymbolLocator::SearchBfd(const void* addr, const BfdAccessor* b
       iter--;
     }
     if ((*iter)->value + (*iter)->section->vma <= pc) {
-      sym_info->address = addr;
-      sym_info->symbol_name = DemangleName((*iter)->name);
+      *sym = *iter;
       return LocatorStatus{LocatorRetCode::kOK, ""};
     }
   }
@@ -246,25 +398,190 @@ LocatorStatus BfdSymbolLocator::SearchBfd(const void* addr, const BfdAccessor* b
   return LocatorStatus{LocatorRetCode::kSymbolNotFound, "no symbol"};
 }
 
+LocatorStatus BfdSymbolLocator::ReloadProcMaps() {
+  std::unique_lock<std::shared_mutex> locker(rw_mutex_);
+  ScopedPhase phase(this->stats_, StatsPhase::kParseMaps);
+  if (this->is_self_analysis_) {
+    // online analysis, load maps content again
+    if (LoadFileContent(kSelfMapsPath, &this->proc_mapping_content_) != 0) {
+      return LocatorStatus{LocatorRetCode::kOpenFileFailed, "load proc maps failed"};
+    }
+  }
+  this->dyn_mappings_.ParseProcMaps(this->proc_mapping_content_);
+  return LocatorStatus{LocatorRetCode::kOK, ""};
+}
+
 LocatorStatus BfdSymbolLocator::SearchSymbols(const std::vector<void*>& addrs,
                                               std::unordered_map<void*, SymbolInfo>* sym_mapping) {
   if (addrs.empty()) {
     return LocatorStatus{LocatorRetCode::kNoAddr, "no addrs provided"};
   }
-  {
-    std::unique_lock<std::shared_mutex> locker(rw_mutex_);
-    if (this->is_self_analysis_) {
-      // online analysis, load maps content again
-      if (LoadFileContent(kSelfMapsPath, &this->proc_mapping_content_) != 0) {
-        return LocatorStatus{LocatorRetCode::kOpenFileFailed, "load proc maps failed"};
-      }
-    }
-    this->dyn_mappings_.ParseProcMaps(this->proc_mapping_content_);
+  ScopedPhase phase(this->stats_, StatsPhase::kLookup);
+  if (auto ret = this->ReloadProcMaps(); ret.ret != LocatorRetCode::kOK) {
+    return ret;
   }
-  for (const auto& addr : addrs) {
+  LocatorRetCode stop_code{LocatorRetCode::kOK};
+  for (size_t i = 0; i < addrs.size(); i++) {
+    if (StopSearch(i, &stop_code)) {
+      return LocatorStatus{stop_code, "search stopped by control"};
+    }
     SymbolInfo info;
-    this->SearchSymbol(addr, &info);
-    sym_mapping->emplace(addr, info);
+    this->SearchSymbol(addrs[i], &info);
+    sym_mapping->emplace(addrs[i], info);
+  }
+  return LocatorStatus{LocatorRetCode::kOK, ""};
+}
+
+LocatorStatus BfdSymbolLocator::SearchSymbolIds(InternedSymbols* result) {
+  if (result->addrs.empty()) {
+    return LocatorStatus{LocatorRetCode::kNoAddr, "no addrs provided"};
+  }
+  ScopedPhase phase(this->stats_, StatsPhase::kLookup);
+  if (auto ret = this->ReloadProcMaps(); ret.ret != LocatorRetCode::kOK) {
+    return ret;
+  }
+  if (result->table == nullptr) {
+    result->table = std::make_shared<SymbolTable>();
+  }
+  result->sym_ids.clear();
+  result->sym_ids.reserve(result->addrs.size());
+  result->func_addrs.clear();
+  result->func_addrs.reserve(result->addrs.size());
+  // many addrs hit the same function, bfd symbol name pointer is stable, so demangle & intern only once
+  std::unordered_map<const char*, uint32_t> name_ids;
+  LocatorRetCode stop_code{LocatorRetCode::kOK};
+  for (size_t i = 0; i < result->addrs.size(); i++) {
+    if (StopSearch(i, &stop_code)) {
+      return LocatorStatus{stop_code, "search stopped by control"};
+    }
+    void* addr = result->addrs[i];
+    const asymbol* sym{nullptr};
+    const void* start{nullptr};
+    if (this->LocateSymbol(addr, &sym, &start).ret != LocatorRetCode::kOK) {
+      result->sym_ids.push_back(SymbolTable::kUnknownSymbolId);
+      result->func_addrs.push_back(nullptr);
+      continue;
+    }
+    result->func_addrs.push_back(const_cast<void*>(start));
+    auto [iter, inserted] = name_ids.emplace(sym->name, SymbolTable::kUnknownSymbolId);
+    if (inserted) {
+      ScopedPhase demangle(this->stats_, StatsPhase::kDemangle);
+      iter->second = result->table->Intern(DemangleName(sym->name));
+    }
+    if (this->stats_ != nullptr) {
+      (inserted ? this->stats_->demangle_cache_misses : this->stats_->demangle_cache_hits)++;
+    }
+    result->sym_ids.push_back(iter->second);
+  }
+  return LocatorStatus{LocatorRetCode::kOK, ""};
+}
+
+LocatorMemoryUsage BfdSymbolLocator::MemoryUsage() {
+  std::shared_lock<std::shared_mutex> locker(this->rw_mutex_);
+  LocatorMemoryUsage usage;
+  usage.symbol_tables = this->self_bfd_ != nullptr ? this->self_bfd_->mem_bytes : 0;
+  usage.lib_num = this->self_bfd_ != nullptr ? 1 : 0;
+  usage.mappings = StringHeapBytes(this->proc_mapping_content_) + StringHeapBytes(this->program_path_) +
+                   this->dyn_mappings_.MemoryUsage() + HashNodeBytes(this->dynamic_bfds_);
+  for (const auto& [file, bfd_info] : this->dynamic_bfds_) {
+    usage.symbol_tables += bfd_info->mem_bytes;
+    usage.mappings += StringHeapBytes(file);
+    usage.lib_num++;
+  }
+  return usage;
+}
+
+size_t SymbolTable::MemoryUsage() const {
+  size_t bytes = this->names_.size() * sizeof(std::string) + HashNodeBytes(this->index_);
+  for (const auto& name : this->names_) {
+    bytes += StringHeapBytes(name);
+  }
+  return bytes;
+}
+
+uint32_t SymbolTable::Intern(std::string_view name) {
+  if (auto iter = this->index_.find(name); iter != this->index_.cend()) {
+    return iter->second;
+  }
+  uint32_t id = static_cast<uint32_t>(this->names_.size());
+  const auto& stored = this->names_.emplace_back(name);
+  this->index_.emplace(stored, id);
+  return id;
+}
+
+namespace {
+
+template <typename NameOf>
+void WriteSymbolLines(const void* const* addrs, size_t n, const NameOf& name_of, std::ostream& os) {
+  // lines are rendered into a fixed block and written in large pieces, a name longer than block is written directly
+  constexpr size_t kBlockSize = 4096;
+  char block[kBlockSize];
+  size_t used{0};
+  for (size_t i = 0; i < n; i++) {
+    std::string_view sym = name_of(i);
+    size_t name_len = sym.empty() ? kHexAddrLen : sym.size();
+    if (used + kHexAddrLen + name_len + 2 > kBlockSize) {
+      os.write(block, used);
+      used = 0;
+    }
+    char* addr_text = block + used;
+    char* p = FormatHexAddr(reinterpret_cast<uintptr_t>(addrs[i]), addr_text);
+    *p++ = ' ';
+    if (kHexAddrLen + name_len + 2 > kBlockSize) {
+      os.write(block, p - block);
+      os.write(sym.data(), sym.size());
+      os.put('\n');
+      used = 0;
+      continue;
+    }
+    if (sym.empty()) {
+      p = std::copy(addr_text, addr_text + kHexAddrLen, p);
+    } else {
+      p = std::copy(sym.cbegin(), sym.cend(), p);
+    }
+    *p++ = '\n';
+    used = p - block;
+  }
+  os.write(block, used);
+}
+
+}  // namespace
+
+void WriteRawSymbols(const InternedSymbols& symbols, std::ostream& os) {
+  if (symbols.table == nullptr) {
+    return;
+  }
+  WriteSymbolLines(
+      symbols.addrs.data(), symbols.addrs.size(),
+      [&symbols](size_t i) -> std::string_view { return symbols.table->GetName(symbols.sym_ids[i]); }, os);
+}
+
+void WriteRawSymbols(const void* const* addrs, size_t n, const std::function<std::string_view(size_t)>& name_of,
+                     std::ostream& os) {
+  WriteSymbolLines(addrs, n, name_of, os);
+}
+
+LocatorStatus SymbolLocator::SearchSymbolIds(InternedSymbols* result) {
+  std::unordered_map<void*, SymbolInfo> sym_mapping;
+  if (auto ret = this->SearchSymbols(result->addrs, &sym_mapping); ret.ret != LocatorRetCode::kOK) {
+    return ret;
+  }
+  if (result->table == nullptr) {
+    result->table = std::make_shared<SymbolTable>();
+  }
+  result->sym_ids.clear();
+  result->sym_ids.reserve(result->addrs.size());
+  result->func_addrs.clear();
+  result->func_addrs.reserve(result->addrs.size());
+  for (const auto& addr : result->addrs) {
+    auto iter = sym_mapping.find(addr);
+    if (iter == sym_mapping.cend()) {
+      result->sym_ids.push_back(SymbolTable::kUnknownSymbolId);
+      result->func_addrs.push_back(nullptr);
+      continue;
+    }
+    result->sym_ids.push_back(result->table->Intern(iter->second.symbol_name));
+    result->func_addrs.push_back(const_cast<void*>(iter->second.start_address));
   }
   return LocatorStatus{LocatorRetCode::kOK, ""};
 }
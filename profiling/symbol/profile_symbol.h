@@ -10,18 +10,31 @@
 #include "bfd.h"
 
 #include <link.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <list>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
 #include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include "profiling/util/stats.h"
+
 namespace pprofcpp {
 
 
 /// @brief simple symbol info consists of address and symbol_name
 struct SymbolInfo {
   const void* address{nullptr};
-  std::string symbol_name;  // equivalent to demangled function name now
+  std::string symbol_name;           // equivalent to demangled function name now
+  const void* start_address{nullptr};  // start address of the function, nullptr if unknown
 };
 
 enum class LocatorRetCode {
@@ -33,6 +46,8 @@ enum class LocatorRetCode {
   kNoMatchedFile = 5,
   kSymbolNotFound = 6,
   kNoAddr = 7,
+  kCancelled = 8,         // stopped by ProcessingControl of current thread
+  kDeadlineExceeded = 9,
 };
 
 struct LocatorStatus {
@@ -44,6 +59,48 @@ struct LocatorStatus {
   std::string err;
 };
 
+/// @brief interned symbol name table, every distinct name is stored only once and referenced by id
+// id 0(kUnknownSymbolId) is reserved for unresolved address, its name is empty
+class SymbolTable {
+ public:
+  static constexpr uint32_t kUnknownSymbolId = 0;
+  SymbolTable() { Intern(""); }
+  ~SymbolTable() = default;
+  // @brief return id of name, name is copied only when first seen
+  uint32_t Intern(std::string_view name);
+  const std::string& GetName(uint32_t id) const { return names_.at(id); }
+  // @brief distinct name num, including the reserved empty name
+  size_t Size() const { return names_.size(); }
+  // @brief approximate heap bytes of names & index
+  size_t MemoryUsage() const;
+
+ private:
+  std::deque<std::string> names_;  // deque keeps element address stable, so index_ keys never dangle
+  std::unordered_map<std::string_view, uint32_t> index_;
+};
+
+/// @brief interned search result, sym_ids is parallel to addrs and refers to names in shared table
+struct InternedSymbols {
+  std::vector<void*> addrs;
+  std::vector<uint32_t> sym_ids;
+  std::vector<void*> func_addrs;  // parallel to addrs, start address of function, nullptr if unknown
+  std::shared_ptr<SymbolTable> table;
+};
+
+/// @brief write symbols as pprof raw profile symbol section lines: "0x%016lx name\n",
+// unresolved address is written as its own name
+void WriteRawSymbols(const InternedSymbols& symbols, std::ostream& os);
+/// @brief same lines for n sorted addrs, name_of(i) is name of addrs[i]
+void WriteRawSymbols(const void* const* addrs, size_t n, const std::function<std::string_view(size_t)>& name_of,
+                     std::ostream& os);
+
+/// @brief symbol addr of frame i of a call stack(leaf first): leaf pc as is, callers are return addresses whose
+// call ptr(pc - 1) is searched
+inline void* ToSymbolAddr(const void* const* ptrs, size_t i) {
+  auto pc = reinterpret_cast<uintptr_t>(ptrs[i]);
+  return reinterpret_cast<void*>(i == 0 ? pc : pc - 1);
+}
+
 /// @brief symobl locator interface
 class SymbolLocator {
  public:
@@ -51,6 +108,9 @@ class SymbolLocator {
   virtual ~SymbolLocator() = default;
   virtual LocatorStatus SearchSymbols(const std::vector<void*>& addrs,
                                       std::unordered_map<void*, SymbolInfo>* sym_mapping) = 0;
+  // @brief search symbols of result->addrs, fill result->sym_ids & result->func_addrs and intern names into
+  // result->table, table will be created if null, default implementation is based on SearchSymbols
+  virtual LocatorStatus SearchSymbolIds(InternedSymbols* result);
 };
 
 /// @brief lib mapping item
@@ -78,11 +138,14 @@ class DynamicLibMappings {
   DynamicLibMappings() = default;
   ~DynamicLibMappings() = default;
   // @brief find matched lib specified addr belongs to
-  bool FindMatchedLib(const void* addr, ProcLibMapping* lib_mapping);
+  bool FindMatchedLib(const void* addr, ProcLibMapping* lib_mapping) const;
   // @brief parse proc lib mapping from mapping content(dump content of /proc/xxx/maps)
   int ParseProcMaps(const std::string& proc_mapping_content);
   // @brief get distinct lib paths loaded by the program
-  bool GetLibPaths(std::vector<std::string>* paths);
+  bool GetLibPaths(std::vector<std::string>* paths) const;
+  const std::vector<ProcLibMapping>& GetLibMappings() const { return lib_mappings_; }
+  // @brief approximate heap bytes of lib mappings
+  size_t MemoryUsage() const;
 
  private:
   uintptr_t lower_bound_{UINTPTR_MAX};        // lowest addr
@@ -90,6 +153,10 @@ class DynamicLibMappings {
   std::vector<ProcLibMapping> lib_mappings_;  // dependent dynamic libs
 };
 
+/// @brief process-wide lock of libbfd calls(bfd_init, open, symbol loading & close): libbfd keeps global state(open
+// file cache, error state) and is not thread-safe. lookups on loaded & sorted symbol tables need no lock
+std::mutex& GetBfdMutex();
+
 /// @brief bfd object file info accessor wrapper
 struct BfdAccessor {
   BfdAccessor() = default;
@@ -100,40 +167,97 @@ struct BfdAccessor {
   }
   ~BfdAccessor() {
     if (bfd_ptr != nullptr) {
+      std::lock_guard<std::mutex> lock(GetBfdMutex());
       bfd_close(bfd_ptr);
       free(mini_syms);
     }
     bfd_ptr = nullptr;
     mini_syms = nullptr;
     sym_count = 0;
+    mem_bytes = 0;
   }
   bfd* bfd_ptr{nullptr};         // object file accessor pointer
   asymbol** mini_syms{nullptr};  // bfd symbol table pointer
   int sym_count{0};              // loaded symbol count
+  size_t mem_bytes{0};           // approximate bytes of loaded symbol table, estimated at load
 
  private:
   void MoveData(BfdAccessor&& rhs) {
     this->bfd_ptr = rhs.bfd_ptr;
     this->mini_syms = rhs.mini_syms;
     this->sym_count = rhs.sym_count;
+    this->mem_bytes = rhs.mem_bytes;
     rhs.bfd_ptr = nullptr;
     rhs.mini_syms = nullptr;
     rhs.sym_count = 0;
+    rhs.mem_bytes = 0;
   }
   BfdAccessor(const BfdAccessor&) = delete;
   BfdAccessor& operator=(const BfdAccessor&) = delete;
 };
 
+/// @brief approximate heap bytes held by BfdSymbolLocator
+struct LocatorMemoryUsage {
+  size_t symbol_tables{0};  // bfd symbol tables(symbol pointers, symbols & names) of program and loaded libs
+  size_t mappings{0};       // proc maps content, parsed lib mappings & lib index
+  size_t lib_num{0};        // loaded object files, including program itself
+  size_t Total() const { return symbol_tables + mappings; }
+};
+
+/// @brief symbol tables of object files shared by BfdSymbolLocators of many processes(e.g. batch analysis), every
+// file is loaded once wherever it is mapped: locators keep their own proc maps and load bases, only the tables are
+// shared. keyed by path, mtime & size, so a file rebuilt at the same path is loaded again. least recently used files
+// beyond capacity are dropped, locators still holding them keep them alive. thread-safe
+class ObjectFileCache {
+ public:
+  using Loader = std::function<LocatorStatus(BfdAccessor* bfd_info)>;
+  explicit ObjectFileCache(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {}
+  ~ObjectFileCache() = default;
+  // @brief loaded table of file, loader runs once per key(outside of cache lock, libbfd calls in it are serialized
+  // by GetBfdMutex) and its failure is cached too.
+  // variant tells different ways of loading the same file apart
+  LocatorStatus Get(const std::string& file, int variant, const Loader& loader,
+                    std::shared_ptr<const BfdAccessor>* bfd_info);
+  // @brief object files loaded so far, including dropped ones
+  size_t GetLoadedNum() const { return loaded_.load(); }
+
+ private:
+  struct Entry {
+    std::once_flag once;
+    LocatorStatus status{LocatorRetCode::kOK, ""};
+    std::shared_ptr<const BfdAccessor> bfd_info;
+  };
+  size_t capacity_;
+  std::mutex mutex_;
+  std::list<std::string> lru_;  // keys, most recently used first
+  std::unordered_map<std::string, std::pair<std::shared_ptr<Entry>, std::list<std::string>::iterator>> entries_;
+  std::atomic<size_t> loaded_{0};
+};
+
 /// @brief bfd symbol locator which locate symbol for given address
 class BfdSymbolLocator : public SymbolLocator {
  public:
   /// @brief for current program analysis
-  BfdSymbolLocator();
+  // stats(nullable, not owned) collects symbol loading done by constructor and later searches, see SetStats
+  explicit BfdSymbolLocator(ProcessingStats* stats = nullptr);
   /// @brief given program file path and proc mapping content for offline analysis
-  BfdSymbolLocator(const std::string& prog_path, const std::string& proc_map_data);
+  BfdSymbolLocator(const std::string& prog_path, const std::string& proc_map_data, ProcessingStats* stats = nullptr);
+  /// @brief same as above, symbol tables of program and libs come from object_cache shared with other locators,
+  // MemoryUsage still counts every table this locator holds
+  BfdSymbolLocator(const std::string& prog_path, const std::string& proc_map_data,
+                   std::shared_ptr<ObjectFileCache> object_cache, ProcessingStats* stats = nullptr);
   ~BfdSymbolLocator() override = default;
+  // @brief collect timings of lib loading, maps parsing, lookup & demangling and cache counters into stats
+  // stats is not synchronized and tracks the running phase of one thread: searches of this locator must not run
+  // concurrently while stats is set, and one stats object must not be shared by locators used concurrently
+  // (e.g. SymbolizeAsync tasks, profile_batch workers), give each its own
+  void SetStats(ProcessingStats* stats) { stats_ = stats; }
+  // @brief memory held by loaded symbol tables & mappings, grows as shared libs are loaded lazily by searches
+  LocatorMemoryUsage MemoryUsage();
   LocatorStatus SearchSymbols(const std::vector<void*>& addrs,
                               std::unordered_map<void*, SymbolInfo>* sym_mapping) override;
+  // @brief demangle once per distinct bfd symbol instead of once per address
+  LocatorStatus SearchSymbolIds(InternedSymbols* result) override;
 
  private:
   struct SearchSymbolMeta {
@@ -154,22 +278,30 @@ class BfdSymbolLocator : public SymbolLocator {
   LocatorStatus LoadSelfSymbols();
   LocatorStatus PreLoadDynSymbols();
   LocatorStatus LoadMiniSymbols(const std::string& filename, bool only_dynamic, BfdAccessor* bfd_info);
-  LocatorStatus SearchDynamic(const void* addr, SymbolInfo* sym_info);
-  LocatorStatus SearchStatic(const void* addr, SymbolInfo* sym_info);
-  LocatorStatus SearchBfd(const void* addr, const BfdAccessor* bfd_info_ptr, SymbolInfo* sym_info);
+  // @brief load symbol table of file(through object_cache_ if set), dynamic_fallback: load dynamic symbols if file
+  // has no normal ones
+  LocatorStatus LoadObject(const std::string& file, bool dynamic_fallback,
+                           std::shared_ptr<const BfdAccessor>* bfd_info);
+  LocatorStatus ReloadProcMaps();
+  LocatorStatus SearchStatic(const void* addr, const asymbol** sym);
+  LocatorStatus SearchBfd(const void* addr, const BfdAccessor* bfd_info_ptr, const asymbol** sym);
   LocatorStatus SearchSymbol(const void* addr, SymbolInfo* sym_info);
+  // @brief start(nullable) is set to runtime start address of located symbol
+  LocatorStatus LocateSymbol(const void* addr, const asymbol** sym, const void** start = nullptr);
   bool FindMatchedLib(FileMatchMeta* meta);
-  LocatorStatus GetOrCreateDynBfd(const std::string& file, BfdAccessor** bfd_info_ptr);
-  LocatorStatus SearchDynamic(const FileMatchMeta& match, SymbolInfo* sym_info);
+  LocatorStatus GetOrCreateDynBfd(const std::string& file, const BfdAccessor** bfd_info_ptr);
+  LocatorStatus SearchDynamic(const FileMatchMeta& match, const asymbol** sym);
 
  private:
-  BfdAccessor self_bfd_;
+  std::shared_ptr<ObjectFileCache> object_cache_;  // nullable
+  std::shared_ptr<const BfdAccessor> self_bfd_;
   std::shared_mutex rw_mutex_;
-  std::unordered_map<std::string, BfdAccessor> dynamic_bfds_;
+  std::unordered_map<std::string, std::shared_ptr<const BfdAccessor>> dynamic_bfds_;
   DynamicLibMappings dyn_mappings_;
   std::string program_path_;
   std::string proc_mapping_content_;
   bool is_self_analysis_{false};  // is analyzing current process(online analysis)?
+  ProcessingStats* stats_{nullptr};
 };
 
 }  // namespace pprofcpp
@@ -0,0 +1,133 @@
+/*
+ * FileName profile_symbol_benchmark.cc
+ * Author jattle
+ * Description: symbol lookup cost against a large synthetic symbol table compiled into this binary,
+ * and lib matching against large synthetic proc maps
+ */
+#include <array>
+#include <random>
+#include <utility>
+
+#include "benchmark/benchmark.h"
+#include "fmt/format.h"
+
+#include "profiling/symbol/profile_symbol.h"
+
+using namespace pprofcpp;
+
+namespace {
+
+constexpr size_t kSyntheticFuncNum = 8192;
+
+using SyntheticFunc = size_t (*)(size_t);
+
+// every instantiation has a distinct body, so that none of them is folded and each gets its own symbol
+template <size_t N>
+__attribute__((noinline)) size_t SyntheticFunction(size_t v) {
+  return v * (N + 1) + N;
+}
+
+template <size_t... I>
+std::array<SyntheticFunc, sizeof...(I)> MakeSyntheticFuncs(std::index_sequence<I...>) {
+  return {&SyntheticFunction<I>...};
+}
+
+const std::array<SyntheticFunc, kSyntheticFuncNum>& GetSyntheticFuncs() {
+  static const auto funcs = MakeSyntheticFuncs(std::make_index_sequence<kSyntheticFuncNum>{});
+  return funcs;
+}
+
+// addrs inside random synthetic functions(start + 1, like a call ptr)
+std::vector<void*> MakeAddrs(size_t n) {
+  std::mt19937_64 rng{n};
+  const auto& funcs = GetSyntheticFuncs();
+  std::vector<void*> addrs;
+  addrs.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    addrs.push_back(reinterpret_cast<char*>(funcs[rng() % funcs.size()]) + 1);
+  }
+  return addrs;
+}
+
+BfdSymbolLocator* GetLocator() {
+  static BfdSymbolLocator locator;
+  return &locator;
+}
+
+void AddrArgs(benchmark::internal::Benchmark* b) {
+  b->Arg(1000)->Arg(100000)->ArgName("addrs")->Unit(benchmark::kMillisecond);
+}
+
+}  // namespace
+
+static void BM_BfdLoadSelfSymbols(benchmark::State& state) {
+  for (auto _ : state) {
+    BfdSymbolLocator locator;
+    benchmark::DoNotOptimize(&locator);
+  }
+}
+BENCHMARK(BM_BfdLoadSelfSymbols)->Unit(benchmark::kMillisecond);
+
+static void BM_BfdSearchSymbols(benchmark::State& state) {
+  auto addrs = MakeAddrs(static_cast<size_t>(state.range(0)));
+  size_t found = 0;
+  for (auto _ : state) {
+    std::unordered_map<void*, SymbolInfo> sym_mapping;
+    if (GetLocator()->SearchSymbols(addrs, &sym_mapping).ret != LocatorRetCode::kOK) {
+      state.SkipWithError("search symbols failed");
+      return;
+    }
+    found = 0;
+    for (const auto& [addr, info] : sym_mapping) {
+      found += info.symbol_name.empty() ? 0 : 1;
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * addrs.size()));
+  state.counters["found"] = static_cast<double>(found);
+}
+BENCHMARK(BM_BfdSearchSymbols)->Apply(AddrArgs);
+
+static void BM_BfdSearchSymbolIds(benchmark::State& state) {
+  auto addrs = MakeAddrs(static_cast<size_t>(state.range(0)));
+  size_t name_num = 0;
+  for (auto _ : state) {
+    InternedSymbols symbols;
+    symbols.addrs = addrs;
+    if (GetLocator()->SearchSymbolIds(&symbols).ret != LocatorRetCode::kOK) {
+      state.SkipWithError("search symbol ids failed");
+      return;
+    }
+    name_num = symbols.table->Size();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * addrs.size()));
+  state.counters["names"] = static_cast<double>(name_num);
+}
+BENCHMARK(BM_BfdSearchSymbolIds)->Apply(AddrArgs);
+
+static void BM_FindMatchedLib(benchmark::State& state) {
+  auto lib_num = static_cast<size_t>(state.range(0));
+  constexpr uintptr_t kLibSpan = 0x100000;
+  std::string maps_text;
+  for (size_t i = 0; i < lib_num; i++) {
+    uintptr_t start = 0x7f0000000000 + i * kLibSpan;
+    maps_text += fmt::format("{:x}-{:x} r-xp 00000000 08:01 {}   /usr/lib64/libsynthetic{}.so\n", start,
+                             start + kLibSpan, 1000 + i, i);
+  }
+  DynamicLibMappings mappings;
+  mappings.ParseProcMaps(maps_text);
+  std::mt19937_64 rng{lib_num};
+  std::vector<const void*> addrs(4096);
+  for (auto& addr : addrs) {
+    addr = reinterpret_cast<const void*>(0x7f0000000000 + rng() % (lib_num * kLibSpan));
+  }
+  for (auto _ : state) {
+    ProcLibMapping lib;
+    for (const auto* addr : addrs) {
+      benchmark::DoNotOptimize(mappings.FindMatchedLib(addr, &lib));
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * addrs.size()));
+}
+BENCHMARK(BM_FindMatchedLib)->Arg(16)->Arg(256)->Arg(4096)->ArgName("libs");
+
+BENCHMARK_MAIN();
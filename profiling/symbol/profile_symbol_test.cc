@@ -3,6 +3,7 @@
  * Author jattle
  * Description:
  */
+#include <cstdio>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -86,3 +87,108 @@ TEST(BfdSymbolLocator, SearchSymbol) {
   fprintf(stderr, "addr: %p, symbol: %s\n", sym_info.address, sym_info.symbol_name.c_str());
   EXPECT_EQ(st.ret, LocatorRetCode::kSymbolNotFound);
 }
+
+TEST(SymbolTable, Intern) {
+  SymbolTable table;
+  EXPECT_EQ(table.Size(), 1u);
+  EXPECT_EQ(table.Intern(""), SymbolTable::kUnknownSymbolId);
+  uint32_t id1 = table.Intern("main");
+  uint32_t id2 = table.Intern("foo(int)");
+  EXPECT_NE(id1, id2);
+  EXPECT_EQ(table.Intern(std::string("main")), id1);
+  EXPECT_EQ(table.GetName(id1), "main");
+  EXPECT_EQ(table.GetName(id2), "foo(int)");
+  EXPECT_EQ(table.Size(), 3u);
+}
+
+TEST(BfdSymbolLocator, MemoryUsage) {
+  BfdSymbolLocator locator;
+  auto before = locator.MemoryUsage();
+  EXPECT_EQ(before.symbol_tables, locator.self_bfd_ != nullptr ? locator.self_bfd_->mem_bytes : 0);
+  EXPECT_EQ(before.Total(), before.symbol_tables + before.mappings);
+  locator.dyn_mappings_ = PackDynLibMappings();
+  auto lib = std::make_shared<BfdAccessor>();
+  lib->mem_bytes = 1000;
+  locator.dynamic_bfds_.emplace(kLib1, std::move(lib));
+  auto after = locator.MemoryUsage();
+  EXPECT_EQ(after.lib_num, before.lib_num + 1);
+  EXPECT_EQ(after.symbol_tables, before.symbol_tables + 1000);
+  EXPECT_GE(after.mappings, before.mappings + 2 * sizeof(ProcLibMapping) + 4 * sizeof(ProcMapItem));
+}
+
+TEST(ObjectFileCache, Get) {
+  std::string file = ::testing::TempDir() + "object_file_cache_test.so";
+  auto write = [&file](const std::string& content) {
+    FILE* fp = fopen(file.c_str(), "w");
+    ASSERT_NE(fp, nullptr);
+    fputs(content.c_str(), fp);
+    fclose(fp);
+  };
+  write("v1");
+  size_t load_num = 0;
+  auto loader = [&load_num](BfdAccessor* bfd_info) {
+    bfd_info->mem_bytes = ++load_num;
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  };
+  ObjectFileCache cache{2};
+  std::shared_ptr<const BfdAccessor> first, second;
+  ASSERT_EQ(cache.Get(file, 0, loader, &first).ret, LocatorRetCode::kOK);
+  ASSERT_EQ(cache.Get(file, 0, loader, &second).ret, LocatorRetCode::kOK);
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(load_num, 1u);
+  // other way of loading is another entry
+  ASSERT_EQ(cache.Get(file, 1, loader, &second).ret, LocatorRetCode::kOK);
+  EXPECT_NE(first, second);
+  EXPECT_EQ(load_num, 2u);
+  // rebuilt file is loaded again, holders of the old table keep it
+  write("version 2");
+  ASSERT_EQ(cache.Get(file, 0, loader, &second).ret, LocatorRetCode::kOK);
+  EXPECT_EQ(load_num, 3u);
+  EXPECT_EQ(first->mem_bytes, 1u);
+  EXPECT_EQ(second->mem_bytes, 3u);
+  EXPECT_EQ(cache.GetLoadedNum(), 3u);
+  // failure is cached as well
+  std::string missing = ::testing::TempDir() + "object_file_cache_missing.so";
+  EXPECT_EQ(cache.Get(missing, 0, loader, &second).ret, LocatorRetCode::kOpenFileFailed);
+  remove(file.c_str());
+}
+
+TEST(SymbolTable, MemoryUsage) {
+  SymbolTable table;
+  size_t empty = table.MemoryUsage();
+  std::string name(100, 'f');
+  table.Intern(name);
+  EXPECT_GE(table.MemoryUsage(), empty + sizeof(std::string) + name.size() + 1);
+  // interned names are not counted twice
+  size_t once = table.MemoryUsage();
+  table.Intern(name);
+  EXPECT_EQ(table.MemoryUsage(), once);
+}
+
+class FakeSymbolLocator : public SymbolLocator {
+ public:
+  LocatorStatus SearchSymbols(const std::vector<void*>& addrs,
+                              std::unordered_map<void*, SymbolInfo>* sym_mapping) override {
+    for (const auto& addr : addrs) {
+      if (reinterpret_cast<uintptr_t>(addr) < 0x100) {
+        sym_mapping->emplace(addr, SymbolInfo{addr, reinterpret_cast<uintptr_t>(addr) < 0x50 ? "low" : "high"});
+      }
+    }
+    return LocatorStatus{LocatorRetCode::kOK, ""};
+  }
+};
+
+TEST(SymbolLocator, SearchSymbolIds) {
+  FakeSymbolLocator locator;
+  InternedSymbols result;
+  result.addrs = {IntToPtrAddr(0x10), IntToPtrAddr(0x20), IntToPtrAddr(0x60), IntToPtrAddr(0x200)};
+  EXPECT_EQ(locator.SearchSymbolIds(&result).ret, LocatorRetCode::kOK);
+  ASSERT_NE(result.table, nullptr);
+  ASSERT_EQ(result.sym_ids.size(), result.addrs.size());
+  EXPECT_EQ(result.sym_ids[0], result.sym_ids[1]);
+  EXPECT_EQ(result.table->GetName(result.sym_ids[0]), "low");
+  EXPECT_EQ(result.table->GetName(result.sym_ids[2]), "high");
+  EXPECT_EQ(result.sym_ids[3], SymbolTable::kUnknownSymbolId);
+  // "", low, high
+  EXPECT_EQ(result.table->Size(), 3u);
+}
@@ -0,0 +1,46 @@
+/*
+ * FileName: control.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/util/control.h"
+
+namespace pprofcpp {
+
+namespace {
+
+thread_local ProcessingControl* tls_control{nullptr};
+
+}  // namespace
+
+ControlStatus ProcessingControl::Check() const {
+  if (cancelled_.load(std::memory_order_relaxed)) {
+    return ControlStatus::kCancelled;
+  }
+  int64_t deadline = deadline_ns_.load(std::memory_order_relaxed);
+  if (deadline != INT64_MAX && std::chrono::steady_clock::now().time_since_epoch().count() >= deadline) {
+    return ControlStatus::kDeadlineExceeded;
+  }
+  return ControlStatus::kOK;
+}
+
+ProcessingProgress ProcessingControl::GetProgress() const {
+  ProcessingProgress progress;
+  progress.records_parsed = records_parsed_.load(std::memory_order_relaxed);
+  progress.addrs_symbolized = addrs_symbolized_.load(std::memory_order_relaxed);
+  progress.addrs_total = addrs_total_.load(std::memory_order_relaxed);
+  progress.records_emitted = records_emitted_.load(std::memory_order_relaxed);
+  return progress;
+}
+
+ProcessingControl* CurrentControl() { return tls_control; }
+
+ControlStatus CheckCurrentControl() {
+  return tls_control == nullptr ? ControlStatus::kOK : tls_control->Check();
+}
+
+ScopedControl::ScopedControl(ProcessingControl* control) : prev_(tls_control) { tls_control = control; }
+
+ScopedControl::~ScopedControl() { tls_control = prev_; }
+
+}  // namespace pprofcpp
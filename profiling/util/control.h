@@ -0,0 +1,85 @@
+/*
+ * FileName: control.h
+ * Author: jattle
+ * Descrption: cooperative cancellation, deadline & progress of long running profile processing
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace pprofcpp {
+
+enum class ControlStatus {
+  kOK = 0,
+  kCancelled = 1,
+  kDeadlineExceeded = 2,
+};
+
+/// @brief progress reported by processing loops
+struct ProcessingProgress {
+  size_t records_parsed{0};
+  size_t addrs_symbolized{0};
+  size_t addrs_total{0};  // 0 until symbolization starts
+  size_t records_emitted{0};
+};
+
+/// @brief cancellation flag, deadline & progress shared between a processing task and its owner, all methods are
+// thread-safe. loops of parse, symbol search & emission check it every kControlCheckInterval iterations, so a
+// stopped task returns within one interval, keeping what is done so far
+class ProcessingControl {
+ public:
+  ProcessingControl() = default;
+  ~ProcessingControl() = default;
+  ProcessingControl(const ProcessingControl&) = delete;
+  ProcessingControl& operator=(const ProcessingControl&) = delete;
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+  void SetDeadline(std::chrono::steady_clock::time_point deadline) {
+    deadline_ns_.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+  }
+  void SetTimeout(std::chrono::nanoseconds timeout) { SetDeadline(std::chrono::steady_clock::now() + timeout); }
+  // @brief cancellation wins over deadline
+  ControlStatus Check() const;
+  ProcessingProgress GetProgress() const;
+  void SetRecordsParsed(size_t n) { records_parsed_.store(n, std::memory_order_relaxed); }
+  void SetAddrsSymbolized(size_t n, size_t total) {
+    addrs_symbolized_.store(n, std::memory_order_relaxed);
+    addrs_total_.store(total, std::memory_order_relaxed);
+  }
+  void SetRecordsEmitted(size_t n) { records_emitted_.store(n, std::memory_order_relaxed); }
+
+ private:
+  std::atomic<bool> cancelled_{false};
+  std::atomic<int64_t> deadline_ns_{INT64_MAX};  // steady clock
+  std::atomic<size_t> records_parsed_{0};
+  std::atomic<size_t> addrs_symbolized_{0};
+  std::atomic<size_t> addrs_total_{0};
+  std::atomic<size_t> records_emitted_{0};
+};
+
+/// @brief iterations between two checks of current control, a power of 2
+constexpr size_t kControlCheckInterval = 1024;
+
+/// @brief control of processing running on current thread, null if none
+ProcessingControl* CurrentControl();
+
+/// @brief check current control, kOK if there is none
+ControlStatus CheckCurrentControl();
+
+/// @brief install control for processing on current thread during the scope, nesting restores the outer one.
+// control is per thread rather than per object, so a locator shared by concurrent tasks stops only the searches of
+// the task being cancelled
+class ScopedControl {
+ public:
+  explicit ScopedControl(ProcessingControl* control);
+  ~ScopedControl();
+  ScopedControl(const ScopedControl&) = delete;
+  ScopedControl& operator=(const ScopedControl&) = delete;
+
+ private:
+  ProcessingControl* prev_;
+};
+
+}  // namespace pprofcpp
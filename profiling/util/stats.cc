@@ -0,0 +1,133 @@
+/*
+ * FileName: stats.cc
+ * Author: jattle
+ * Descrption:
+ */
+#include "profiling/util/stats.h"
+
+#include <time.h>
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace pprofcpp {
+
+namespace {
+
+constexpr const char* kPhaseNames[] = {"read", "build_stacks", "parse_maps", "load_libs", "lookup", "demangle", "emit"};
+static_assert(sizeof(kPhaseNames) / sizeof(kPhaseNames[0]) == static_cast<size_t>(StatsPhase::kPhaseNum));
+
+uint64_t NowNs(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+struct Counter {
+  const char* name;
+  uint64_t ProcessingStats::*field;
+};
+
+constexpr Counter kCounters[] = {
+    {"bytes_read", &ProcessingStats::bytes_read},
+    {"slots_decoded", &ProcessingStats::slots_decoded},
+    {"records", &ProcessingStats::records},
+    {"libs_loaded", &ProcessingStats::libs_loaded},
+    {"lib_cache_hits", &ProcessingStats::lib_cache_hits},
+    {"lib_cache_misses", &ProcessingStats::lib_cache_misses},
+    {"demangle_cache_hits", &ProcessingStats::demangle_cache_hits},
+    {"demangle_cache_misses", &ProcessingStats::demangle_cache_misses},
+    {"alloc_num", &ProcessingStats::alloc_num},
+    {"alloc_bytes", &ProcessingStats::alloc_bytes},
+};
+
+}  // namespace
+
+const char* StatsPhaseName(StatsPhase phase) {
+  auto index = static_cast<size_t>(phase);
+  return index < static_cast<size_t>(StatsPhase::kPhaseNum) ? kPhaseNames[index] : "unknown";
+}
+
+void ProcessingStats::Reset() {
+  // running phases keep their parent links, only numbers are cleared
+  ScopedPhase* active = active_phase;
+  *this = ProcessingStats{};
+  active_phase = active;
+}
+
+std::string ProcessingStats::ToText() const {
+  std::string text;
+  char line[128];
+  for (size_t i = 0; i < static_cast<size_t>(StatsPhase::kPhaseNum); i++) {
+    snprintf(line, sizeof(line), "%s: wall_us=%" PRIu64 " cpu_us=%" PRIu64 " calls=%" PRIu64 "\n", kPhaseNames[i],
+             phases[i].wall_ns / 1000, phases[i].cpu_ns / 1000, phases[i].calls);
+    text += line;
+  }
+  for (const auto& counter : kCounters) {
+    snprintf(line, sizeof(line), "%s: %" PRIu64 "\n", counter.name, this->*counter.field);
+    text += line;
+  }
+  return text;
+}
+
+std::string ProcessingStats::ToJson() const {
+  std::string json = "{\"phases\":{";
+  char item[160];
+  for (size_t i = 0; i < static_cast<size_t>(StatsPhase::kPhaseNum); i++) {
+    snprintf(item, sizeof(item), "%s\"%s\":{\"wall_ns\":%" PRIu64 ",\"cpu_ns\":%" PRIu64 ",\"calls\":%" PRIu64 "}",
+             i == 0 ? "" : ",", kPhaseNames[i], phases[i].wall_ns, phases[i].cpu_ns, phases[i].calls);
+    json += item;
+  }
+  json += "}";
+  for (const auto& counter : kCounters) {
+    snprintf(item, sizeof(item), ",\"%s\":%" PRIu64, counter.name, this->*counter.field);
+    json += item;
+  }
+  json += "}";
+  return json;
+}
+
+void ScopedPhase::Start() {
+  parent_ = stats_->active_phase;
+  stats_->active_phase = this;
+  wall_start_ = NowNs(CLOCK_MONOTONIC);
+  cpu_start_ = NowNs(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void ScopedPhase::Stop() {
+  uint64_t wall = NowNs(CLOCK_MONOTONIC) - wall_start_;
+  uint64_t cpu = NowNs(CLOCK_THREAD_CPUTIME_ID) - cpu_start_;
+  auto& timing = stats_->phases[static_cast<size_t>(phase_)];
+  timing.wall_ns += wall > child_wall_ ? wall - child_wall_ : 0;
+  timing.cpu_ns += cpu > child_cpu_ ? cpu - child_cpu_ : 0;
+  if (parent_ == nullptr || parent_->phase_ != phase_) {
+    timing.calls++;
+  }
+  if (parent_ != nullptr) {
+    parent_->child_wall_ += wall;
+    parent_->child_cpu_ += cpu;
+  }
+  stats_->active_phase = parent_;
+}
+
+StatsStreamBuf::int_type StatsStreamBuf::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+  std::streamsize n{0};
+  {
+    ScopedPhase phase(stats_, StatsPhase::kRead);
+    source_->read(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    n = source_->gcount();
+  }
+  if (n <= 0) {
+    return traits_type::eof();
+  }
+  if (stats_ != nullptr) {
+    stats_->bytes_read += static_cast<uint64_t>(n);
+  }
+  setg(buffer_.data(), buffer_.data(), buffer_.data() + n);
+  return traits_type::to_int_type(*gptr());
+}
+
+}  // namespace pprofcpp
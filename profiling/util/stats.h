@@ -0,0 +1,112 @@
+/*
+ * FileName: stats.h
+ * Author: jattle
+ * Descrption: opt-in per-phase timing & counters of profile processing
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace pprofcpp {
+
+/// @brief phases of profile processing
+enum class StatsPhase : uint32_t {
+  kRead = 0,         // reading bytes from profile stream
+  kBuildStacks = 1,  // decoding slots & materializing call stacks
+  kParseMaps = 2,    // parsing maps text
+  kLoadLibs = 3,     // opening object files & loading their symbol tables
+  kLookup = 4,       // searching symbols of addrs
+  kDemangle = 5,
+  kEmit = 6,         // writing output profile
+  kPhaseNum = 7,
+};
+
+const char* StatsPhaseName(StatsPhase phase);
+
+struct PhaseTiming {
+  uint64_t wall_ns{0};
+  uint64_t cpu_ns{0};  // cpu time of calling thread
+  uint64_t calls{0};
+};
+
+class ScopedPhase;
+
+/// @brief processing stats, handed to SetStats of CPUProfile, CPUProfileReader & BfdSymbolLocator.
+// phase timings are exclusive: time of a nested phase is not counted in the enclosing one, so phases add up to
+// the total. allocations are counted at allocation sites of this library(stack pcs, symbol tables), not by hooking
+// malloc. stats are disabled by default(nullptr), then every instrumented point costs a single branch.
+// not thread-safe, do not share one object among concurrent calls
+struct ProcessingStats {
+  PhaseTiming phases[static_cast<size_t>(StatsPhase::kPhaseNum)];
+  uint64_t bytes_read{0};
+  uint64_t slots_decoded{0};
+  uint64_t records{0};
+  uint64_t libs_loaded{0};
+  uint64_t lib_cache_hits{0};  // lookups of already loaded shared libs
+  uint64_t lib_cache_misses{0};
+  uint64_t demangle_cache_hits{0};    // symbols demangled before in the same SearchSymbolIds
+  uint64_t demangle_cache_misses{0};  // distinct symbols demangled by SearchSymbolIds
+  uint64_t alloc_num{0};
+  uint64_t alloc_bytes{0};
+  ScopedPhase* active_phase{nullptr};  // innermost running phase
+
+  const PhaseTiming& GetPhase(StatsPhase phase) const { return phases[static_cast<size_t>(phase)]; }
+  void Reset();
+  // @brief one "name: value" line per item, durations in microseconds
+  std::string ToText() const;
+  std::string ToJson() const;
+};
+
+/// @brief time the enclosing scope as phase of stats, no-op if stats is null
+// a scope nested in a running scope of the same phase is not counted as another call
+class ScopedPhase {
+ public:
+  ScopedPhase(ProcessingStats* stats, StatsPhase phase) : stats_(stats), phase_(phase) {
+    if (stats_ != nullptr) {
+      Start();
+    }
+  }
+  ~ScopedPhase() {
+    if (stats_ != nullptr) {
+      Stop();
+    }
+  }
+  ScopedPhase(const ScopedPhase&) = delete;
+  ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+ private:
+  void Start();
+  void Stop();
+
+  ProcessingStats* stats_;
+  StatsPhase phase_;
+  ScopedPhase* parent_{nullptr};
+  uint64_t wall_start_{0};
+  uint64_t cpu_start_{0};
+  uint64_t child_wall_{0};  // time of nested phases, excluded from this one
+  uint64_t child_cpu_{0};
+};
+
+/// @brief input buffer over source stream, every refill is a bulk read timed as kRead and counted in bytes_read
+// so that reading is measured per chunk rather than per slot
+class StatsStreamBuf : public std::streambuf {
+ public:
+  StatsStreamBuf(std::istream* source, ProcessingStats* stats, size_t buffer_size = 64 * 1024)
+      : source_(source), stats_(stats), buffer_(buffer_size) {}
+  ~StatsStreamBuf() override = default;
+
+ protected:
+  int_type underflow() override;
+
+ private:
+  std::istream* source_;
+  ProcessingStats* stats_;
+  std::vector<char> buffer_;
+};
+
+}  // namespace pprofcpp
@@ -1,12 +1,98 @@
 #include "profiling/util/utils.h"
 
 #include <cxxabi.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#include <memory>
+#include <array>
+#include <cctype>
 #include <cstdio>
+#include <cstring>
+#include <memory>
 
 namespace pprofcpp {
 
+namespace {
+
+/// @brief "000102...ff", two hex digits for every byte value
+constexpr std::array<char, 512> MakeHexPairs() {
+  constexpr char kDigits[] = "0123456789abcdef";
+  std::array<char, 512> pairs{};
+  for (size_t i = 0; i < 256; i++) {
+    pairs[i * 2] = kDigits[i >> 4];
+    pairs[i * 2 + 1] = kDigits[i & 0xf];
+  }
+  return pairs;
+}
+
+constexpr std::array<char, 512> kHexPairs = MakeHexPairs();
+
+}  // namespace
+
+std::string_view TrimFront(std::string_view sv) {
+  while (!sv.empty() && isspace(static_cast<unsigned char>(sv.front()))) {
+    sv.remove_prefix(1);
+  }
+  return sv;
+}
+
+std::string_view TrimBack(std::string_view sv) {
+  while (!sv.empty() && isspace(static_cast<unsigned char>(sv.back()))) {
+    sv.remove_suffix(1);
+  }
+  return sv;
+}
+
+std::string_view Trim(std::string_view sv) { return TrimBack(TrimFront(sv)); }
+
+int MappedFile::Open(const std::string& filename) {
+  Close();
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return 1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return 1;
+  }
+  if (st.st_size > 0) {
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      return 1;
+    }
+    // scanned front to back
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(addr);
+    size_ = st.st_size;
+  }
+  close(fd);
+  return 0;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+
+char* FormatHexAddr(uintptr_t addr, char* buf) {
+  uint64_t v = addr;
+  buf[0] = '0';
+  buf[1] = addr == 0 ? '0' : 'x';  // "%#lx" omits 0x prefix of zero
+  // fill from the lowest byte backwards, one table lookup per byte
+  for (char* p = buf + kHexAddrLen; p != buf + 2; v >>= 8) {
+    p -= 2;
+    memcpy(p, &kHexPairs[(v & 0xff) * 2], 2);
+  }
+  return buf + kHexAddrLen;
+}
+
 std::string DemangleName(const char* mangled_name) {
   int status;
   char* demangled = abi::__cxa_demangle(mangled_name, nullptr, nullptr, &status);
@@ -6,7 +6,10 @@
  */
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace pprofcpp {
 
@@ -15,6 +18,46 @@ std::string DemangleName(const char* mangled_name);
 /// @brief load full content from file, return 0 if load successfully
 int LoadFileContent(const std::string& filename, std::string* content);
 
+/// @brief read-only mmapped file, content is accessed as string_view without copying
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile() { Close(); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  /// @brief map whole file, return 0 if mapped successfully(empty file is mapped as empty view)
+  int Open(const std::string& filename);
+  void Close();
+  std::string_view View() const { return std::string_view{data_, size_}; }
+
+ private:
+  const char* data_{nullptr};
+  size_t size_{0};
+};
+
+/// @brief length of address formatted by FormatHexAddr
+constexpr size_t kHexAddrLen = 18;
+
+/// @brief format addr as fixed width "0x" + 16 lower hex digits into buf, no terminating null is written.
+// output is byte-for-byte the same as "%#018lx", so zero is written as 18 '0's without prefix
+/// @param addr
+/// @param buf at least kHexAddrLen bytes
+/// @return end of written characters
+char* FormatHexAddr(uintptr_t addr, char* buf);
+
+/// @brief heap bytes owned by s, 0 if it is stored inline(short string)
+inline size_t StringHeapBytes(const std::string& s) {
+  return s.capacity() > std::string{}.capacity() ? s.capacity() + 1 : 0;
+}
+
+/// @brief approximate heap bytes of a node based hash container: bucket array plus one allocation per element
+// (value, next pointer, cached hash and malloc overhead), heap owned by values themselves is not included
+template <typename HashContainer>
+size_t HashNodeBytes(const HashContainer& c) {
+  constexpr size_t kNodeOverhead = 2 * sizeof(void*) + 16;
+  return c.bucket_count() * sizeof(void*) + c.size() * (sizeof(typename HashContainer::value_type) + kNodeOverhead);
+}
+
 /// @brief trim front and back characters of sv 
 /// @param sv 
 /// @return 
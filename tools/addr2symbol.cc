@@ -2,10 +2,12 @@
 
 #include "gflags/gflags.h"
 
+#include "profiling/symbol/perf_map_symbol.h"
 #include "profiling/symbol/profile_symbol.h"
 
 DEFINE_string(exe, "", "executable file path");
 DEFINE_string(proc_mapping, "", "proc mapping file path, maybe empty");
+DEFINE_string(perf_map, "", "perf map file of JIT code(/tmp/perf-<pid>.map), maybe empty");
 DEFINE_string(addr, "", "hex memory address, 0x00007fd4246d05b6 or 00007fd4246d05b6 etc");
 
 int main(int argc, char* argv[]) {
@@ -13,7 +15,10 @@ int main(int argc, char* argv[]) {
     google::ShowUsageWithFlags(argv[0]);
     return 1;
   }
-  pprofcpp::BfdSymbolLocator locator{FLAGS_exe, FLAGS_proc_mapping};
+  pprofcpp::BfdSymbolLocator bfd_locator{FLAGS_exe, FLAGS_proc_mapping};
+  pprofcpp::PerfMapSymbolLocator perf_map_locator{FLAGS_perf_map, &bfd_locator};
+  pprofcpp::SymbolLocator& locator =
+      FLAGS_perf_map.empty() ? static_cast<pprofcpp::SymbolLocator&>(bfd_locator) : perf_map_locator;
   pprofcpp::SymbolInfo sym_info;
   constexpr size_t kBufferSize = 32;
   char buffer[kBufferSize] = {0};
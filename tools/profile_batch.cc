@@ -0,0 +1,319 @@
+/*
+ * FileName profile_batch.cc
+ * Author jattle
+ * Description: batch converter of many CPU profiles, pipelined parse -> symbolize -> emit with a worker pool per
+ * stage, bounded queues between stages and symbol tables of object files shared across profiles
+ */
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+#include "profiling/cpu_profile.h"
+#include "profiling/profile_snapshot.h"
+#include "profiling/symbol/profile_symbol.h"
+
+DEFINE_string(input_dir, "", "directory of profiles, every regular file is a profile of --binary");
+DEFINE_string(binary, "", "program binary of profiles in --input_dir");
+DEFINE_string(manifest, "", "manifest file, one \"profile binary\" pair per line, # starts a comment");
+DEFINE_string(output_dir, "", "output directory, output of profile x is x.raw or x.folded, basenames must be unique");
+DEFINE_string(format, "raw", "output format: raw(pprof --raw compatible) or folded(flamegraph)");
+DEFINE_uint32(parse_threads, 0, "parse workers, 0 means a quarter of cores");
+DEFINE_uint32(symbolize_threads, 0, "symbolize workers, 0 means half of cores");
+DEFINE_uint32(emit_threads, 0, "emit workers, 0 means a quarter of cores");
+DEFINE_uint32(queue_size, 0, "capacity of queues between stages, 0 means twice the workers of next stage");
+DEFINE_uint32(object_cache, 64, "max object files(loaded symbol tables of binaries & libs) kept for later profiles");
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/// @brief blocking FIFO of fixed capacity, Push blocks while full so that profiles in flight are bounded
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {}
+  void Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this]() { return items_.size() < capacity_; });
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+  }
+  // @brief nullopt once queue is closed and drained
+  std::optional<T> Pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() { return !items_.empty() || closed_; });
+    if (items_.empty()) {
+      return std::nullopt;
+    }
+    T item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return item;
+  }
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<T> items_;
+  bool closed_{false};
+};
+
+struct BatchJob {
+  std::string profile_path;
+  std::string binary;
+  std::string output_path;
+  std::unique_ptr<pprofcpp::CPUProfile> profile;
+  std::shared_ptr<pprofcpp::SymbolLocator> locator;
+};
+
+/// @brief totals of the whole batch, busy time is summed over workers of a stage
+struct BatchSummary {
+  std::atomic<size_t> files{0};
+  std::atomic<size_t> failed{0};
+  std::atomic<size_t> records{0};
+  std::atomic<size_t> samples{0};
+  std::atomic<size_t> input_bytes{0};
+  std::atomic<size_t> output_bytes{0};
+  std::atomic<int64_t> parse_ns{0};
+  std::atomic<int64_t> symbolize_ns{0};
+  std::atomic<int64_t> emit_ns{0};
+};
+
+int64_t ElapsedNs(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+size_t FileSize(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+}
+
+std::string BaseName(const std::string& path) {
+  auto pos = path.find_last_of('/');
+  return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+bool ListJobs(std::vector<BatchJob>* jobs) {
+  // output is named by basename of profile, profiles of the same basename would overwrite each other
+  std::unordered_map<std::string, std::string> outputs;  // output path -> profile
+  bool unique = true;
+  auto add = [&](const std::string& profile, const std::string& binary) {
+    BatchJob job;
+    job.profile_path = profile;
+    job.binary = binary;
+    job.output_path = FLAGS_output_dir + "/" + BaseName(profile) + "." + FLAGS_format;
+    if (auto [iter, inserted] = outputs.emplace(job.output_path, profile); !inserted) {
+      fprintf(stderr, "profiles %s and %s have the same output %s\n", iter->second.c_str(), profile.c_str(),
+              job.output_path.c_str());
+      unique = false;
+    }
+    jobs->emplace_back(std::move(job));
+  };
+  if (!FLAGS_manifest.empty()) {
+    std::ifstream manifest{FLAGS_manifest};
+    if (!manifest) {
+      fprintf(stderr, "open manifest %s failed\n", FLAGS_manifest.c_str());
+      return false;
+    }
+    std::string line;
+    while (std::getline(manifest, line)) {
+      std::istringstream fields{line};
+      std::string profile, binary;
+      if (!(fields >> profile) || profile[0] == '#') {
+        continue;
+      }
+      if (!(fields >> binary)) {
+        fprintf(stderr, "no binary for profile %s in manifest\n", profile.c_str());
+        return false;
+      }
+      add(profile, binary);
+    }
+  }
+  if (!FLAGS_input_dir.empty()) {
+    DIR* dir = opendir(FLAGS_input_dir.c_str());
+    if (dir == nullptr) {
+      fprintf(stderr, "open dir %s failed\n", FLAGS_input_dir.c_str());
+      return false;
+    }
+    std::vector<std::string> files;
+    while (auto* entry = readdir(dir)) {
+      std::string path = FLAGS_input_dir + "/" + entry->d_name;
+      struct stat st;
+      if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        files.emplace_back(std::move(path));
+      }
+    }
+    closedir(dir);
+    // stable order for reproducible runs
+    std::sort(files.begin(), files.end());
+    for (const auto& file : files) {
+      add(file, FLAGS_binary);
+    }
+  }
+  return unique;
+}
+
+void Fail(BatchSummary* summary, const BatchJob& job, const char* stage, int ret) {
+  fprintf(stderr, "%s %s failed, ret: %d\n", stage, job.profile_path.c_str(), ret);
+  summary->failed++;
+}
+
+// @brief emit output of job, symbols are resolved already, so locator is only needed by snapshot building
+pprofcpp::CPUProfileRetCode Emit(BatchJob* job) {
+  std::ofstream os{job->output_path, std::ofstream::binary};
+  if (!os) {
+    return pprofcpp::CPUProfileRetCode::kWriteOutputFailed;
+  }
+  if (FLAGS_format == "folded") {
+    if (job->profile->GetCallStacks().empty()) {
+      return pprofcpp::CPUProfileRetCode::kOK;
+    }
+    std::shared_ptr<const pprofcpp::ProfileSnapshot> snapshot;
+    if (auto ret = pprofcpp::ProfileSnapshot::Build(job->profile.get(), job->locator.get(), &snapshot);
+        ret != pprofcpp::CPUProfileRetCode::kOK) {
+      return ret;
+    }
+    // profile is not needed any more, release it before writing
+    job->profile.reset();
+    return snapshot->GenerateFoldedProfile(os);
+  }
+  pprofcpp::RawProfileMeta meta;
+  meta.program_path = job->binary;
+  return job->profile->GenerateRawProfile(meta, job->locator.get(), os);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  google::SetUsageMessage("convert CPU profiles in batch: profile_batch --manifest=list --output_dir=out");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  if ((FLAGS_manifest.empty() && FLAGS_input_dir.empty()) || FLAGS_output_dir.empty() ||
+      (!FLAGS_input_dir.empty() && FLAGS_binary.empty())) {
+    google::ShowUsageWithFlags(argv[0]);
+    return 1;
+  }
+  if (FLAGS_format != "raw" && FLAGS_format != "folded") {
+    fprintf(stderr, "unknown output format: %s\n", FLAGS_format.c_str());
+    return 1;
+  }
+  std::vector<BatchJob> jobs;
+  if (!ListJobs(&jobs)) {
+    return 1;
+  }
+  size_t cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  // symbol search dominates, it gets half of cores by default
+  size_t parse_threads = FLAGS_parse_threads > 0 ? FLAGS_parse_threads : std::max<size_t>(cores / 4, 1);
+  size_t symbolize_threads = FLAGS_symbolize_threads > 0 ? FLAGS_symbolize_threads : std::max<size_t>(cores / 2, 1);
+  size_t emit_threads = FLAGS_emit_threads > 0 ? FLAGS_emit_threads : std::max<size_t>(cores / 4, 1);
+  // profiles in flight are bounded by workers plus queue capacities, symbol tables by object_cache plus workers
+  BoundedQueue<BatchJob> input{FLAGS_queue_size > 0 ? FLAGS_queue_size : 2 * parse_threads};
+  BoundedQueue<BatchJob> parsed{FLAGS_queue_size > 0 ? FLAGS_queue_size : 2 * symbolize_threads};
+  BoundedQueue<BatchJob> symbolized{FLAGS_queue_size > 0 ? FLAGS_queue_size : 2 * emit_threads};
+  auto objects = std::make_shared<pprofcpp::ObjectFileCache>(FLAGS_object_cache);
+  BatchSummary summary;
+  auto start = Clock::now();
+
+  std::vector<std::thread> parse_workers, symbolize_workers, emit_workers;
+  for (size_t i = 0; i < parse_threads; i++) {
+    parse_workers.emplace_back([&]() {
+      while (auto job = input.Pop()) {
+        auto begin = Clock::now();
+        job->profile = std::make_unique<pprofcpp::CPUProfile>(job->profile_path);
+        auto ret = job->profile->Parse();
+        summary.parse_ns += ElapsedNs(begin);
+        if (ret != pprofcpp::ReaderRetCode::kOK) {
+          Fail(&summary, *job, "parse", static_cast<int>(ret));
+          continue;
+        }
+        summary.input_bytes += FileSize(job->profile_path);
+        summary.records += job->profile->GetRecordNum();
+        parsed.Push(std::move(*job));
+      }
+    });
+  }
+  for (size_t i = 0; i < symbolize_threads; i++) {
+    symbolize_workers.emplace_back([&]() {
+      while (auto job = parsed.Pop()) {
+        auto begin = Clock::now();
+        // locator of every profile has its own maps(load bases differ under ASLR), symbol tables are shared
+        job->locator = std::make_shared<pprofcpp::BfdSymbolLocator>(job->binary, job->profile->GetMapsText(), objects);
+        // full symbolization in one SearchSymbolIds call: maps are parsed once and every function demangled once
+        const auto& interned = job->profile->GetInternedSymbols(job->locator.get());
+        summary.symbolize_ns += ElapsedNs(begin);
+        // empty profiles are emitted as is
+        if (!job->profile->GetCallStacks().empty() && interned.table == nullptr) {
+          Fail(&summary, *job, "symbolize", static_cast<int>(pprofcpp::CPUProfileRetCode::kSearchSymbolFailed));
+          continue;
+        }
+        symbolized.Push(std::move(*job));
+      }
+    });
+  }
+  for (size_t i = 0; i < emit_threads; i++) {
+    emit_workers.emplace_back([&]() {
+      while (auto job = symbolized.Pop()) {
+        auto begin = Clock::now();
+        for (const auto& s : job->profile->GetCallStacks()) {
+          summary.samples += s.sample_count;
+        }
+        auto ret = Emit(&*job);
+        summary.emit_ns += ElapsedNs(begin);
+        if (ret != pprofcpp::CPUProfileRetCode::kOK) {
+          Fail(&summary, *job, "emit", static_cast<int>(ret));
+          continue;
+        }
+        summary.output_bytes += FileSize(job->output_path);
+        summary.files++;
+      }
+    });
+  }
+  // feed jobs, blocks while parse stage is behind
+  for (auto& job : jobs) {
+    input.Push(std::move(job));
+  }
+  // drain stage by stage
+  input.Close();
+  for (auto& t : parse_workers) t.join();
+  parsed.Close();
+  for (auto& t : symbolize_workers) t.join();
+  symbolized.Close();
+  for (auto& t : emit_workers) t.join();
+
+  double wall_s = static_cast<double>(ElapsedNs(start)) / 1e9;
+  auto busy = [](const std::atomic<int64_t>& ns, size_t threads) {
+    return static_cast<double>(ns.load()) / 1e9 / static_cast<double>(threads);
+  };
+  fprintf(stderr, "files: %zu ok, %zu failed, object files loaded: %zu, wall: %.3fs\n", summary.files.load(),
+          summary.failed.load(), objects->GetLoadedNum(), wall_s);
+  fprintf(stderr, "records: %zu, samples: %zu, input: %.2f MB, output: %.2f MB\n", summary.records.load(),
+          summary.samples.load(), summary.input_bytes.load() / 1048576.0, summary.output_bytes.load() / 1048576.0);
+  fprintf(stderr, "throughput: %.1f files/s, %.1f records/s, %.2f MB/s\n", summary.files.load() / wall_s,
+          summary.records.load() / wall_s, summary.input_bytes.load() / 1048576.0 / wall_s);
+  fprintf(stderr, "mean busy per worker: parse %.3fs x%zu, symbolize %.3fs x%zu, emit %.3fs x%zu\n",
+          busy(summary.parse_ns, parse_threads), parse_threads, busy(summary.symbolize_ns, symbolize_threads),
+          symbolize_threads, busy(summary.emit_ns, emit_threads), emit_threads);
+  return summary.failed.load() == 0 ? 0 : 2;
+}
@@ -0,0 +1,93 @@
+/*
+ * FileName profile_generator.cc
+ * Author jattle
+ * Description: synthetic gperftools CPU profile generator, optionally with a matching ELF symbol table
+ */
+#include <cstring>
+#include <fstream>
+
+#include "gflags/gflags.h"
+
+#include "profiling/io/synthetic_profile.h"
+
+DEFINE_string(output, "", "output profile path");
+DEFINE_string(elf_output, "", "output path of matching synthetic ELF symbol table, maybe empty");
+DEFINE_uint64(records, 100000, "record num");
+DEFINE_string(depth_dist, "uniform", "stack depth distribution: fixed, uniform or geometric");
+DEFINE_uint64(min_depth, 4, "min stack depth");
+DEFINE_uint64(max_depth, 32, "max stack depth");
+DEFINE_double(mean_depth, 12, "mean stack depth of geometric distribution");
+DEFINE_double(duplicate_ratio, 0.5, "fraction of records repeating an earlier stack");
+DEFINE_uint64(max_sample_count, 10, "max sample count of a record");
+DEFINE_uint32(addr_len, 64, "address length in bits: 32 or 64");
+DEFINE_string(endian, "little", "byte order: little or big");
+DEFINE_uint64(funcs, 16384, "synthetic function num");
+DEFINE_uint64(func_size, 256, "synthetic function size in bytes");
+DEFINE_bool(mangled, true, "use C++ mangled function names");
+DEFINE_string(program_path, "/usr/local/bin/synthetic", "program path written into maps text");
+DEFINE_uint64(maps_libs, 16, "extra shared lib mappings in maps text");
+DEFINE_uint64(seed, 0, "random seed");
+
+int main(int argc, char* argv[]) {
+  google::SetUsageMessage("generate synthetic CPU profile for scale testing");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_output.empty() && FLAGS_elf_output.empty()) {
+    google::ShowUsageWithFlags(argv[0]);
+    return 1;
+  }
+  pprofcpp::SyntheticProfileOptions options;
+  options.record_num = FLAGS_records;
+  if (FLAGS_depth_dist == "fixed") {
+    options.depth_distribution = pprofcpp::DepthDistribution::kFixed;
+  } else if (FLAGS_depth_dist == "geometric") {
+    options.depth_distribution = pprofcpp::DepthDistribution::kGeometric;
+  } else if (FLAGS_depth_dist != "uniform") {
+    fprintf(stderr, "unknown depth distribution: %s\n", FLAGS_depth_dist.c_str());
+    return 1;
+  }
+  options.min_depth = FLAGS_min_depth;
+  options.max_depth = FLAGS_max_depth;
+  options.mean_depth = FLAGS_mean_depth;
+  options.duplicate_ratio = FLAGS_duplicate_ratio;
+  options.max_sample_count = FLAGS_max_sample_count;
+  if (FLAGS_addr_len == 32) {
+    options.meta.address_len = pprofcpp::ProfileAddressLen::k32Bit;
+  } else if (FLAGS_addr_len == 64) {
+    options.meta.address_len = pprofcpp::ProfileAddressLen::k64Bit;
+  } else {
+    fprintf(stderr, "unknown address length: %u\n", FLAGS_addr_len);
+    return 1;
+  }
+  if (FLAGS_endian == "little") {
+    options.meta.unpack_type = pprofcpp::UnpackType::kLittleEndian;
+  } else if (FLAGS_endian == "big") {
+    options.meta.unpack_type = pprofcpp::UnpackType::kBigEndian;
+  } else {
+    fprintf(stderr, "unknown byte order: %s\n", FLAGS_endian.c_str());
+    return 1;
+  }
+  options.func_num = FLAGS_funcs;
+  options.func_size = FLAGS_func_size;
+  options.mangled_names = FLAGS_mangled;
+  options.program_path = FLAGS_program_path;
+  options.maps_lib_num = FLAGS_maps_libs;
+  options.seed = FLAGS_seed;
+  if (!FLAGS_elf_output.empty()) {
+    std::ofstream elf{FLAGS_elf_output, std::ofstream::binary};
+    if (auto ret = pprofcpp::WriteSyntheticElf(options, elf); ret != pprofcpp::WriterRetCode::kOK) {
+      fprintf(stderr, "write elf failed, ret: %d\n", static_cast<int>(ret));
+      return 1;
+    }
+  }
+  if (!FLAGS_output.empty()) {
+    auto os = std::make_shared<std::ofstream>(FLAGS_output, std::ofstream::binary);
+    pprofcpp::SyntheticProfileStats stats;
+    if (auto ret = pprofcpp::WriteSyntheticProfile(options, os, &stats); ret != pprofcpp::WriterRetCode::kOK) {
+      fprintf(stderr, "write profile failed, ret: %d\n", static_cast<int>(ret));
+      return 1;
+    }
+    fprintf(stderr, "records: %zu, duplicate records: %zu, pcs: %zu, samples: %zu\n", stats.record_num,
+            stats.duplicate_record_num, stats.pc_num, stats.sample_count);
+  }
+  return 0;
+}
@@ -2,22 +2,64 @@
  * FileName profile_printer.cc
  * Author jattle
  * Copyright (c) 2024 jattle 
- * Description: CPU Profile printer
+ * Description: CPU Profile printer, records are streamed to stdout in one pass with bounded memory
  */
-#include "profiling/cpu_profile.h"
+#include <cstdio>
+
+#include "gflags/gflags.h"
+
+#include "profiling/io/profile_io.h"
+#include "profiling/profile_summary.h"
+#include "profiling/util/utils.h"
+
+DEFINE_bool(stacks, true, "print pcs of every record, disable it for a quick look at huge profiles");
+DEFINE_bool(summary, true, "print header, sample & pc counts, depth histogram and top stacks");
+DEFINE_uint64(top, 10, "top stacks by sample count in summary");
 
 int main(int argc, char* argv[]) {
+  google::SetUsageMessage("print CPU profile: profile_printer [--nostacks] [--top=N] profile");
+  google::ParseCommandLineFlags(&argc, &argv, true);
   if (argc != 2) {
-    fprintf(stderr, "Usage: %s profile\n", argv[0]);
+    fprintf(stderr, "Usage: %s [--nostacks] [--nosummary] [--top=N] profile\n", argv[0]);
     return -1;
   }
-  pprofcpp::CPUProfile profile{argv[1]};
-  auto ret = profile.Parse();
+  pprofcpp::CPUProfileReader reader{argv[1]};
+  // one line per record, rendered into a reused buffer
+  std::string line;
+  pprofcpp::RecordCallback print_stack;
+  if (FLAGS_stacks) {
+    fprintf(stdout, "Dump CPU profile:\n---------------Stacks:\n");
+    print_stack = [&line](size_t sample_count, const size_t* pcs, size_t num_pcs) {
+      line.resize(num_pcs * (pprofcpp::kHexAddrLen + 1) + 1);
+      char* p = line.data();
+      for (size_t i = 0; i < num_pcs; i++) {
+        p = pprofcpp::FormatHexAddr(pcs[i], p);
+        *p++ = ' ';
+      }
+      *p++ = '\n';
+      fwrite(line.data(), 1, p - line.data(), stdout);
+    };
+  }
+  pprofcpp::ReaderRetCode ret;
+  if (FLAGS_summary) {
+    pprofcpp::ProfileSummary summary;
+    ret = pprofcpp::SummarizeProfile(&reader, FLAGS_top, &summary, print_stack);
+    // records read before an error are summarized too, nothing to summarize if header is broken
+    if (ret == pprofcpp::ReaderRetCode::kOK || summary.record_num > 0) {
+      auto text = summary.ToText();
+      fwrite(text.data(), 1, text.size(), stdout);
+    }
+  } else {
+    pprofcpp::CPUProfileBinaryHeader header;
+    ret = reader.ReadHeader(&header);
+    if (ret == pprofcpp::ReaderRetCode::kOK) {
+      // records are still read through to report a corrupted profile
+      ret = reader.ReadRecords(print_stack ? print_stack : [](size_t, const size_t*, size_t) {});
+    }
+  }
   if (ret != pprofcpp::ReaderRetCode::kOK) {
     fprintf(stderr, "parse profile failed, ret: %d\n", static_cast<int>(ret));
-  } else {
-    fprintf(stdout, "Dump CPU profile:\n");
-    fprintf(stdout, "%s\n", profile.ToString().c_str());
+    return -1;
   }
   return 0;
 }
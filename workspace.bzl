@@ -39,5 +39,11 @@ visibility = ["//visibility:public"],
         build_file = "//third_party/gtest:BUILD",
         urls = ["https://github.com/google/googletest/archive/release-1.10.0.tar.gz"],
     )
+    http_archive(
+        name = "com_github_google_benchmark",
+        sha256 = "6bc180a57d23d4d9515519f92b0c83d61b05b5bab188961f36ac7b06b0d9e9ce",
+        strip_prefix = "benchmark-1.8.3",
+        urls = ["https://github.com/google/benchmark/archive/v1.8.3.tar.gz"],
+    )
  
 